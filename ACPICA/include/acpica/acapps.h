@@ -235,11 +235,11 @@ AcDeleteTableList (
 
 BOOLEAN
 AcIsFileBinary (
-    ACPI_FILE                    *File);
+    FILE                    *File);
 
 ACPI_STATUS
 AcValidateTableHeader (
-    ACPI_FILE                    *File,
+    FILE                    *File,
     long                    TableOffset);
 
 
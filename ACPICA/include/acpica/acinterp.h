@@ -357,6 +357,14 @@ AcpiExAccessRegion (
     UINT64                  *Value,
     UINT32                  ReadWrite);
 
+#ifdef ACPI_DARWIN_EC_BURST
+ACPI_STATUS
+AcpiExAccessEcField (
+    ACPI_OPERAND_OBJECT     *ObjDesc,
+    UINT64                  *Value,
+    UINT32                  Function);
+#endif
+
 
 /*
  * exmisc - misc support routines
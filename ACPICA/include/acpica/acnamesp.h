@@ -690,4 +690,12 @@ void
 AcpiNsTerminate (
     void);
 
+
+/*
+ * nsindex - Hash index for wide scopes
+ */
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+#include "platform/acnsindex.h"
+#endif
+
 #endif /* __ACNAMESP_H__ */
@@ -42,13 +42,20 @@
 #include <mach/semaphore.h>
 #include <IOKit/IOLib.h>
 
-#define ACPI_USE_LOCAL_CACHE
+/* osdarwin.c provides the object cache; utcache.c's is left out. */
+struct _acpi_cache;
+#define ACPI_CACHE_T struct _acpi_cache
 
 #define ACPI_USE_GPE_POLLING
 
 #define ACPI_SEMAPHORE semaphore_t
 #define ACPI_SPINLOCK IOSimpleLock *
 
+/* osdarwin.c provides a native adaptive mutex instead of a binary semaphore. */
+struct _acpi_mutex;
+#define ACPI_MUTEX_TYPE ACPI_OSL_MUTEX
+#define ACPI_MUTEX struct _acpi_mutex *
+
 #define ACPI_USE_SYSTEM_CLIBRARY
 
 #define ACPI_MSG_ERROR          "ACPI Error: "
@@ -61,6 +68,147 @@
 
 #include <stdint.h>
 
+/* Per-cache counters, see AcpiOsCopyCacheStatistics in osdarwin.c */
+typedef struct acpi_darwin_cache_stats {
+    char        Name[16];
+    uint64_t    Requests;
+    uint64_t    MagazineHits;   /* served from this CPU's magazines */
+    uint64_t    DepotHits;      /* served after a depot refill; disjoint from MagazineHits */
+    uint64_t    SlabRefills;
+    uint64_t    Reaped;
+    uint64_t    Contention;
+    uint64_t    CachedObjects;
+    uint32_t    ObjectSize;
+    uint32_t    MagazineSize;
+    uint32_t    DepotMagazines;
+    uint32_t    Slabs;
+} ACPI_DARWIN_CACHE_STATS;
+
+/* AcpiOsAllocate footprint, see AcpiOsCopyAllocStatistics in osdarwin.c */
+#define ACPI_DARWIN_ALLOC_CLASSES 9     /* 32..4096 bytes, then IOMalloc passthrough */
+
+typedef struct acpi_darwin_alloc_stats {
+    uint64_t    LiveBytes;
+    uint64_t    HighWaterBytes;
+    uint32_t    ClassSize[ACPI_DARWIN_ALLOC_CLASSES];
+    uint64_t    ClassLive[ACPI_DARWIN_ALLOC_CLASSES];
+    uint64_t    ClassTotal[ACPI_DARWIN_ALLOC_CLASSES];
+} ACPI_DARWIN_ALLOC_STATS;
+
+/* Evaluation arena counters, see AcpiOsCopyArenaStatistics in osdarwin.c */
+typedef struct acpi_darwin_arena_stats {
+    uint64_t    Evaluations;
+    uint64_t    Allocations;
+    uint64_t    ChunksAllocated;
+    uint64_t    ChunksPinned;
+    uint64_t    NoSlot;
+} ACPI_DARWIN_ARENA_STATS;
+
+/* Log ring counters, see AcpiOsCopyLogStatistics in osdarwin.c */
+typedef struct acpi_darwin_log_stats {
+    uint64_t    Lines;
+    uint64_t    InterruptLines;
+    uint64_t    Dropped;
+    uint64_t    Suppressed;
+    uint64_t    Truncated;
+    uint64_t    Emitted;
+} ACPI_DARWIN_LOG_STATS;
+
+/* Per-mutex counters, see AcpiOsCopyMutexStatistics in osdarwin.c. Histogram bucket n is below 2^n us. */
+#define ACPI_DARWIN_MUTEX_BUCKETS 16
+typedef struct acpi_darwin_mutex_stats {
+    char        Name[32];
+    uint64_t    Acquires;
+    uint64_t    Contended;
+    uint64_t    Sleeps;
+    uint64_t    Timeouts;
+    uint64_t    WaitTime;   /* ns */
+    uint64_t    HoldTime;   /* ns */
+    uint64_t    WaitHistogram[ACPI_DARWIN_MUTEX_BUCKETS];
+    uint64_t    HoldHistogram[ACPI_DARWIN_MUTEX_BUCKETS];
+} ACPI_DARWIN_MUTEX_STATS;
+
+/* utmutex.c and excreate.c label their mutexes with this so the statistics are readable. */
+#define ACPI_DARWIN_MUTEX_NAMES
+void AcpiOsSetMutexName(ACPI_MUTEX Mutex, const char *Name);
+
+/*
+ * Namespace load and device initialization timing, see AcpiOsCopyInitStatistics in osdarwin.c.
+ * Times are in nanoseconds. tbdata.c and nsinit.c report through the hooks below.
+ */
+#define ACPI_DARWIN_INIT_TIMING
+#define ACPI_DARWIN_MAX_TIMED_TABLES 64
+typedef struct acpi_darwin_table_timing {
+    char        Signature[4];
+    char        OemTableId[8];
+    uint32_t    TableIndex;
+    uint32_t    Length;
+    uint32_t    Status;
+    uint64_t    LoadTime;
+} ACPI_DARWIN_TABLE_TIMING;
+
+typedef struct acpi_darwin_init_stats {
+    uint64_t    RegTime;
+    uint64_t    DeviceInitTime;
+    uint32_t    Devices;
+    uint32_t    IniMethods;
+    uint32_t    StaMethods;
+    uint32_t    TableCount;     /* may exceed ACPI_DARWIN_MAX_TIMED_TABLES; the rest aren't kept */
+    ACPI_DARWIN_TABLE_TIMING Tables[ACPI_DARWIN_MAX_TIMED_TABLES];
+} ACPI_DARWIN_INIT_STATS;
+
+struct acpi_table_header;
+void AcpiOsRecordTableLoad(uint32_t TableIndex, struct acpi_table_header *Table, uint64_t Elapsed, uint32_t Status);
+void AcpiOsRecordRegMethods(uint64_t Elapsed);
+void AcpiOsRecordDeviceInit(uint64_t Elapsed, uint32_t Devices, uint32_t IniMethods, uint32_t StaMethods);
+
+/* nseval.c brackets method execution with these so osdarwin.c can scope its arena. */
+#define ACPI_DARWIN_EVALUATION_ARENA
+void AcpiOsBeginEvaluation(void);
+void AcpiOsEndEvaluation(void);
+
+/* exfield.c hands multi-byte EC fields to the EC handler whole, so it can use burst mode. */
+#define ACPI_DARWIN_EC_BURST
+
+/* Wide namespace scopes get a hash index, see nsindex.c. */
+#define ACPI_DARWIN_NAMESPACE_INDEX
+#include "acnsindex.h"
+
+/*
+ * System sleep. The SLP_TYP values for S0-S5 are read once after namespace initialization
+ * (AcpiOsLoadSleepTypes) and hwxfsleep.c takes them from there instead of evaluating _Sx on
+ * every transition. hwxfsleep.c and hwsleep.c timestamp each phase of a transition; the
+ * record lives in kernel memory so it is still there to read after resume, see
+ * AcpiOsCopySleepTiming in osdarwin.c. Times are in nanoseconds.
+ */
+#define ACPI_DARWIN_SLEEP_STATES
+enum {
+    ACPI_DARWIN_SLEEP_DEVICES_OFF,      /* the platform expert's device tree to D3 */
+    ACPI_DARWIN_SLEEP_PTS,
+    ACPI_DARWIN_SLEEP_WAKE_GPES,        /* disable runtime GPEs, arm wake GPEs */
+    ACPI_DARWIN_SLEEP_REGISTERS,        /* SLP_TYP written; Start is the moment before SLP_EN */
+    ACPI_DARWIN_SLEEP_WAKE_PREP,        /* SLP_TYP back to S0 */
+    ACPI_DARWIN_SLEEP_WAK,
+    ACPI_DARWIN_SLEEP_DEVICES_ON,
+    ACPI_DARWIN_SLEEP_PHASES
+};
+
+typedef struct acpi_darwin_sleep_timing {
+    uint32_t    SleepState;
+    uint32_t    Completed;      /* bitmask of phases recorded since AcpiOsResetSleepTiming */
+    uint64_t    Start[ACPI_DARWIN_SLEEP_PHASES];
+    uint64_t    Elapsed[ACPI_DARWIN_SLEEP_PHASES];
+} ACPI_DARWIN_SLEEP_TIMING;
+
+/* The platform expert calls these too. */
+__BEGIN_DECLS
+void AcpiOsLoadSleepTypes(void);
+uint32_t AcpiOsGetSleepTypeData(uint8_t SleepState, uint8_t *SleepTypeA, uint8_t *SleepTypeB);
+void AcpiOsResetSleepTiming(uint8_t SleepState);
+void AcpiOsRecordSleepPhase(uint32_t Phase, uint64_t Start, uint64_t Elapsed);
+void AcpiOsCopySleepTiming(ACPI_DARWIN_SLEEP_TIMING *Timing);
+__END_DECLS
+
 #define ACPI_DEBUG_OUTPUT
 #define ACPI_DISASSEMBLER
 #define ACPI_DEBUGGER
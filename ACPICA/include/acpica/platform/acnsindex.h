@@ -0,0 +1,80 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apple's AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef __ACNSINDEX_H__
+#define __ACNSINDEX_H__
+
+#include <stdint.h>
+
+/*
+ * Wide namespace scopes. nssearch.c and nsalloc.c normally walk a scope's child list to find
+ * a name or append one; once a walk gets long, nsindex.c indexes that scope by (parent, name).
+ * See AcpiNsIndexSearch. The flags live in the upper byte of ACPI_NAMESPACE_NODE.Flags, which
+ * ACPICA doesn't use.
+ *
+ * Nothing here depends on the host: the index only uses the OSL lock and allocation calls,
+ * so an ACPICA userspace build (osunixxf.c) gets it by defining ACPI_DARWIN_NAMESPACE_INDEX.
+ * PDACPIPlatformTests/PDACPINamespaceIndexTests.c is built that way.
+ */
+#define ANOBJ_DARWIN_INDEXED    0x0100  /* this node's children are in the index */
+#define ANOBJ_DARWIN_SHADOWED   0x0200  /* a later sibling has the same name */
+
+typedef struct acpi_darwin_ns_index_stats {
+    uint64_t    Scopes;
+    uint64_t    Entries;
+    uint64_t    Capacity;
+    uint64_t    Lookups;
+    uint64_t    Appends;
+    uint64_t    Failures;   /* scopes dropped back to the linear walk for lack of memory */
+} ACPI_DARWIN_NS_INDEX_STATS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct acpi_namespace_node;
+uint32_t AcpiNsIndexInitialize(void);   /* ACPI_STATUS; utmutex.c, with the other global locks */
+void AcpiNsIndexTerminate(void);
+struct acpi_namespace_node *AcpiNsIndexSearch(struct acpi_namespace_node *Parent, uint32_t Name);
+struct acpi_namespace_node *AcpiNsIndexLastChild(struct acpi_namespace_node *Parent);
+void AcpiNsIndexInsert(struct acpi_namespace_node *Node);
+void AcpiNsIndexRemove(struct acpi_namespace_node *Node, struct acpi_namespace_node *PrevNode);
+void AcpiNsIndexGetStatistics(ACPI_DARWIN_NS_INDEX_STATS *Stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ACNSINDEX_H__ */
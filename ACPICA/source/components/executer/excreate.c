@@ -317,6 +317,9 @@ AcpiExCreateMutex (
 {
     ACPI_STATUS             Status = AE_OK;
     ACPI_OPERAND_OBJECT     *ObjDesc;
+#ifdef ACPI_DARWIN_MUTEX_NAMES
+    char                    Name[ACPI_NAMESEG_SIZE + 1];
+#endif
 
 
     ACPI_FUNCTION_TRACE_PTR (ExCreateMutex, ACPI_WALK_OPERANDS);
@@ -343,6 +346,11 @@ AcpiExCreateMutex (
 
     ObjDesc->Mutex.SyncLevel = (UINT8) WalkState->Operands[1]->Integer.Value;
     ObjDesc->Mutex.Node = (ACPI_NAMESPACE_NODE *) WalkState->Operands[0];
+#ifdef ACPI_DARWIN_MUTEX_NAMES
+    ACPI_COPY_NAMESEG (Name, AcpiUtGetNodeName (ObjDesc->Mutex.Node));
+    Name[ACPI_NAMESEG_SIZE] = 0;
+    AcpiOsSetMutexName (ObjDesc->Mutex.OsMutex, Name);
+#endif
 
     Status = AcpiNsAttachObject (
         ObjDesc->Mutex.Node, ObjDesc, ACPI_TYPE_MUTEX);
@@ -198,6 +198,21 @@ static const UINT8      AcpiProtocolLengths[] =
 #define GENERIC_SUBSPACE_COMMAND(a)     (4 == a || a == 5)
 #define MASTER_SUBSPACE_COMMAND(a)      (12 <= a && a <= 15)
 
+#ifdef ACPI_DARWIN_EC_BURST
+/*
+ * Darwin: EC fields that cover whole bytes, and more than one of them, go to
+ * the EC handler as a single access (see AcpiExAccessEcField).
+ */
+#define ACPI_DARWIN_IS_BURST_EC_FIELD(o) \
+    ((o)->Common.Type == ACPI_TYPE_LOCAL_REGION_FIELD && \
+     (o)->Field.RegionObj->Region.SpaceId == ACPI_ADR_SPACE_EC && \
+     (o)->Field.AccessByteWidth == 1 && \
+     (o)->Field.StartFieldBitOffset == 0 && \
+     ((o)->Field.BitLength & 7) == 0 && \
+     (o)->Field.BitLength > 8 && \
+     (o)->Field.BitLength <= 64)
+#endif
+
 
 /*******************************************************************************
  *
@@ -387,6 +402,19 @@ AcpiExReadDataFromField (
 
     AcpiExAcquireGlobalLock (ObjDesc->CommonField.FieldFlags);
 
+#ifdef ACPI_DARWIN_EC_BURST
+    if (ACPI_DARWIN_IS_BURST_EC_FIELD (ObjDesc))
+    {
+        UINT64              EcValue = 0;
+
+        Status = AcpiExAccessEcField (ObjDesc, &EcValue, ACPI_READ);
+        memcpy (Buffer, &EcValue, ACPI_MIN (BufferLength,
+            ACPI_DIV_8 (ObjDesc->Field.BitLength)));
+        AcpiExReleaseGlobalLock (ObjDesc->CommonField.FieldFlags);
+        goto Exit;
+    }
+#endif
+
     /* Read from the field */
 
     Status = AcpiExExtractFromField (ObjDesc, Buffer, BufferLength);
@@ -553,6 +581,19 @@ AcpiExWriteDataToField (
 
     AcpiExAcquireGlobalLock (ObjDesc->CommonField.FieldFlags);
 
+#ifdef ACPI_DARWIN_EC_BURST
+    if (ACPI_DARWIN_IS_BURST_EC_FIELD (ObjDesc))
+    {
+        UINT64              EcValue = 0;
+
+        memcpy (&EcValue, Buffer, ACPI_MIN (BufferLength,
+            ACPI_DIV_8 (ObjDesc->Field.BitLength)));
+        Status = AcpiExAccessEcField (ObjDesc, &EcValue, ACPI_WRITE);
+        AcpiExReleaseGlobalLock (ObjDesc->CommonField.FieldFlags);
+        return_ACPI_STATUS (Status);
+    }
+#endif
+
     /* Write to the field */
 
     Status = AcpiExInsertIntoField (ObjDesc, Buffer, BufferLength);
@@ -436,6 +436,57 @@ AcpiExAccessRegion (
 }
 
 
+#ifdef ACPI_DARWIN_EC_BURST
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiExAccessEcField
+ *
+ * PARAMETERS:  ObjDesc                 - Byte-aligned EC field, 16 to 64 bits
+ *              Value                   - Where to store value (must at least
+ *                                        64 bits)
+ *              Function                - Read or Write flag plus other region-
+ *                                        dependent flags
+ *
+ * RETURN:      Status
+ *
+ * DESCRIPTION: Darwin: Read or Write an entire EC field with a single call to
+ *              the region handler, so that the EC driver can move all of its
+ *              bytes in one burst-mode transaction instead of performing a
+ *              full handshake for each byte.
+ *
+ ******************************************************************************/
+
+ACPI_STATUS
+AcpiExAccessEcField (
+    ACPI_OPERAND_OBJECT     *ObjDesc,
+    UINT64                  *Value,
+    UINT32                  Function)
+{
+    ACPI_STATUS             Status;
+    UINT32                  ByteLength;
+
+
+    ACPI_FUNCTION_TRACE (ExAccessEcField);
+
+
+    /* Validate the last byte of the field; the region must hold all of it */
+
+    ByteLength = ACPI_DIV_8 (ObjDesc->CommonField.BitLength);
+    Status = AcpiExSetupRegion (ObjDesc, ByteLength - 1);
+    if (ACPI_FAILURE (Status))
+    {
+        return_ACPI_STATUS (Status);
+    }
+
+    Status = AcpiEvAddressSpaceDispatch (ObjDesc->CommonField.RegionObj,
+        ObjDesc, Function, ObjDesc->CommonField.BaseByteOffset,
+        ObjDesc->CommonField.BitLength, Value);
+
+    return_ACPI_STATUS (Status);
+}
+#endif
+
+
 /*******************************************************************************
  *
  * FUNCTION:    AcpiExRegisterOverflow
@@ -181,6 +181,9 @@ AcpiHwLegacySleep (
     UINT32                  Pm1bControl;
     UINT32                  InValue;
     ACPI_STATUS             Status;
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    UINT64                  Start;
+#endif
 
 
     ACPI_FUNCTION_TRACE (HwLegacySleep);
@@ -200,6 +203,9 @@ AcpiHwLegacySleep (
 
     /* Disable all GPEs */
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    Start = AcpiOsGetTimer ();
+#endif
     Status = AcpiHwDisableAllGpes ();
     if (ACPI_FAILURE (Status))
     {
@@ -219,6 +225,10 @@ AcpiHwLegacySleep (
     {
         return_ACPI_STATUS (Status);
     }
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    AcpiOsRecordSleepPhase (ACPI_DARWIN_SLEEP_WAKE_GPES, Start, AcpiOsGetTimer () - Start);
+    Start = AcpiOsGetTimer ();
+#endif
 
     /* Get current value of PM1A control */
 
@@ -277,6 +287,10 @@ AcpiHwLegacySleep (
         return_ACPI_STATUS (Status);
     }
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    AcpiOsRecordSleepPhase (ACPI_DARWIN_SLEEP_REGISTERS, Start, AcpiOsGetTimer () - Start);
+#endif
+
     /* Write #2: Write both SLP_TYP + SLP_EN */
 
     Status = AcpiHwWritePm1Control (Pm1aControl, Pm1bControl);
@@ -347,6 +361,9 @@ AcpiHwLegacyWakePrep (
     ACPI_BIT_REGISTER_INFO  *SleepEnableRegInfo;
     UINT32                  Pm1aControl;
     UINT32                  Pm1bControl;
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    UINT64                  Start = AcpiOsGetTimer ();
+#endif
 
 
     ACPI_FUNCTION_TRACE (HwLegacyWakePrep);
@@ -388,6 +405,9 @@ AcpiHwLegacyWakePrep (
         }
     }
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    AcpiOsRecordSleepPhase (ACPI_DARWIN_SLEEP_WAKE_PREP, Start, AcpiOsGetTimer () - Start);
+#endif
     return_ACPI_STATUS (Status);
 }
 
@@ -410,6 +430,9 @@ AcpiHwLegacyWake (
     UINT8                   SleepState)
 {
     ACPI_STATUS             Status;
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    UINT64                  Start;
+#endif
 
 
     ACPI_FUNCTION_TRACE (HwLegacyWake);
@@ -444,7 +467,13 @@ AcpiHwLegacyWake (
      * Now we can execute _WAK, etc. Some machines require that the GPEs
      * are enabled before the wake methods are executed.
      */
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    Start = AcpiOsGetTimer ();
+#endif
     AcpiHwExecuteSleepMethod (METHOD_PATHNAME__WAK, SleepState);
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    AcpiOsRecordSleepPhase (ACPI_DARWIN_SLEEP_WAK, Start, AcpiOsGetTimer () - Start);
+#endif
 
     /*
      * Some BIOS code assumes that WAK_STS will be cleared on resume
@@ -454,20 +454,33 @@ AcpiEnterSleepStatePrep (
     ACPI_OBJECT_LIST        ArgList;
     ACPI_OBJECT             Arg;
     UINT32                  SstValue;
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    UINT64                  Start;
+#endif
 
 
     ACPI_FUNCTION_TRACE (AcpiEnterSleepStatePrep);
 
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    Status = AcpiOsGetSleepTypeData (SleepState,
+        &AcpiGbl_SleepTypeA, &AcpiGbl_SleepTypeB);
+#else
     Status = AcpiGetSleepTypeData (SleepState,
         &AcpiGbl_SleepTypeA, &AcpiGbl_SleepTypeB);
+#endif
     if (ACPI_FAILURE (Status))
     {
         return_ACPI_STATUS (Status);
     }
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    Status = AcpiOsGetSleepTypeData (ACPI_STATE_S0,
+        &AcpiGbl_SleepTypeAS0, &AcpiGbl_SleepTypeBS0);
+#else
     Status = AcpiGetSleepTypeData (ACPI_STATE_S0,
         &AcpiGbl_SleepTypeAS0, &AcpiGbl_SleepTypeBS0);
+#endif
     if (ACPI_FAILURE (Status)) {
         AcpiGbl_SleepTypeAS0 = ACPI_SLEEP_TYPE_INVALID;
     }
@@ -479,7 +492,13 @@ AcpiEnterSleepStatePrep (
     Arg.Type = ACPI_TYPE_INTEGER;
     Arg.Integer.Value = SleepState;
 
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    Start = AcpiOsGetTimer ();
+#endif
     Status = AcpiEvaluateObject (NULL, METHOD_PATHNAME__PTS, &ArgList, NULL);
+#ifdef ACPI_DARWIN_SLEEP_STATES
+    AcpiOsRecordSleepPhase (ACPI_DARWIN_SLEEP_PTS, Start, AcpiOsGetTimer () - Start);
+#endif
     if (ACPI_FAILURE (Status) && Status != AE_NOT_FOUND)
     {
         return_ACPI_STATUS (Status);
@@ -355,6 +355,9 @@ AcpiNsRootInitialize (
                     AcpiUtRemoveReference (ObjDesc);
                     goto UnlockAndExit;
                 }
+#ifdef ACPI_DARWIN_MUTEX_NAMES
+                AcpiOsSetMutexName (ObjDesc->Mutex.OsMutex, InitVal->Name);
+#endif
 
                 /* Special case for ACPI Global Lock */
 
@@ -332,6 +332,10 @@ AcpiNsRemoveNode (
         ParentNode->Child = Node->Peer;
     }
 
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+    AcpiNsIndexRemove (Node, PrevNode);
+#endif
+
     /* Delete the node and any attached objects */
 
     AcpiNsDeleteNode (Node);
@@ -409,10 +413,14 @@ AcpiNsInstallNode (
     {
         /* Add node to the end of the peer list */
 
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+        ChildNode = AcpiNsIndexLastChild (ParentNode);
+#else
         while (ChildNode->Peer)
         {
             ChildNode = ChildNode->Peer;
         }
+#endif
 
         ChildNode->Peer = Node;
     }
@@ -422,6 +430,10 @@ AcpiNsInstallNode (
     Node->OwnerId = OwnerId;
     Node->Type = (UINT8) Type;
 
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+    AcpiNsIndexInsert (Node);
+#endif
+
     ACPI_DEBUG_PRINT ((ACPI_DB_NAMES,
         "%4.4s (%s) [Node %p Owner %3.3X] added to %4.4s (%s) [Node %p]\n",
         AcpiUtGetNodeName (Node), AcpiUtGetTypeName (Node->Type), Node, OwnerId,
@@ -480,6 +492,9 @@ AcpiNsDeleteChildren (
          */
         NodeToDelete = NextNode;
         NextNode = NextNode->Peer;
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+        AcpiNsIndexRemove (NodeToDelete, NULL);
+#endif
         AcpiNsDeleteNode (NodeToDelete);
     }
 
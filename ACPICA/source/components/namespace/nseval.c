@@ -356,7 +356,13 @@ AcpiNsEvaluate (
          * here before calling into the AML parser
          */
         AcpiExEnterInterpreter ();
+#ifdef ACPI_DARWIN_EVALUATION_ARENA
+        AcpiOsBeginEvaluation ();
+#endif
         Status = AcpiPsExecuteMethod (Info);
+#ifdef ACPI_DARWIN_EVALUATION_ARENA
+        AcpiOsEndEvaluation ();
+#endif
         AcpiExExitInterpreter ();
         break;
 
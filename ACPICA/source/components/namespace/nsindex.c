@@ -0,0 +1,760 @@
+/*******************************************************************************
+ *
+ * Module Name: nsindex - Hash index for wide namespace scopes
+ *
+ ******************************************************************************/
+
+/******************************************************************************
+ *
+ * 1. Copyright Notice
+ *
+ * Some or all of this work - Copyright (c) 1999 - 2025, Intel Corp.
+ * All rights reserved.
+ *
+ * 2. License
+ *
+ * 2.1. This is your license from Intel Corp. under its intellectual property
+ * rights. You may have additional license terms from the party that provided
+ * you this software, covering your right to use that party's intellectual
+ * property rights.
+ *
+ * 2.2. Intel grants, free of charge, to any person ("Licensee") obtaining a
+ * copy of the source code appearing in this file ("Covered Code") an
+ * irrevocable, perpetual, worldwide license under Intel's copyrights in the
+ * base code distributed originally by Intel ("Original Intel Code") to copy,
+ * make derivatives, distribute, use and display any portion of the Covered
+ * Code in any form, with the right to sublicense such rights; and
+ *
+ * 2.3. Intel grants Licensee a non-exclusive and non-transferable patent
+ * license (with the right to sublicense), under only those claims of Intel
+ * patents that are infringed by the Original Intel Code, to make, use, sell,
+ * offer to sell, and import the Covered Code and derivative works thereof
+ * solely to the minimum extent necessary to exercise the above copyright
+ * license, and in no event shall the patent license extend to any additions
+ * to or modifications of the Original Intel Code. No other license or right
+ * is granted directly or by implication, estoppel or otherwise;
+ *
+ * The above copyright and patent license is granted only if the following
+ * conditions are met:
+ *
+ * 3. Conditions
+ *
+ * 3.1. Redistribution of Source with Rights to Further Distribute Source.
+ * Redistribution of source code of any substantial portion of the Covered
+ * Code or modification with rights to further distribute source must include
+ * the above Copyright Notice, the above License, this list of Conditions,
+ * and the following Disclaimer and Export Compliance provision. In addition,
+ * Licensee must cause all Covered Code to which Licensee contributes to
+ * contain a file documenting the changes Licensee made to create that Covered
+ * Code and the date of any change. Licensee must include in that file the
+ * documentation of any changes made by any predecessor Licensee. Licensee
+ * must include a prominent statement that the modification is derived,
+ * directly or indirectly, from Original Intel Code.
+ *
+ * 3.2. Redistribution of Source with no Rights to Further Distribute Source.
+ * Redistribution of source code of any substantial portion of the Covered
+ * Code or modification without rights to further distribute source must
+ * include the following Disclaimer and Export Compliance provision in the
+ * documentation and/or other materials provided with distribution. In
+ * addition, Licensee may not authorize further sublicense of source of any
+ * portion of the Covered Code, and must include terms to the effect that the
+ * license from Licensee to its licensee is limited to the intellectual
+ * property embodied in the software Licensee provides to its licensee, and
+ * not to intellectual property embodied in modifications its licensee may
+ * make.
+ *
+ * 3.3. Redistribution of Executable. Redistribution in executable form of any
+ * substantial portion of the Covered Code or modification must reproduce the
+ * above Copyright Notice, and the following Disclaimer and Export Compliance
+ * provision in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * 3.4. Intel retains all right, title, and interest in and to the Original
+ * Intel Code.
+ *
+ * 3.5. Neither the name Intel nor any other trademark owned or controlled by
+ * Intel shall be used in advertising or otherwise to promote the sale, use or
+ * other dealings in products derived from or relating to the Covered Code
+ * without prior written authorization from Intel.
+ *
+ * 4. Disclaimer and Export Compliance
+ *
+ * 4.1. INTEL MAKES NO WARRANTY OF ANY KIND REGARDING ANY SOFTWARE PROVIDED
+ * HERE. ANY SOFTWARE ORIGINATING FROM INTEL OR DERIVED FROM INTEL SOFTWARE
+ * IS PROVIDED "AS IS," AND INTEL WILL NOT PROVIDE ANY SUPPORT, ASSISTANCE,
+ * INSTALLATION, TRAINING OR OTHER SERVICES. INTEL WILL NOT PROVIDE ANY
+ * UPDATES, ENHANCEMENTS OR EXTENSIONS. INTEL SPECIFICALLY DISCLAIMS ANY
+ * IMPLIED WARRANTIES OF MERCHANTABILITY, NONINFRINGEMENT AND FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ * 4.2. IN NO EVENT SHALL INTEL HAVE ANY LIABILITY TO LICENSEE, ITS LICENSEES
+ * OR ANY OTHER THIRD PARTY, FOR ANY LOST PROFITS, LOST DATA, LOSS OF USE OR
+ * COSTS OF PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES, OR FOR ANY INDIRECT,
+ * SPECIAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THIS AGREEMENT, UNDER ANY
+ * CAUSE OF ACTION OR THEORY OF LIABILITY, AND IRRESPECTIVE OF WHETHER INTEL
+ * HAS ADVANCE NOTICE OF THE POSSIBILITY OF SUCH DAMAGES. THESE LIMITATIONS
+ * SHALL APPLY NOTWITHSTANDING THE FAILURE OF THE ESSENTIAL PURPOSE OF ANY
+ * LIMITED REMEDY.
+ *
+ * 4.3. Licensee shall not export, either directly or indirectly, any of this
+ * software or system incorporating such software without first obtaining any
+ * required license or other approval from the U. S. Department of Commerce or
+ * any other agency or department of the United States Government. In the
+ * event Licensee exports any such software from the United States or
+ * re-exports any such software from a foreign destination, Licensee shall
+ * ensure that the distribution and export/re-export of the software is in
+ * compliance with all laws, regulations, orders, or other restrictions of the
+ * U.S. Export Administration Regulations. Licensee agrees that neither it nor
+ * any of its subsidiaries will export/re-export any technical data, process,
+ * software, or service, directly or indirectly, to any country for which the
+ * United States government or any agency thereof requires an export license,
+ * other governmental approval, or letter of assurance, without first obtaining
+ * such license, approval or letter.
+ *
+ *****************************************************************************
+ *
+ * Alternatively, you may choose to be licensed under the terms of the
+ * following license:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions, and the following disclaimer,
+ *    without modification.
+ * 2. Redistributions in binary form must reproduce at minimum a disclaimer
+ *    substantially similar to the "NO WARRANTY" disclaimer below
+ *    ("Disclaimer") and any redistribution must be conditioned upon
+ *    including a substantially similar Disclaimer requirement for further
+ *    binary redistribution.
+ * 3. Neither the names of the above-listed copyright holders nor the names
+ *    of any contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Alternatively, you may choose to be licensed under the terms of the
+ * GNU General Public License ("GPL") version 2 as published by the Free
+ * Software Foundation.
+ *
+ *****************************************************************************/
+
+#include "acpi.h"
+#include "accommon.h"
+#include "acnamesp.h"
+
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+
+#define _COMPONENT          ACPI_NAMESPACE
+        ACPI_MODULE_NAME    ("nsindex")
+
+
+/*
+ * AcpiNsSearchOneScope and AcpiNsInstallNode walk a scope's child list, so filling a scope
+ * with n names costs O(n^2) and every lookup in it O(n). Nobody notices under a device with a
+ * dozen methods. Server firmware, though, hangs hundreds of devices off \_SB and its PCI roots
+ * and hundreds of processors off \_PR, and every SSDT that adds to them pays for it again.
+ * Making each load cheaper is the only option: the load runs module-level AML, which can test
+ * _OSI and read operation regions, so a saved image of the namespace couldn't stand in for it.
+ *
+ * A scope is indexed the first time a walk over its children passes ACPI_NS_WIDE_SCOPE.
+ * From then on each child has an entry keyed by (parent, name), and the last child has one
+ * keyed by (parent, 0), which no ACPI name can be. Narrow scopes, nearly all of them, are
+ * walked as before and cost nothing extra.
+ *
+ * A name can repeat within a scope (ACPICA tolerates some firmware that does it). The linear
+ * search finds the first, so the entry points at the first and ANOBJ_DARWIN_SHADOWED marks a
+ * node that has a later namesake to promote when it goes.
+ *
+ * The child lists themselves are still serialized by the interpreter and namespace locks.
+ * The spinlock only keeps the table coherent for concurrent lookups while it's updated or
+ * rehashed; nothing allocates under it. Only the OSL lock and allocation calls are used, so
+ * this builds the same in the kernel and in a userspace tool on osunixxf.c.
+ */
+#define ACPI_NS_WIDE_SCOPE      16
+#define ACPI_NS_TAIL            0
+
+typedef struct acpi_ns_index_entry
+{
+    ACPI_NAMESPACE_NODE     *Parent;
+    ACPI_NAMESPACE_NODE     *Node;          /* NULL if the slot is empty */
+    UINT32                  Name;
+
+} ACPI_NS_INDEX_ENTRY;
+
+static ACPI_SPINLOCK        AcpiGbl_NsIndexLock;
+static ACPI_NS_INDEX_ENTRY  *AcpiGbl_NsIndex;
+static UINT32               AcpiGbl_NsIndexShift;   /* capacity is 1 << shift, 0 before the first scope */
+static UINT32               AcpiGbl_NsIndexCount;
+static UINT64               AcpiGbl_NsIndexScopes;
+static UINT64               AcpiGbl_NsIndexLookups;
+static UINT64               AcpiGbl_NsIndexAppends;
+static UINT64               AcpiGbl_NsIndexFailures;
+
+
+static UINT32
+AcpiNsIndexHash (
+    ACPI_NAMESPACE_NODE     *Parent,
+    UINT32                  Name,
+    UINT32                  Shift)
+{
+    UINT64                  Key = ((UINT64) ACPI_TO_INTEGER (Parent) >> 4) ^ ((UINT64) Name << 32);
+
+
+    return ((UINT32) ((Key * 0x9E3779B97F4A7C15ULL) >> (64 - Shift)));
+}
+
+
+/* The slot holding (Parent, Name), or the empty one where it would go. The table is never full. */
+
+static ACPI_NS_INDEX_ENTRY *
+AcpiNsIndexFindSlot (
+    ACPI_NS_INDEX_ENTRY     *Table,
+    UINT32                  Shift,
+    ACPI_NAMESPACE_NODE     *Parent,
+    UINT32                  Name)
+{
+    UINT32                  Mask = (1U << Shift) - 1;
+    UINT32                  Slot = AcpiNsIndexHash (Parent, Name, Shift);
+    ACPI_NS_INDEX_ENTRY     *Entry;
+
+
+    for (;; Slot = (Slot + 1) & Mask)
+    {
+        Entry = &Table[Slot];
+        if (!Entry->Node || (Entry->Parent == Parent && Entry->Name == Name))
+        {
+            return (Entry);
+        }
+    }
+}
+
+
+/* Backward-shift deletion, so probe chains stay intact without tombstones. Lock held. */
+
+static void
+AcpiNsIndexErase (
+    ACPI_NS_INDEX_ENTRY     *Entry)
+{
+    UINT32                  Mask = (1U << AcpiGbl_NsIndexShift) - 1;
+    UINT32                  Hole = (UINT32) (Entry - AcpiGbl_NsIndex);
+    UINT32                  Slot = Hole;
+    UINT32                  Home;
+
+
+    for (;;)
+    {
+        Slot = (Slot + 1) & Mask;
+        Entry = &AcpiGbl_NsIndex[Slot];
+        if (!Entry->Node)
+        {
+            break;
+        }
+
+        /* Move it back into the hole unless its home slot lies between the hole and here */
+
+        Home = AcpiNsIndexHash (Entry->Parent, Entry->Name, AcpiGbl_NsIndexShift);
+        if (((Slot - Home) & Mask) >= ((Slot - Hole) & Mask))
+        {
+            AcpiGbl_NsIndex[Hole] = *Entry;
+            Hole = Slot;
+        }
+    }
+
+    memset (&AcpiGbl_NsIndex[Hole], 0, sizeof (ACPI_NS_INDEX_ENTRY));
+    AcpiGbl_NsIndexCount--;
+}
+
+
+/* Add (Parent, Name) -> Node. An existing name keeps its entry unless Replace. Lock held. */
+
+static void
+AcpiNsIndexPut (
+    ACPI_NAMESPACE_NODE     *Parent,
+    UINT32                  Name,
+    ACPI_NAMESPACE_NODE     *Node,
+    BOOLEAN                 Replace)
+{
+    ACPI_NS_INDEX_ENTRY     *Entry;
+
+
+    Entry = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, Name);
+    if (!Entry->Node)
+    {
+        Entry->Parent = Parent;
+        Entry->Name = Name;
+        Entry->Node = Node;
+        AcpiGbl_NsIndexCount++;
+    }
+    else if (Replace)
+    {
+        Entry->Node = Node;
+    }
+    else
+    {
+        Entry->Node->Flags |= ANOBJ_DARWIN_SHADOWED;
+    }
+}
+
+
+/* Make room for Additional more entries at no more than half load. Called without the lock. */
+
+static BOOLEAN
+AcpiNsIndexReserve (
+    UINT32                  Additional)
+{
+    ACPI_NS_INDEX_ENTRY     *Table;
+    ACPI_NS_INDEX_ENTRY     *Old;
+    ACPI_CPU_FLAGS          LockFlags;
+    UINT32                  Shift;
+    UINT32                  NewShift;
+    UINT32                  Needed;
+    UINT32                  i;
+
+
+    for (;;)
+    {
+        LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+        Shift = AcpiGbl_NsIndexShift;
+        Needed = AcpiGbl_NsIndexCount + Additional;
+        AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+
+        if (Shift && Needed * 2 <= (1U << Shift))
+        {
+            return (TRUE);
+        }
+
+        NewShift = Shift ? Shift + 1 : 8;
+        while ((1U << NewShift) < Needed * 2)
+        {
+            NewShift++;
+        }
+
+        Table = ACPI_ALLOCATE_ZEROED ((ACPI_SIZE) sizeof (ACPI_NS_INDEX_ENTRY) << NewShift);
+        if (!Table)
+        {
+            return (FALSE);
+        }
+
+        LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+        if (AcpiGbl_NsIndexShift != Shift)
+        {
+            /* Someone else grew it first; see whether that was enough */
+
+            AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+            ACPI_FREE (Table);
+            continue;
+        }
+
+        Old = AcpiGbl_NsIndex;
+        for (i = 0; Old && i < (1U << Shift); i++)
+        {
+            if (Old[i].Node)
+            {
+                *AcpiNsIndexFindSlot (Table, NewShift, Old[i].Parent, Old[i].Name) = Old[i];
+            }
+        }
+        AcpiGbl_NsIndex = Table;
+        AcpiGbl_NsIndexShift = NewShift;
+        AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+
+        if (Old)
+        {
+            ACPI_FREE (Old);
+        }
+        return (TRUE);
+    }
+}
+
+
+/* Take every child of Parent out of the index and go back to walking its list. Lock held. */
+
+static void
+AcpiNsIndexUnindexScope (
+    ACPI_NAMESPACE_NODE     *Parent)
+{
+    ACPI_NAMESPACE_NODE     *Child;
+    ACPI_NS_INDEX_ENTRY     *Entry;
+
+
+    for (Child = Parent->Child; Child; Child = Child->Peer)
+    {
+        Entry = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, Child->Name.Integer);
+        if (Entry->Node == Child)
+        {
+            AcpiNsIndexErase (Entry);
+        }
+        Child->Flags &= ~ANOBJ_DARWIN_SHADOWED;
+    }
+
+    Entry = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, ACPI_NS_TAIL);
+    if (Entry->Node)
+    {
+        AcpiNsIndexErase (Entry);
+    }
+
+    Parent->Flags &= ~ANOBJ_DARWIN_INDEXED;
+    AcpiGbl_NsIndexScopes--;
+}
+
+
+static void
+AcpiNsIndexScope (
+    ACPI_NAMESPACE_NODE     *Parent)
+{
+    ACPI_NAMESPACE_NODE     *Child;
+    ACPI_NAMESPACE_NODE     *Last = NULL;
+    ACPI_CPU_FLAGS          LockFlags;
+    UINT32                  Children = 0;
+
+
+    for (Child = Parent->Child; Child; Child = Child->Peer)
+    {
+        Children++;
+    }
+
+    if (!AcpiGbl_NsIndexLock || !AcpiNsIndexReserve (Children + 1))
+    {
+        return;
+    }
+
+    LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+    if (!(Parent->Flags & ANOBJ_DARWIN_INDEXED))
+    {
+        for (Child = Parent->Child; Child; Child = Child->Peer)
+        {
+            AcpiNsIndexPut (Parent, Child->Name.Integer, Child, FALSE);
+            Last = Child;
+        }
+        if (Last)
+        {
+            AcpiNsIndexPut (Parent, ACPI_NS_TAIL, Last, TRUE);
+        }
+        Parent->Flags |= ANOBJ_DARWIN_INDEXED;
+        AcpiGbl_NsIndexScopes++;
+    }
+    AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexSearch
+ *
+ * PARAMETERS:  Parent          - Scope to search
+ *              Name            - 4-character ACPI name
+ *
+ * RETURN:      The first child of Parent called Name, or NULL
+ *
+ * DESCRIPTION: Stands in for the child list walk in AcpiNsSearchOneScope.
+ *              Indexes the scope once that walk gets long.
+ *
+ ******************************************************************************/
+
+ACPI_NAMESPACE_NODE *
+AcpiNsIndexSearch (
+    ACPI_NAMESPACE_NODE     *Parent,
+    UINT32                  Name)
+{
+    ACPI_NAMESPACE_NODE     *Node;
+    ACPI_CPU_FLAGS          LockFlags;
+    UINT32                  Steps = 0;
+
+
+    if (Parent->Flags & ANOBJ_DARWIN_INDEXED)
+    {
+        LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+        Node = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, Name)->Node;
+        AcpiGbl_NsIndexLookups++;
+        AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+        return (Node);
+    }
+
+    for (Node = Parent->Child; Node && Node->Name.Integer != Name; Node = Node->Peer)
+    {
+        Steps++;
+    }
+
+    if (Steps > ACPI_NS_WIDE_SCOPE)
+    {
+        AcpiNsIndexScope (Parent);
+    }
+
+    return (Node);
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexLastChild
+ *
+ * PARAMETERS:  Parent          - Scope with at least one child
+ *
+ * RETURN:      The last child of Parent
+ *
+ * DESCRIPTION: Stands in for the peer list walk in AcpiNsInstallNode.
+ *
+ ******************************************************************************/
+
+ACPI_NAMESPACE_NODE *
+AcpiNsIndexLastChild (
+    ACPI_NAMESPACE_NODE     *Parent)
+{
+    ACPI_NAMESPACE_NODE     *Node = NULL;
+    ACPI_CPU_FLAGS          LockFlags;
+    UINT32                  Steps = 0;
+
+
+    if (Parent->Flags & ANOBJ_DARWIN_INDEXED)
+    {
+        LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+        Node = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, ACPI_NS_TAIL)->Node;
+        AcpiGbl_NsIndexAppends++;
+        AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+        if (Node)
+        {
+            return (Node);
+        }
+    }
+
+    for (Node = Parent->Child; Node->Peer; Node = Node->Peer)
+    {
+        Steps++;
+    }
+
+    if (Steps > ACPI_NS_WIDE_SCOPE)
+    {
+        AcpiNsIndexScope (Parent);
+    }
+
+    return (Node);
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexInsert
+ *
+ * PARAMETERS:  Node            - Node just linked in as its parent's last child
+ *
+ * RETURN:      None
+ *
+ * DESCRIPTION: Keep an indexed scope's entries current. If the index can't
+ *              grow, the scope goes back to being walked.
+ *
+ ******************************************************************************/
+
+void
+AcpiNsIndexInsert (
+    ACPI_NAMESPACE_NODE     *Node)
+{
+    ACPI_NAMESPACE_NODE     *Parent = Node->Parent;
+    ACPI_CPU_FLAGS          LockFlags;
+    BOOLEAN                 Reserved;
+
+
+    if (!(Parent->Flags & ANOBJ_DARWIN_INDEXED))
+    {
+        return;
+    }
+
+    Reserved = AcpiNsIndexReserve (2);
+
+    LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+    if (Reserved)
+    {
+        AcpiNsIndexPut (Parent, Node->Name.Integer, Node, FALSE);
+        AcpiNsIndexPut (Parent, ACPI_NS_TAIL, Node, TRUE);
+    }
+    else
+    {
+        AcpiNsIndexUnindexScope (Parent);
+        AcpiGbl_NsIndexFailures++;
+    }
+    AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexRemove
+ *
+ * PARAMETERS:  Node            - Node about to be deleted
+ *              PrevNode        - The sibling before it if it was unlinked on
+ *                                its own, NULL when the whole child list is
+ *                                going (AcpiNsDeleteChildren)
+ *
+ * RETURN:      None
+ *
+ * DESCRIPTION: Drop Node's entries, promoting a later namesake if it had one.
+ *              Node->Peer is still intact either way.
+ *
+ ******************************************************************************/
+
+void
+AcpiNsIndexRemove (
+    ACPI_NAMESPACE_NODE     *Node,
+    ACPI_NAMESPACE_NODE     *PrevNode)
+{
+    ACPI_NAMESPACE_NODE     *Parent = Node->Parent;
+    ACPI_NAMESPACE_NODE     *Next = NULL;
+    ACPI_NAMESPACE_NODE     *Later;
+    ACPI_NS_INDEX_ENTRY     *Entry;
+    ACPI_CPU_FLAGS          LockFlags;
+    BOOLEAN                 ParentIndexed = Parent && (Parent->Flags & ANOBJ_DARWIN_INDEXED);
+
+
+    if (!AcpiGbl_NsIndexLock || (!ParentIndexed && !(Node->Flags & ANOBJ_DARWIN_INDEXED)))
+    {
+        return;
+    }
+
+    LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+
+    /* Its own children should be gone by now, but don't leave entries keyed by a freed node */
+
+    if (Node->Flags & ANOBJ_DARWIN_INDEXED)
+    {
+        AcpiNsIndexUnindexScope (Node);
+    }
+
+    if (ParentIndexed)
+    {
+        Entry = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, Node->Name.Integer);
+        if (Entry->Node == Node)
+        {
+            if (Node->Flags & ANOBJ_DARWIN_SHADOWED)
+            {
+                for (Next = Node->Peer; Next && Next->Name.Integer != Node->Name.Integer; Next = Next->Peer)
+                {
+                }
+            }
+
+            if (Next)
+            {
+                /* Promote the namesake, and keep it marked if there's another one after it */
+
+                for (Later = Next->Peer; Later && Later->Name.Integer != Next->Name.Integer; Later = Later->Peer)
+                {
+                }
+                if (Later)
+                {
+                    Next->Flags |= ANOBJ_DARWIN_SHADOWED;
+                }
+                Entry->Node = Next;
+            }
+            else
+            {
+                AcpiNsIndexErase (Entry);
+            }
+        }
+
+        if (!Node->Peer)
+        {
+            Entry = AcpiNsIndexFindSlot (AcpiGbl_NsIndex, AcpiGbl_NsIndexShift, Parent, ACPI_NS_TAIL);
+            if (PrevNode)
+            {
+                AcpiNsIndexPut (Parent, ACPI_NS_TAIL, PrevNode, TRUE);
+            }
+            else if (Entry->Node)
+            {
+                AcpiNsIndexErase (Entry);
+            }
+        }
+    }
+
+    AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexInitialize, AcpiNsIndexTerminate
+ *
+ * PARAMETERS:  None
+ *
+ * RETURN:      Status
+ *
+ * DESCRIPTION: Create and delete the index lock along with the other global
+ *              locks. The namespace is gone by the time we terminate, and
+ *              every entry with it.
+ *
+ ******************************************************************************/
+
+UINT32
+AcpiNsIndexInitialize (
+    void)
+{
+
+    return (AcpiOsCreateLock (&AcpiGbl_NsIndexLock));
+}
+
+
+void
+AcpiNsIndexTerminate (
+    void)
+{
+
+    if (!AcpiGbl_NsIndexLock || AcpiGbl_NsIndexCount)
+    {
+        return;
+    }
+
+    if (AcpiGbl_NsIndex)
+    {
+        ACPI_FREE (AcpiGbl_NsIndex);
+        AcpiGbl_NsIndex = NULL;
+        AcpiGbl_NsIndexShift = 0;
+    }
+
+    AcpiOsDeleteLock (AcpiGbl_NsIndexLock);
+    AcpiGbl_NsIndexLock = NULL;
+}
+
+
+/*******************************************************************************
+ *
+ * FUNCTION:    AcpiNsIndexGetStatistics
+ *
+ * PARAMETERS:  Stats           - Where to return the counters
+ *
+ * RETURN:      None
+ *
+ * DESCRIPTION: Snapshot the index counters for the host's statistics.
+ *
+ ******************************************************************************/
+
+void
+AcpiNsIndexGetStatistics (
+    ACPI_DARWIN_NS_INDEX_STATS  *Stats)
+{
+    ACPI_CPU_FLAGS          LockFlags;
+
+
+    memset (Stats, 0, sizeof (*Stats));
+    if (!AcpiGbl_NsIndexLock)
+    {
+        return;
+    }
+
+    LockFlags = AcpiOsAcquireLock (AcpiGbl_NsIndexLock);
+    Stats->Scopes = AcpiGbl_NsIndexScopes;
+    Stats->Entries = AcpiGbl_NsIndexCount;
+    Stats->Capacity = AcpiGbl_NsIndexShift ? 1ULL << AcpiGbl_NsIndexShift : 0;
+    Stats->Lookups = AcpiGbl_NsIndexLookups;
+    Stats->Appends = AcpiGbl_NsIndexAppends;
+    Stats->Failures = AcpiGbl_NsIndexFailures;
+    AcpiOsReleaseLock (AcpiGbl_NsIndexLock, LockFlags);
+}
+
+#endif /* ACPI_DARWIN_NAMESPACE_INDEX */
@@ -268,6 +268,11 @@ AcpiNsInitializeDevices (
     ACPI_STATUS             Status = AE_OK;
     ACPI_DEVICE_WALK_INFO   Info;
     ACPI_HANDLE             Handle;
+#ifdef ACPI_DARWIN_INIT_TIMING
+    UINT64                  Start = AcpiOsGetTimer ();
+    UINT64                  RegStart;
+    UINT64                  RegElapsed = 0;
+#endif
 
 
     ACPI_FUNCTION_TRACE (NsInitializeDevices);
@@ -362,7 +367,14 @@ AcpiNsInitializeDevices (
         ACPI_DEBUG_PRINT ((ACPI_DB_EXEC,
             "[Init] Executing _REG OpRegion methods\n"));
 
+#ifdef ACPI_DARWIN_INIT_TIMING
+        RegStart = AcpiOsGetTimer ();
+#endif
         Status = AcpiEvInitializeOpRegions ();
+#ifdef ACPI_DARWIN_INIT_TIMING
+        RegElapsed = AcpiOsGetTimer () - RegStart;
+        AcpiOsRecordRegMethods (RegElapsed);
+#endif
         if (ACPI_FAILURE (Status))
         {
             goto ErrorExit;
@@ -396,6 +408,10 @@ AcpiNsInitializeDevices (
             "    Executed %u _INI methods requiring %u _STA executions "
             "(examined %u objects)\n",
             Info.Num_INI, Info.Num_STA, Info.DeviceCount));
+#ifdef ACPI_DARWIN_INIT_TIMING
+        AcpiOsRecordDeviceInit (AcpiOsGetTimer () - Start - RegElapsed,
+            Info.DeviceCount, Info.Num_INI, Info.Num_STA);
+#endif
     }
 
     return_ACPI_STATUS (Status);
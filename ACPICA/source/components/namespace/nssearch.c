@@ -237,7 +237,11 @@ AcpiNsSearchOneScope (
      * Search for name at this namespace level, which is to say that we
      * must search for the name among the children of this object
      */
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+    Node = AcpiNsIndexSearch (ParentNode, TargetName);
+#else
     Node = ParentNode->Child;
+#endif
     while (Node)
     {
         /* Check for match against the name */
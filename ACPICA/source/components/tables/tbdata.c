@@ -1209,6 +1209,9 @@ AcpiTbLoadTable (
     ACPI_TABLE_HEADER       *Table;
     ACPI_STATUS             Status;
     ACPI_OWNER_ID           OwnerId;
+#ifdef ACPI_DARWIN_INIT_TIMING
+    UINT64                  Start;
+#endif
 
 
     ACPI_FUNCTION_TRACE (TbLoadTable);
@@ -1224,7 +1227,13 @@ AcpiTbLoadTable (
         return_ACPI_STATUS (Status);
     }
 
+#ifdef ACPI_DARWIN_INIT_TIMING
+    Start = AcpiOsGetTimer ();
+#endif
     Status = AcpiNsLoadTable (TableIndex, ParentNode);
+#ifdef ACPI_DARWIN_INIT_TIMING
+    AcpiOsRecordTableLoad (TableIndex, Table, AcpiOsGetTimer () - Start, Status);
+#endif
     if (ACPI_FAILURE (Status))
     {
         return_ACPI_STATUS (Status);
@@ -261,6 +261,9 @@ AcpiTbLoadNamespace (
     ACPI_TABLE_DESC         *Table;
     UINT32                  TablesLoaded = 0;
     UINT32                  TablesFailed = 0;
+#ifdef ACPI_DARWIN_INIT_TIMING
+    UINT64                  Start;
+#endif
 
 
     ACPI_FUNCTION_TRACE (TbLoadNamespace);
@@ -315,7 +318,13 @@ AcpiTbLoadNamespace (
     /* Load and parse tables */
 
     (void) AcpiUtReleaseMutex (ACPI_MTX_TABLES);
+#ifdef ACPI_DARWIN_INIT_TIMING
+    Start = AcpiOsGetTimer ();
+#endif
     Status = AcpiNsLoadTable (AcpiGbl_DsdtIndex, AcpiGbl_RootNode);
+#ifdef ACPI_DARWIN_INIT_TIMING
+    AcpiOsRecordTableLoad (AcpiGbl_DsdtIndex, AcpiGbl_DSDT, AcpiOsGetTimer () - Start, Status);
+#endif
     (void) AcpiUtAcquireMutex (ACPI_MTX_TABLES);
     if (ACPI_FAILURE (Status))
     {
@@ -345,7 +354,13 @@ AcpiTbLoadNamespace (
         /* Ignore errors while loading tables, get as many as possible */
 
         (void) AcpiUtReleaseMutex (ACPI_MTX_TABLES);
+#ifdef ACPI_DARWIN_INIT_TIMING
+        Start = AcpiOsGetTimer ();
+#endif
         Status =  AcpiNsLoadTable (i, AcpiGbl_RootNode);
+#ifdef ACPI_DARWIN_INIT_TIMING
+        AcpiOsRecordTableLoad (i, Table->Pointer, AcpiOsGetTimer () - Start, Status);
+#endif
         (void) AcpiUtAcquireMutex (ACPI_MTX_TABLES);
         if (ACPI_FAILURE (Status))
         {
@@ -151,6 +151,7 @@
 
 #include "acpi.h"
 #include "accommon.h"
+#include "acnamesp.h"
 
 #define _COMPONENT          ACPI_UTILITIES
         ACPI_MODULE_NAME    ("utmutex")
@@ -221,6 +222,14 @@ AcpiUtMutexInitialize (
         return_ACPI_STATUS (Status);
     }
 
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+    Status = AcpiNsIndexInitialize ();
+    if (ACPI_FAILURE (Status))
+    {
+        return_ACPI_STATUS (Status);
+    }
+#endif
+
     /* Mutex for _OSI support */
 
     Status = AcpiOsCreateMutex (&AcpiGbl_OsiMutex);
@@ -228,6 +237,9 @@ AcpiUtMutexInitialize (
     {
         return_ACPI_STATUS (Status);
     }
+#ifdef ACPI_DARWIN_MUTEX_NAMES
+    AcpiOsSetMutexName (AcpiGbl_OsiMutex, "ACPI_MTX_Osi");
+#endif
 
     /* Create the reader/writer lock for namespace access */
 
@@ -278,6 +290,9 @@ AcpiUtMutexTerminate (
     AcpiOsDeleteLock (AcpiGbl_GpeLock);
     AcpiOsDeleteLock (AcpiGbl_HardwareLock);
     AcpiOsDeleteLock (AcpiGbl_ReferenceCountLock);
+#ifdef ACPI_DARWIN_NAMESPACE_INDEX
+    AcpiNsIndexTerminate ();
+#endif
 
     /* Delete the reader/writer lock */
 
@@ -313,6 +328,13 @@ AcpiUtCreateMutex (
         Status = AcpiOsCreateMutex (&AcpiGbl_MutexInfo[MutexId].Mutex);
         AcpiGbl_MutexInfo[MutexId].ThreadId = ACPI_MUTEX_NOT_ACQUIRED;
         AcpiGbl_MutexInfo[MutexId].UseCount = 0;
+#ifdef ACPI_DARWIN_MUTEX_NAMES
+        if (ACPI_SUCCESS (Status))
+        {
+            AcpiOsSetMutexName (AcpiGbl_MutexInfo[MutexId].Mutex,
+                AcpiUtGetMutexName (MutexId));
+        }
+#endif
     }
 
     return_ACPI_STATUS (Status);
@@ -37,12 +37,18 @@
 /* standard includes... */
 #include "acpica/acpi.h"
 #include "acpica/actables.h"  /* For MCFG table definitions */
+#include "acpica/aclocal.h"   /* ACPI_NAMESPACE_NODE, for the namespace index */
 
 #include <mach/semaphore.h>
 #include <machine/machine_routines.h>
 #include <mach/machine.h>
 #include <IOKit/IOLib.h>
 #include <mach/thread_status.h>
+#include <kern/cpu_number.h>
+#include <kern/thread_call.h>
+#include <kern/clock.h>
+#include <kern/sched_prim.h>
+#include <libkern/OSAtomic.h>
 
 /* ACPI OS Layer implementations because yes */
 #define _COMPONENT ACPI_OS_SERVICES
@@ -62,31 +68,33 @@ ACPI_MODULE_NAME("osdarwin");
 /* track memory allocations, otherwise all hell will break loose in XNU. */
 struct _memory_tag {
     UINT32 magic;
-    ACPI_SIZE size;
+    UINT32 size_class;      /* index into gAcpiOsAllocClasses, or ACPI_ALLOC_LARGE */
+    ACPI_SIZE size;         /* what the caller asked for */
 };
 
-/* Cache management structures for ACPICA object caching */
-struct _cache_object {
-    struct _cache_object *next;
-    /* Object data follows this header */
-};
+/*
+ * AcpiOsAllocate size classes. Anything up to 4KB (including the tag) comes out of
+ * one of these object caches, so it gets the same per-CPU magazines as ACPICA's own
+ * caches; bigger requests go straight to IOMalloc.
+ */
+#define ACPI_ALLOC_MIN_SHIFT    5       /* 32 bytes; the tag alone is 16 */
+#define ACPI_ALLOC_MAX_SHIFT    12      /* 4096 bytes */
+#define ACPI_ALLOC_CLASSES      (ACPI_ALLOC_MAX_SHIFT - ACPI_ALLOC_MIN_SHIFT + 1)
+#define ACPI_ALLOC_LARGE        0xFFFFFFFF
 
-struct _acpi_cache {
-    UINT32 magic;
-    char name[16];
-    ACPI_SIZE object_size;
-    UINT16 max_depth;
-    UINT16 current_depth;
-    struct _cache_object *list_head;
-    IOSimpleLock *lock;
-    UINT32 requests;
-    UINT32 hits;
-};
+_Static_assert(ACPI_ALLOC_CLASSES + 1 == ACPI_DARWIN_ALLOC_CLASSES, "acdarwin.h and osdarwin.c disagree on size classes");
 
-#define ACPI_CACHE_MAGIC 'cach'
+struct _acpi_cache;
+static struct _acpi_cache *gAcpiOsAllocClasses[ACPI_ALLOC_CLASSES];
+
+static volatile SInt64 gAcpiOsAllocLiveBytes;
+static volatile SInt64 gAcpiOsAllocHighWater;
+static volatile SInt64 gAcpiOsAllocClassLive[ACPI_ALLOC_CLASSES + 1];  /* last slot counts large allocations */
+static volatile SInt64 gAcpiOsAllocClassTotal[ACPI_ALLOC_CLASSES + 1];
 
 #define ACPI_OS_PRINTF_USE_KPRINTF 0x1
 #define ACPI_OS_PRINTF_USE_IOLOG   0x2
+#define ACPI_OS_PRINTF_SYNC        0x4  /* bypass the log rings, for debugging early boot */
 
 #if DEBUG
 UInt32 gAcpiOsPrintfFlags = ACPI_OS_PRINTF_USE_KPRINTF | ACPI_OS_PRINTF_USE_IOLOG;
@@ -97,16 +105,49 @@ UInt32 gAcpiOsPrintfFlags = ACPI_OS_PRINTF_USE_IOLOG;
 
 /* External functions - see PDACPIPlatform/AcpiOsLayer.cpp */
 extern void *AcpiOsExtMapMemory(ACPI_PHYSICAL_ADDRESS, ACPI_SIZE);
-extern void AcpiOsExtUnmapMemory(void *);
+extern void AcpiOsExtUnmapMemory(void *, ACPI_SIZE);
 extern ACPI_STATUS AcpiOsExtInitialize(void);
 extern ACPI_PHYSICAL_ADDRESS AcpiOsExtGetRootPointer(void);
 extern ACPI_STATUS AcpiOsExtExecute(ACPI_EXECUTE_TYPE Type, ACPI_OSD_EXEC_CALLBACK Function, void *Context);
+extern ACPI_STATUS AcpiOsExtWaitEventsComplete(void);
+extern ACPI_STATUS AcpiOsExtRegisterPciEcam(UINT16 Segment, UINT8 StartBus, UINT8 EndBus, ACPI_PHYSICAL_ADDRESS Address);
+extern ACPI_STATUS AcpiOsExtRegisterPciEcamTable(const ACPI_TABLE_MCFG *Mcfg);
+extern void *AcpiOsExtGetPciConfigAddress(UINT16 Segment, UINT8 Bus, UINT8 Device, UINT8 Function, UINT32 Register);
+extern IOInterruptState AcpiOsExtLockPciConfigPorts(void);
+extern void AcpiOsExtUnlockPciConfigPorts(IOInterruptState State);
+extern ACPI_STATUS AcpiOsExtReadMemory(ACPI_PHYSICAL_ADDRESS Address, UINT64 *Value, UINT32 Width);
+extern ACPI_STATUS AcpiOsExtWriteMemory(ACPI_PHYSICAL_ADDRESS Address, UINT64 Value, UINT32 Width);
+
+/* Set once the MCFG has been handed to the ECAM window table in AcpiOsLayer.cpp */
+static boolean_t gPciEcamInitialized = FALSE;
+
+/* All live object caches, so the statistics can be walked. See AcpiOsCreateCache. */
+static struct _acpi_cache *gAcpiOsCacheList;
+static IOLock *gAcpiOsCacheListLock;
+
+/* All live mutexes, for the statistics. See AcpiOsCreateMutex. */
+#define ACPI_MUTEX_SPIN_NS 20000    /* how long a contended acquire spins before it sleeps */
+static struct _acpi_mutex *gAcpiOsMutexList;
+static IOLock *gAcpiOsMutexListLock;
+static UInt64 gAcpiOsMutexSpinWindow;
+
+static void AcpiOsAllocInitialize(void);
+static void AcpiOsAllocTerminate(void);
+static void AcpiOsArenaTerminate(void);
+static void AcpiOsLogInitialize(void);
+static void AcpiOsLogTerminate(void);
 
 ACPI_STATUS AcpiOsInitialize(void)
 {
     ACPI_STATUS status;
     
     PE_parse_boot_argn("acpi_os_log", &gAcpiOsPrintfFlags, sizeof(UInt32));
+    AcpiOsLogInitialize();
+    
+    gAcpiOsCacheListLock = IOLockAlloc();
+    gAcpiOsMutexListLock = IOLockAlloc();
+    nanoseconds_to_absolutetime(ACPI_MUTEX_SPIN_NS, &gAcpiOsMutexSpinWindow);
+    AcpiOsAllocInitialize();
     
     status = AcpiOsExtInitialize(); /* dispatch to AcpiOsLayer.cpp to establish the memory map tracking + PCI access. */
     if (ACPI_FAILURE(status)) {
@@ -119,82 +160,30 @@ ACPI_STATUS AcpiOsInitialize(void)
     return AE_OK;
 }
 
-/* AcpiOsValidateCache (Debug helper) - Validate cache integrity (debug builds only) */
-#if DEBUG
-ACPI_STATUS
-AcpiOsValidateCache(ACPI_CACHE_T *Cache)
-{
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
-    struct _cache_object *object;
-    UINT16 count = 0;
-    
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
-        AcpiOsPrintf("ACPI: Invalid cache object\n");
-        return AE_BAD_PARAMETER;
-    }
-    
-    IOSimpleLockLock(cache->lock);
-    
-    /* Count objects in cache */
-    object = cache->list_head;
-    while (object && count < cache->max_depth + 10) { /* Prevent infinite loops */
-        count++;
-        object = object->next;
-    }
-    
-    if (count != cache->current_depth) {
-        AcpiOsPrintf("ACPI: Cache '%s' depth mismatch: reported %d, actual %d\n",
-                     cache->name, cache->current_depth, count);
-        IOSimpleLockUnlock(cache->lock);
-        return AE_ERROR;
-    }
-    
-    IOSimpleLockUnlock(cache->lock);
-    
-    AcpiOsPrintf("ACPI: Cache '%s' validated: %d/%d objects, %u requests, %u hits\n",
-                 cache->name, cache->current_depth, cache->max_depth,
-                 cache->requests, cache->hits);
-    
-    return AE_OK;
-}
-#endif
-
-/* AcpiOsGetCacheStatistics (Debug helper) -  Get cache statistics */
-ACPI_STATUS
-AcpiOsGetCacheStatistics(ACPI_CACHE_T *Cache, UINT32 *Requests, UINT32 *Hits)
+ACPI_STATUS AcpiOsTerminate(void)
 {
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    /* Cleanup any OS-specific resources if needed */
+    gPciEcamInitialized = FALSE;
     
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
-        return AE_BAD_PARAMETER;
-    }
+    AcpiOsAllocTerminate();
+    AcpiOsArenaTerminate();
+    AcpiOsLogTerminate();
     
-    if (Requests) {
-        *Requests = cache->requests;
+    /* ACPICA deletes its caches before calling us; any left over are leaked on purpose. */
+    if (gAcpiOsCacheListLock && !gAcpiOsCacheList) {
+        IOLockFree(gAcpiOsCacheListLock);
+        gAcpiOsCacheListLock = NULL;
     }
     
-    if (Hits) {
-        *Hits = cache->hits;
+    /* Same for mutexes. */
+    if (gAcpiOsMutexListLock && !gAcpiOsMutexList) {
+        IOLockFree(gAcpiOsMutexListLock);
+        gAcpiOsMutexListLock = NULL;
     }
     
     return AE_OK;
 }
 
-ACPI_STATUS AcpiOsTerminate(void)
-{
-    /* Cleanup any OS-specific resources if needed */
-    gPciEcamInitialized = FALSE;
-    gPciEcamBase = 0;
-    gPciEcamSize = 0;
-    gPciStartBus = 0;
-    gPciEndBus = 0;
-    
-    /* Note: ACPICA should clean up its own caches via AcpiOsDeleteCache() */
-    /* but we could add cache leak detection here in debug builds */
-    
-    return AE_OK;
-}
-
 ACPI_PHYSICAL_ADDRESS AcpiOsGetRootPointer(void)
 {
     return AcpiOsExtGetRootPointer();
@@ -221,39 +210,153 @@ AcpiOsMapMemory(ACPI_PHYSICAL_ADDRESS Where, ACPI_SIZE Length)
 void
 AcpiOsUnmapMemory(void *LogicalAddress, ACPI_SIZE Length)
 {
-    AcpiOsExtUnmapMemory(LogicalAddress);
+    AcpiOsExtUnmapMemory(LogicalAddress, Length);
+}
+
+static void *AcpiOsCacheAlloc(struct _acpi_cache *cache, BOOLEAN Zero);
+static void AcpiOsCacheFreeOrphan(void *Object);
+
+/* Smallest size class that fits Bytes, or ACPI_ALLOC_LARGE */
+static UINT32
+AcpiOsAllocSizeClass(ACPI_SIZE Bytes)
+{
+    UINT32 shift;
+    
+    if (Bytes > (1 << ACPI_ALLOC_MAX_SHIFT)) {
+        return ACPI_ALLOC_LARGE;
+    }
+    
+    if (Bytes <= (1 << ACPI_ALLOC_MIN_SHIFT)) {
+        return 0;
+    }
+    
+    shift = 64 - __builtin_clzll((UINT64)Bytes - 1);
+    return shift - ACPI_ALLOC_MIN_SHIFT;
+}
+
+static void
+AcpiOsAllocAccount(UINT32 SizeClass, SInt64 Bytes)
+{
+    UINT32 slot = (SizeClass == ACPI_ALLOC_LARGE) ? ACPI_ALLOC_CLASSES : SizeClass;
+    SInt64 live;
+    SInt64 high;
+    
+    live = OSAddAtomic64(Bytes, &gAcpiOsAllocLiveBytes) + Bytes;
+    OSAddAtomic64((Bytes > 0) ? 1 : -1, &gAcpiOsAllocClassLive[slot]);
+    if (Bytes < 0) {
+        return;
+    }
+    
+    OSIncrementAtomic64(&gAcpiOsAllocClassTotal[slot]);
+    
+    while (live > (high = gAcpiOsAllocHighWater)) {
+        if (OSCompareAndSwap64(high, live, &gAcpiOsAllocHighWater)) {
+            break;
+        }
+    }
+}
+
+static void
+AcpiOsAllocInitialize(void)
+{
+    char name[16];
+    UINT32 i;
+    
+    for (i = 0; i < ACPI_ALLOC_CLASSES; i++) {
+        snprintf(name, sizeof(name), "Acpi-Alloc-%u", 1 << (i + ACPI_ALLOC_MIN_SHIFT));
+        if (ACPI_FAILURE(AcpiOsCreateCache(name, 1 << (i + ACPI_ALLOC_MIN_SHIFT), 0, &gAcpiOsAllocClasses[i]))) {
+            /* That class (and the ones above it) just fall through to IOMalloc */
+            gAcpiOsAllocClasses[i] = NULL;
+        }
+    }
+}
+
+static void
+AcpiOsAllocTerminate(void)
+{
+    UINT32 i;
+    
+    for (i = 0; i < ACPI_ALLOC_CLASSES; i++) {
+        struct _acpi_cache *cache = gAcpiOsAllocClasses[i];
+        if (cache) {
+            gAcpiOsAllocClasses[i] = NULL;
+            AcpiOsDeleteCache(cache);
+        }
+    }
 }
 
 void *
 AcpiOsAllocate(ACPI_SIZE Size)
 {
-    void *alloc = IOMalloc(Size + sizeof(struct _memory_tag));
-    struct _memory_tag *mem = alloc;
+    ACPI_SIZE bytes = Size + sizeof(struct _memory_tag);
+    UINT32 size_class = AcpiOsAllocSizeClass(bytes);
+    struct _memory_tag *mem = NULL;
+    
+    if (size_class != ACPI_ALLOC_LARGE && gAcpiOsAllocClasses[size_class]) {
+        mem = AcpiOsCacheAlloc(gAcpiOsAllocClasses[size_class], FALSE);
+    }
+    
+    if (!mem) {
+        size_class = ACPI_ALLOC_LARGE;
+        mem = IOMalloc(bytes);
+        if (!mem) {
+            return NULL;
+        }
+    }
+    
     mem->magic = 'mema';
-    mem->size = Size + sizeof(struct _memory_tag);
-    return (alloc + sizeof(struct _memory_tag));
+    mem->size_class = size_class;
+    mem->size = Size;
+    AcpiOsAllocAccount(size_class, (SInt64)Size);
+    return ((char *)mem + sizeof(struct _memory_tag));
 }
 
 void *
 AcpiOsAllocateZeroed(ACPI_SIZE Size)
 {
     void *alloc = AcpiOsAllocate(Size);
-    memset(alloc, 0, Size);
+    if (alloc) {
+        memset(alloc, 0, Size);
+    }
     return alloc;
 }
 
 void
 AcpiOsFree(void *p)
 {
-    struct _memory_tag *m = p - sizeof(struct _memory_tag);
+    struct _memory_tag *m = (struct _memory_tag *)((char *)p - sizeof(struct _memory_tag));
     if (m->magic == 'mema') {
-        IOFree(m, m->size);
+        m->magic = 0;
+        AcpiOsAllocAccount(m->size_class, -(SInt64)m->size);
+        if (m->size_class == ACPI_ALLOC_LARGE) {
+            IOFree(m, m->size + sizeof(struct _memory_tag));
+        } else if (gAcpiOsAllocClasses[m->size_class]) {
+            AcpiOsReleaseObject(gAcpiOsAllocClasses[m->size_class], m);
+        } else {
+            /* The class was torn down with this still live; its slab outlived the cache. */
+            AcpiOsCacheFreeOrphan(m);
+        }
     } else {
         /* induce panic? */
         return;
     }
 }
 
+/* Footprint counters for AcpiOsExtCopyStatistics. Class ACPI_ALLOC_CLASSES is the IOMalloc passthrough. */
+void
+AcpiOsCopyAllocStatistics(ACPI_DARWIN_ALLOC_STATS *Stats)
+{
+    UINT32 i;
+    
+    Stats->LiveBytes = (uint64_t)gAcpiOsAllocLiveBytes;
+    Stats->HighWaterBytes = (uint64_t)gAcpiOsAllocHighWater;
+    for (i = 0; i <= ACPI_ALLOC_CLASSES; i++) {
+        Stats->ClassSize[i] = (i < ACPI_ALLOC_CLASSES) ? (1 << (i + ACPI_ALLOC_MIN_SHIFT)) : 0;
+        Stats->ClassLive[i] = (uint64_t)gAcpiOsAllocClassLive[i];
+        Stats->ClassTotal[i] = (uint64_t)gAcpiOsAllocClassTotal[i];
+    }
+}
+
 /* ZORMEISTER: me is kernel. i can write and read as i want. */
 BOOLEAN AcpiOsReadable(void *Memory, ACPI_SIZE Length) { return true; }
 BOOLEAN AcpiOsWriteable(void *Memory, ACPI_SIZE Length) { return true; }
@@ -286,6 +389,16 @@ AcpiOsReadMemory(
     UINT64                  *Value,
     UINT32                  Width)
 {
+    if (Width != 8 && Width != 16 && Width != 32 && Width != 64) {
+        AcpiOsPrintf("ACPI: bad width value\n");
+        return AE_ERROR;
+    }
+    
+    /* Hot registers live in the page cache; everything else takes the physmap route. */
+    if (ACPI_SUCCESS(AcpiOsExtReadMemory(Address, Value, Width))) {
+        return AE_OK;
+    }
+    
     switch (Width) {
         case 8:
 #if __LP64__
@@ -314,6 +427,7 @@ AcpiOsReadMemory(
 #else
             *Value = ml_phys_read_double(Address);
 #endif
+            return AE_OK;
         default:
             AcpiOsPrintf("ACPI: bad width value\n");
             return AE_ERROR;
@@ -359,6 +473,15 @@ AcpiOsWriteMemory(ACPI_PHYSICAL_ADDRESS Address,
                   UINT64 Value,
                   UINT32 Width)
 {
+    if (Width != 8 && Width != 16 && Width != 32 && Width != 64) {
+        AcpiOsPrintf("ACPI: bad width value\n");
+        return AE_ERROR;
+    }
+    
+    if (ACPI_SUCCESS(AcpiOsExtWriteMemory(Address, Value, Width))) {
+        return AE_OK;
+    }
+    
     switch (Width) {
         case 8:
 #if __LP64__
@@ -387,6 +510,7 @@ AcpiOsWriteMemory(ACPI_PHYSICAL_ADDRESS Address,
 #else
             ml_phys_write_double(Address, Value);
 #endif
+            return AE_OK;
         default:
             AcpiOsPrintf("ACPI: bad width value\n");
             return AE_ERROR;
@@ -419,13 +543,6 @@ AcpiOsWritePort(ACPI_IO_ADDRESS Address,
 
 /* PCI Configuration Space Access - MMIO and Port I/O Implementation */
 
-/* Global variables for ECAM/MMIO support */
-static ACPI_PHYSICAL_ADDRESS gPciEcamBase = 0;
-static UINT32 gPciEcamSize = 0;
-static UINT16 gPciStartBus = 0;
-static UINT16 gPciEndBus = 0;
-static boolean_t gPciEcamInitialized = FALSE;
-
 /* Initialize ECAM (Enhanced Configuration Access Mechanism) support */
 static ACPI_STATUS
 AcpiOsInitializePciEcam(void)
@@ -437,70 +554,44 @@ AcpiOsInitializePciEcam(void)
         return AE_OK;
     }
     
-    /* Try to get MCFG table for ECAM base address */
+    /* Every MCFG allocation goes into the ECAM routing table; the PE may have beaten us to it. */
     status = AcpiGetTable(ACPI_SIG_MCFG, 0, (ACPI_TABLE_HEADER **)&mcfg_table);
     if (ACPI_SUCCESS(status) && mcfg_table) {
-        ACPI_MCFG_ALLOCATION *allocation;
-        
-        /* Get first allocation entry */
-        allocation = (ACPI_MCFG_ALLOCATION *)((UINT8 *)mcfg_table + sizeof(ACPI_TABLE_MCFG));
-        
-        if ((UINT8 *)allocation < (UINT8 *)mcfg_table + mcfg_table->Header.Length) {
-            gPciEcamBase = allocation->Address;
-            gPciStartBus = allocation->PciSegment;  /* Actually start bus */
-            gPciEndBus = allocation->EndBusNumber;
-            gPciEcamSize = (gPciEndBus - gPciStartBus + 1) * 256 * 4096; /* Each bus has 256 devices, 4KB each */
-            
-#if DEBUG
-            AcpiOsPrintf("ACPI: ECAM base 0x%llX, buses %d-%d, size 0x%X\n", 
-                        gPciEcamBase, gPciStartBus, gPciEndBus, gPciEcamSize);
-#endif
-        }
+        AcpiOsExtRegisterPciEcamTable(mcfg_table);
     }
     
     gPciEcamInitialized = TRUE;
     return AE_OK;
 }
 
-/* MMIO-based PCI configuration space access */
+/* MMIO-based PCI configuration space access, through the persistent ECAM windows */
 static ACPI_STATUS
 AcpiOsReadPciConfigMmio(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 *Value, UINT32 Width)
 {
-    ACPI_PHYSICAL_ADDRESS config_addr;
-    void *mapped_addr;
+    void *config_addr;
     UINT64 data = 0;
     
-    /* Calculate ECAM address: Base + (Bus << 20) + (Device << 15) + (Function << 12) + Register */
-    config_addr = gPciEcamBase + 
-                  ((UINT64)PciId->Bus << 20) + 
-                  ((UINT64)PciId->Device << 15) + 
-                  ((UINT64)PciId->Function << 12) + 
-                  Register;
-    
-    /* Map the configuration space */
-    mapped_addr = AcpiOsMapMemory(config_addr, Width / 8);
-    if (!mapped_addr) {
-        return AE_NO_MEMORY;
+    config_addr = AcpiOsExtGetPciConfigAddress(PciId->Segment, PciId->Bus, PciId->Device, PciId->Function, Register);
+    if (!config_addr) {
+        return AE_NOT_EXIST;
     }
     
     /* Read the value */
     switch (Width) {
         case 8:
-            data = *(UINT8 *)mapped_addr;
+            data = *(volatile UINT8 *)config_addr;
             break;
         case 16:
-            data = *(UINT16 *)mapped_addr;
+            data = *(volatile UINT16 *)config_addr;
             break;
         case 32:
-            data = *(UINT32 *)mapped_addr;
+            data = *(volatile UINT32 *)config_addr;
             break;
         default:
-            AcpiOsUnmapMemory(mapped_addr, Width / 8);
             return AE_BAD_PARAMETER;
     }
     
     *Value = data;
-    AcpiOsUnmapMemory(mapped_addr, Width / 8);
     
 #if DEBUG
     AcpiOsPrintf("PCI MMIO read: %02X:%02X:%02X reg 0x%02X width %d = 0x%X\n",
@@ -514,8 +605,7 @@ AcpiOsReadPciConfigMmio(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 *Value, UINT
 static ACPI_STATUS
 AcpiOsWritePciConfigMmio(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 Value, UINT32 Width)
 {
-    ACPI_PHYSICAL_ADDRESS config_addr;
-    void *mapped_addr;
+    void *config_addr;
     
 #if DEBUG
     AcpiOsPrintf("PCI MMIO write: %02X:%02X:%02X reg 0x%02X width %d = 0x%X\n",
@@ -523,36 +613,26 @@ AcpiOsWritePciConfigMmio(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 Value, UINT
                  Register, Width, (UINT32)Value);
 #endif
     
-    /* Calculate ECAM address */
-    config_addr = gPciEcamBase + 
-                  ((UINT64)PciId->Bus << 20) + 
-                  ((UINT64)PciId->Device << 15) + 
-                  ((UINT64)PciId->Function << 12) + 
-                  Register;
-    
-    /* Map the configuration space */
-    mapped_addr = AcpiOsMapMemory(config_addr, Width / 8);
-    if (!mapped_addr) {
-        return AE_NO_MEMORY;
+    config_addr = AcpiOsExtGetPciConfigAddress(PciId->Segment, PciId->Bus, PciId->Device, PciId->Function, Register);
+    if (!config_addr) {
+        return AE_NOT_EXIST;
     }
     
     /* Write the value */
     switch (Width) {
         case 8:
-            *(UINT8 *)mapped_addr = (UINT8)Value;
+            *(volatile UINT8 *)config_addr = (UINT8)Value;
             break;
         case 16:
-            *(UINT16 *)mapped_addr = (UINT16)Value;
+            *(volatile UINT16 *)config_addr = (UINT16)Value;
             break;
         case 32:
-            *(UINT32 *)mapped_addr = (UINT32)Value;
+            *(volatile UINT32 *)config_addr = (UINT32)Value;
             break;
         default:
-            AcpiOsUnmapMemory(mapped_addr, Width / 8);
             return AE_BAD_PARAMETER;
     }
     
-    AcpiOsUnmapMemory(mapped_addr, Width / 8);
     return AE_OK;
 }
 
@@ -562,6 +642,12 @@ AcpiOsReadPciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 *Value, UI
 {
     UINT32 pci_address;
     UINT32 data = 0;
+    IOInterruptState is;
+    
+    /* CF8/CFC can only reach the legacy 256 bytes of segment 0 */
+    if (PciId->Segment != 0 || Register > 0xFF) {
+        return AE_NOT_EXIST;
+    }
     
     /* Construct PCI configuration address for legacy method */
     pci_address = (1U << 31) |                  /* Enable bit */
@@ -570,6 +656,9 @@ AcpiOsReadPciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 *Value, UI
                   (PciId->Function << 8) |      /* Function number */
                   (Register & 0xFC);            /* Register (aligned to 32-bit) */
     
+    /* The address latch is shared; nobody may get between our address and data cycles */
+    is = AcpiOsExtLockPciConfigPorts();
+    
     /* Write address to CONFIG_ADDRESS port (0xCF8) */
     ml_port_io_write32(0xCF8, pci_address);
     
@@ -586,6 +675,8 @@ AcpiOsReadPciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 *Value, UI
             break;
     }
     
+    AcpiOsExtUnlockPciConfigPorts(is);
+    
     *Value = data;
     
 #if DEBUG
@@ -601,6 +692,12 @@ static ACPI_STATUS
 AcpiOsWritePciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 Value, UINT32 Width)
 {
     UINT32 pci_address;
+    IOInterruptState is;
+    
+    /* CF8/CFC can only reach the legacy 256 bytes of segment 0 */
+    if (PciId->Segment != 0 || Register > 0xFF) {
+        return AE_NOT_EXIST;
+    }
     
 #if DEBUG
     AcpiOsPrintf("PCI Port I/O write: %02X:%02X:%02X reg 0x%02X width %d = 0x%X\n",
@@ -615,6 +712,8 @@ AcpiOsWritePciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 Value, UI
                   (PciId->Function << 8) |      /* Function number */
                   (Register & 0xFC);            /* Register (aligned to 32-bit) */
     
+    is = AcpiOsExtLockPciConfigPorts();
+    
     /* Write address to CONFIG_ADDRESS port (0xCF8) */
     ml_port_io_write32(0xCF8, pci_address);
     
@@ -631,6 +730,8 @@ AcpiOsWritePciConfigPortIo(ACPI_PCI_ID *PciId, UINT32 Register, UINT64 Value, UI
             break;
     }
     
+    AcpiOsExtUnlockPciConfigPorts(is);
+    
     return AE_OK;
 }
 
@@ -652,11 +753,9 @@ AcpiOsReadPciConfiguration(ACPI_PCI_ID *PciId,
     /* Initialize ECAM support if not done already */
     AcpiOsInitializePciEcam();
     
-    /* Try MMIO/ECAM first if available and bus is in range */
-    if (gPciEcamBase != 0 && 
-        PciId->Bus >= gPciStartBus && 
-        PciId->Bus <= gPciEndBus) {
-        return AcpiOsReadPciConfigMmio(PciId, Register, Value, Width);
+    /* Try MMIO/ECAM first; buses without an ECAM window report AE_NOT_EXIST */
+    if (ACPI_SUCCESS(AcpiOsReadPciConfigMmio(PciId, Register, Value, Width))) {
+        return AE_OK;
     }
     
     /* Fall back to legacy Port I/O method */
@@ -680,11 +779,9 @@ AcpiOsWritePciConfiguration(ACPI_PCI_ID *PciId,
     /* Initialize ECAM support if not done already */
     AcpiOsInitializePciEcam();
     
-    /* Try MMIO/ECAM first if available and bus is in range */
-    if (gPciEcamBase != 0 && 
-        PciId->Bus >= gPciStartBus && 
-        PciId->Bus <= gPciEndBus) {
-        return AcpiOsWritePciConfigMmio(PciId, Register, Value, Width);
+    /* Try MMIO/ECAM first; buses without an ECAM window report AE_NOT_EXIST */
+    if (ACPI_SUCCESS(AcpiOsWritePciConfigMmio(PciId, Register, Value, Width))) {
+        return AE_OK;
     }
     
     /* Fall back to legacy Port I/O method */
@@ -813,305 +910,2326 @@ ACPI_STATUS AcpiOsSignalSemaphore(ACPI_SEMAPHORE Semaphore, UInt32 Units)
 }
 
 
-#pragma mark Cache management functions
+#pragma mark Mutex code
 
-/* adjustments by csekel (InSaneDarwin)
- * ACPICA Object Cache Implementation for Darwin
- * 
- * ACPICA uses object caching to improve performance by reusing frequently
- * allocated/freed objects like parse tree nodes, namespace entries, etc.
+/*
+ * ACPI_MUTEX.
+ *
+ * ACPICA takes its namespace, table and interpreter mutexes on nearly every evaluation,
+ * and most of the time nobody else holds them, so a Mach semaphore round trip is wasted.
+ * These are adaptive: an uncontended acquire is one compare-and-swap, a contended one
+ * spins for a few microseconds in case the owner is about to let go, and only then
+ * sleeps on the mutex until the owner wakes it (or the timeout passes).
  *
- * Cache objects are stored as a simple linked list (LIFO) for fast
- * acquire/release operations. Each cache maintains its own lock and
- * statistics to minimize contention between different object types.
+ * The state word follows the usual three-state scheme: 0 is free, 1 is held, 2 is held
+ * and somebody may be asleep. Sleepers and the releasing thread meet on the interlock so
+ * that a wakeup can't slip in between a sleeper's check and its assert_wait.
+ *
+ * Counters are only touched by the owner while it holds the mutex, so they need no atomics.
  */
+#define ACPI_MUTEX_FREE             0
+#define ACPI_MUTEX_HELD             1
+#define ACPI_MUTEX_CONTENDED        2
+
+struct _acpi_mutex {
+    volatile UInt32 state;
+    thread_t owner;
+    UInt64 acquired_at;
+    IOSimpleLock *interlock;
+    
+    char name[32];
+    UInt64 acquires;
+    UInt64 contended;
+    UInt64 sleeps;
+    UInt64 timeouts;
+    UInt64 wait_time;
+    UInt64 hold_time;
+    UInt64 wait_histogram[ACPI_DARWIN_MUTEX_BUCKETS];
+    UInt64 hold_histogram[ACPI_DARWIN_MUTEX_BUCKETS];
+    
+    struct _acpi_mutex *next_mutex;
+};
 
-/* AcpiOsCreateCache - Create a cache object for ACPICA */
-ACPI_STATUS
-AcpiOsCreateCache(char *CacheName,
-                  UINT16 ObjectSize,
-                  UINT16 MaxDepth,
-                  ACPI_CACHE_T **ReturnCache)
+static struct _acpi_mutex **gAcpiOsMutexListTail = &gAcpiOsMutexList;
+
+/* Bucket n counts intervals below 2^n microseconds; the last one takes everything longer. */
+static UInt32
+AcpiOsMutexBucket(UInt64 abs)
 {
-    struct _acpi_cache *cache;
+    UInt64 us;
+    UInt32 bucket = 0;
     
-    if (!CacheName || !ReturnCache || ObjectSize == 0) {
+    absolutetime_to_nanoseconds(abs, &us);
+    us /= 1000;
+    
+    while (us && bucket < ACPI_DARWIN_MUTEX_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    
+    return bucket;
+}
+
+ACPI_STATUS AcpiOsCreateMutex(ACPI_MUTEX *OutHandle)
+{
+    struct _acpi_mutex *mutex;
+    
+    if (OutHandle == NULL) {
         return AE_BAD_PARAMETER;
     }
     
-    /* Allocate cache structure */
-    cache = (struct _acpi_cache *)IOMalloc(sizeof(struct _acpi_cache));
-    if (!cache) {
+    mutex = IOMallocZero(sizeof(struct _acpi_mutex));
+    if (!mutex) {
         return AE_NO_MEMORY;
     }
     
-    /* Initialize cache structure */
-    memset(cache, 0, sizeof(struct _acpi_cache));
-    cache->magic = ACPI_CACHE_MAGIC;
-    strncpy(cache->name, CacheName, sizeof(cache->name) - 1);
-    cache->name[sizeof(cache->name) - 1] = '\0';
-    cache->object_size = ObjectSize;
-    cache->max_depth = MaxDepth;
-    cache->current_depth = 0;
-    cache->list_head = NULL;
-    cache->requests = 0;
-    cache->hits = 0;
-    
-    /* Create lock for thread safety */
-    cache->lock = IOSimpleLockAlloc();
-    if (!cache->lock) {
-        IOFree(cache, sizeof(struct _acpi_cache));
+    mutex->interlock = IOSimpleLockAlloc();
+    if (!mutex->interlock) {
+        IOFree(mutex, sizeof(struct _acpi_mutex));
         return AE_NO_MEMORY;
     }
     
-    *ReturnCache = (ACPI_CACHE_T *)cache;
+    strlcpy(mutex->name, "Mutex", sizeof(mutex->name));
     
-#if DEBUG
-    AcpiOsPrintf("ACPI: Created cache '%s', object size %d, max depth %d\n",
-                 CacheName, ObjectSize, MaxDepth);
-#endif
+    if (gAcpiOsMutexListLock) {
+        IOLockLock(gAcpiOsMutexListLock);
+        *gAcpiOsMutexListTail = mutex;
+        gAcpiOsMutexListTail = &mutex->next_mutex;
+        IOLockUnlock(gAcpiOsMutexListLock);
+    }
     
+    *OutHandle = mutex;
     return AE_OK;
 }
 
-/* AcpiOsDeleteCache - Free all objects within a cache and delete the cache object */
-ACPI_STATUS
-AcpiOsDeleteCache(ACPI_CACHE_T *Cache)
+void AcpiOsDeleteMutex(ACPI_MUTEX Handle)
 {
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
-    struct _cache_object *object, *next;
+    struct _acpi_mutex **link;
     
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
-        return AE_BAD_PARAMETER;
+    if (Handle == NULL) {
+        return;
     }
     
-#if DEBUG
-    AcpiOsPrintf("ACPI: Deleting cache '%s', requests %u, hits %u (%.1f%%)\n",
-                 cache->name, cache->requests, cache->hits,
-                 cache->requests ? (cache->hits * 100.0 / cache->requests) : 0.0);
-#endif
-    
-    /* Purge all objects from cache */
-    IOSimpleLockLock(cache->lock);
-    
-    object = cache->list_head;
-    while (object) {
-        next = object->next;
-        IOFree(object, sizeof(struct _cache_object) + cache->object_size);
-        object = next;
+    if (gAcpiOsMutexListLock) {
+        IOLockLock(gAcpiOsMutexListLock);
+        for (link = &gAcpiOsMutexList; *link; link = &(*link)->next_mutex) {
+            if (*link == Handle) {
+                *link = Handle->next_mutex;
+                if (gAcpiOsMutexListTail == &Handle->next_mutex) {
+                    gAcpiOsMutexListTail = link;
+                }
+                break;
+            }
+        }
+        IOLockUnlock(gAcpiOsMutexListLock);
     }
     
-    IOSimpleLockUnlock(cache->lock);
-    
-    /* Free the lock and cache structure */
-    IOSimpleLockFree(cache->lock);
-    cache->magic = 0; /* Invalidate */
-    IOFree(cache, sizeof(struct _acpi_cache));
-    
-    return AE_OK;
+    IOSimpleLockFree(Handle->interlock);
+    IOFree(Handle, sizeof(struct _acpi_mutex));
 }
 
-/* AcpiOsPurgeCache - Free all objects within a cache */
-ACPI_STATUS
-AcpiOsPurgeCache(ACPI_CACHE_T *Cache)
+/* Label a mutex for the statistics, see ACPI_DARWIN_MUTEX_NAMES. */
+void AcpiOsSetMutexName(ACPI_MUTEX Handle, const char *Name)
 {
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
-    struct _cache_object *object, *next;
-    UINT16 purged = 0;
+    if (Handle && Name) {
+        strlcpy(Handle->name, Name, sizeof(Handle->name));
+    }
+}
+
+ACPI_STATUS AcpiOsAcquireMutex(ACPI_MUTEX Handle, UINT16 Timeout)
+{
+    UInt64 start, now, deadline = 0;
+    boolean_t contended = FALSE;
     
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+    if (Handle == NULL) {
         return AE_BAD_PARAMETER;
     }
     
-    IOSimpleLockLock(cache->lock);
-    
-    object = cache->list_head;
-    while (object) {
-        next = object->next;
-        IOFree(object, sizeof(struct _cache_object) + cache->object_size);
-        object = next;
-        purged++;
+    if (OSCompareAndSwap(ACPI_MUTEX_FREE, ACPI_MUTEX_HELD, &Handle->state)) {
+        start = now = mach_absolute_time();
+        goto acquired;
     }
     
-    cache->list_head = NULL;
-    cache->current_depth = 0;
-    
-    IOSimpleLockUnlock(cache->lock);
+    if (Timeout == 0) {
+        return AE_TIME;
+    }
     
-#if DEBUG
-    AcpiOsPrintf("ACPI: Purged %d objects from cache '%s'\n", purged, cache->name);
-#endif
+    contended = TRUE;
+    start = mach_absolute_time();
     
-    return AE_OK;
-}
-
-/* AcpiOsAcquireObject - Get an object from the cache or allocate a new one */
-void *
-AcpiOsAcquireObject(ACPI_CACHE_T *Cache)
-{
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
-    struct _cache_object *object;
-    void *return_object = NULL;
+    /* The owner is most likely running and about to release it; don't sleep just yet. */
+    do {
+        __asm__ volatile("pause");
+        if (Handle->state == ACPI_MUTEX_FREE &&
+            OSCompareAndSwap(ACPI_MUTEX_FREE, ACPI_MUTEX_HELD, &Handle->state)) {
+            now = mach_absolute_time();
+            goto acquired;
+        }
+        now = mach_absolute_time();
+    } while (now - start < gAcpiOsMutexSpinWindow);
     
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
-        return NULL;
+    if (Timeout != ACPI_WAIT_FOREVER) {
+        clock_interval_to_deadline(Timeout, kMillisecondScale, &deadline);
     }
     
-    IOSimpleLockLock(cache->lock);
-    
-    cache->requests++;
-    
-    /* Try to get an object from the cache first */
-    if (cache->list_head) {
-        object = cache->list_head;
-        cache->list_head = object->next;
-        cache->current_depth--;
-        cache->hits++;
+    for (;;) {
+        wait_result_t result;
         
-        /* Return pointer to data area (after the header) */
-        return_object = (void *)((char *)object + sizeof(struct _cache_object));
+        IOSimpleLockLock(Handle->interlock);
+        if (__atomic_exchange_n(&Handle->state, ACPI_MUTEX_CONTENDED, __ATOMIC_ACQUIRE) == ACPI_MUTEX_FREE) {
+            IOSimpleLockUnlock(Handle->interlock);
+            break;
+        }
         
-        IOSimpleLockUnlock(cache->lock);
+        if (deadline) {
+            assert_wait_deadline(Handle, THREAD_UNINT, deadline);
+        } else {
+            assert_wait(Handle, THREAD_UNINT);
+        }
+        IOSimpleLockUnlock(Handle->interlock);
         
-        /* Clear the object data */
-        memset(return_object, 0, cache->object_size);
+        result = thread_block(THREAD_CONTINUE_NULL);
+        if (result == THREAD_TIMED_OUT) {
+            /* The mutex isn't ours, so the counter can't be touched safely. Count it anyway; it's a rare path. */
+            OSIncrementAtomic64((volatile SInt64 *)&Handle->timeouts);
+            return AE_TIME;
+        }
         
-        return return_object;
+        Handle->sleeps++;
     }
     
-    IOSimpleLockUnlock(cache->lock);
+    now = mach_absolute_time();
     
-    /* Cache is empty, allocate a new object */
-    object = (struct _cache_object *)IOMalloc(sizeof(struct _cache_object) + cache->object_size);
-    if (!object) {
-        return NULL;
+acquired:
+    Handle->owner = current_thread();
+    Handle->acquired_at = now;
+    Handle->acquires++;
+    if (contended) {
+        Handle->contended++;
+        Handle->wait_time += now - start;
+        Handle->wait_histogram[AcpiOsMutexBucket(now - start)]++;
     }
     
-    /* Clear the entire object */
-    memset(object, 0, sizeof(struct _cache_object) + cache->object_size);
-    
-    /* Return pointer to data area */
-    return_object = (void *)((char *)object + sizeof(struct _cache_object));
-    
-    return return_object;
+    return AE_OK;
 }
 
-/* AcpiOsReleaseObject - Release an object back to the cache */
-ACPI_STATUS
-AcpiOsReleaseObject(ACPI_CACHE_T *Cache, void *Object)
+void AcpiOsReleaseMutex(ACPI_MUTEX Handle)
 {
-    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
-    struct _cache_object *cache_object;
+    UInt64 held;
     
-    if (!cache || cache->magic != ACPI_CACHE_MAGIC || !Object) {
-        /* If cache is invalid, just free the object */
-        if (Object) {
-            cache_object = (struct _cache_object *)((char *)Object - sizeof(struct _cache_object));
-            IOFree(cache_object, sizeof(struct _cache_object) + (cache ? cache->object_size : 0));
-        }
-        return AE_BAD_PARAMETER;
+    if (Handle == NULL) {
+        return;
     }
     
-    /* Get pointer to cache object header */
-    cache_object = (struct _cache_object *)((char *)Object - sizeof(struct _cache_object));
-    
-    IOSimpleLockLock(cache->lock);
+    held = mach_absolute_time() - Handle->acquired_at;
+    Handle->hold_time += held;
+    Handle->hold_histogram[AcpiOsMutexBucket(held)]++;
+    Handle->owner = NULL;
     
-    /* If cache is full, just free the object */
-    if (cache->current_depth >= cache->max_depth) {
-        IOSimpleLockUnlock(cache->lock);
-        IOFree(cache_object, sizeof(struct _cache_object) + cache->object_size);
-        return AE_OK;
+    if (__atomic_exchange_n(&Handle->state, ACPI_MUTEX_FREE, __ATOMIC_RELEASE) == ACPI_MUTEX_CONTENDED) {
+        IOSimpleLockLock(Handle->interlock);
+        thread_wakeup_one(Handle);
+        IOSimpleLockUnlock(Handle->interlock);
+    }
+}
+
+/*
+ * Copy the counters of up to Count mutexes, in creation order, so the internal ACPICA
+ * mutexes come first. Returns the number copied.
+ */
+UINT32
+AcpiOsCopyMutexStatistics(ACPI_DARWIN_MUTEX_STATS *Stats, UINT32 Count)
+{
+    struct _acpi_mutex *mutex;
+    UINT32 n = 0;
+    
+    if (!gAcpiOsMutexListLock) {
+        return 0;
+    }
+    
+    IOLockLock(gAcpiOsMutexListLock);
+    for (mutex = gAcpiOsMutexList; mutex && n < Count; mutex = mutex->next_mutex, n++) {
+        ACPI_DARWIN_MUTEX_STATS *s = &Stats[n];
+        
+        strlcpy(s->Name, mutex->name, sizeof(s->Name));
+        s->Acquires = mutex->acquires;
+        s->Contended = mutex->contended;
+        s->Sleeps = mutex->sleeps;
+        s->Timeouts = mutex->timeouts;
+        absolutetime_to_nanoseconds(mutex->wait_time, &s->WaitTime);
+        absolutetime_to_nanoseconds(mutex->hold_time, &s->HoldTime);
+        memcpy(s->WaitHistogram, mutex->wait_histogram, sizeof(s->WaitHistogram));
+        memcpy(s->HoldHistogram, mutex->hold_histogram, sizeof(s->HoldHistogram));
+    }
+    IOLockUnlock(gAcpiOsMutexListLock);
+    
+    return n;
+}
+
+
+#pragma mark Cache management functions
+
+/*
+ * ACPICA Object Cache Implementation for Darwin
+ *
+ * ACPICA uses object caching to improve performance by reusing frequently
+ * allocated/freed objects like parse tree nodes, namespace entries, etc.
+ *
+ * This is a magazine allocator in three layers:
+ *
+ *  - Every CPU has a loaded and a previous magazine (a small stack of free
+ *    objects). Most acquires and releases are a push or pop on the local
+ *    magazine under a per-CPU lock that nobody else normally takes.
+ *  - When both local magazines are empty (or full), the CPU swaps one with
+ *    the depot, a per-cache list of full and empty magazines.
+ *  - When the depot has nothing either, objects are carved out of slabs in
+ *    a batch large enough to fill a whole magazine.
+ *
+ * Depth isn't fixed. Contention on the depot lock makes magazines bigger,
+ * and full magazines that sat unused in the depot for a whole interval are
+ * handed back to the slabs, so the cache settles at the working set.
+ */
+
+#define ACPI_CACHE_MAX_CPUS             64
+#define ACPI_CACHE_MAGAZINE_MIN         4
+#define ACPI_CACHE_MAGAZINE_MAX         32
+#define ACPI_CACHE_REAP_INTERVAL        256     /* depot transactions between working set updates */
+#define ACPI_CACHE_SLAB_BYTES           (2 * PAGE_SIZE)
+#define ACPI_CACHE_MIN_SLAB_OBJECTS     8
+
+struct _acpi_cache_slab;
+
+/* Every object carries a small header pointing back at its slab. */
+struct _cache_object {
+    struct _cache_object *next;
+    struct _acpi_cache_slab *slab;
+    /* Object data follows this header */
+};
+
+struct _acpi_cache_slab {
+    struct _acpi_cache_slab *next;     /* partial list linkage */
+    struct _acpi_cache_slab *prev;
+    struct _cache_object *free_list;
+    UINT32 free_count;
+    UINT32 total;
+    ACPI_SIZE alloc_size;
+    boolean_t on_partial;
+    /* Objects follow this header */
+};
+
+struct _acpi_cache_magazine {
+    struct _acpi_cache_magazine *next;
+    UINT32 rounds;
+    struct _cache_object *objects[ACPI_CACHE_MAGAZINE_MAX];
+};
+
+struct _acpi_cache_cpu {
+    IOSimpleLock *lock;
+    struct _acpi_cache_magazine *loaded;
+    struct _acpi_cache_magazine *previous;
+    UINT64 requests;
+    UINT64 hits;
+} __attribute__((aligned(64)));
+
+struct _acpi_cache {
+    UINT32 magic;
+    char name[16];
+    ACPI_SIZE object_size;
+    ACPI_SIZE slot_size;
+    UINT32 slab_objects;
+    UINT16 max_depth;                   /* ACPICA's hint; only reported */
+    boolean_t arena;                    /* served from the evaluation arena while a method runs */
+    volatile UINT32 magazine_size;      /* rounds per magazine, grows under depot contention */
+    
+    struct _acpi_cache_cpu cpu[ACPI_CACHE_MAX_CPUS];
+    
+    /* Depot and slab layer, all under depot_lock */
+    IOSimpleLock *depot_lock;
+    struct _acpi_cache_magazine *full;
+    struct _acpi_cache_magazine *empty;
+    UINT32 full_count;
+    UINT32 empty_count;
+    UINT32 full_min;                    /* fewest full magazines seen this interval */
+    UINT32 depot_ops;
+    struct _acpi_cache_slab *partial;   /* slabs with at least one free object */
+    UINT32 slab_count;
+    UINT64 objects_in_use;
+    
+    UINT64 depot_hits;
+    UINT64 slab_refills;
+    UINT64 reaped;
+    UINT64 contention;
+    
+    struct _acpi_cache *next_cache;
+};
+
+#define ACPI_CACHE_MAGIC 'cach'
+
+#define ACPI_CACHE_OBJECT_DATA(o)   ((void *)((char *)(o) + sizeof(struct _cache_object)))
+#define ACPI_CACHE_DATA_OBJECT(p)   ((struct _cache_object *)((char *)(p) - sizeof(struct _cache_object)))
+
+/* Pin ourselves to a CPU and lock its magazines. */
+static struct _acpi_cache_cpu *
+AcpiOsCacheLockCpu(struct _acpi_cache *cache, boolean_t *istate)
+{
+    struct _acpi_cache_cpu *cpu;
+    
+    *istate = ml_set_interrupts_enabled(FALSE);
+    cpu = &cache->cpu[cpu_number() % ACPI_CACHE_MAX_CPUS];
+    IOSimpleLockLock(cpu->lock);
+    return cpu;
+}
+
+static void
+AcpiOsCacheUnlockCpu(struct _acpi_cache_cpu *cpu, boolean_t istate)
+{
+    IOSimpleLockUnlock(cpu->lock);
+    ml_set_interrupts_enabled(istate);
+}
+
+/* Take the depot lock, growing the magazines if we had to wait for it. */
+static void
+AcpiOsCacheLockDepot(struct _acpi_cache *cache)
+{
+    if (IOSimpleLockTryLock(cache->depot_lock)) {
+        return;
+    }
+    
+    IOSimpleLockLock(cache->depot_lock);
+    cache->contention++;
+    if (cache->magazine_size < ACPI_CACHE_MAGAZINE_MAX) {
+        cache->magazine_size++;
+    }
+}
+
+/*
+ * Count a depot transaction. Once per interval, the full magazines that were
+ * never needed (full_min of them) are detached and returned for reaping.
+ * Caller holds depot_lock.
+ */
+static struct _acpi_cache_magazine *
+AcpiOsCacheDepotTick(struct _acpi_cache *cache)
+{
+    struct _acpi_cache_magazine *reap = NULL;
+    UINT32 excess;
+    
+    if (cache->full_count < cache->full_min) {
+        cache->full_min = cache->full_count;
+    }
+    
+    if (++cache->depot_ops < ACPI_CACHE_REAP_INTERVAL) {
+        return NULL;
+    }
+    
+    for (excess = cache->full_min; excess > 0 && cache->full; excess--) {
+        struct _acpi_cache_magazine *mag = cache->full;
+        cache->full = mag->next;
+        cache->full_count--;
+        mag->next = reap;
+        reap = mag;
+    }
+    
+    cache->depot_ops = 0;
+    cache->full_min = cache->full_count;
+    return reap;
+}
+
+/* Give an object back to its slab. Empty slabs are queued on *free_slabs. Caller holds depot_lock. */
+static void
+AcpiOsCacheSlabPut(struct _acpi_cache *cache, struct _cache_object *object,
+                   struct _acpi_cache_slab **free_slabs)
+{
+    struct _acpi_cache_slab *slab = object->slab;
+    
+    object->next = slab->free_list;
+    slab->free_list = object;
+    slab->free_count++;
+    cache->objects_in_use--;
+    
+    if (!slab->on_partial) {
+        slab->prev = NULL;
+        slab->next = cache->partial;
+        if (cache->partial) {
+            cache->partial->prev = slab;
+        }
+        cache->partial = slab;
+        slab->on_partial = TRUE;
+    }
+    
+    if (slab->free_count == slab->total) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            cache->partial = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+        
+        cache->slab_count--;
+        slab->next = *free_slabs;
+        *free_slabs = slab;
+    }
+}
+
+/* Pull up to count objects out of the partial slabs. Caller holds depot_lock. */
+static UINT32
+AcpiOsCacheSlabGet(struct _acpi_cache *cache, struct _cache_object **objects, UINT32 count)
+{
+    UINT32 got = 0;
+    
+    while (got < count && cache->partial) {
+        struct _acpi_cache_slab *slab = cache->partial;
+        
+        while (got < count && slab->free_list) {
+            struct _cache_object *object = slab->free_list;
+            slab->free_list = object->next;
+            slab->free_count--;
+            objects[got++] = object;
+        }
+        
+        if (!slab->free_list) {
+            cache->partial = slab->next;
+            if (cache->partial) {
+                cache->partial->prev = NULL;
+            }
+            slab->on_partial = FALSE;
+        }
+    }
+    
+    cache->objects_in_use += got;
+    return got;
+}
+
+static struct _acpi_cache_slab *
+AcpiOsCacheSlabCreate(struct _acpi_cache *cache)
+{
+    ACPI_SIZE size = sizeof(struct _acpi_cache_slab) + cache->slab_objects * cache->slot_size;
+    struct _acpi_cache_slab *slab = IOMallocZero(size);
+    UINT32 i;
+    
+    if (!slab) {
+        return NULL;
+    }
+    
+    slab->alloc_size = size;
+    slab->total = cache->slab_objects;
+    slab->free_count = cache->slab_objects;
+    
+    for (i = cache->slab_objects; i > 0; i--) {
+        struct _cache_object *object = (struct _cache_object *)((char *)(slab + 1) + (i - 1) * cache->slot_size);
+        object->slab = slab;
+        object->next = slab->free_list;
+        slab->free_list = object;
+    }
+    
+    return slab;
+}
+
+/* Return every object in a chain of magazines to the slabs and free whatever becomes empty. */
+static void
+AcpiOsCacheReap(struct _acpi_cache *cache, struct _acpi_cache_magazine *mags)
+{
+    struct _acpi_cache_slab *free_slabs = NULL;
+    struct _acpi_cache_magazine *mag;
+    boolean_t istate;
+    UINT32 i;
+    
+    if (!mags) {
+        return;
+    }
+    
+    istate = ml_set_interrupts_enabled(FALSE);
+    IOSimpleLockLock(cache->depot_lock);
+    for (mag = mags; mag; mag = mag->next) {
+        for (i = 0; i < mag->rounds; i++) {
+            AcpiOsCacheSlabPut(cache, mag->objects[i], &free_slabs);
+        }
+        cache->reaped += mag->rounds;
+        mag->rounds = 0;
+    }
+    IOSimpleLockUnlock(cache->depot_lock);
+    ml_set_interrupts_enabled(istate);
+    
+    while (mags) {
+        mag = mags->next;
+        IOFree(mags, sizeof(struct _acpi_cache_magazine));
+        mags = mag;
+    }
+    
+    while (free_slabs) {
+        struct _acpi_cache_slab *next = free_slabs->next;
+        IOFree(free_slabs, free_slabs->alloc_size);
+        free_slabs = next;
+    }
+}
+
+#if DEBUG
+/* AcpiOsValidateCache (Debug helper) - Validate cache integrity (debug builds only) */
+ACPI_STATUS
+AcpiOsValidateCache(ACPI_CACHE_T *Cache)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    struct _acpi_cache_magazine *mag;
+    struct _acpi_cache_slab *slab;
+    boolean_t istate;
+    UINT32 count = 0;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+        AcpiOsPrintf("ACPI: Invalid cache object\n");
+        return AE_BAD_PARAMETER;
+    }
+    
+    istate = ml_set_interrupts_enabled(FALSE);
+    IOSimpleLockLock(cache->depot_lock);
+    
+    /* Count magazines in the depot */
+    for (mag = cache->full; mag && count <= cache->full_count; mag = mag->next) {
+        count++;
+    }
+    
+    if (count != cache->full_count) {
+        IOSimpleLockUnlock(cache->depot_lock);
+        ml_set_interrupts_enabled(istate);
+        AcpiOsPrintf("ACPI: Cache '%s' depot mismatch: reported %u full magazines, actual %u\n",
+                     cache->name, cache->full_count, count);
+        return AE_ERROR;
+    }
+    
+    /* Every slab on the partial list must actually have something free */
+    for (slab = cache->partial; slab; slab = slab->next) {
+        if (!slab->free_list || slab->free_count == 0 || slab->free_count > slab->total) {
+            IOSimpleLockUnlock(cache->depot_lock);
+            ml_set_interrupts_enabled(istate);
+            AcpiOsPrintf("ACPI: Cache '%s' has a corrupt slab %p\n", cache->name, slab);
+            return AE_ERROR;
+        }
+    }
+    
+    IOSimpleLockUnlock(cache->depot_lock);
+    ml_set_interrupts_enabled(istate);
+    
+    AcpiOsPrintf("ACPI: Cache '%s' validated: %u slabs, %u full magazines of %u, %llu objects in use\n",
+                 cache->name, cache->slab_count, cache->full_count, cache->magazine_size, cache->objects_in_use);
+    
+    return AE_OK;
+}
+#endif
+
+/*
+ * Evaluation arena.
+ *
+ * While a control method runs (AcpiNsEvaluate -> AcpiPsExecuteMethod), parse ops
+ * and generic states for that thread are bump-allocated out of a 64KB chunk owned
+ * by the evaluation instead of going through the magazines. These are the objects
+ * the interpreter churns through per statement and never hands out, so they die
+ * with the evaluation; operand objects and AcpiOsAllocate memory can end up
+ * attached to the namespace and stay on the general heap.
+ *
+ * Frees are a decrement on the chunk's live count. A chunk whose count hits zero
+ * is rewound and reused, so a finished evaluation leaves a clean chunk behind for
+ * the next one. If something does outlive the evaluation, its chunk is retired
+ * instead: it stays allocated until the last object in it is released, so an
+ * escaping object is never freed under anyone, it just pins its chunk.
+ */
+#define ACPI_ARENA_CHUNK_SIZE   (64 * 1024)
+#define ACPI_ARENA_SLOTS        32
+#define ACPI_ARENA_RETIRED      0x80000000U
+#define ACPI_ARENA_CHUNK_MAGIC  'aren'
+
+struct _acpi_arena_chunk {
+    UINT32 magic;
+    volatile UInt32 state;              /* live objects, plus ACPI_ARENA_RETIRED once abandoned */
+    UINT32 offset;                      /* bump pointer, relative to the end of this header */
+    UINT32 reserved;
+    /* Objects follow this header */
+};
+
+struct _acpi_arena {
+    volatile UINT64 owner;              /* ACPI_THREAD_ID of the evaluating thread, 0 if free */
+    UINT32 depth;                       /* nested AcpiNsEvaluate calls on that thread */
+    struct _acpi_arena_chunk *chunk;
+} __attribute__((aligned(64)));
+
+static struct _acpi_arena gAcpiOsArenas[ACPI_ARENA_SLOTS];
+
+static volatile SInt64 gAcpiOsArenaEvaluations;
+static volatile SInt64 gAcpiOsArenaAllocations;
+static volatile SInt64 gAcpiOsArenaChunks;
+static volatile SInt64 gAcpiOsArenaPinned;
+static volatile SInt64 gAcpiOsArenaNoSlot;
+
+/*
+ * The arena owned by the calling thread, if it's evaluating. An interrupt handler
+ * shares the thread ID of whatever it interrupted but not its lifetime, so it never
+ * gets an arena and allocates from the magazines.
+ */
+static struct _acpi_arena *
+AcpiOsArenaLookup(UINT64 Thread)
+{
+    UINT32 start = (UINT32)(Thread % ACPI_ARENA_SLOTS);
+    UINT32 i;
+    
+    if (ml_at_interrupt_context()) {
+        return NULL;
+    }
+    
+    for (i = 0; i < ACPI_ARENA_SLOTS; i++) {
+        struct _acpi_arena *arena = &gAcpiOsArenas[(start + i) % ACPI_ARENA_SLOTS];
+        if (arena->owner == Thread) {
+            return arena;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Drop our claim on a chunk; whoever brings it to zero live objects frees it. */
+static void
+AcpiOsArenaRetireChunk(struct _acpi_arena_chunk *chunk)
+{
+    UInt32 old = OSBitOrAtomic(ACPI_ARENA_RETIRED, &chunk->state);
+    
+    if ((old & ~ACPI_ARENA_RETIRED) == 0) {
+        chunk->magic = 0;
+        IOFreeAligned(chunk, ACPI_ARENA_CHUNK_SIZE);
+    } else {
+        OSIncrementAtomic64(&gAcpiOsArenaPinned);
+    }
+}
+
+void
+AcpiOsBeginEvaluation(void)
+{
+    UINT64 thread = AcpiOsGetThreadId();
+    struct _acpi_arena *arena = AcpiOsArenaLookup(thread);
+    UINT32 start;
+    UINT32 i;
+    
+    if (arena) {
+        arena->depth++;
+        return;
+    }
+    
+    if (ml_at_interrupt_context()) {
+        return;
+    }
+    
+    start = (UINT32)(thread % ACPI_ARENA_SLOTS);
+    for (i = 0; i < ACPI_ARENA_SLOTS; i++) {
+        arena = &gAcpiOsArenas[(start + i) % ACPI_ARENA_SLOTS];
+        if (arena->owner == 0 && OSCompareAndSwap64(0, thread, &arena->owner)) {
+            arena->depth = 1;
+            OSIncrementAtomic64(&gAcpiOsArenaEvaluations);
+            return;
+        }
+    }
+    
+    /* Too many threads evaluating at once; this one just uses the magazines. */
+    OSIncrementAtomic64(&gAcpiOsArenaNoSlot);
+}
+
+void
+AcpiOsEndEvaluation(void)
+{
+    struct _acpi_arena *arena = AcpiOsArenaLookup(AcpiOsGetThreadId());
+    struct _acpi_arena_chunk *chunk;
+    
+    if (!arena || --arena->depth > 0) {
+        return;
+    }
+    
+    chunk = arena->chunk;
+    if (chunk) {
+        if (chunk->state == 0) {
+            /* Everything came back; leave the chunk rewound for the next evaluation. */
+            chunk->offset = 0;
+        } else {
+            arena->chunk = NULL;
+            AcpiOsArenaRetireChunk(chunk);
+        }
+    }
+    
+    __atomic_store_n(&arena->owner, 0, __ATOMIC_RELEASE);
+}
+
+/* Bump-allocate a cache object for the evaluating thread, or NULL to use the magazines. */
+static struct _cache_object *
+AcpiOsArenaAlloc(struct _acpi_cache *cache)
+{
+    struct _acpi_arena *arena = AcpiOsArenaLookup(AcpiOsGetThreadId());
+    struct _acpi_arena_chunk *chunk;
+    struct _cache_object *object;
+    
+    if (!arena) {
+        return NULL;
+    }
+    
+    chunk = arena->chunk;
+    if (!chunk || chunk->offset + cache->slot_size > ACPI_ARENA_CHUNK_SIZE - sizeof(struct _acpi_arena_chunk)) {
+        if (chunk && chunk->state == 0) {
+            chunk->offset = 0;
+        } else {
+            /* A new chunk may block. */
+            if (!ml_get_interrupts_enabled()) {
+                return NULL;
+            }
+            
+            if (chunk) {
+                arena->chunk = NULL;
+                AcpiOsArenaRetireChunk(chunk);
+            }
+            
+            chunk = IOMallocAligned(ACPI_ARENA_CHUNK_SIZE, ACPI_ARENA_CHUNK_SIZE);
+            if (!chunk) {
+                return NULL;
+            }
+            
+            chunk->magic = ACPI_ARENA_CHUNK_MAGIC;
+            chunk->state = 0;
+            chunk->offset = 0;
+            arena->chunk = chunk;
+            OSIncrementAtomic64(&gAcpiOsArenaChunks);
+        }
+    }
+    
+    object = (struct _cache_object *)((char *)(chunk + 1) + chunk->offset);
+    chunk->offset += cache->slot_size;
+    OSIncrementAtomic((volatile SInt32 *)&chunk->state);
+    OSIncrementAtomic64(&gAcpiOsArenaAllocations);
+    
+    object->next = NULL;
+    object->slab = NULL;    /* marks an arena object */
+    return object;
+}
+
+/* Release an arena object; may be called from any thread. */
+static void
+AcpiOsArenaFree(struct _cache_object *object)
+{
+    struct _acpi_arena_chunk *chunk = (struct _acpi_arena_chunk *)((uintptr_t)object & ~(uintptr_t)(ACPI_ARENA_CHUNK_SIZE - 1));
+    SInt32 old = OSDecrementAtomic((volatile SInt32 *)&chunk->state);
+    
+    if ((UInt32)old == (ACPI_ARENA_RETIRED | 1)) {
+        chunk->magic = 0;
+        IOFreeAligned(chunk, ACPI_ARENA_CHUNK_SIZE);
+    }
+}
+
+/* Free the rewound chunks idle arenas are holding on to. */
+static void
+AcpiOsArenaTerminate(void)
+{
+    UINT32 i;
+    
+    for (i = 0; i < ACPI_ARENA_SLOTS; i++) {
+        struct _acpi_arena_chunk *chunk = gAcpiOsArenas[i].chunk;
+        if (chunk && gAcpiOsArenas[i].owner == 0) {
+            gAcpiOsArenas[i].chunk = NULL;
+            AcpiOsArenaRetireChunk(chunk);
+        }
+    }
+}
+
+void
+AcpiOsCopyArenaStatistics(ACPI_DARWIN_ARENA_STATS *Stats)
+{
+    Stats->Evaluations = (uint64_t)gAcpiOsArenaEvaluations;
+    Stats->Allocations = (uint64_t)gAcpiOsArenaAllocations;
+    Stats->ChunksAllocated = (uint64_t)gAcpiOsArenaChunks;
+    Stats->ChunksPinned = (uint64_t)gAcpiOsArenaPinned;
+    Stats->NoSlot = (uint64_t)gAcpiOsArenaNoSlot;
+}
+
+/* AcpiOsCreateCache - Create a cache object for ACPICA */
+ACPI_STATUS
+AcpiOsCreateCache(char *CacheName,
+                  UINT16 ObjectSize,
+                  UINT16 MaxDepth,
+                  ACPI_CACHE_T **ReturnCache)
+{
+    struct _acpi_cache *cache;
+    UINT32 i;
+    
+    if (!CacheName || !ReturnCache || ObjectSize == 0) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    /* Allocate cache structure */
+    cache = (struct _acpi_cache *)IOMallocZero(sizeof(struct _acpi_cache));
+    if (!cache) {
+        return AE_NO_MEMORY;
+    }
+    
+    /* Initialize cache structure */
+    cache->magic = ACPI_CACHE_MAGIC;
+    strncpy(cache->name, CacheName, sizeof(cache->name) - 1);
+    cache->name[sizeof(cache->name) - 1] = '\0';
+    cache->object_size = ObjectSize;
+    cache->slot_size = ACPI_ROUND_UP(sizeof(struct _cache_object) + ObjectSize, 16);
+    cache->slab_objects = (ACPI_CACHE_SLAB_BYTES - sizeof(struct _acpi_cache_slab)) / cache->slot_size;
+    if (cache->slab_objects < ACPI_CACHE_MIN_SLAB_OBJECTS) {
+        cache->slab_objects = ACPI_CACHE_MIN_SLAB_OBJECTS;
+    }
+    cache->max_depth = MaxDepth;
+    
+    /* Parse ops and generic states never outlive the evaluation that made them. */
+    cache->arena = (strcmp(CacheName, "Acpi-Parse") == 0 ||
+                    strcmp(CacheName, "Acpi-ParseExt") == 0 ||
+                    strcmp(CacheName, "Acpi-State") == 0);
+    cache->magazine_size = ACPI_CACHE_MAGAZINE_MIN;
+    
+    /* Create locks for thread safety */
+    cache->depot_lock = IOSimpleLockAlloc();
+    for (i = 0; i < ACPI_CACHE_MAX_CPUS && cache->depot_lock; i++) {
+        cache->cpu[i].lock = IOSimpleLockAlloc();
+        if (!cache->cpu[i].lock) {
+            break;
+        }
+    }
+    
+    if (!cache->depot_lock || i < ACPI_CACHE_MAX_CPUS) {
+        while (i-- > 0) {
+            IOSimpleLockFree(cache->cpu[i].lock);
+        }
+        if (cache->depot_lock) {
+            IOSimpleLockFree(cache->depot_lock);
+        }
+        IOFree(cache, sizeof(struct _acpi_cache));
+        return AE_NO_MEMORY;
+    }
+    
+    if (gAcpiOsCacheListLock) {
+        IOLockLock(gAcpiOsCacheListLock);
+        cache->next_cache = gAcpiOsCacheList;
+        gAcpiOsCacheList = cache;
+        IOLockUnlock(gAcpiOsCacheListLock);
+    }
+    
+    *ReturnCache = (ACPI_CACHE_T *)cache;
+    
+#if DEBUG
+    AcpiOsPrintf("ACPI: Created cache '%s', object size %d, %u objects per slab\n",
+                 CacheName, ObjectSize, cache->slab_objects);
+#endif
+    
+    return AE_OK;
+}
+
+/* AcpiOsPurgeCache - Free all objects within a cache */
+ACPI_STATUS
+AcpiOsPurgeCache(ACPI_CACHE_T *Cache)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    struct _acpi_cache_magazine *mags = NULL;
+    struct _acpi_cache_magazine *tail;
+    boolean_t istate;
+    UINT32 i;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    /* Collect every magazine, loaded or not, then hand the lot back to the slabs. */
+    for (i = 0; i < ACPI_CACHE_MAX_CPUS; i++) {
+        struct _acpi_cache_cpu *cpu = &cache->cpu[i];
+        
+        istate = ml_set_interrupts_enabled(FALSE);
+        IOSimpleLockLock(cpu->lock);
+        if (cpu->loaded) {
+            cpu->loaded->next = mags;
+            mags = cpu->loaded;
+            cpu->loaded = NULL;
+        }
+        if (cpu->previous) {
+            cpu->previous->next = mags;
+            mags = cpu->previous;
+            cpu->previous = NULL;
+        }
+        IOSimpleLockUnlock(cpu->lock);
+        ml_set_interrupts_enabled(istate);
+    }
+    
+    istate = ml_set_interrupts_enabled(FALSE);
+    IOSimpleLockLock(cache->depot_lock);
+    for (tail = cache->full; tail && tail->next; tail = tail->next);
+    if (tail) {
+        tail->next = cache->empty;
+    } else {
+        cache->full = cache->empty;
+    }
+    for (tail = cache->full; tail && tail->next; tail = tail->next);
+    if (tail) {
+        tail->next = mags;
+        mags = cache->full;
+    }
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->full_count = 0;
+    cache->empty_count = 0;
+    cache->full_min = 0;
+    IOSimpleLockUnlock(cache->depot_lock);
+    ml_set_interrupts_enabled(istate);
+    
+    AcpiOsCacheReap(cache, mags);
+    
+    return AE_OK;
+}
+
+/* AcpiOsDeleteCache - Free all objects within a cache and delete the cache object */
+ACPI_STATUS
+AcpiOsDeleteCache(ACPI_CACHE_T *Cache)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    struct _acpi_cache **link;
+    UINT32 i;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+        return AE_BAD_PARAMETER;
+    }
+    
+#if DEBUG
+    AcpiOsValidateCache(Cache);
+#endif
+    
+    AcpiOsPurgeCache(Cache);
+    
+    if (gAcpiOsCacheListLock) {
+        IOLockLock(gAcpiOsCacheListLock);
+        for (link = &gAcpiOsCacheList; *link; link = &(*link)->next_cache) {
+            if (*link == cache) {
+                *link = cache->next_cache;
+                break;
+            }
+        }
+        IOLockUnlock(gAcpiOsCacheListLock);
+    }
+    
+    /* Anything still on a slab now is an object ACPICA never gave back; leak it rather than free it under them. */
+    if (cache->objects_in_use) {
+        AcpiOsPrintf("ACPI: Cache '%s' deleted with %llu objects outstanding\n",
+                     cache->name, cache->objects_in_use);
+    }
+    
+    /* Free the locks and cache structure */
+    for (i = 0; i < ACPI_CACHE_MAX_CPUS; i++) {
+        IOSimpleLockFree(cache->cpu[i].lock);
+    }
+    IOSimpleLockFree(cache->depot_lock);
+    cache->magic = 0; /* Invalidate */
+    IOFree(cache, sizeof(struct _acpi_cache));
+    
+    return AE_OK;
+}
+
+/*
+ * Free an object whose cache was deleted while it was outstanding. AcpiOsDeleteCache
+ * leaves such slabs alone and nothing else refers to them any more, so the slab
+ * just counts its objects back in and is freed with the size it was allocated with
+ * once the last one returns.
+ */
+static void
+AcpiOsCacheFreeOrphan(void *Object)
+{
+    struct _acpi_cache_slab *slab = ACPI_CACHE_DATA_OBJECT(Object)->slab;
+    
+    if (__atomic_add_fetch(&slab->free_count, 1, __ATOMIC_ACQ_REL) == slab->total) {
+        IOFree(slab, slab->alloc_size);
+    }
+}
+
+/* Take an object from the cache; only ACPICA's own caches need it zeroed. */
+static void *
+AcpiOsCacheAlloc(struct _acpi_cache *cache, BOOLEAN Zero)
+{
+    struct _acpi_cache_magazine *mag, *spare = NULL;
+    struct _acpi_cache_cpu *cpu;
+    struct _cache_object *object = NULL;
+    boolean_t istate, refilled = FALSE;
+    UINT32 wanted, got;
+    
+    cpu = AcpiOsCacheLockCpu(cache, &istate);
+    cpu->requests++;
+    
+    for (;;) {
+        if (cpu->loaded && cpu->loaded->rounds > 0) {
+            object = cpu->loaded->objects[--cpu->loaded->rounds];
+            /* Each request counts once: a depot refill already did. */
+            if (!refilled) {
+                cpu->hits++;
+            }
+            break;
+        }
+        
+        if (cpu->previous && cpu->previous->rounds > 0) {
+            mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+            continue;
+        }
+        
+        /* Both local magazines are dry; trade an empty one for a full one at the depot. */
+        AcpiOsCacheLockDepot(cache);
+        mag = cache->full;
+        if (mag) {
+            cache->full = mag->next;
+            cache->full_count--;
+            cache->depot_hits++;
+            refilled = TRUE;
+            if (cpu->previous) {
+                cpu->previous->next = cache->empty;
+                cache->empty = cpu->previous;
+                cache->empty_count++;
+            }
+            cpu->previous = cpu->loaded;
+            cpu->loaded = mag;
+            spare = AcpiOsCacheDepotTick(cache);
+            IOSimpleLockUnlock(cache->depot_lock);
+            continue;
+        }
+        
+        /* Nothing in the depot either; grab an empty magazine to refill from the slabs. */
+        mag = cache->empty;
+        if (mag) {
+            cache->empty = mag->next;
+            cache->empty_count--;
+        }
+        IOSimpleLockUnlock(cache->depot_lock);
+        break;
+    }
+    
+    AcpiOsCacheUnlockCpu(cpu, istate);
+    AcpiOsCacheReap(cache, spare);
+    
+    if (object) {
+        if (Zero) {
+            memset(ACPI_CACHE_OBJECT_DATA(object), 0, cache->object_size);
+        }
+        return ACPI_CACHE_OBJECT_DATA(object);
+    }
+    
+    /*
+     * Slow path: refill a whole magazine from the slabs in one go, keep one
+     * object for the caller and park the rest on this CPU (or in the depot).
+     */
+    if (!mag) {
+        mag = IOMallocZero(sizeof(struct _acpi_cache_magazine));
+    }
+    
+    wanted = mag ? cache->magazine_size : 1;
+    
+    for (;;) {
+        struct _cache_object *batch[ACPI_CACHE_MAGAZINE_MAX];
+        struct _acpi_cache_slab *slab;
+        
+        istate = ml_set_interrupts_enabled(FALSE);
+        IOSimpleLockLock(cache->depot_lock);
+        got = AcpiOsCacheSlabGet(cache, batch, wanted);
+        if (got) {
+            cache->slab_refills++;
+        }
+        IOSimpleLockUnlock(cache->depot_lock);
+        ml_set_interrupts_enabled(istate);
+        
+        if (got) {
+            object = batch[--got];
+            if (mag) {
+                memcpy(mag->objects, batch, got * sizeof(batch[0]));
+                mag->rounds = got;
+            }
+            break;
+        }
+        
+        slab = AcpiOsCacheSlabCreate(cache);
+        if (!slab) {
+            if (mag) {
+                IOFree(mag, sizeof(struct _acpi_cache_magazine));
+            }
+            return NULL;
+        }
+        
+        istate = ml_set_interrupts_enabled(FALSE);
+        IOSimpleLockLock(cache->depot_lock);
+        slab->next = cache->partial;
+        if (cache->partial) {
+            cache->partial->prev = slab;
+        }
+        cache->partial = slab;
+        slab->on_partial = TRUE;
+        cache->slab_count++;
+        IOSimpleLockUnlock(cache->depot_lock);
+        ml_set_interrupts_enabled(istate);
+    }
+    
+    if (mag) {
+        cpu = AcpiOsCacheLockCpu(cache, &istate);
+        if (!cpu->loaded || cpu->loaded->rounds == 0) {
+            struct _acpi_cache_magazine *old = cpu->loaded;
+            cpu->loaded = mag;
+            mag = old;
+        }
+        
+        if (mag) {
+            /* Park whatever is left over in the depot, full or empty. */
+            AcpiOsCacheLockDepot(cache);
+            if (mag->rounds) {
+                mag->next = cache->full;
+                cache->full = mag;
+                cache->full_count++;
+            } else {
+                mag->next = cache->empty;
+                cache->empty = mag;
+                cache->empty_count++;
+            }
+            IOSimpleLockUnlock(cache->depot_lock);
+        }
+        AcpiOsCacheUnlockCpu(cpu, istate);
+    }
+    
+    if (Zero) {
+        memset(ACPI_CACHE_OBJECT_DATA(object), 0, cache->object_size);
+    }
+    return ACPI_CACHE_OBJECT_DATA(object);
+}
+
+/* AcpiOsAcquireObject - Get an object from the cache or allocate a new one */
+void *
+AcpiOsAcquireObject(ACPI_CACHE_T *Cache)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+        return NULL;
+    }
+    
+    if (cache->arena) {
+        struct _cache_object *object = AcpiOsArenaAlloc(cache);
+        if (object) {
+            memset(ACPI_CACHE_OBJECT_DATA(object), 0, cache->object_size);
+            return ACPI_CACHE_OBJECT_DATA(object);
+        }
+    }
+    
+    /* ACPICA expects zeroed objects (see AcpiUtCreateGenericState) */
+    return AcpiOsCacheAlloc(cache, TRUE);
+}
+
+/* AcpiOsReleaseObject - Release an object back to the cache */
+ACPI_STATUS
+AcpiOsReleaseObject(ACPI_CACHE_T *Cache, void *Object)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    struct _acpi_cache_magazine *mag, *spare = NULL, *fresh = NULL;
+    struct _acpi_cache_slab *free_slab = NULL;
+    struct _acpi_cache_cpu *cpu;
+    struct _cache_object *object;
+    boolean_t istate;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC || !Object) {
+        /* Objects belong to a slab; there's nothing sane to free without the cache. */
+        return AE_BAD_PARAMETER;
+    }
+    
+    object = ACPI_CACHE_DATA_OBJECT(Object);
+    
+    if (!object->slab) {
+        AcpiOsArenaFree(object);
+        return AE_OK;
+    }
+    
+    for (;;) {
+        cpu = AcpiOsCacheLockCpu(cache, &istate);
+        
+        if (cpu->loaded && cpu->loaded->rounds < cache->magazine_size) {
+            cpu->loaded->objects[cpu->loaded->rounds++] = object;
+            break;
+        }
+        
+        if (cpu->previous && cpu->previous->rounds == 0) {
+            mag = cpu->loaded;
+            cpu->loaded = cpu->previous;
+            cpu->previous = mag;
+            cpu->loaded->objects[cpu->loaded->rounds++] = object;
+            break;
+        }
+        
+        /* Both local magazines are full (or missing); swap a full one for an empty one. */
+        AcpiOsCacheLockDepot(cache);
+        mag = cache->empty;
+        if (mag) {
+            cache->empty = mag->next;
+            cache->empty_count--;
+        } else if (fresh) {
+            mag = fresh;
+            fresh = NULL;
+        }
+        
+        if (mag) {
+            if (cpu->previous) {
+                cpu->previous->next = cache->full;
+                cache->full = cpu->previous;
+                cache->full_count++;
+            }
+            cpu->previous = cpu->loaded;
+            cpu->loaded = mag;
+            cpu->loaded->objects[cpu->loaded->rounds++] = object;
+            spare = AcpiOsCacheDepotTick(cache);
+            IOSimpleLockUnlock(cache->depot_lock);
+            break;
+        }
+        
+        IOSimpleLockUnlock(cache->depot_lock);
+        AcpiOsCacheUnlockCpu(cpu, istate);
+        
+        /* No empty magazines anywhere; make one and try again, or give the object straight back. */
+        fresh = IOMallocZero(sizeof(struct _acpi_cache_magazine));
+        if (!fresh) {
+            istate = ml_set_interrupts_enabled(FALSE);
+            IOSimpleLockLock(cache->depot_lock);
+            AcpiOsCacheSlabPut(cache, object, &free_slab);
+            IOSimpleLockUnlock(cache->depot_lock);
+            ml_set_interrupts_enabled(istate);
+            if (free_slab) {
+                IOFree(free_slab, free_slab->alloc_size);
+            }
+            return AE_OK;
+        }
+    }
+    
+    AcpiOsCacheUnlockCpu(cpu, istate);
+    
+    if (fresh) {
+        IOFree(fresh, sizeof(struct _acpi_cache_magazine));
+    }
+    AcpiOsCacheReap(cache, spare);
+    
+    return AE_OK;
+}
+
+/* AcpiOsGetCacheStatistics (Debug helper) -  Get cache statistics */
+ACPI_STATUS
+AcpiOsGetCacheStatistics(ACPI_CACHE_T *Cache, UINT32 *Requests, UINT32 *Hits)
+{
+    struct _acpi_cache *cache = (struct _acpi_cache *)Cache;
+    UINT64 requests = 0, hits = 0;
+    UINT32 i;
+    
+    if (!cache || cache->magic != ACPI_CACHE_MAGIC) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    for (i = 0; i < ACPI_CACHE_MAX_CPUS; i++) {
+        requests += cache->cpu[i].requests;
+        hits += cache->cpu[i].hits;
+    }
+    
+    if (Requests) {
+        *Requests = (UINT32)requests;
+    }
+    
+    if (Hits) {
+        *Hits = (UINT32)hits;
+    }
+    
+    return AE_OK;
+}
+
+/*
+ * Snapshot up to Count caches into Stats for the registry (see AcpiOsExtCopyStatistics).
+ * Returns how many were filled in. Counters are read without the locks, so they're
+ * only approximately consistent with each other.
+ */
+UINT32
+AcpiOsCopyCacheStatistics(ACPI_DARWIN_CACHE_STATS *Stats, UINT32 Count)
+{
+    struct _acpi_cache *cache;
+    UINT32 n = 0;
+    UINT32 i;
+    
+    if (!gAcpiOsCacheListLock) {
+        return 0;
+    }
+    
+    IOLockLock(gAcpiOsCacheListLock);
+    for (cache = gAcpiOsCacheList; cache && n < Count; cache = cache->next_cache, n++) {
+        ACPI_DARWIN_CACHE_STATS *s = &Stats[n];
+        
+        memset(s, 0, sizeof(*s));
+        strlcpy(s->Name, cache->name, sizeof(s->Name));
+        for (i = 0; i < ACPI_CACHE_MAX_CPUS; i++) {
+            s->Requests += cache->cpu[i].requests;
+            s->MagazineHits += cache->cpu[i].hits;
+            if (cache->cpu[i].loaded) {
+                s->CachedObjects += cache->cpu[i].loaded->rounds;
+            }
+            if (cache->cpu[i].previous) {
+                s->CachedObjects += cache->cpu[i].previous->rounds;
+            }
+        }
+        s->DepotHits = cache->depot_hits;
+        s->SlabRefills = cache->slab_refills;
+        s->Reaped = cache->reaped;
+        s->Contention = cache->contention;
+        s->ObjectSize = (uint32_t)cache->object_size;
+        s->MagazineSize = cache->magazine_size;
+        s->DepotMagazines = cache->full_count;
+        s->Slabs = cache->slab_count;
+        s->CachedObjects += (uint64_t)cache->full_count * cache->magazine_size;
+    }
+    IOLockUnlock(gAcpiOsCacheListLock);
+    
+    return n;
+}
+
+#pragma mark Initialization timing
+
+/*
+ * Filled in by the ACPI_DARWIN_INIT_TIMING hooks in tbxfload.c (the DSDT and SSDTs loaded
+ * at boot), tbdata.c (Load/LoadTable later on) and nsinit.c, and read by the platform
+ * expert for its "ACPI Boot Timing" property. The boot loads run one after another before
+ * any AML does, and later loads are serialized by ACPICA's interpreter lock, so the table
+ * records need no lock of their own.
+ * Elapsed times arrive in AcpiOsGetTimer units (100ns). The prototypes are in acdarwin.h,
+ * ahead of ACPICA's own types, hence the stdint types.
+ */
+static ACPI_DARWIN_INIT_STATS gAcpiOsInitStats;
+
+void
+AcpiOsRecordTableLoad(uint32_t TableIndex, ACPI_TABLE_HEADER *Table, uint64_t Elapsed, uint32_t Status)
+{
+    UINT32 n = gAcpiOsInitStats.TableCount++;
+    ACPI_DARWIN_TABLE_TIMING *t;
+    
+    if (n >= ACPI_DARWIN_MAX_TIMED_TABLES || !Table) {
+        return;
+    }
+    
+    t = &gAcpiOsInitStats.Tables[n];
+    memcpy(t->Signature, Table->Signature, sizeof(t->Signature));
+    memcpy(t->OemTableId, Table->OemTableId, sizeof(t->OemTableId));
+    t->TableIndex = TableIndex;
+    t->Length = Table->Length;
+    t->Status = Status;
+    t->LoadTime = Elapsed * 100;
+}
+
+void
+AcpiOsRecordRegMethods(uint64_t Elapsed)
+{
+    gAcpiOsInitStats.RegTime = Elapsed * 100;
+}
+
+void
+AcpiOsRecordDeviceInit(uint64_t Elapsed, uint32_t Devices, uint32_t IniMethods, uint32_t StaMethods)
+{
+    gAcpiOsInitStats.DeviceInitTime = Elapsed * 100;
+    gAcpiOsInitStats.Devices = Devices;
+    gAcpiOsInitStats.IniMethods = IniMethods;
+    gAcpiOsInitStats.StaMethods = StaMethods;
+}
+
+void
+AcpiOsCopyInitStatistics(ACPI_DARWIN_INIT_STATS *Stats)
+{
+    memcpy(Stats, &gAcpiOsInitStats, sizeof(*Stats));
+}
+
+#pragma mark System sleep
+
+/*
+ * SLP_TYPa/SLP_TYPb for S0-S5, read once by AcpiOsLoadSleepTypes. _Sx lives in the DSDT,
+ * so nothing loaded later can change it.
+ */
+static struct {
+    BOOLEAN     Valid;
+    UINT8       TypeA;
+    UINT8       TypeB;
+} gAcpiOsSleepTypes[ACPI_S_STATE_COUNT];
+static BOOLEAN gAcpiOsSleepTypesLoaded;
+
+/* Phase timestamps for the last transition, see ACPI_DARWIN_SLEEP_STATES in acdarwin.h. */
+static ACPI_DARWIN_SLEEP_TIMING gAcpiOsSleepTiming;
+
+void
+AcpiOsLoadSleepTypes(void)
+{
+    UINT8 state;
+    
+    for (state = ACPI_STATE_S0; state < ACPI_S_STATE_COUNT; state++) {
+        gAcpiOsSleepTypes[state].Valid = ACPI_SUCCESS(AcpiGetSleepTypeData(state,
+            &gAcpiOsSleepTypes[state].TypeA, &gAcpiOsSleepTypes[state].TypeB));
+    }
+    gAcpiOsSleepTypesLoaded = TRUE;
+}
+
+ACPI_STATUS
+AcpiOsGetSleepTypeData(UINT8 SleepState, UINT8 *SleepTypeA, UINT8 *SleepTypeB)
+{
+    if (!gAcpiOsSleepTypesLoaded) {
+        return AcpiGetSleepTypeData(SleepState, SleepTypeA, SleepTypeB);
+    }
+    
+    if (SleepState >= ACPI_S_STATE_COUNT || !SleepTypeA || !SleepTypeB) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    if (!gAcpiOsSleepTypes[SleepState].Valid) {
+        return AE_NOT_FOUND;
+    }
+    
+    *SleepTypeA = gAcpiOsSleepTypes[SleepState].TypeA;
+    *SleepTypeB = gAcpiOsSleepTypes[SleepState].TypeB;
+    return AE_OK;
+}
+
+void
+AcpiOsResetSleepTiming(uint8_t SleepState)
+{
+    memset(&gAcpiOsSleepTiming, 0, sizeof(gAcpiOsSleepTiming));
+    gAcpiOsSleepTiming.SleepState = SleepState;
+}
+
+void
+AcpiOsRecordSleepPhase(uint32_t Phase, uint64_t Start, uint64_t Elapsed)
+{
+    if (Phase >= ACPI_DARWIN_SLEEP_PHASES) {
+        return;
+    }
+    
+    gAcpiOsSleepTiming.Start[Phase] = Start * 100;
+    gAcpiOsSleepTiming.Elapsed[Phase] = Elapsed * 100;
+    gAcpiOsSleepTiming.Completed |= 1U << Phase;
+}
+
+void
+AcpiOsCopySleepTiming(ACPI_DARWIN_SLEEP_TIMING *Timing)
+{
+    memcpy(Timing, &gAcpiOsSleepTiming, sizeof(*Timing));
+}
+
+/* hwsleep.c's last chance before SLP_EN. Nothing to do; the platform expert has already done it. */
+ACPI_STATUS
+AcpiOsEnterSleep(UINT8 SleepState, UINT32 RegaValue, UINT32 RegbValue)
+{
+    return AE_OK;
+}
+
+#pragma mark thread related stuff
+
+ACPI_THREAD_ID
+AcpiOsGetThreadId(void)
+{
+    return thread_tid(current_thread()); /* I think? */
+}
+
+ACPI_STATUS AcpiOsExecute(ACPI_EXECUTE_TYPE Type, ACPI_OSD_EXEC_CALLBACK Function, void *Context)
+{
+    return AcpiOsExtExecute(Type, Function, Context);
+}
+
+void AcpiOsWaitEventsComplete(void)
+{
+    /* Wait for all queued asynchronous events to complete; a timeout has already been logged */
+    (void)AcpiOsExtWaitEventsComplete();
+}
+
+#pragma mark Override functions - they do nothing.
+
+ACPI_STATUS AcpiOsPredefinedOverride(const ACPI_PREDEFINED_NAMES *PredefinedObject, ACPI_STRING *NewValue)
+{
+    *NewValue = NULL;
+    return AE_OK;
+}
+
+ACPI_STATUS AcpiOsTableOverride(ACPI_TABLE_HEADER *ExistingTable, ACPI_TABLE_HEADER **NewTable)
+{
+    *NewTable = NULL;
+    return AE_OK;
+}
+
+ACPI_STATUS AcpiOsPhysicalTableOverride(ACPI_TABLE_HEADER *ExistingTable,
+                                        ACPI_PHYSICAL_ADDRESS *NewAddress,
+                                        UINT32 *NewTableLength)
+{
+    if (!ExistingTable || !NewAddress || !NewTableLength) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    *NewAddress = 0;
+    *NewTableLength = 0;
+    return AE_OK;
+}
+
+#pragma mark Misc. OSL services
+
+ACPI_STATUS AcpiOsSignal(UINT32 Function, void *Info)
+{
+    switch (Function) {
+        case ACPI_SIGNAL_BREAKPOINT: {
+            if (Info) {
+                char *breakpt = (char *)Info;
+                AcpiOsPrintf("ACPI: recieved breakpoint signal: %s", breakpt);
+            } else {
+                AcpiOsPrintf("ACPI: recieved breakpoint signal");
+            }
+            break;
+        }
+
+        case ACPI_SIGNAL_FATAL: {
+            if (Info) {
+                ACPI_SIGNAL_FATAL_INFO *ftl = (ACPI_SIGNAL_FATAL_INFO *)Info;
+                AcpiOsPrintf("ACPI: recieved AML fatal signal, type: %d, code: %d, arg: %d\n", ftl->Type, ftl->Code, ftl->Argument);
+            } else {
+                AcpiOsPrintf("ACPI: recieved AML fatal signal");
+            }
+            break;
+        }
+
+        default: {
+            AcpiOsPrintf("ACPI: unknown signal recieved (%d)\n", Function);
+            break;
+        }
     }
-    
-    /* Add object back to cache */
-    cache_object->next = cache->list_head;
-    cache->list_head = cache_object;
-    cache->current_depth++;
-    
-    IOSimpleLockUnlock(cache->lock);
-    
     return AE_OK;
 }
 
-#pragma mark thread related stuff
+#pragma mark Logging
+
+/*
+ * Log rings.
+ *
+ * Firmware that trips over its own AML can print thousands of lines a second, often from
+ * a GPE or notify handler, so AcpiOsVprintf must not go straight to IOLog. Each line is
+ * formatted into a record in a per-CPU ring with interrupts disabled and no locks taken;
+ * a thread call drains the rings in timestamp order, emits the lines to IOLog/kprintf
+ * and keeps the most recent output in a history buffer that can be read from the registry.
+ *
+ * ACPICA builds one line out of several AcpiOsPrintf calls (prefix, message, suffix). The
+ * fragments are collected in a line buffer that belongs to the writer, i.e. the calling
+ * thread, or the CPU when at interrupt context, so a thread that is preempted or migrated
+ * half way through a line still finishes its own line and nobody else's. Only a complete
+ * line goes into a ring, as a single record. A line that never gets its newline (a writer
+ * that died half way, say) is flushed by the drain once it has sat untouched for a while.
+ *
+ * A ring has a single producer at a time: the CPU that claimed it, for as long as it takes
+ * to copy one line in. Rings are claimed with a compare-and-swap rather than a lock, so a
+ * CPU that finds its ring taken (more CPUs than rings, or a nested interrupt) moves on to
+ * the next one, and gives up only when every ring is busy. The drain is the only consumer
+ * and is serialized by its own lock.
+ *
+ * The rate limit lives in the rings too. A line's site is the combination of the format
+ * strings that went into it, and every site gets a budget of lines per window in each
+ * ring; anything over is counted and reported next to the following line from that site.
+ * Since the ring is already ours while the line goes in, this needs no lock of its own.
+ */
+#define ACPI_LOG_RINGS              32
+#define ACPI_LOG_RING_BYTES         8192    /* power of two */
+#define ACPI_LOG_MAX_LINE           256
+#define ACPI_LOG_PARTIAL_LINES      64      /* writers that can be half way through a line */
+#define ACPI_LOG_HISTORY_BYTES      (32 * 1024)
+#define ACPI_LOG_DRAIN_DELAY_MS     10
+#define ACPI_LOG_SITES              64      /* per ring, power of two */
+#define ACPI_LOG_SITE_BURST         20      /* lines per site per window, in each ring */
+#define ACPI_LOG_SITE_WINDOW_MS     5000
+#define ACPI_LOG_PARTIAL_STALE_MS   1000    /* an unfinished line this old is flushed as is */
+
+#define ACPI_LOG_RECORD_PAD         0x1     /* rest of the ring is unused, wrap to the start */
+#define ACPI_LOG_RECORD_TRUNCATED   0x2
+#define ACPI_LOG_RECORD_INTERRUPT   0x4
+
+#define ACPI_LOG_NO_RECORD          0xFFFFFFFF
+
+struct _acpi_log_record {
+    UINT16 length;          /* text bytes, not terminated */
+    UINT8 flags;
+    UINT8 cpu;
+    UINT32 suppressed;      /* lines from this site dropped by the rate limit before this one */
+    UINT64 timestamp;
+};
+
+#define ACPI_LOG_RECORD_BYTES(len)  ((sizeof(struct _acpi_log_record) + (len) + 7) & ~7U)
+
+struct _acpi_log_site {
+    UInt64 site;
+    UInt64 windowStart;
+    UInt32 count;
+    UInt32 suppressed;
+};
+
+struct _acpi_log_ring {
+    volatile UInt32 busy;
+    volatile UInt32 head;   /* published records end here; written by the producer */
+    volatile UInt32 tail;   /* consumed records end here; written by the drain */
+    char *data;
+    struct _acpi_log_site sites[ACPI_LOG_SITES];    /* only touched while the ring is claimed */
+};
+
+/*
+ * A line that one writer has started but not finished yet. The owner appends to it while
+ * holding busy; the drain takes busy too before it flushes a stale line.
+ */
+struct _acpi_log_line {
+    volatile UInt64 owner;  /* see AcpiOsLogWriter; 0 when free */
+    volatile UInt32 busy;
+    UInt64 site;
+    UInt64 updated;         /* when the last fragment went in */
+    UInt32 length;          /* 0 while the line is free or freshly claimed */
+    boolean_t truncated;    /* didn't fit; the rest of its fragments are dropped */
+    char text[ACPI_LOG_MAX_LINE + 1];
+};
+
+static struct _acpi_log_ring *gAcpiOsLogRings;
+static struct _acpi_log_line *gAcpiOsLogPartial;
+static thread_call_t gAcpiOsLogDrainCall;
+static volatile UInt32 gAcpiOsLogDrainPending;
+static IOLock *gAcpiOsLogDrainLock;
+
+static UInt64 gAcpiOsLogSiteWindow;
+static UInt64 gAcpiOsLogPartialStale;
+
+/* Written by the drain under gAcpiOsLogDrainLock. */
+static char *gAcpiOsLogHistory;
+static UInt32 gAcpiOsLogHistoryHead;
+static boolean_t gAcpiOsLogHistoryWrapped;
+
+static volatile SInt64 gAcpiOsLogLines;
+static volatile SInt64 gAcpiOsLogInterruptLines;
+static volatile SInt64 gAcpiOsLogDropped;
+static volatile SInt64 gAcpiOsLogSuppressed;
+static volatile SInt64 gAcpiOsLogTruncated;
+static volatile SInt64 gAcpiOsLogEmitted;
+
+static void AcpiOsLogDrain(thread_call_param_t param0, thread_call_param_t param1);
+static void AcpiOsLogEmit(const char *text);
+
+/* Print straight to the console, bypassing the rings. */
+static void
+AcpiOsLogPrintDirect(const char *text)
+{
+    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_KPRINTF) {
+        kprintf("%s", text);
+    }
+    
+    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_IOLOG) {
+        /* Allegedly IOLog can't be used within an interrupt context. I believe. */
+        if (!ml_at_interrupt_context()) {
+            IOLog("%s", text);
+        }
+    }
+}
+
+static void
+AcpiOsLogInitialize(void)
+{
+    char *data;
+    UInt32 i;
+    
+    if (gAcpiOsLogRings) {
+        return;
+    }
+    
+    gAcpiOsLogRings = IOMallocZero(sizeof(struct _acpi_log_ring) * ACPI_LOG_RINGS);
+    gAcpiOsLogPartial = IOMallocZero(sizeof(struct _acpi_log_line) * ACPI_LOG_PARTIAL_LINES);
+    data = IOMallocZero(ACPI_LOG_RING_BYTES * ACPI_LOG_RINGS);
+    gAcpiOsLogHistory = IOMallocZero(ACPI_LOG_HISTORY_BYTES);
+    gAcpiOsLogDrainLock = IOLockAlloc();
+    gAcpiOsLogDrainCall = thread_call_allocate(AcpiOsLogDrain, NULL);
+    
+    if (!gAcpiOsLogRings || !gAcpiOsLogPartial || !data || !gAcpiOsLogHistory || !gAcpiOsLogDrainLock ||
+        !gAcpiOsLogDrainCall) {
+        /* AcpiOsVprintf falls back to printing synchronously. */
+        if (data) {
+            IOFree(data, ACPI_LOG_RING_BYTES * ACPI_LOG_RINGS);
+        }
+        
+        AcpiOsLogTerminate();
+        return;
+    }
+    
+    for (i = 0; i < ACPI_LOG_RINGS; i++) {
+        gAcpiOsLogRings[i].data = data + i * ACPI_LOG_RING_BYTES;
+    }
+    
+    nanoseconds_to_absolutetime(ACPI_LOG_SITE_WINDOW_MS * 1000000ULL, &gAcpiOsLogSiteWindow);
+    nanoseconds_to_absolutetime(ACPI_LOG_PARTIAL_STALE_MS * 1000000ULL, &gAcpiOsLogPartialStale);
+}
 
-ACPI_THREAD_ID
-AcpiOsGetThreadId(void)
+static void
+AcpiOsLogTerminate(void)
 {
-    return thread_tid(current_thread()); /* I think? */
+    struct _acpi_log_ring *rings = gAcpiOsLogRings;
+    
+    /* ACPICA is gone by now, so nothing is producing; flush what's left. */
+    if (rings && gAcpiOsLogDrainLock) {
+        AcpiOsLogDrain(NULL, NULL);
+    }
+    
+    gAcpiOsLogRings = NULL;
+    
+    if (gAcpiOsLogDrainCall) {
+        thread_call_cancel(gAcpiOsLogDrainCall);
+        thread_call_free(gAcpiOsLogDrainCall);
+        gAcpiOsLogDrainCall = NULL;
+    }
+    
+    if (gAcpiOsLogDrainLock) {
+        /* Wait out a drain that was already running. */
+        IOLockLock(gAcpiOsLogDrainLock);
+        IOLockUnlock(gAcpiOsLogDrainLock);
+        IOLockFree(gAcpiOsLogDrainLock);
+        gAcpiOsLogDrainLock = NULL;
+    }
+    
+    if (rings) {
+        if (rings[0].data) {
+            IOFree(rings[0].data, ACPI_LOG_RING_BYTES * ACPI_LOG_RINGS);
+        }
+        
+        IOFree(rings, sizeof(struct _acpi_log_ring) * ACPI_LOG_RINGS);
+    }
+    
+    if (gAcpiOsLogPartial) {
+        IOFree(gAcpiOsLogPartial, sizeof(struct _acpi_log_line) * ACPI_LOG_PARTIAL_LINES);
+        gAcpiOsLogPartial = NULL;
+    }
+    
+    if (gAcpiOsLogHistory) {
+        IOFree(gAcpiOsLogHistory, ACPI_LOG_HISTORY_BYTES);
+        gAcpiOsLogHistory = NULL;
+    }
 }
 
-ACPI_STATUS AcpiOsExecute(ACPI_EXECUTE_TYPE Type, ACPI_OSD_EXEC_CALLBACK Function, void *Context)
+/*
+ * Charge a line to its site in a ring we have claimed. Returns FALSE if the site is over
+ * budget, otherwise the number of lines that were suppressed since the site was last
+ * allowed through.
+ */
+static boolean_t
+AcpiOsLogAdmit(struct _acpi_log_ring *ring, UInt64 site, UInt64 now, UInt32 *suppressed)
 {
-    return AcpiOsExtExecute(Type, Function, Context);
+    struct _acpi_log_site *entry;
+    UInt64 hash = site * 0x9E3779B97F4A7C15ULL;
+    boolean_t admit = TRUE;
+    
+    entry = &ring->sites[(hash >> 32) & (ACPI_LOG_SITES - 1)];
+    *suppressed = 0;
+    
+    if (entry->site != site || now - entry->windowStart >= gAcpiOsLogSiteWindow) {
+        if (entry->site == site) {
+            *suppressed = entry->suppressed;
+        }
+        
+        entry->site = site;
+        entry->windowStart = now;
+        entry->count = 0;
+        entry->suppressed = 0;
+    }
+    
+    if (entry->count < ACPI_LOG_SITE_BURST) {
+        entry->count++;
+    } else {
+        entry->suppressed++;
+        admit = FALSE;
+    }
+    
+    return admit;
 }
 
-void AcpiOsWaitEventsComplete(void)
+/* Have the drain run soon, unless it already will. */
+static void
+AcpiOsLogKick(void)
 {
-    /* Wait for all queued asynchronous events to complete */
-    /* Implementation depends on how AcpiOsExecute queues work */
-    /* For now, this is a no-op since AcpiOsExecute delegates to external implementation */
+    if (OSCompareAndSwap(0, 1, &gAcpiOsLogDrainPending)) {
+        uint64_t deadline;
+        clock_interval_to_deadline(ACPI_LOG_DRAIN_DELAY_MS, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(gAcpiOsLogDrainCall, deadline);
+    }
 }
 
-#pragma mark Override functions - they do nothing.
+static struct _acpi_log_ring *
+AcpiOsLogClaimRing(void)
+{
+    UInt32 first = cpu_number() % ACPI_LOG_RINGS;
+    UInt32 i;
+    
+    for (i = 0; i < ACPI_LOG_RINGS; i++) {
+        struct _acpi_log_ring *ring = &gAcpiOsLogRings[(first + i) % ACPI_LOG_RINGS];
+        if (OSCompareAndSwap(0, 1, &ring->busy)) {
+            return ring;
+        }
+    }
+    
+    return NULL;
+}
 
-ACPI_STATUS AcpiOsPredefinedOverride(const ACPI_PREDEFINED_NAMES *PredefinedObject, ACPI_STRING *NewValue)
+/*
+ * Make room for a record of Length bytes, wrapping if the end of the ring is too short.
+ * Returns where the record goes, or ACPI_LOG_NO_RECORD if the drain is behind.
+ */
+static UInt32
+AcpiOsLogReserve(struct _acpi_log_ring *ring, UInt32 length)
 {
-    *NewValue = NULL;
-    return AE_OK;
+    UInt32 head = ring->head;
+    UInt32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    UInt32 offset = head & (ACPI_LOG_RING_BYTES - 1);
+    UInt32 need = ACPI_LOG_RECORD_BYTES(length);
+    UInt32 pad = 0;
+    
+    if (offset + need > ACPI_LOG_RING_BYTES) {
+        pad = ACPI_LOG_RING_BYTES - offset;
+    }
+    
+    if (head + pad + need - tail > ACPI_LOG_RING_BYTES) {
+        return ACPI_LOG_NO_RECORD;
+    }
+    
+    if (pad >= sizeof(struct _acpi_log_record)) {
+        struct _acpi_log_record *marker = (struct _acpi_log_record *)(ring->data + offset);
+        marker->flags = ACPI_LOG_RECORD_PAD;
+    }
+    
+    return head + pad;
 }
 
-ACPI_STATUS AcpiOsTableOverride(ACPI_TABLE_HEADER *ExistingTable, ACPI_TABLE_HEADER **NewTable)
+/*
+ * Put a finished line into a ring as one record. Returns FALSE if every ring was busy,
+ * in which case the caller prints the line itself.
+ */
+static boolean_t
+AcpiOsLogPublish(const char *text, UInt32 length, UInt64 site, boolean_t truncated)
 {
-    *NewTable = NULL;
-    return AE_OK;
+    struct _acpi_log_ring *ring;
+    struct _acpi_log_record *record;
+    UInt64 now;
+    UInt32 suppressed;
+    UInt32 position;
+    boolean_t istate;
+    
+    istate = ml_set_interrupts_enabled(FALSE);
+    
+    ring = AcpiOsLogClaimRing();
+    if (!ring) {
+        ml_set_interrupts_enabled(istate);
+        return FALSE;
+    }
+    
+    now = mach_absolute_time();
+    if (!AcpiOsLogAdmit(ring, site, now, &suppressed)) {
+        __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+        ml_set_interrupts_enabled(istate);
+        OSIncrementAtomic64(&gAcpiOsLogSuppressed);
+        return TRUE;
+    }
+    
+    position = AcpiOsLogReserve(ring, length);
+    if (position == ACPI_LOG_NO_RECORD) {
+        /* The drain is behind; lose this line rather than wait for it. */
+        __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+        ml_set_interrupts_enabled(istate);
+        OSIncrementAtomic64(&gAcpiOsLogDropped);
+        return TRUE;
+    }
+    
+    record = (struct _acpi_log_record *)(ring->data + (position & (ACPI_LOG_RING_BYTES - 1)));
+    memcpy(record + 1, text, length);
+    record->length = length;
+    record->flags = (truncated ? ACPI_LOG_RECORD_TRUNCATED : 0) |
+                    (ml_at_interrupt_context() ? ACPI_LOG_RECORD_INTERRUPT : 0);
+    record->cpu = cpu_number();
+    record->suppressed = suppressed;
+    record->timestamp = now;
+    
+    __atomic_store_n(&ring->head, position + ACPI_LOG_RECORD_BYTES(length), __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    ml_set_interrupts_enabled(istate);
+    
+    OSIncrementAtomic64(&gAcpiOsLogLines);
+    if (truncated) {
+        OSIncrementAtomic64(&gAcpiOsLogTruncated);
+    }
+    if (record->flags & ACPI_LOG_RECORD_INTERRUPT) {
+        OSIncrementAtomic64(&gAcpiOsLogInterruptLines);
+    }
+    
+    AcpiOsLogKick();
+    return TRUE;
 }
 
-ACPI_STATUS AcpiOsPhysicalTableOverride(ACPI_TABLE_HEADER *ExistingTable,
-                                        ACPI_PHYSICAL_ADDRESS *NewAddress,
-                                        UINT32 *NewTableLength)
+/*
+ * Print a line without going through a ring, marked the way the drain marks a truncated
+ * one. Text must have room for its terminator at Length.
+ */
+static void
+AcpiOsLogPrintLine(char *text, UInt32 length, boolean_t truncated)
 {
-    if (!ExistingTable || !NewAddress || !NewTableLength) {
-        return AE_BAD_PARAMETER;
+    text[length] = '\0';
+    AcpiOsLogPrintDirect(text);
+    if (truncated) {
+        AcpiOsLogPrintDirect("...\n");
+    }
+}
+
+/*
+ * Who a fragment belongs to: the current thread, or the CPU at interrupt context. An
+ * interrupt runs to completion with interrupts off, so nothing else on that CPU can
+ * write as the same interrupt-context writer in the middle of its line.
+ */
+static UInt64
+AcpiOsLogWriter(void)
+{
+    if (ml_at_interrupt_context()) {
+        return (1ULL << 63) | cpu_number();
     }
     
-    *NewAddress = 0;
-    *NewTableLength = 0;
-    return AE_OK;
+    return (UInt64)(uintptr_t)current_thread();
 }
 
-#pragma mark Misc. OSL services
+/* The writer's unfinished line, or a newly claimed one if claim is set. NULL if there is none. */
+static struct _acpi_log_line *
+AcpiOsLogFindLine(UInt64 writer, boolean_t claim)
+{
+    UInt32 start = (UInt32)((writer >> 4) % ACPI_LOG_PARTIAL_LINES);
+    UInt32 i;
+    
+    for (i = 0; i < ACPI_LOG_PARTIAL_LINES; i++) {
+        struct _acpi_log_line *line = &gAcpiOsLogPartial[(start + i) % ACPI_LOG_PARTIAL_LINES];
+        if (line->owner == writer) {
+            return line;
+        }
+    }
+    
+    for (i = 0; claim && i < ACPI_LOG_PARTIAL_LINES; i++) {
+        struct _acpi_log_line *line = &gAcpiOsLogPartial[(start + i) % ACPI_LOG_PARTIAL_LINES];
+        if (line->owner == 0 && OSCompareAndSwap64(0, writer, &line->owner)) {
+            line->site = 0;
+            line->truncated = FALSE;
+            return line;
+        }
+    }
+    
+    return NULL;
+}
 
-ACPI_STATUS AcpiOsSignal(UINT32 Function, void *Info)
+/* Give a line back; the length goes first so the drain never sees a stale one claimed. */
+static void
+AcpiOsLogReleaseLine(struct _acpi_log_line *line)
 {
-    switch (Function) {
-        case ACPI_SIGNAL_BREAKPOINT: {
-            if (Info) {
-                char *breakpt = (char *)Info;
-                AcpiOsPrintf("ACPI: recieved breakpoint signal: %s", breakpt);
-            } else {
-                AcpiOsPrintf("ACPI: recieved breakpoint signal");
+    line->length = 0;
+    __atomic_store_n(&line->owner, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&line->busy, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add a formatted fragment to the writer's line and publish the line once it ends.
+ * Returns FALSE if the text couldn't be published, so the caller prints it directly.
+ */
+static boolean_t
+AcpiOsLogWrite(const char *fmt, va_list list)
+{
+    UInt64 writer = AcpiOsLogWriter();
+    struct _acpi_log_line *line;
+    boolean_t endsLine = fmt[0] && fmt[strlen(fmt) - 1] == '\n';
+    boolean_t published, istate;
+    int length;
+    
+    for (;;) {
+        line = AcpiOsLogFindLine(writer, !endsLine);
+        if (!line) {
+            /* A whole line in one call (the common case), or no line buffer to spare. */
+            char text[ACPI_LOG_MAX_LINE + 1];
+            
+            length = vsnprintf(text, sizeof(text), fmt, list);
+            if (length < 0) {
+                length = 0;
             }
+            
+            return AcpiOsLogPublish(text, (length > ACPI_LOG_MAX_LINE) ? ACPI_LOG_MAX_LINE : (UInt32)length,
+                                    (UInt64)(uintptr_t)fmt, length > ACPI_LOG_MAX_LINE);
+        }
+        
+        /* The drain only holds busy for a copy, with interrupts off, while it flushes a stale line. */
+        istate = ml_set_interrupts_enabled(FALSE);
+        while (!OSCompareAndSwap(0, 1, &line->busy)) {
+            __asm__ volatile("pause");
+        }
+        if (line->owner == writer) {
             break;
         }
+        
+        /* Flushed under us; start over with a fresh line. */
+        __atomic_store_n(&line->busy, 0, __ATOMIC_RELEASE);
+        ml_set_interrupts_enabled(istate);
+    }
+    
+    line->site = (line->site * 31) + (UInt64)(uintptr_t)fmt;
+    line->updated = mach_absolute_time();
+    
+    if (!line->truncated) {
+        UInt32 room = ACPI_LOG_MAX_LINE - line->length;
+        
+        length = vsnprintf(line->text + line->length, room + 1, fmt, list);
+        if (length < 0) {
+            length = 0;
+        }
+        
+        if ((UInt32)length > room) {
+            /* Keep what fit and drop the rest of the line. */
+            line->length = ACPI_LOG_MAX_LINE;
+            line->truncated = TRUE;
+        } else {
+            line->length += length;
+        }
+    }
+    
+    if (!endsLine && !(line->length && !line->truncated && line->text[line->length - 1] == '\n')) {
+        __atomic_store_n(&line->busy, 0, __ATOMIC_RELEASE);
+        ml_set_interrupts_enabled(istate);
+        
+        /* Make sure the drain gets to look at it, should the rest never come. */
+        AcpiOsLogKick();
+        return TRUE;
+    }
+    
+    published = AcpiOsLogPublish(line->text, line->length, line->site, line->truncated);
+    if (!published) {
+        /* Every ring is busy; print the line here, the caller only knows about the last fragment. */
+        char text[ACPI_LOG_MAX_LINE + 1];
+        UInt32 textLength = line->length;
+        boolean_t truncated = line->truncated;
+        
+        memcpy(text, line->text, textLength);
+        AcpiOsLogReleaseLine(line);
+        ml_set_interrupts_enabled(istate);
+        
+        AcpiOsLogPrintLine(text, textLength, truncated);
+        return TRUE;
+    }
+    
+    AcpiOsLogReleaseLine(line);
+    ml_set_interrupts_enabled(istate);
+    return TRUE;
+}
 
-        case ACPI_SIGNAL_FATAL: {
-            if (Info) {
-                ACPI_SIGNAL_FATAL_INFO *ftl = (ACPI_SIGNAL_FATAL_INFO *)Info;
-                AcpiOsPrintf("ACPI: recieved AML fatal signal, type: %d, code: %d, arg: %d\n", ftl->Type, ftl->Code, ftl->Argument);
+/*
+ * Flush lines whose writer hasn't added to them for ACPI_LOG_PARTIAL_STALE_MS, as they
+ * stand. Returns whether any unfinished lines are left. Called from the drain.
+ */
+static boolean_t
+AcpiOsLogFlushStale(void)
+{
+    char text[ACPI_LOG_MAX_LINE + 1];
+    boolean_t outstanding = FALSE;
+    UInt32 i;
+    
+    for (i = 0; i < ACPI_LOG_PARTIAL_LINES; i++) {
+        struct _acpi_log_line *line = &gAcpiOsLogPartial[i];
+        boolean_t truncated = FALSE, istate;
+        UInt32 length = 0;
+        
+        if (!__atomic_load_n(&line->owner, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        
+        istate = ml_set_interrupts_enabled(FALSE);
+        if (!OSCompareAndSwap(0, 1, &line->busy)) {
+            ml_set_interrupts_enabled(istate);
+            outstanding = TRUE;
+            continue;
+        }
+        
+        if (line->owner && line->length) {
+            if (mach_absolute_time() - line->updated >= gAcpiOsLogPartialStale) {
+                length = line->length;
+                truncated = line->truncated;
+                memcpy(text, line->text, length);
+                AcpiOsLogReleaseLine(line);
             } else {
-                AcpiOsPrintf("ACPI: recieved AML fatal signal");
+                outstanding = TRUE;
+                __atomic_store_n(&line->busy, 0, __ATOMIC_RELEASE);
             }
-            break;
+        } else {
+            /* Claimed, but nothing in it yet. */
+            outstanding = outstanding || line->owner;
+            __atomic_store_n(&line->busy, 0, __ATOMIC_RELEASE);
+        }
+        ml_set_interrupts_enabled(istate);
+        
+        if (length) {
+            text[length] = '\0';
+            AcpiOsLogEmit(text);
+            AcpiOsLogEmit(truncated ? "...\n" : "\n");
+            OSIncrementAtomic64(&gAcpiOsLogEmitted);
         }
+    }
+    
+    return outstanding;
+}
 
-        default: {
-            AcpiOsPrintf("ACPI: unknown signal recieved (%d)\n", Function);
+static void
+AcpiOsLogAppendHistory(const char *text, UInt32 length)
+{
+    while (length) {
+        UInt32 chunk = ACPI_LOG_HISTORY_BYTES - gAcpiOsLogHistoryHead;
+        if (chunk > length) {
+            chunk = length;
+        }
+        
+        memcpy(gAcpiOsLogHistory + gAcpiOsLogHistoryHead, text, chunk);
+        gAcpiOsLogHistoryHead += chunk;
+        if (gAcpiOsLogHistoryHead == ACPI_LOG_HISTORY_BYTES) {
+            gAcpiOsLogHistoryHead = 0;
+            gAcpiOsLogHistoryWrapped = TRUE;
+        }
+        
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+static void
+AcpiOsLogEmit(const char *text)
+{
+    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_KPRINTF) {
+        kprintf("%s", text);
+    }
+    
+    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_IOLOG) {
+        IOLog("%s", text);
+    }
+    
+    AcpiOsLogAppendHistory(text, (UInt32)strlen(text));
+}
+
+/* The oldest published record in a ring, skipping over the padding at the end. */
+static struct _acpi_log_record *
+AcpiOsLogPeek(struct _acpi_log_ring *ring)
+{
+    UInt32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    
+    while (ring->tail != head) {
+        UInt32 offset = ring->tail & (ACPI_LOG_RING_BYTES - 1);
+        struct _acpi_log_record *record = (struct _acpi_log_record *)(ring->data + offset);
+        
+        if (ACPI_LOG_RING_BYTES - offset < sizeof(struct _acpi_log_record) ||
+            (record->flags & ACPI_LOG_RECORD_PAD)) {
+            __atomic_store_n(&ring->tail, ring->tail + (ACPI_LOG_RING_BYTES - offset), __ATOMIC_RELEASE);
+            continue;
+        }
+        
+        return record;
+    }
+    
+    return NULL;
+}
+
+/* Emit everything that has been published, oldest first across all of the rings. */
+static void
+AcpiOsLogDrain(thread_call_param_t param0, thread_call_param_t param1)
+{
+    char line[ACPI_LOG_MAX_LINE + 64];
+    
+    IOLockLock(gAcpiOsLogDrainLock);
+    
+    /* Anything committed from here on schedules another pass. */
+    __atomic_store_n(&gAcpiOsLogDrainPending, 0, __ATOMIC_SEQ_CST);
+    
+    while (gAcpiOsLogRings) {
+        struct _acpi_log_ring *oldestRing = NULL;
+        struct _acpi_log_record *oldest = NULL;
+        UInt32 i;
+        
+        for (i = 0; i < ACPI_LOG_RINGS; i++) {
+            struct _acpi_log_record *record = AcpiOsLogPeek(&gAcpiOsLogRings[i]);
+            if (record && (!oldest || record->timestamp < oldest->timestamp)) {
+                oldest = record;
+                oldestRing = &gAcpiOsLogRings[i];
+            }
+        }
+        
+        if (!oldest) {
             break;
         }
+        
+        if (oldest->suppressed) {
+            snprintf(line, sizeof(line), "ACPI: %u similar messages suppressed\n", oldest->suppressed);
+            AcpiOsLogEmit(line);
+        }
+        
+        memcpy(line, oldest + 1, oldest->length);
+        line[oldest->length] = '\0';
+        if (oldest->flags & ACPI_LOG_RECORD_TRUNCATED) {
+            strlcat(line, "...\n", sizeof(line));
+        }
+        
+        __atomic_store_n(&oldestRing->tail, oldestRing->tail + ACPI_LOG_RECORD_BYTES(oldest->length), __ATOMIC_RELEASE);
+        
+        AcpiOsLogEmit(line);
+        OSIncrementAtomic64(&gAcpiOsLogEmitted);
     }
-    return AE_OK;
+    
+    /*
+     * Come back for unfinished lines once they could be stale. This leaves the pending flag
+     * clear, so a line published meanwhile still gets the usual short delay.
+     */
+    if (gAcpiOsLogRings && AcpiOsLogFlushStale() && gAcpiOsLogDrainCall) {
+        uint64_t deadline;
+        clock_interval_to_deadline(ACPI_LOG_PARTIAL_STALE_MS, kMillisecondScale, &deadline);
+        thread_call_enter_delayed(gAcpiOsLogDrainCall, deadline);
+    }
+    
+    IOLockUnlock(gAcpiOsLogDrainLock);
+}
+
+/*
+ * Copy the recent output, oldest first, for the registry. Pending records are drained
+ * first so the copy is current. Returns the number of bytes copied.
+ */
+UINT32
+AcpiOsCopyLogHistory(char *Buffer, UINT32 Length)
+{
+    UInt32 copied = 0;
+    UInt32 start, size;
+    
+    if (!gAcpiOsLogRings || !Buffer) {
+        return 0;
+    }
+    
+    AcpiOsLogDrain(NULL, NULL);
+    
+    IOLockLock(gAcpiOsLogDrainLock);
+    
+    start = gAcpiOsLogHistoryWrapped ? gAcpiOsLogHistoryHead : 0;
+    size = gAcpiOsLogHistoryWrapped ? ACPI_LOG_HISTORY_BYTES : gAcpiOsLogHistoryHead;
+    if (size > Length) {
+        /* Keep the newest output. */
+        start = (start + size - Length) % ACPI_LOG_HISTORY_BYTES;
+        size = Length;
+    }
+    
+    while (copied < size) {
+        UInt32 chunk = ACPI_LOG_HISTORY_BYTES - start;
+        if (chunk > size - copied) {
+            chunk = size - copied;
+        }
+        
+        memcpy(Buffer + copied, gAcpiOsLogHistory + start, chunk);
+        copied += chunk;
+        start = (start + chunk) % ACPI_LOG_HISTORY_BYTES;
+    }
+    
+    IOLockUnlock(gAcpiOsLogDrainLock);
+    return copied;
+}
+
+void
+AcpiOsCopyLogStatistics(ACPI_DARWIN_LOG_STATS *Stats)
+{
+    Stats->Lines = gAcpiOsLogLines;
+    Stats->InterruptLines = gAcpiOsLogInterruptLines;
+    Stats->Dropped = gAcpiOsLogDropped;
+    Stats->Suppressed = gAcpiOsLogSuppressed;
+    Stats->Truncated = gAcpiOsLogTruncated;
+    Stats->Emitted = gAcpiOsLogEmitted;
 }
 
 void AcpiOsPrintf(const char *fmt, ...)
@@ -1124,17 +3242,28 @@ void AcpiOsPrintf(const char *fmt, ...)
 
 void AcpiOsVprintf(const char *fmt, va_list list)
 {
-    char msg[4096]; /* I don't think a message will exceed this size in one go. */
-    vsnprintf(msg, 4096, fmt, list);
-
-    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_KPRINTF) {
-        kprintf("%s", msg);
-    }
+    char msg[ACPI_LOG_MAX_LINE + 1];
+    int length;
     
-    if (gAcpiOsPrintfFlags & ACPI_OS_PRINTF_USE_IOLOG) {
-        /* Allegedly IOLog can't be used within an interrupt context. I believe. */
-        if (!ml_at_interrupt_context()) {
-            IOLog("%s", msg);
+    if (!(gAcpiOsPrintfFlags & ACPI_OS_PRINTF_SYNC) && gAcpiOsLogRings) {
+        va_list copy;
+        boolean_t stored;
+        
+        va_copy(copy, list);
+        stored = AcpiOsLogWrite(fmt, copy);
+        va_end(copy);
+        
+        if (stored) {
+            return;
         }
+        
+        /* Every ring is busy; print it directly rather than lose it. */
+    }
+    
+    /* Same limit as a ring record. */
+    length = vsnprintf(msg, sizeof(msg), fmt, list);
+    if (length < 0) {
+        length = 0;
     }
+    AcpiOsLogPrintLine(msg, (length > ACPI_LOG_MAX_LINE) ? ACPI_LOG_MAX_LINE : (UInt32)length, length > ACPI_LOG_MAX_LINE);
 }
@@ -40,12 +40,12 @@
 #include <IOKit/IOMemoryDescriptor.h>
 #include <IOKit/IORegistryEntry.h>
 #include <IOKit/IODeviceTreeSupport.h>
-#include <IOKit/IOCommand.h>
-#include <IOKit/IOCommandGate.h>
-#include <libkern/c++/OSSet.h>
-#include <libkern/c++/OSCollectionIterator.h>
+#include <kern/thread.h>
+#include <kern/sched_prim.h>
+#include <libkern/tree.h>
 #include <pexpert/i386/efi.h>
 #include <pexpert/i386/boot.h>
+#include "pci_config_access.h"
 
 /* for some reason Xcode has disabled any and all forms of auto completion. */
 /* ZORMEISTER: Consider using CLion or VS Code with C++ extensions for better completion */
@@ -55,107 +55,632 @@ extern "C" void AcpiOsExtUnmapMemory(void *, ACPI_SIZE);  /* Fixed: Added missin
 extern "C" ACPI_STATUS AcpiOsExtInitialize(void);
 extern "C" ACPI_PHYSICAL_ADDRESS AcpiOsExtGetRootPointer(void);
 extern "C" ACPI_STATUS AcpiOsExtExecute(ACPI_EXECUTE_TYPE Type, ACPI_OSD_EXEC_CALLBACK Function, void *Context);
-extern "C" void AcpiOsExtWaitEventsComplete(void);
+extern "C" ACPI_STATUS AcpiOsExtWaitEventsComplete(void);
 
-IOWorkLoop *gAcpiOsThreadWorkLoop;
-IOCommandGate *gAcpiOsThreadCommandGate;
+/* osdarwin.c */
+extern "C" UInt32 AcpiOsCopyCacheStatistics(ACPI_DARWIN_CACHE_STATS *Stats, UInt32 Count);
+extern "C" void AcpiOsCopyAllocStatistics(ACPI_DARWIN_ALLOC_STATS *Stats);
+extern "C" void AcpiOsCopyArenaStatistics(ACPI_DARWIN_ARENA_STATS *Stats);
+extern "C" void AcpiOsCopyLogStatistics(ACPI_DARWIN_LOG_STATS *Stats);
+extern "C" UInt32 AcpiOsCopyMutexStatistics(ACPI_DARWIN_MUTEX_STATS *Stats, UInt32 Count);
+extern "C" UINT32 AcpiOsCopyLogHistory(char *Buffer, UINT32 Length);
 
 /* PCI config space stuff. */
 ACPI_MCFG_ALLOCATION gPCIFromPE;
 ACPI_MCFG_ALLOCATION *gPCIDataFromMCFG;
 size_t gPCIMCFGEntryCount;
 
-/* Enhanced PCI access state */
-static boolean_t gPCIEcamAvailable = false;
-static IOMemoryMap *gPCIEcamMap = NULL;
-static void *gPCIEcamVirtualBase = NULL;
+/*
+ * ECAM window table.
+ *
+ * Each (segment, bus) pair owns a 1MB configuration window which is mapped the first
+ * time it is touched and then kept around until AcpiOsExtTerminate. osdarwin.c and the
+ * helpers in pci_config_access.h both go through this table, so a config access
+ * is a table lookup and a load/store instead of a map + unmap pair.
+ *
+ * Segments are 16 bits wide but sparse, so they're kept in a two level directory:
+ * the high byte picks a chunk of 256 segment pointers, the low byte picks the segment.
+ * Every step is a direct index; nothing is searched.
+ */
+#define kAcpiOsEcamSegmentChunkShift 8
+#define kAcpiOsEcamSegmentChunkSize  (1 << kAcpiOsEcamSegmentChunkShift)
+#define kAcpiOsEcamBusWindowShift   20 /* 32 devices * 8 functions * 4KB */
+#define kAcpiOsEcamBusWindowSize    (1ULL << kAcpiOsEcamBusWindowShift)
 
-IOLock *gAcpiOsExtMemoryMapLock;
-OSSet *gAcpiOsExtMemoryMapSet;
-OSCollectionIterator *gAcpiOsExtMemoryMapIterator;
+struct AcpiOsEcamBus {
+    ACPI_PHYSICAL_ADDRESS PhysicalAddress; /* zero if this bus isn't decoded by ECAM */
+    IOMemoryMap *Map;
+    volatile UInt8 *Window;
+};
+
+struct AcpiOsEcamSegment {
+    AcpiOsEcamBus Bus[256];
+};
+
+struct AcpiOsEcamSegmentChunk {
+    AcpiOsEcamSegment *Segment[kAcpiOsEcamSegmentChunkSize];
+};
 
-/* Enhanced execution tracking */
-static UInt32 gPendingExecutions = 0;
-static IOLock *gExecutionLock;
+static AcpiOsEcamSegmentChunk *gAcpiOsEcamDirectory[65536 >> kAcpiOsEcamSegmentChunkShift];
+static IOLock *gAcpiOsEcamLock;
+static UInt32 gAcpiOsEcamSegmentCount;
+static bool gAcpiOsEcamMcfgLoaded;
+
+/* MapsAvoided counts config accesses served from an already mapped window. */
+static volatile SInt64 gAcpiOsEcamWindowsMapped;
+static volatile SInt64 gAcpiOsEcamMapsAvoided;
+static volatile SInt64 gAcpiOsEcamFallbacks;
+
+/*
+ * Mapping registry.
+ *
+ * Every AcpiOsMapMemory is backed by a page aligned AcpiOsMapping, indexed twice:
+ * by virtual base, so AcpiOsUnmapMemory can find its mapping in O(log n), and by
+ * physical base, so a request that falls inside an existing mapping just takes
+ * another reference on it. The physical index only holds mappings that don't
+ * overlap each other; a request straddling two of them gets a private mapping
+ * that is only reachable through the virtual index.
+ */
+struct AcpiOsMapping {
+    RB_ENTRY(AcpiOsMapping) VirtualLink;
+    RB_ENTRY(AcpiOsMapping) PhysicalLink;
+    IOVirtualAddress VirtualBase;
+    ACPI_PHYSICAL_ADDRESS PhysicalBase;
+    ACPI_SIZE Length;
+    IOMemoryMap *Map;
+    UInt32 RefCount;
+    bool PhysicallyIndexed;
+};
+
+static int AcpiOsMappingCompareVirtual(AcpiOsMapping *a, AcpiOsMapping *b)
+{
+    return (a->VirtualBase < b->VirtualBase) ? -1 : (a->VirtualBase > b->VirtualBase);
+}
 
-struct _iocmdq_callback_data
+static int AcpiOsMappingComparePhysical(AcpiOsMapping *a, AcpiOsMapping *b)
 {
+    return (a->PhysicalBase < b->PhysicalBase) ? -1 : (a->PhysicalBase > b->PhysicalBase);
+}
+
+RB_HEAD(AcpiOsMappingVirtualTree, AcpiOsMapping);
+RB_HEAD(AcpiOsMappingPhysicalTree, AcpiOsMapping);
+RB_PROTOTYPE(AcpiOsMappingVirtualTree, AcpiOsMapping, VirtualLink, AcpiOsMappingCompareVirtual);
+RB_PROTOTYPE(AcpiOsMappingPhysicalTree, AcpiOsMapping, PhysicalLink, AcpiOsMappingComparePhysical);
+RB_GENERATE(AcpiOsMappingVirtualTree, AcpiOsMapping, VirtualLink, AcpiOsMappingCompareVirtual);
+RB_GENERATE(AcpiOsMappingPhysicalTree, AcpiOsMapping, PhysicalLink, AcpiOsMappingComparePhysical);
+
+static struct AcpiOsMappingVirtualTree gAcpiOsMappingsByVirtual = RB_INITIALIZER(&gAcpiOsMappingsByVirtual);
+static struct AcpiOsMappingPhysicalTree gAcpiOsMappingsByPhysical = RB_INITIALIZER(&gAcpiOsMappingsByPhysical);
+IOLock *gAcpiOsExtMemoryMapLock;
+
+/* All of these are protected by gAcpiOsExtMemoryMapLock. */
+static UInt64 gAcpiOsMappingsLive;
+static UInt64 gAcpiOsMappingBytes;
+static UInt64 gAcpiOsMappingRequests;
+static UInt64 gAcpiOsMappingHits;
+
+/*
+ * Register page cache.
+ *
+ * AcpiOsReadMemory/AcpiOsWriteMemory are mostly FADT/GPE registers and SystemMemory
+ * fields that get hit over and over, so the last few pages touched stay mapped and
+ * an access is a lookup plus a load/store. These calls can arrive with interrupts
+ * off (GPE handling runs under ACPI_SPINLOCKs), so the cache is guarded by a simple
+ * lock and the access itself is done under it; that way an eviction can never pull
+ * a page out from under a reader. New pages are only mapped when we're allowed to
+ * block, anything else is left to ml_phys_*.
+ *
+ * The mappings use the default cache mode, same as the physmap ml_phys_* goes
+ * through, so RAM stays coherent and MMIO stays uncached by its MTRRs.
+ *
+ * A page is only admitted on its second miss while it is still among the last few
+ * candidates; the first miss is served by ml_phys_*. One-off accesses (table probes,
+ * a field touched once at boot) then never push a hot register page out.
+ */
+#define kAcpiOsPageCacheEntries     16
+#define kAcpiOsPageCacheCandidates  16
+#define kAcpiOsPageCacheExclusions  8
+
+struct AcpiOsPageCacheEntry {
+    ACPI_PHYSICAL_ADDRESS PhysicalPage;
+    IOMemoryMap *Map;
+    volatile UInt8 *VirtualPage;
+    UInt64 LastUse;
+};
+
+struct AcpiOsPageCacheExclusion {
+    ACPI_PHYSICAL_ADDRESS Start;
+    ACPI_PHYSICAL_ADDRESS End;
+};
+
+static AcpiOsPageCacheEntry gAcpiOsPageCache[kAcpiOsPageCacheEntries];
+static ACPI_PHYSICAL_ADDRESS gAcpiOsPageCacheCandidates[kAcpiOsPageCacheCandidates];
+static UInt32 gAcpiOsPageCacheNextCandidate;
+static AcpiOsPageCacheExclusion gAcpiOsPageCacheExclusions[kAcpiOsPageCacheExclusions];
+static UInt32 gAcpiOsPageCacheExclusionCount;
+static UInt64 gAcpiOsPageCacheClock;
+static IOSimpleLock *gAcpiOsPageCacheLock;
+static bool gAcpiOsPageCacheDisabled;
+
+static volatile SInt64 gAcpiOsPageCacheHits;
+static volatile SInt64 gAcpiOsPageCacheMisses;
+static volatile SInt64 gAcpiOsPageCacheEvictions;
+static volatile SInt64 gAcpiOsPageCacheDeferred;
+static volatile SInt64 gAcpiOsPageCacheFallbacks;
+
+/*
+ * Deferred execution.
+ *
+ * AcpiOsExecute hands us GPE methods, Notify handlers and EC work that ACPICA wants run
+ * away from the caller. Every ACPI_EXECUTE_TYPE has its own FIFO with a limit on how many
+ * of its callbacks may run at once, and a fixed pool of worker threads serves the queues
+ * in priority order, so a slow Notify handler can't hold up an EC transaction. Callbacks
+ * run preemptibly on the worker threads.
+ *
+ * Work may be queued from the SCI handler, so the queues sit behind a simple lock taken
+ * with interrupts disabled, items come from a preallocated pool and the workers are woken
+ * with thread_wakeup.
+ */
+#define kAcpiOsExecWorkers          4
+#define kAcpiOsExecItems            256
+#define kAcpiOsExecQueues           (OSL_EC_BURST_HANDLER + 1)
+#define kAcpiOsExecWaitTimeoutMs    5000
+
+struct AcpiOsExecItem {
+    AcpiOsExecItem *Next;
     ACPI_OSD_EXEC_CALLBACK Callback;
     void *Context;
+    UInt64 QueuedAt;
 };
 
-IOReturn AcpiOsThreadDispatch(OSObject *, void *field0, void *, void *, void *)
+struct AcpiOsExecQueue {
+    const char *Name;
+    UInt32 Limit;           /* callbacks from this queue that may run at once */
+    UInt32 Running;
+    UInt32 Blocked;         /* of those, ones stuck in AcpiOsExtWaitEventsComplete */
+    UInt32 Depth;
+    AcpiOsExecItem *Head;
+    AcpiOsExecItem *Tail;
+    
+    UInt64 Queued;
+    UInt64 Completed;
+    UInt64 Rejected;
+    UInt64 PeakDepth;
+    UInt64 MaxLatency;      /* absolute time between queueing and starting */
+};
+
+/*
+ * Indexed by ACPI_EXECUTE_TYPE. Notify handlers stay serialized so that a device sees its
+ * notifications in order, and the EC is only ever driven by one callback at a time.
+ */
+static AcpiOsExecQueue gAcpiOsExecQueues[kAcpiOsExecQueues] = {
+    { "Global Lock",     1 },
+    { "Notify",          1 },
+    { "GPE",             2 },
+    { "Debugger",        1 },
+    { "Debugger Exec",   1 },
+    { "EC Poll",         1 },
+    { "EC Burst",        1 },
+};
+
+/* The order the workers look at the queues in. */
+static const UInt8 gAcpiOsExecPriority[kAcpiOsExecQueues] = {
+    OSL_EC_BURST_HANDLER,
+    OSL_EC_POLL_HANDLER,
+    OSL_GLOBAL_LOCK_HANDLER,
+    OSL_GPE_HANDLER,
+    OSL_NOTIFY_HANDLER,
+    OSL_DEBUGGER_EXEC_THREAD,
+    OSL_DEBUGGER_MAIN_THREAD,
+};
+
+static IOSimpleLock *gAcpiOsExecLock;
+static AcpiOsExecItem *gAcpiOsExecItems;
+static AcpiOsExecItem *gAcpiOsExecFree;
+static thread_t gAcpiOsExecThreads[kAcpiOsExecWorkers];
+static AcpiOsExecQueue *gAcpiOsExecCurrent[kAcpiOsExecWorkers];    /* what each worker is running */
+static UInt32 gAcpiOsExecWorkersLive;
+static UInt32 gAcpiOsExecWorkersBlocked;
+static UInt32 gAcpiOsExecPending;   /* queued or running */
+static UInt32 gAcpiOsExecWaiters;
+static bool gAcpiOsExecStopping;
+
+/* The first queue in priority order with work that is allowed to start. Caller holds gAcpiOsExecLock. */
+static AcpiOsExecQueue *AcpiOsExecNextQueue(void)
 {
-    _iocmdq_callback_data *d = (_iocmdq_callback_data *)field0;
+    for (UInt32 i = 0; i < kAcpiOsExecQueues; i++) {
+        AcpiOsExecQueue *queue = &gAcpiOsExecQueues[gAcpiOsExecPriority[i]];
+        if (queue->Head && queue->Running < queue->Limit) {
+            return queue;
+        }
+    }
     
-    ml_set_interrupts_enabled(false); /* disable interrupts */
-    d->Callback(d->Context);
-    ml_set_interrupts_enabled(true); /* enable interrupts */
+    return NULL;
+}
 
-    /* Update pending execution count */
-    IOLockLock(gExecutionLock);
-    if (gPendingExecutions > 0) {
-        gPendingExecutions--;
+static void AcpiOsExecWorker(void *param, wait_result_t)
+{
+    UInt32 index = (UInt32)(uintptr_t)param;
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+    
+    for (;;) {
+        AcpiOsExecQueue *queue = AcpiOsExecNextQueue();
+        if (!queue) {
+            /* Queues are drained before the workers go away. */
+            if (gAcpiOsExecStopping) {
+                break;
+            }
+            
+            assert_wait(&gAcpiOsExecQueues, THREAD_UNINT);
+            IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+            thread_block(THREAD_CONTINUE_NULL);
+            is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+            continue;
+        }
+        
+        AcpiOsExecItem *item = queue->Head;
+        queue->Head = item->Next;
+        if (!queue->Head) {
+            queue->Tail = NULL;
+        }
+        queue->Depth--;
+        queue->Running++;
+        gAcpiOsExecCurrent[index] = queue;
+        
+        UInt64 latency = mach_absolute_time() - item->QueuedAt;
+        if (latency > queue->MaxLatency) {
+            queue->MaxLatency = latency;
+        }
+        
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+        
+        item->Callback(item->Context);
+        
+        is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+        gAcpiOsExecCurrent[index] = NULL;
+        queue->Running--;
+        queue->Completed++;
+        item->Next = gAcpiOsExecFree;
+        gAcpiOsExecFree = item;
+        gAcpiOsExecPending--;
+        
+        if (gAcpiOsExecWaiters) {
+            thread_wakeup(&gAcpiOsExecPending);
+        }
     }
-    IOLockUnlock(gExecutionLock);
+    
+    gAcpiOsExecWorkersLive--;
+    thread_wakeup(&gAcpiOsExecWorkersLive);
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+    
+    thread_terminate(current_thread());
+}
 
-    /* we no longer have need for our callback data, and we have exited the cautious period without interrupts. */
-    IOFree(d, sizeof(_iocmdq_callback_data));
-    return kIOReturnSuccess;
+/* The calling worker's slot, or -1 if this isn't a worker thread. */
+static SInt32 AcpiOsExecWorkerIndex(void)
+{
+    thread_t self = current_thread();
+    
+    for (UInt32 i = 0; i < kAcpiOsExecWorkers; i++) {
+        if (gAcpiOsExecThreads[i] == self) {
+            return (SInt32)i;
+        }
+    }
+    
+    return -1;
 }
 
 /*
- * Initialize ECAM/MMIO PCI Configuration Space Access
- * This sets up memory mapping for the PCI configuration space base
- * obtained from boot arguments or MCFG table.
+ * Callbacks that can still finish without help from the blocked waiters: running ones
+ * whose worker isn't waiting, and queued ones that will get a slot and a worker. What's
+ * queued behind a blocked callback in a queue it fills up can't start until that wait
+ * ends, so it doesn't count. Caller holds gAcpiOsExecLock.
  */
-static ACPI_STATUS InitializePCIEcam(void)
+static UInt32 AcpiOsExecProgressing(void)
 {
-    if (gPCIEcamAvailable) {
-        return AE_OK;
-    }
+    bool workersFree = gAcpiOsExecWorkersBlocked < gAcpiOsExecWorkersLive;
+    UInt32 count = 0;
     
-    /* Use boot args data if available */
-    if (gPCIFromPE.Address != 0) {
-        ACPI_SIZE ecam_size = (gPCIFromPE.EndBusNumber - gPCIFromPE.StartBusNumber + 1) * 256 * 4096;
+    for (UInt32 i = 0; i < kAcpiOsExecQueues; i++) {
+        AcpiOsExecQueue *queue = &gAcpiOsExecQueues[i];
+        UInt32 running = queue->Running - queue->Blocked;
         
-        IOMemoryDescriptor *desc = IOMemoryDescriptor::withAddressRange(
-            gPCIFromPE.Address, ecam_size, 
-            kIOMemoryDirectionInOut | kIOMemoryMapperNone, 
-            kernel_task
-        );
+        count += running;
+        if (workersFree && (running || queue->Running < queue->Limit)) {
+            count += queue->Depth;
+        }
+    }
+    
+    return count;
+}
+
+static void AcpiOsExecTerminate(void);
+
+static void AcpiOsExecInitialize(void)
+{
+    gAcpiOsExecLock = IOSimpleLockAlloc();
+    gAcpiOsExecItems = (AcpiOsExecItem *)IOMallocZero(sizeof(AcpiOsExecItem) * kAcpiOsExecItems);
+    if (!gAcpiOsExecLock || !gAcpiOsExecItems) {
+        IOLog("ACPI: Failed to set up deferred execution, callbacks will be refused\n");
+        AcpiOsExecTerminate();
+        return;
+    }
+    
+    for (UInt32 i = 0; i < kAcpiOsExecItems; i++) {
+        gAcpiOsExecItems[i].Next = gAcpiOsExecFree;
+        gAcpiOsExecFree = &gAcpiOsExecItems[i];
+    }
+    
+    for (UInt32 i = 0; i < kAcpiOsExecWorkers; i++) {
+        thread_t thread;
+        if (kernel_thread_start(&AcpiOsExecWorker, (void *)(uintptr_t)i, &thread) != KERN_SUCCESS) {
+            break;
+        }
         
+        /* The reference is kept so AcpiOsExecWorkerIndex can recognise the thread. */
+        gAcpiOsExecThreads[i] = thread;
+        IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+        gAcpiOsExecWorkersLive++;
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+    }
+    
+    if (!gAcpiOsExecWorkersLive) {
+        /* Nothing would ever drain the queues, so don't accept work into them. */
+        IOLog("ACPI: Failed to start any execution workers, callbacks will be refused\n");
+        AcpiOsExecTerminate();
+    }
+}
+
+static void AcpiOsExecTerminate(void)
+{
+    if (!gAcpiOsExecLock) {
+        if (gAcpiOsExecItems) {
+            IOFree(gAcpiOsExecItems, sizeof(AcpiOsExecItem) * kAcpiOsExecItems);
+            gAcpiOsExecItems = NULL;
+        }
+        return;
+    }
+    
+    /* Let the workers finish what's queued, then wait for them to exit. */
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+    gAcpiOsExecStopping = true;
+    thread_wakeup(&gAcpiOsExecQueues);
+    
+    while (gAcpiOsExecWorkersLive) {
+        assert_wait(&gAcpiOsExecWorkersLive, THREAD_UNINT);
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+        thread_block(THREAD_CONTINUE_NULL);
+        is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+    }
+    
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+    
+    for (UInt32 i = 0; i < kAcpiOsExecWorkers; i++) {
+        if (gAcpiOsExecThreads[i]) {
+            thread_deallocate(gAcpiOsExecThreads[i]);
+            gAcpiOsExecThreads[i] = NULL;
+        }
+    }
+    
+    if (gAcpiOsExecItems) {
+        IOFree(gAcpiOsExecItems, sizeof(AcpiOsExecItem) * kAcpiOsExecItems);
+        gAcpiOsExecItems = NULL;
+        gAcpiOsExecFree = NULL;
+    }
+    
+    IOSimpleLockFree(gAcpiOsExecLock);
+    gAcpiOsExecLock = NULL;
+    gAcpiOsExecStopping = false;
+}
+
+/*
+ * Describe an ECAM range to the window table. Address is the base of bus 0 in the
+ * segment, as in the MCFG, so bus N lives at Address + (N << 20). Nothing is mapped
+ * here; AcpiOsExtGetPciConfigAddress maps a bus the first time it is used.
+ */
+extern "C" ACPI_STATUS AcpiOsExtRegisterPciEcam(UInt16 Segment, UInt8 StartBus, UInt8 EndBus, ACPI_PHYSICAL_ADDRESS Address)
+{
+    if (Address == 0 || StartBus > EndBus) {
+        return AE_BAD_PARAMETER;
+    }
+
+    IOLockLock(gAcpiOsEcamLock);
+
+    AcpiOsEcamSegmentChunk *chunk = gAcpiOsEcamDirectory[Segment >> kAcpiOsEcamSegmentChunkShift];
+    if (!chunk) {
+        chunk = (AcpiOsEcamSegmentChunk *)IOMallocZero(sizeof(AcpiOsEcamSegmentChunk));
+        if (!chunk) {
+            IOLockUnlock(gAcpiOsEcamLock);
+            return AE_NO_MEMORY;
+        }
+        __atomic_store_n(&gAcpiOsEcamDirectory[Segment >> kAcpiOsEcamSegmentChunkShift], chunk, __ATOMIC_RELEASE);
+    }
+
+    AcpiOsEcamSegment *seg = chunk->Segment[Segment & (kAcpiOsEcamSegmentChunkSize - 1)];
+    if (!seg) {
+        seg = (AcpiOsEcamSegment *)IOMallocZero(sizeof(AcpiOsEcamSegment));
+        if (!seg) {
+            IOLockUnlock(gAcpiOsEcamLock);
+            return AE_NO_MEMORY;
+        }
+        __atomic_store_n(&chunk->Segment[Segment & (kAcpiOsEcamSegmentChunkSize - 1)], seg, __ATOMIC_RELEASE);
+        gAcpiOsEcamSegmentCount++;
+    }
+
+    for (UInt32 bus = StartBus; bus <= EndBus; bus++) {
+        /* Windows that are already mapped stay where they are. */
+        if (!seg->Bus[bus].Map) {
+            seg->Bus[bus].PhysicalAddress = Address + ((UInt64)bus << kAcpiOsEcamBusWindowShift);
+        }
+    }
+
+    IOLockUnlock(gAcpiOsEcamLock);
+
+    IOLog("ACPI: ECAM segment %u, buses %u-%u at 0x%llx\n", Segment, StartBus, EndBus, (UInt64)Address);
+    return AE_OK;
+}
+
+/*
+ * Feed every MCFG allocation into the window table. The PE calls this once it has the
+ * table catalogued, and osdarwin.c calls it if ACPICA touches config space first;
+ * whoever comes second finds the table already loaded and returns.
+ */
+extern "C" ACPI_STATUS AcpiOsExtRegisterPciEcamTable(const ACPI_TABLE_MCFG *Mcfg)
+{
+    if (!Mcfg || Mcfg->Header.Length < sizeof(ACPI_TABLE_MCFG)) {
+        return AE_BAD_PARAMETER;
+    }
+
+    if (__atomic_load_n(&gAcpiOsEcamMcfgLoaded, __ATOMIC_ACQUIRE)) {
+        return AE_OK;
+    }
+
+    const ACPI_MCFG_ALLOCATION *alloc = (const ACPI_MCFG_ALLOCATION *)((const UInt8 *)Mcfg + sizeof(ACPI_TABLE_MCFG));
+    UInt32 count = (Mcfg->Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION);
+
+    for (UInt32 i = 0; i < count; i++) {
+        ACPI_STATUS status = AcpiOsExtRegisterPciEcam(alloc[i].PciSegment, alloc[i].StartBusNumber,
+                                                      alloc[i].EndBusNumber, alloc[i].Address);
+        if (ACPI_FAILURE(status)) {
+            IOLog("ACPI: MCFG entry %u (segment %u) rejected: %s\n", i, alloc[i].PciSegment, AcpiFormatException(status));
+        }
+    }
+
+    __atomic_store_n(&gAcpiOsEcamMcfgLoaded, true, __ATOMIC_RELEASE);
+    return AE_OK;
+}
+
+static volatile UInt8 *AcpiOsEcamMapBus(AcpiOsEcamBus *bus)
+{
+    IOLockLock(gAcpiOsEcamLock);
+
+    /* Someone may have beaten us to it. */
+    if (!bus->Window && bus->PhysicalAddress) {
+        IOMemoryDescriptor *desc = IOMemoryDescriptor::withAddressRange(bus->PhysicalAddress, kAcpiOsEcamBusWindowSize,
+                                                                        kIOMemoryDirectionInOut | kIOMemoryMapperNone,
+                                                                        kernel_task);
         if (desc) {
-            gPCIEcamMap = desc->map();
-            if (gPCIEcamMap) {
-                gPCIEcamVirtualBase = (void *)gPCIEcamMap->getVirtualAddress();
-                gPCIEcamAvailable = true;
-                
-                IOLog("ACPI: ECAM initialized at 0x%llx, buses %d-%d\n", 
-                      gPCIFromPE.Address, gPCIFromPE.StartBusNumber, gPCIFromPE.EndBusNumber);
+            IOMemoryMap *map = desc->map(kIOMapInhibitCache);
+            if (map) {
+                bus->Map = map;
+                __atomic_store_n(&bus->Window, (volatile UInt8 *)map->getVirtualAddress(), __ATOMIC_RELEASE);
+                OSIncrementAtomic64(&gAcpiOsEcamWindowsMapped);
             }
             desc->release();
         }
     }
+
+    IOLockUnlock(gAcpiOsEcamLock);
+    return bus->Window;
+}
+
+/*
+ * Type 1 config access is an address write to 0xCF8 followed by a data cycle on 0xCFC, and
+ * the address latch is shared by every CPU. The pair is done under this lock with interrupts
+ * off so that neither another CPU nor an interrupt handler can retarget the latch in between.
+ * Before AcpiOsExtInitialize only the boot CPU is running, so disabling interrupts is enough.
+ */
+static IOSimpleLock *gAcpiOsPciConfigPortLock;
+
+extern "C" IOInterruptState AcpiOsExtLockPciConfigPorts(void)
+{
+    if (!gAcpiOsPciConfigPortLock) {
+        return (IOInterruptState)ml_set_interrupts_enabled(FALSE);
+    }
     
-    return gPCIEcamAvailable ? AE_OK : AE_NOT_FOUND;
+    return IOSimpleLockLockDisableInterrupt(gAcpiOsPciConfigPortLock);
+}
+
+extern "C" void AcpiOsExtUnlockPciConfigPorts(IOInterruptState State)
+{
+    if (!gAcpiOsPciConfigPortLock) {
+        ml_set_interrupts_enabled((boolean_t)State);
+        return;
+    }
+    
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsPciConfigPortLock, State);
+}
+
+/*
+ * Returns the kernel virtual address of a config register, or NULL if the function
+ * isn't reachable through ECAM. A window that isn't mapped yet can't be mapped with
+ * interrupts off, so those callers get NULL and should fall back to port I/O.
+ */
+extern "C" void *AcpiOsExtGetPciConfigAddress(UInt16 Segment, UInt8 Bus, UInt8 Device, UInt8 Function, UInt32 Register)
+{
+    if (Device > 31 || Function > 7 || Register > 0xFFF) {
+        return NULL;
+    }
+
+    AcpiOsEcamSegmentChunk *chunk = __atomic_load_n(&gAcpiOsEcamDirectory[Segment >> kAcpiOsEcamSegmentChunkShift], __ATOMIC_ACQUIRE);
+    AcpiOsEcamSegment *seg = chunk ? __atomic_load_n(&chunk->Segment[Segment & (kAcpiOsEcamSegmentChunkSize - 1)], __ATOMIC_ACQUIRE) : NULL;
+    if (!seg) {
+        OSIncrementAtomic64(&gAcpiOsEcamFallbacks);
+        return NULL;
+    }
+
+    AcpiOsEcamBus *bus = &seg->Bus[Bus];
+    volatile UInt8 *window = __atomic_load_n(&bus->Window, __ATOMIC_ACQUIRE);
+
+    if (window) {
+        OSIncrementAtomic64(&gAcpiOsEcamMapsAvoided);
+    } else if (bus->PhysicalAddress && ml_get_interrupts_enabled() && !ml_at_interrupt_context()) {
+        window = AcpiOsEcamMapBus(bus);
+    }
+
+    if (!window) {
+        OSIncrementAtomic64(&gAcpiOsEcamFallbacks);
+        return NULL;
+    }
+
+    return (void *)(window + ((UInt32)Device << 15) + ((UInt32)Function << 12) + Register);
+}
+
+static void AcpiOsEcamTerminate(void)
+{
+    for (UInt32 i = 0; i < (65536 >> kAcpiOsEcamSegmentChunkShift); i++) {
+        AcpiOsEcamSegmentChunk *chunk = gAcpiOsEcamDirectory[i];
+        if (!chunk) {
+            continue;
+        }
+
+        for (UInt32 j = 0; j < kAcpiOsEcamSegmentChunkSize; j++) {
+            AcpiOsEcamSegment *seg = chunk->Segment[j];
+            if (!seg) {
+                continue;
+            }
+
+            for (UInt32 bus = 0; bus < 256; bus++) {
+                OSSafeReleaseNULL(seg->Bus[bus].Map);
+            }
+
+            IOFree(seg, sizeof(AcpiOsEcamSegment));
+        }
+
+        IOFree(chunk, sizeof(AcpiOsEcamSegmentChunk));
+        gAcpiOsEcamDirectory[i] = NULL;
+    }
+
+    gAcpiOsEcamSegmentCount = 0;
+    gAcpiOsEcamMcfgLoaded = false;
 }
 
 ACPI_STATUS AcpiOsExtInitialize(void)
 {
     /* Initialize local resources. */
     gAcpiOsExtMemoryMapLock = IOLockAlloc();
-    gAcpiOsExtMemoryMapSet = OSSet::withCapacity(4); /* OSSet's can expand if need be, right? */
-    gAcpiOsExtMemoryMapIterator = OSCollectionIterator::withCollection(gAcpiOsExtMemoryMapSet);
 
-    /* Initialize execution tracking */
-    gExecutionLock = IOLockAlloc();
-    gPendingExecutions = 0;
+    gAcpiOsEcamLock = IOLockAlloc();
+    gAcpiOsPciConfigPortLock = IOSimpleLockAlloc();
+
+    gAcpiOsPageCacheLock = IOSimpleLockAlloc();
+    PE_parse_boot_argn("acpi_nopagecache", &gAcpiOsPageCacheDisabled, sizeof(gAcpiOsPageCacheDisabled));
+    if (gAcpiOsPageCacheDisabled) {
+        IOLog("ACPI: register page cache disabled by boot-arg\n");
+    }
 
     /* init the execution system */
-    gAcpiOsThreadWorkLoop = IOWorkLoop::workLoop();
-    gAcpiOsThreadCommandGate = IOCommandGate::commandGate(NULL);
-    gAcpiOsThreadCommandGate->setWorkLoop(gAcpiOsThreadWorkLoop);
+    AcpiOsExecInitialize();
     
     /* Fetch MCFG data from PE boot args, at least until PlatformExpert updates the data. */
     boot_args *args = (boot_args *)PE_state.bootArgs;
@@ -164,47 +689,406 @@ ACPI_STATUS AcpiOsExtInitialize(void)
     gPCIFromPE.StartBusNumber = args->pciConfigSpaceStartBusNumber;
     gPCIFromPE.EndBusNumber = args->pciConfigSpaceEndBusNumber;
     
-    /* Initialize ECAM if available */
-    InitializePCIEcam();
+    /* The MCFG isn't loaded yet, so seed the ECAM window table with the booter's view of segment 0. */
+    if (gPCIFromPE.Address != 0) {
+        AcpiOsExtRegisterPciEcam(0, gPCIFromPE.StartBusNumber, gPCIFromPE.EndBusNumber, gPCIFromPE.Address);
+    }
     
     return AE_OK;
 }
 
-void *AcpiOsExtMapMemory(ACPI_PHYSICAL_ADDRESS addr, ACPI_SIZE size)
+/* The mapping containing va, if any. Caller holds gAcpiOsExtMemoryMapLock. */
+static AcpiOsMapping *AcpiOsMappingFindVirtual(IOVirtualAddress va)
 {
-    IOMemoryDescriptor *desc = IOMemoryDescriptor::withAddressRange(addr, size, kIOMemoryDirectionInOut | kIOMemoryMapperNone, kernel_task);
-    if (desc) {
-        IOMemoryMap *map = desc->map();
-        if (map) {
-            IOVirtualAddress va = map->getVirtualAddress();
-            IOLockLock(gAcpiOsExtMemoryMapLock);
-            gAcpiOsExtMemoryMapSet->setObject(map);
-            IOLockUnlock(gAcpiOsExtMemoryMapLock);
-            /* Don't release the map here - we need it for unmapping */
-            desc->release();
-            return (void *)va;
+    AcpiOsMapping *node = RB_ROOT(&gAcpiOsMappingsByVirtual);
+    AcpiOsMapping *floor = NULL;
+
+    while (node) {
+        if (node->VirtualBase <= va) {
+            floor = node;
+            node = RB_RIGHT(node, VirtualLink);
+        } else {
+            node = RB_LEFT(node, VirtualLink);
         }
-        desc->release();
     }
+
+    if (floor && va - floor->VirtualBase < floor->Length) {
+        return floor;
+    }
+
     return NULL;
 }
 
+/*
+ * The physically indexed mapping with the highest base below end. Since the physical
+ * index never holds overlapping ranges, it is the only one that can cover or overlap
+ * [start, end). Caller holds gAcpiOsExtMemoryMapLock.
+ */
+static AcpiOsMapping *AcpiOsMappingFindPhysical(ACPI_PHYSICAL_ADDRESS end)
+{
+    AcpiOsMapping *node = RB_ROOT(&gAcpiOsMappingsByPhysical);
+    AcpiOsMapping *floor = NULL;
+
+    while (node) {
+        if (node->PhysicalBase < end) {
+            floor = node;
+            node = RB_RIGHT(node, PhysicalLink);
+        } else {
+            node = RB_LEFT(node, PhysicalLink);
+        }
+    }
+
+    return floor;
+}
+
+/* Take a reference on an existing mapping that covers [start, end). Caller holds gAcpiOsExtMemoryMapLock. */
+static AcpiOsMapping *AcpiOsMappingRetainCovering(ACPI_PHYSICAL_ADDRESS start, ACPI_PHYSICAL_ADDRESS end)
+{
+    AcpiOsMapping *mapping = AcpiOsMappingFindPhysical(end);
+
+    if (mapping && mapping->PhysicalBase <= start && end <= mapping->PhysicalBase + mapping->Length) {
+        mapping->RefCount++;
+        gAcpiOsMappingHits++;
+        return mapping;
+    }
+
+    return NULL;
+}
+
+void *AcpiOsExtMapMemory(ACPI_PHYSICAL_ADDRESS addr, ACPI_SIZE size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    ACPI_PHYSICAL_ADDRESS start = addr & ~(ACPI_PHYSICAL_ADDRESS)PAGE_MASK;
+    ACPI_PHYSICAL_ADDRESS end = (addr + size + PAGE_MASK) & ~(ACPI_PHYSICAL_ADDRESS)PAGE_MASK;
+
+    IOLockLock(gAcpiOsExtMemoryMapLock);
+    gAcpiOsMappingRequests++;
+    AcpiOsMapping *mapping = AcpiOsMappingRetainCovering(start, end);
+    IOLockUnlock(gAcpiOsExtMemoryMapLock);
+
+    if (mapping) {
+        return (void *)(mapping->VirtualBase + (addr - mapping->PhysicalBase));
+    }
+
+    /* Nothing to share; build the mapping without holding the lock. */
+    IOMemoryDescriptor *desc = IOMemoryDescriptor::withAddressRange(start, end - start, kIOMemoryDirectionInOut | kIOMemoryMapperNone, kernel_task);
+    if (!desc) {
+        return NULL;
+    }
+
+    IOMemoryMap *map = desc->map();
+    desc->release();
+    if (!map) {
+        return NULL;
+    }
+
+    mapping = (AcpiOsMapping *)IOMallocZero(sizeof(AcpiOsMapping));
+    if (!mapping) {
+        map->release();
+        return NULL;
+    }
+
+    mapping->VirtualBase = map->getVirtualAddress();
+    mapping->PhysicalBase = start;
+    mapping->Length = end - start;
+    mapping->Map = map;
+    mapping->RefCount = 1;
+
+    IOLockLock(gAcpiOsExtMemoryMapLock);
+
+    /* Someone may have mapped the same range while we were unlocked; if so, use theirs. */
+    AcpiOsMapping *existing = AcpiOsMappingRetainCovering(start, end);
+    if (existing) {
+        IOLockUnlock(gAcpiOsExtMemoryMapLock);
+        map->release();
+        IOFree(mapping, sizeof(AcpiOsMapping));
+        return (void *)(existing->VirtualBase + (addr - existing->PhysicalBase));
+    }
+
+    RB_INSERT(AcpiOsMappingVirtualTree, &gAcpiOsMappingsByVirtual, mapping);
+
+    AcpiOsMapping *neighbour = AcpiOsMappingFindPhysical(end);
+    if (!neighbour || neighbour->PhysicalBase + neighbour->Length <= start) {
+        RB_INSERT(AcpiOsMappingPhysicalTree, &gAcpiOsMappingsByPhysical, mapping);
+        mapping->PhysicallyIndexed = true;
+    }
+
+    gAcpiOsMappingsLive++;
+    gAcpiOsMappingBytes += mapping->Length;
+
+    IOLockUnlock(gAcpiOsExtMemoryMapLock);
+
+    return (void *)(mapping->VirtualBase + (addr - start));
+}
+
 void AcpiOsExtUnmapMemory(void *p, ACPI_SIZE size)
 {
     IOVirtualAddress va = (IOVirtualAddress)p;
 
     IOLockLock(gAcpiOsExtMemoryMapLock);
-    gAcpiOsExtMemoryMapIterator->reset();
-    while (IOMemoryMap *map = OSDynamicCast(IOMemoryMap, gAcpiOsExtMemoryMapIterator->getNextObject())) {
-        if (map->getVirtualAddress() == va && map->getLength() == size) {
-            gAcpiOsExtMemoryMapSet->removeObject(map);
-            map->release(); /* Now we can release it */
+
+    AcpiOsMapping *mapping = AcpiOsMappingFindVirtual(va);
+    if (!mapping) {
+        IOLockUnlock(gAcpiOsExtMemoryMapLock);
+        IOLog("ACPI: AcpiOsUnmapMemory called on unknown address %p (size %llu)\n", p, (UInt64)size);
+        return;
+    }
+
+    if (--mapping->RefCount > 0) {
+        IOLockUnlock(gAcpiOsExtMemoryMapLock);
+        return;
+    }
+
+    RB_REMOVE(AcpiOsMappingVirtualTree, &gAcpiOsMappingsByVirtual, mapping);
+    if (mapping->PhysicallyIndexed) {
+        RB_REMOVE(AcpiOsMappingPhysicalTree, &gAcpiOsMappingsByPhysical, mapping);
+    }
+
+    gAcpiOsMappingsLive--;
+    gAcpiOsMappingBytes -= mapping->Length;
+
+    IOLockUnlock(gAcpiOsExtMemoryMapLock);
+
+    mapping->Map->release();
+    IOFree(mapping, sizeof(AcpiOsMapping));
+}
+
+/* Drop whatever ACPICA leaked; only called on the way out. */
+static void AcpiOsMappingTerminate(void)
+{
+    AcpiOsMapping *mapping;
+
+    while ((mapping = RB_MIN(AcpiOsMappingVirtualTree, &gAcpiOsMappingsByVirtual)) != NULL) {
+        RB_REMOVE(AcpiOsMappingVirtualTree, &gAcpiOsMappingsByVirtual, mapping);
+        if (mapping->PhysicallyIndexed) {
+            RB_REMOVE(AcpiOsMappingPhysicalTree, &gAcpiOsMappingsByPhysical, mapping);
+        }
+
+        mapping->Map->release();
+        IOFree(mapping, sizeof(AcpiOsMapping));
+    }
+
+    gAcpiOsMappingsLive = 0;
+    gAcpiOsMappingBytes = 0;
+}
+
+/*
+ * Keep [Address, Address + Length) out of the register page cache, for registers
+ * with side effects that must always go through ml_phys_*. The cache works in whole
+ * pages, so the range is widened to the pages it touches. Pages already cached in
+ * that range are left alone until they age out, so call this early.
+ */
+extern "C" ACPI_STATUS AcpiOsExtExcludeFromPageCache(ACPI_PHYSICAL_ADDRESS Address, ACPI_SIZE Length)
+{
+    if (Length == 0) {
+        return AE_BAD_PARAMETER;
+    }
+    if (!gAcpiOsPageCacheLock) {
+        return AE_NOT_EXIST;
+    }
+
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsPageCacheLock);
+
+    if (gAcpiOsPageCacheExclusionCount == kAcpiOsPageCacheExclusions) {
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+        return AE_LIMIT;
+    }
+
+    AcpiOsPageCacheExclusion *ex = &gAcpiOsPageCacheExclusions[gAcpiOsPageCacheExclusionCount++];
+    ex->Start = Address & ~(ACPI_PHYSICAL_ADDRESS)PAGE_MASK;
+    ex->End = (Address + Length + PAGE_MASK) & ~(ACPI_PHYSICAL_ADDRESS)PAGE_MASK;
+
+    for (UInt32 i = 0; i < kAcpiOsPageCacheEntries; i++) {
+        if (gAcpiOsPageCache[i].Map && gAcpiOsPageCache[i].PhysicalPage >= ex->Start && gAcpiOsPageCache[i].PhysicalPage < ex->End) {
+            /* Can't release the map with the lock held; just stop handing it out. */
+            gAcpiOsPageCache[i].PhysicalPage = (ACPI_PHYSICAL_ADDRESS)-1;
+        }
+    }
+
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+    return AE_OK;
+}
+
+static bool AcpiOsPageCacheExcluded(ACPI_PHYSICAL_ADDRESS Page)
+{
+    for (UInt32 i = 0; i < gAcpiOsPageCacheExclusionCount; i++) {
+        if (Page >= gAcpiOsPageCacheExclusions[i].Start && Page < gAcpiOsPageCacheExclusions[i].End) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Note a miss on Page and say whether it has earned a slot, i.e. whether it missed
+ * recently enough to still be a candidate. Caller holds gAcpiOsPageCacheLock.
+ */
+static bool AcpiOsPageCacheAdmit(ACPI_PHYSICAL_ADDRESS Page)
+{
+    for (UInt32 i = 0; i < kAcpiOsPageCacheCandidates; i++) {
+        if (gAcpiOsPageCacheCandidates[i] == Page + 1) {
+            gAcpiOsPageCacheCandidates[i] = 0;
+            return true;
+        }
+    }
+
+    /* Stored off by one so that physical page 0 doesn't look like an empty slot. */
+    gAcpiOsPageCacheCandidates[gAcpiOsPageCacheNextCandidate] = Page + 1;
+    gAcpiOsPageCacheNextCandidate = (gAcpiOsPageCacheNextCandidate + 1) % kAcpiOsPageCacheCandidates;
+    return false;
+}
+
+/* Caller holds gAcpiOsPageCacheLock. */
+static AcpiOsPageCacheEntry *AcpiOsPageCacheLookup(ACPI_PHYSICAL_ADDRESS Page)
+{
+    for (UInt32 i = 0; i < kAcpiOsPageCacheEntries; i++) {
+        if (gAcpiOsPageCache[i].Map && gAcpiOsPageCache[i].PhysicalPage == Page) {
+            gAcpiOsPageCache[i].LastUse = ++gAcpiOsPageCacheClock;
+            return &gAcpiOsPageCache[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void AcpiOsPageCacheAccess(volatile UInt8 *Register, UInt64 *Value, UInt32 Width, bool Write)
+{
+    switch (Width) {
+        case 8:
+            if (Write) *(volatile UInt8 *)Register = (UInt8)*Value; else *Value = *(volatile UInt8 *)Register;
+            break;
+        case 16:
+            if (Write) *(volatile UInt16 *)Register = (UInt16)*Value; else *Value = *(volatile UInt16 *)Register;
+            break;
+        case 32:
+            if (Write) *(volatile UInt32 *)Register = (UInt32)*Value; else *Value = *(volatile UInt32 *)Register;
+            break;
+        case 64:
+            if (Write) *(volatile UInt64 *)Register = *Value; else *Value = *(volatile UInt64 *)Register;
             break;
+    }
+}
+
+/*
+ * Do a Width-bit access to physical Address through the page cache. Returns
+ * AE_NOT_FOUND if the caller has to fall back to ml_phys_* instead.
+ */
+static ACPI_STATUS AcpiOsPageCacheTransfer(ACPI_PHYSICAL_ADDRESS Address, UInt64 *Value, UInt32 Width, bool Write)
+{
+    ACPI_PHYSICAL_ADDRESS page = Address & ~(ACPI_PHYSICAL_ADDRESS)PAGE_MASK;
+    UInt32 offset = (UInt32)(Address & PAGE_MASK);
+
+    /* Accesses that straddle a page boundary aren't worth the trouble. */
+    if (gAcpiOsPageCacheDisabled || !gAcpiOsPageCacheLock || offset + (Width / 8) > PAGE_SIZE) {
+        OSIncrementAtomic64(&gAcpiOsPageCacheFallbacks);
+        return AE_NOT_FOUND;
+    }
+
+    bool canMap = ml_get_interrupts_enabled() && !ml_at_interrupt_context();
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsPageCacheLock);
+
+    if (AcpiOsPageCacheExcluded(page)) {
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+        OSIncrementAtomic64(&gAcpiOsPageCacheFallbacks);
+        return AE_NOT_FOUND;
+    }
+
+    AcpiOsPageCacheEntry *entry = AcpiOsPageCacheLookup(page);
+    if (entry) {
+        AcpiOsPageCacheAccess(entry->VirtualPage + offset, Value, Width, Write);
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+        OSIncrementAtomic64(&gAcpiOsPageCacheHits);
+        return AE_OK;
+    }
+
+    OSIncrementAtomic64(&gAcpiOsPageCacheMisses);
+
+    /* Mapping can block; canMap was sampled before the lock turned interrupts off. */
+    if (!canMap || !AcpiOsPageCacheAdmit(page)) {
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+        if (canMap) {
+            OSIncrementAtomic64(&gAcpiOsPageCacheDeferred);
         }
+        OSIncrementAtomic64(&gAcpiOsPageCacheFallbacks);
+        return AE_NOT_FOUND;
     }
-    IOLockUnlock(gAcpiOsExtMemoryMapLock);
+
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+
+    IOMemoryDescriptor *desc = IOMemoryDescriptor::withAddressRange(page, PAGE_SIZE, kIOMemoryDirectionInOut | kIOMemoryMapperNone, kernel_task);
+    if (!desc) {
+        OSIncrementAtomic64(&gAcpiOsPageCacheFallbacks);
+        return AE_NOT_FOUND;
+    }
+
+    IOMemoryMap *map = desc->map();
+    desc->release();
+    if (!map) {
+        OSIncrementAtomic64(&gAcpiOsPageCacheFallbacks);
+        return AE_NOT_FOUND;
+    }
+
+    IOMemoryMap *evicted = NULL;
+
+    is = IOSimpleLockLockDisableInterrupt(gAcpiOsPageCacheLock);
+
+    entry = AcpiOsPageCacheLookup(page);
+    if (entry) {
+        /* Lost the race; the page we just mapped goes straight back. */
+        evicted = map;
+    } else {
+        entry = &gAcpiOsPageCache[0];
+        for (UInt32 i = 1; i < kAcpiOsPageCacheEntries && entry->Map; i++) {
+            if (!gAcpiOsPageCache[i].Map || gAcpiOsPageCache[i].LastUse < entry->LastUse) {
+                entry = &gAcpiOsPageCache[i];
+            }
+        }
+
+        evicted = entry->Map;
+        entry->PhysicalPage = page;
+        entry->Map = map;
+        entry->VirtualPage = (volatile UInt8 *)map->getVirtualAddress();
+        entry->LastUse = ++gAcpiOsPageCacheClock;
+    }
+
+    AcpiOsPageCacheAccess(entry->VirtualPage + offset, Value, Width, Write);
+
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsPageCacheLock, is);
+
+    if (evicted) {
+        if (evicted != map) {
+            OSIncrementAtomic64(&gAcpiOsPageCacheEvictions);
+        }
+        evicted->release();
+    }
+
+    return AE_OK;
 }
 
+extern "C" ACPI_STATUS AcpiOsExtReadMemory(ACPI_PHYSICAL_ADDRESS Address, UInt64 *Value, UInt32 Width)
+{
+    return AcpiOsPageCacheTransfer(Address, Value, Width, false);
+}
+
+extern "C" ACPI_STATUS AcpiOsExtWriteMemory(ACPI_PHYSICAL_ADDRESS Address, UInt64 Value, UInt32 Width)
+{
+    return AcpiOsPageCacheTransfer(Address, &Value, Width, true);
+}
+
+static void AcpiOsPageCacheTerminate(void)
+{
+    for (UInt32 i = 0; i < kAcpiOsPageCacheEntries; i++) {
+        OSSafeReleaseNULL(gAcpiOsPageCache[i].Map);
+        gAcpiOsPageCache[i].VirtualPage = NULL;
+    }
+
+    bzero(gAcpiOsPageCacheCandidates, sizeof(gAcpiOsPageCacheCandidates));
+    gAcpiOsPageCacheExclusionCount = 0;
+}
 
 /* Locate the EFI configuration table */
 ACPI_PHYSICAL_ADDRESS AcpiOsExtGetRootPointer(void)
@@ -247,74 +1131,115 @@ ACPI_PHYSICAL_ADDRESS AcpiOsExtGetRootPointer(void)
     return 0;
 }
 
+/*
+ * Queue a callback for one of the workers. Safe to call from interrupt context: the callback
+ * never runs on the caller's stack. If the item pool is exhausted, or there are no workers to
+ * serve the queues, the request is refused rather than allocated, and ACPICA reports it.
+ * Work queued while the workers are still starting is picked up as soon as they run.
+ */
 ACPI_STATUS AcpiOsExtExecute(ACPI_EXECUTE_TYPE Type, ACPI_OSD_EXEC_CALLBACK Function, void *Context)
 {
-    _iocmdq_callback_data *d = (_iocmdq_callback_data *)IOMalloc(sizeof(_iocmdq_callback_data));
-    if (!d) {
+    if (!Function || (UInt32)Type >= kAcpiOsExecQueues) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    if (!gAcpiOsExecLock) {
         return AE_NO_MEMORY;
     }
     
-    d->Callback = Function;
-    d->Context = Context;
+    AcpiOsExecQueue *queue = &gAcpiOsExecQueues[Type];
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
     
-    /* Track pending executions */
-    IOLockLock(gExecutionLock);
-    gPendingExecutions++;
-    IOLockUnlock(gExecutionLock);
+    AcpiOsExecItem *item = gAcpiOsExecFree;
+    if (!item || gAcpiOsExecStopping) {
+        queue->Rejected++;
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+        return AE_NO_MEMORY;
+    }
     
-    IOReturn result = gAcpiOsThreadCommandGate->runAction(&AcpiOsThreadDispatch, d);
+    gAcpiOsExecFree = item->Next;
+    item->Next = NULL;
+    item->Callback = Function;
+    item->Context = Context;
+    item->QueuedAt = mach_absolute_time();
     
-    /* If execution failed, decrement counter */
-    if (result != kIOReturnSuccess) {
-        IOLockLock(gExecutionLock);
-        if (gPendingExecutions > 0) {
-            gPendingExecutions--;
-        }
-        IOLockUnlock(gExecutionLock);
-        IOFree(d, sizeof(_iocmdq_callback_data));
-        return AE_ERROR;
+    if (queue->Tail) {
+        queue->Tail->Next = item;
+    } else {
+        queue->Head = item;
     }
+    queue->Tail = item;
     
+    queue->Queued++;
+    if (++queue->Depth > queue->PeakDepth) {
+        queue->PeakDepth = queue->Depth;
+    }
+    gAcpiOsExecPending++;
+    
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+    
+    thread_wakeup_one(&gAcpiOsExecQueues);
     return AE_OK;
 }
 
 /*
- * Wait for all pending ACPI executions to complete
- * This addresses the previous comment: "How do I check that my IOCommandGate has finished all of it's runAction calls?"
+ * Block until everything queued through AcpiOsExtExecute that can still run has run. A
+ * callback that calls this (e.g. by removing a handler) doesn't wait for itself, for work
+ * stuck behind it in its own queue, or for another callback that is waiting too; either
+ * would never finish. Gives up with AE_TIME after kAcpiOsExecWaitTimeoutMs.
  */
-void AcpiOsExtWaitEventsComplete(void)
+ACPI_STATUS AcpiOsExtWaitEventsComplete(void)
 {
-    const int max_wait_ms = 5000; /* Maximum wait time: 5 seconds */
-    const int poll_interval_ms = 10; /* Poll every 10ms */
-    int waited_ms = 0;
+    if (!gAcpiOsExecLock) {
+        return AE_OK;
+    }
     
-    /* Poll until all executions complete or timeout */
-    while (waited_ms < max_wait_ms) {
-        IOLockLock(gExecutionLock);
-        UInt32 pending = gPendingExecutions;
-        IOLockUnlock(gExecutionLock);
+    ACPI_STATUS status = AE_OK;
+    SInt32 self = AcpiOsExecWorkerIndex();
+    uint64_t deadline;
+    clock_interval_to_deadline(kAcpiOsExecWaitTimeoutMs, kMillisecondScale, &deadline);
+    
+    IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+    AcpiOsExecQueue *queue = self >= 0 ? gAcpiOsExecCurrent[self] : NULL;
+    gAcpiOsExecWaiters++;
+    if (queue) {
+        /* Others may have been counting on us; let them look again. */
+        queue->Blocked++;
+        gAcpiOsExecWorkersBlocked++;
+        thread_wakeup(&gAcpiOsExecPending);
+    }
+    
+    while (AcpiOsExecProgressing()) {
+        assert_wait_deadline(&gAcpiOsExecPending, THREAD_UNINT, deadline);
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+        wait_result_t result = thread_block(THREAD_CONTINUE_NULL);
+        is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
         
-        if (pending == 0) {
-            break; /* All executions completed */
+        if (result == THREAD_TIMED_OUT && AcpiOsExecProgressing()) {
+            status = AE_TIME;
+            break;
         }
-        
-        IOSleep(poll_interval_ms);
-        waited_ms += poll_interval_ms;
     }
     
-    if (waited_ms >= max_wait_ms) {
-        IOLockLock(gExecutionLock);
-        UInt32 remaining = gPendingExecutions;
-        IOLockUnlock(gExecutionLock);
-        
-        IOLog("ACPI: Warning - %u executions still pending after %d ms timeout\n", 
-              remaining, max_wait_ms);
+    UInt32 remaining = AcpiOsExecProgressing();
+    if (queue) {
+        queue->Blocked--;
+        gAcpiOsExecWorkersBlocked--;
+    }
+    gAcpiOsExecWaiters--;
+    IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+    
+    if (ACPI_FAILURE(status)) {
+        IOLog("ACPI: Warning - %u executions still pending after %d ms, giving up\n",
+              remaining, kAcpiOsExecWaitTimeoutMs);
     }
+    return status;
 }
 
 /*
- * Enhanced PCI Configuration Space Access using ECAM/MMIO
- * This implements the missing AcpiOsReadPCIConfigSpace function
+ * Kext-side PCI Configuration Space Access
+ * Routed through pci_config_access.h, which tries the ECAM window for (segment, bus)
+ * before falling back to CF8/CFC on segment 0.
  */
 ACPI_STATUS AcpiOsReadPCIConfigSpace(ACPI_PCI_ID *PciId, UInt32 Reg, UInt64 *Value, UInt32 Width) 
 {
@@ -326,41 +1251,19 @@ ACPI_STATUS AcpiOsReadPCIConfigSpace(ACPI_PCI_ID *PciId, UInt32 Reg, UInt64 *Val
         return AE_BAD_PARAMETER;
     }
     
-    /* Try ECAM/MMIO first if available */
-    if (gPCIEcamAvailable && gPCIEcamVirtualBase &&
-        PciId->Bus >= gPCIFromPE.StartBusNumber && 
-        PciId->Bus <= gPCIFromPE.EndBusNumber) {
-        
-        /* Calculate ECAM offset: (Bus << 20) + (Device << 15) + (Function << 12) + Register */
-        UInt32 bus_offset = (PciId->Bus - gPCIFromPE.StartBusNumber) << 20;
-        UInt32 device_offset = PciId->Device << 15;
-        UInt32 function_offset = PciId->Function << 12;
-        UInt32 total_offset = bus_offset + device_offset + function_offset + Reg;
-        
-        void *config_addr = (char *)gPCIEcamVirtualBase + total_offset;
-        
-        switch (Width) {
-            case 8:
-                *Value = *(UInt8 *)config_addr;
-                break;
-            case 16:
-                *Value = *(UInt16 *)config_addr;
-                break;
-            case 32:
-                *Value = *(UInt32 *)config_addr;
-                break;
-        }
-        
-        return AE_OK;
+    if (Reg > 0xFFF) {
+        return AE_BAD_PARAMETER;
     }
     
-    /* Fallback: This should call the legacy port I/O method */
-    /* For now, return error - the caller should use AcpiOsReadPciConfiguration from osdarwin.c */
-    return AE_NOT_IMPLEMENTED;
+    if (!pciConfigRead(PciId->Segment, PciId->Bus, PciId->Device, PciId->Function, (UInt16)Reg, Width, Value)) {
+        return AE_NOT_EXIST;
+    }
+    
+    return AE_OK;
 }
 
 /*
- * Write PCI Configuration Space using ECAM/MMIO
+ * Write PCI Configuration Space
  * Companion function to AcpiOsReadPCIConfigSpace
  */
 ACPI_STATUS AcpiOsWritePCIConfigSpace(ACPI_PCI_ID *PciId, UInt32 Reg, UInt64 Value, UInt32 Width)
@@ -373,36 +1276,15 @@ ACPI_STATUS AcpiOsWritePCIConfigSpace(ACPI_PCI_ID *PciId, UInt32 Reg, UInt64 Val
         return AE_BAD_PARAMETER;
     }
     
-    /* Try ECAM/MMIO first if available */
-    if (gPCIEcamAvailable && gPCIEcamVirtualBase &&
-        PciId->Bus >= gPCIFromPE.StartBusNumber && 
-        PciId->Bus <= gPCIFromPE.EndBusNumber) {
-        
-        /* Calculate ECAM offset */
-        UInt32 bus_offset = (PciId->Bus - gPCIFromPE.StartBusNumber) << 20;
-        UInt32 device_offset = PciId->Device << 15;
-        UInt32 function_offset = PciId->Function << 12;
-        UInt32 total_offset = bus_offset + device_offset + function_offset + Reg;
-        
-        void *config_addr = (char *)gPCIEcamVirtualBase + total_offset;
-        
-        switch (Width) {
-            case 8:
-                *(UInt8 *)config_addr = (UInt8)Value;
-                break;
-            case 16:
-                *(UInt16 *)config_addr = (UInt16)Value;
-                break;
-            case 32:
-                *(UInt32 *)config_addr = (UInt32)Value;
-                break;
-        }
-        
-        return AE_OK;
+    if (Reg > 0xFFF) {
+        return AE_BAD_PARAMETER;
+    }
+    
+    if (!pciConfigWrite(PciId->Segment, PciId->Bus, PciId->Device, PciId->Function, (UInt16)Reg, Width, Value)) {
+        return AE_NOT_EXIST;
     }
     
-    /* Fallback: This should call the legacy port I/O method */
-    return AE_NOT_IMPLEMENTED;
+    return AE_OK;
 }
 
 /*
@@ -501,53 +1383,315 @@ IOReturn AcpiStatus2IOReturn(ACPI_STATUS stat)
 }
 
 /*
- * Cleanup function for AcpiOsLayer resources
- * Should be called during termination
+ * OS layer counters, published by PDACPIPlatformExpert under "ACPI Statistics".
+ * Each subsystem gets its own sub-dictionary.
  */
-ACPI_STATUS AcpiOsExtTerminate(void)
+#define kAcpiOsMaxReportedCaches 24
+#define kAcpiOsMaxReportedMutexes 64
+
+static void AcpiOsSetStatistic(OSDictionary *dict, const char *key, UInt64 value)
 {
-    /* Wait for all pending executions to complete */
-    AcpiOsExtWaitEventsComplete();
-    
-    /* Cleanup ECAM mapping */
-    if (gPCIEcamMap) {
-        gPCIEcamMap->release();
-        gPCIEcamMap = NULL;
-        gPCIEcamVirtualBase = NULL;
-        gPCIEcamAvailable = false;
+    OSNumber *num = OSNumber::withNumber(value, 64);
+    if (num) {
+        dict->setObject(key, num);
+        num->release();
     }
-    
-    /* Cleanup work loop and command gate */
-    if (gAcpiOsThreadCommandGate) {
-        gAcpiOsThreadCommandGate->release();
-        gAcpiOsThreadCommandGate = NULL;
+}
+
+/* A log2 histogram as a dictionary keyed by bucket bound, skipping the empty buckets. */
+static void AcpiOsSetHistogram(OSDictionary *dict, const char *key, const uint64_t *buckets)
+{
+    OSDictionary *histogram = OSDictionary::withCapacity(ACPI_DARWIN_MUTEX_BUCKETS);
+    if (!histogram) {
+        return;
     }
     
-    if (gAcpiOsThreadWorkLoop) {
-        gAcpiOsThreadWorkLoop->release();
-        gAcpiOsThreadWorkLoop = NULL;
+    for (UInt32 i = 0; i < ACPI_DARWIN_MUTEX_BUCKETS; i++) {
+        char bound[16];
+        if (!buckets[i]) {
+            continue;
+        }
+        
+        if (i == ACPI_DARWIN_MUTEX_BUCKETS - 1) {
+            snprintf(bound, sizeof(bound), ">=%uus", 1U << (i - 1));
+        } else {
+            snprintf(bound, sizeof(bound), "<%uus", 1U << i);
+        }
+        AcpiOsSetStatistic(histogram, bound, buckets[i]);
     }
     
-    /* Cleanup memory maps */
-    if (gAcpiOsExtMemoryMapIterator) {
-        gAcpiOsExtMemoryMapIterator->release();
-        gAcpiOsExtMemoryMapIterator = NULL;
+    dict->setObject(key, histogram);
+    histogram->release();
+}
+
+OSDictionary *AcpiOsExtCopyStatistics(void)
+{
+    OSDictionary *stats = OSDictionary::withCapacity(4);
+    if (!stats) {
+        return NULL;
     }
-    
-    if (gAcpiOsExtMemoryMapSet) {
-        gAcpiOsExtMemoryMapSet->release();
-        gAcpiOsExtMemoryMapSet = NULL;
+
+    OSDictionary *ecam = OSDictionary::withCapacity(4);
+    if (ecam) {
+        AcpiOsSetStatistic(ecam, "Segments", gAcpiOsEcamSegmentCount);
+        AcpiOsSetStatistic(ecam, "Windows Mapped", (UInt64)gAcpiOsEcamWindowsMapped);
+        AcpiOsSetStatistic(ecam, "Maps Avoided", (UInt64)gAcpiOsEcamMapsAvoided);
+        AcpiOsSetStatistic(ecam, "Fallbacks", (UInt64)gAcpiOsEcamFallbacks);
+        stats->setObject("PCI ECAM", ecam);
+        ecam->release();
+    }
+
+    OSDictionary *mappings = OSDictionary::withCapacity(5);
+    if (mappings) {
+        IOLockLock(gAcpiOsExtMemoryMapLock);
+        UInt64 requests = gAcpiOsMappingRequests;
+        UInt64 hits = gAcpiOsMappingHits;
+        AcpiOsSetStatistic(mappings, "Live Mappings", gAcpiOsMappingsLive);
+        AcpiOsSetStatistic(mappings, "Bytes Mapped", gAcpiOsMappingBytes);
+        IOLockUnlock(gAcpiOsExtMemoryMapLock);
+
+        AcpiOsSetStatistic(mappings, "Requests", requests);
+        AcpiOsSetStatistic(mappings, "Shared Hits", hits);
+        AcpiOsSetStatistic(mappings, "Hit Rate (%)", requests ? (hits * 100) / requests : 0);
+        stats->setObject("Memory Mappings", mappings);
+        mappings->release();
+    }
+
+    OSDictionary *pages = OSDictionary::withCapacity(5);
+    if (pages) {
+        AcpiOsSetStatistic(pages, "Hits", (UInt64)gAcpiOsPageCacheHits);
+        AcpiOsSetStatistic(pages, "Misses", (UInt64)gAcpiOsPageCacheMisses);
+        AcpiOsSetStatistic(pages, "Evictions", (UInt64)gAcpiOsPageCacheEvictions);
+        AcpiOsSetStatistic(pages, "Admissions Deferred", (UInt64)gAcpiOsPageCacheDeferred);
+        AcpiOsSetStatistic(pages, "ml_phys Fallbacks", (UInt64)gAcpiOsPageCacheFallbacks);
+        stats->setObject("Register Page Cache", pages);
+        pages->release();
+    }
+
+    /* Object caches live in osdarwin.c; one sub-dictionary per cache (Acpi-State, Acpi-Parse, ...) */
+    ACPI_DARWIN_CACHE_STATS caches[kAcpiOsMaxReportedCaches];
+    UInt32 count = AcpiOsCopyCacheStatistics(caches, kAcpiOsMaxReportedCaches);
+    OSDictionary *objectCaches = OSDictionary::withCapacity(count);
+    if (objectCaches) {
+        for (UInt32 i = 0; i < count; i++) {
+            OSDictionary *cache = OSDictionary::withCapacity(11);
+            if (!cache) {
+                continue;
+            }
+
+            AcpiOsSetStatistic(cache, "Object Size", caches[i].ObjectSize);
+            AcpiOsSetStatistic(cache, "Requests", caches[i].Requests);
+            /* The counters are read unlocked, so a request can show up before its hit. */
+            UInt64 hits = caches[i].MagazineHits + caches[i].DepotHits;
+            AcpiOsSetStatistic(cache, "Hits", hits);
+            AcpiOsSetStatistic(cache, "Misses", caches[i].Requests > hits ? caches[i].Requests - hits : 0);
+            AcpiOsSetStatistic(cache, "Depot Hits", caches[i].DepotHits);
+            AcpiOsSetStatistic(cache, "Slab Refills", caches[i].SlabRefills);
+            AcpiOsSetStatistic(cache, "Reaped", caches[i].Reaped);
+            AcpiOsSetStatistic(cache, "Depot Contention", caches[i].Contention);
+            AcpiOsSetStatistic(cache, "Magazine Size", caches[i].MagazineSize);
+            AcpiOsSetStatistic(cache, "Depth", caches[i].CachedObjects);
+            AcpiOsSetStatistic(cache, "Slabs", caches[i].Slabs);
+            objectCaches->setObject(caches[i].Name, cache);
+            cache->release();
+        }
+        stats->setObject("Object Caches", objectCaches);
+        objectCaches->release();
+    }
+
+    ACPI_DARWIN_ALLOC_STATS alloc;
+    AcpiOsCopyAllocStatistics(&alloc);
+    OSDictionary *memory = OSDictionary::withCapacity(3);
+    OSDictionary *classes = OSDictionary::withCapacity(ACPI_DARWIN_ALLOC_CLASSES);
+    if (memory && classes) {
+        AcpiOsSetStatistic(memory, "Live Bytes", alloc.LiveBytes);
+        AcpiOsSetStatistic(memory, "High Water Bytes", alloc.HighWaterBytes);
+
+        for (UInt32 i = 0; i < ACPI_DARWIN_ALLOC_CLASSES; i++) {
+            OSDictionary *cls = OSDictionary::withCapacity(2);
+            if (!cls) {
+                continue;
+            }
+
+            char name[16];
+            if (alloc.ClassSize[i]) {
+                snprintf(name, sizeof(name), "%u", alloc.ClassSize[i]);
+            } else {
+                strlcpy(name, "Large", sizeof(name));
+            }
+
+            AcpiOsSetStatistic(cls, "Live", alloc.ClassLive[i]);
+            AcpiOsSetStatistic(cls, "Total", alloc.ClassTotal[i]);
+            classes->setObject(name, cls);
+            cls->release();
+        }
+
+        memory->setObject("Size Classes", classes);
+        stats->setObject("Memory", memory);
+    }
+    OSSafeReleaseNULL(classes);
+    OSSafeReleaseNULL(memory);
+
+    ACPI_DARWIN_ARENA_STATS arenaStats;
+    AcpiOsCopyArenaStatistics(&arenaStats);
+    OSDictionary *arena = OSDictionary::withCapacity(5);
+    if (arena) {
+        AcpiOsSetStatistic(arena, "Evaluations", arenaStats.Evaluations);
+        AcpiOsSetStatistic(arena, "Allocations", arenaStats.Allocations);
+        AcpiOsSetStatistic(arena, "Chunks Allocated", arenaStats.ChunksAllocated);
+        AcpiOsSetStatistic(arena, "Chunks Pinned", arenaStats.ChunksPinned);
+        AcpiOsSetStatistic(arena, "No Free Arena", arenaStats.NoSlot);
+        stats->setObject("Evaluation Arena", arena);
+        arena->release();
+    }
+
+    ACPI_DARWIN_NS_INDEX_STATS indexStats;
+    AcpiNsIndexGetStatistics(&indexStats);
+    OSDictionary *index = OSDictionary::withCapacity(6);
+    if (index) {
+        AcpiOsSetStatistic(index, "Indexed Scopes", indexStats.Scopes);
+        AcpiOsSetStatistic(index, "Entries", indexStats.Entries);
+        AcpiOsSetStatistic(index, "Capacity", indexStats.Capacity);
+        AcpiOsSetStatistic(index, "Lookups", indexStats.Lookups);
+        AcpiOsSetStatistic(index, "Appends", indexStats.Appends);
+        AcpiOsSetStatistic(index, "Failures", indexStats.Failures);
+        stats->setObject("Namespace Index", index);
+        index->release();
+    }
+
+    OSDictionary *exec = OSDictionary::withCapacity(kAcpiOsExecQueues);
+    if (exec && gAcpiOsExecLock) {
+        AcpiOsExecQueue queues[kAcpiOsExecQueues];
+        IOInterruptState is = IOSimpleLockLockDisableInterrupt(gAcpiOsExecLock);
+        memcpy(queues, gAcpiOsExecQueues, sizeof(queues));
+        IOSimpleLockUnlockEnableInterrupt(gAcpiOsExecLock, is);
+        
+        for (UInt32 i = 0; i < kAcpiOsExecQueues; i++) {
+            OSDictionary *entry = OSDictionary::withCapacity(6);
+            if (!entry) {
+                continue;
+            }
+            
+            UInt64 latency;
+            absolutetime_to_nanoseconds(queues[i].MaxLatency, &latency);
+            AcpiOsSetStatistic(entry, "Queued", queues[i].Queued);
+            AcpiOsSetStatistic(entry, "Completed", queues[i].Completed);
+            AcpiOsSetStatistic(entry, "Rejected", queues[i].Rejected);
+            AcpiOsSetStatistic(entry, "Depth", queues[i].Depth);
+            AcpiOsSetStatistic(entry, "Peak Depth", queues[i].PeakDepth);
+            AcpiOsSetStatistic(entry, "Max Latency (us)", latency / 1000);
+            exec->setObject(queues[i].Name, entry);
+            entry->release();
+        }
+        
+        stats->setObject("Execution", exec);
+    }
+    OSSafeReleaseNULL(exec);
+
+    /* Mutexes, named after the ACPICA mutex ID or the AML Mutex object. */
+    ACPI_DARWIN_MUTEX_STATS *mutexStats = (ACPI_DARWIN_MUTEX_STATS *)IOMalloc(sizeof(ACPI_DARWIN_MUTEX_STATS) * kAcpiOsMaxReportedMutexes);
+    OSDictionary *mutexes = OSDictionary::withCapacity(16);
+    if (mutexStats && mutexes) {
+        count = AcpiOsCopyMutexStatistics(mutexStats, kAcpiOsMaxReportedMutexes);
+        for (UInt32 i = 0; i < count; i++) {
+            OSDictionary *mutex = OSDictionary::withCapacity(8);
+            if (!mutex) {
+                continue;
+            }
+
+            AcpiOsSetStatistic(mutex, "Acquires", mutexStats[i].Acquires);
+            AcpiOsSetStatistic(mutex, "Contended", mutexStats[i].Contended);
+            AcpiOsSetStatistic(mutex, "Sleeps", mutexStats[i].Sleeps);
+            AcpiOsSetStatistic(mutex, "Timeouts", mutexStats[i].Timeouts);
+            AcpiOsSetStatistic(mutex, "Wait Time (ns)", mutexStats[i].WaitTime);
+            AcpiOsSetStatistic(mutex, "Hold Time (ns)", mutexStats[i].HoldTime);
+            AcpiOsSetHistogram(mutex, "Wait Histogram", mutexStats[i].WaitHistogram);
+            AcpiOsSetHistogram(mutex, "Hold Histogram", mutexStats[i].HoldHistogram);
+
+            /* AML mutexes often share a name across devices. */
+            char name[48];
+            strlcpy(name, mutexStats[i].Name, sizeof(name));
+            for (UInt32 n = 2; mutexes->getObject(name); n++) {
+                snprintf(name, sizeof(name), "%s #%u", mutexStats[i].Name, n);
+            }
+
+            mutexes->setObject(name, mutex);
+            mutex->release();
+        }
+        stats->setObject("Mutexes", mutexes);
+    }
+    OSSafeReleaseNULL(mutexes);
+    if (mutexStats) {
+        IOFree(mutexStats, sizeof(ACPI_DARWIN_MUTEX_STATS) * kAcpiOsMaxReportedMutexes);
+    }
+
+    ACPI_DARWIN_LOG_STATS logStats;
+    AcpiOsCopyLogStatistics(&logStats);
+    OSDictionary *log = OSDictionary::withCapacity(6);
+    if (log) {
+        AcpiOsSetStatistic(log, "Lines", logStats.Lines);
+        AcpiOsSetStatistic(log, "Interrupt Lines", logStats.InterruptLines);
+        AcpiOsSetStatistic(log, "Dropped", logStats.Dropped);
+        AcpiOsSetStatistic(log, "Suppressed", logStats.Suppressed);
+        AcpiOsSetStatistic(log, "Truncated", logStats.Truncated);
+        AcpiOsSetStatistic(log, "Emitted", logStats.Emitted);
+        stats->setObject("Log", log);
+        log->release();
+    }
+
+    return stats;
+}
+
+/* The most recent ACPICA output, oldest first. */
+OSData *AcpiOsExtCopyLog(void)
+{
+    const UInt32 capacity = 32 * 1024;
+    char *buffer = (char *)IOMalloc(capacity);
+    if (!buffer) {
+        return NULL;
     }
     
+    UInt32 length = AcpiOsCopyLogHistory(buffer, capacity);
+    OSData *log = OSData::withBytes(buffer, length);
+    IOFree(buffer, capacity);
+    return log;
+}
+
+/*
+ * Cleanup function for AcpiOsLayer resources
+ * Should be called during termination
+ */
+ACPI_STATUS AcpiOsExtTerminate(void)
+{
+    /* Run whatever is still queued and stop the workers */
+    AcpiOsExecTerminate();
+    
+    /* Cleanup ECAM windows */
+    AcpiOsEcamTerminate();
+    
+    /* Cleanup memory maps */
+    AcpiOsPageCacheTerminate();
+    AcpiOsMappingTerminate();
+    
     /* Cleanup locks */
     if (gAcpiOsExtMemoryMapLock) {
         IOLockFree(gAcpiOsExtMemoryMapLock);
         gAcpiOsExtMemoryMapLock = NULL;
     }
     
-    if (gExecutionLock) {
-        IOLockFree(gExecutionLock);
-        gExecutionLock = NULL;
+    if (gAcpiOsEcamLock) {
+        IOLockFree(gAcpiOsEcamLock);
+        gAcpiOsEcamLock = NULL;
+    }
+    
+    if (gAcpiOsPageCacheLock) {
+        IOSimpleLockFree(gAcpiOsPageCacheLock);
+        gAcpiOsPageCacheLock = NULL;
+    }
+    
+    if (gAcpiOsPciConfigPortLock) {
+        IOSimpleLockFree(gAcpiOsPciConfigPortLock);
+        gAcpiOsPciConfigPortLock = NULL;
     }
     
     return AE_OK;
@@ -36,7 +36,12 @@
 #include "PDACPICPU.h"
 #include <IOKit/IOLib.h>
 #include <i386/machine_routines.h>
+#include <kern/clock.h>
 #include "PDACPICPUInterruptController.h"
+#include "PDACPIPlatformExpert.h"
+
+/* AcpiOsLayer.cpp */
+extern "C" ACPI_STATUS AcpiOsExtExcludeFromPageCache(ACPI_PHYSICAL_ADDRESS Address, ACPI_SIZE Length);
 
 #ifndef SDK_IS_PRIVATE
 
@@ -49,8 +54,50 @@ ml_processor_register(
     processor_t     *processor_out,
     boolean_t       boot_cpu,
     boolean_t       start);
+
+typedef enum { SYNC, ASYNC, NOSYNC } mp_sync_t;
+
+extern "C" unsigned int
+mp_cpus_call(
+    uint64_t        cpus,
+    mp_sync_t       mode,
+    void            (*action_func)(void *),
+    void            *arg);
 #endif
 
+/* Processor capabilities for _OSC/_PDC, Intel Processor Vendor-Specific ACPI. */
+#define kPDACPICapPerfFFH           0x0001      /* _PCT may use FFixedHW */
+#define kPDACPICapC1Halt            0x0002
+#define kPDACPICapSMPC1             0x0008      /* C1 on every processor of an SMP system */
+#define kPDACPICapSMPC2C3           0x0010
+#define kPDACPICapPerfSWCoord       0x0020      /* SW_ALL/SW_ANY _PSD domains */
+#define kPDACPICapIdleSWCoord       0x0040      /* ... and _CSD domains */
+#define kPDACPICapC1FFH             0x0100      /* _CST may use MWAIT for C1 */
+#define kPDACPICapC2C3FFH           0x0200      /* ... and for C2/C3 */
+#define kPDACPICapPerfHWCoord       0x0800      /* HW_ALL _PSD domains */
+
+#define kPDACPIPerfNotify           0x80        /* _PPC changed */
+#define kPDACPIIdleNotify           0x81        /* _CST changed */
+
+/* Intel FFixedHW _CST register class for native (MWAIT) states, in the GAS bit offset. */
+#define kIntelCStateNative          2
+
+/* _CST has no break-even residency; assume a state has to last this many exit latencies. */
+#define kPDACPIResidencyFactor      2
+
+/* PCC, ACPI 6.5 section 14: commands and the status bits in the shared memory header. */
+#define kPCCCommandRead             0x00
+#define kPCCCommandWrite            0x01
+#define kPCCStatusComplete          0x0001
+#define kPCCStatusError             0x0004
+#define kPCCSignature               0x50434300  /* "PCC" | subspace ID */
+#define kPDACPIMaxPCCSubspaces      16
+#define kPDACPIPCCTimeoutFactor     10          /* times the nominal latency */
+#define kPDACPIPCCMinTimeoutUs      1000
+#define kPDACPIMaxBatchRegisters    32          /* readRegisters/writeRegisters track them in a UInt32 */
+
+static const PDACPICState kPDACPIDefaultC1 = { 1, kPDACPICStateHalt, false, 1, 1, 0, 0 };
+
 PDACPICPUInterruptController *gCPUInterruptController;
 
 #define super IOService
@@ -86,6 +133,244 @@ OSDefineMetaClassAndStructors(PDACPICPU, IOCPU)
  *     | | | }
  */
 
+#pragma mark - Helpers
+
+static inline void PDACPICPUID(UInt32 leaf, UInt32 subleaf, UInt32 regs[4])
+{
+    asm volatile("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+}
+
+static inline UInt64 PDACPIReadMSR(UInt32 msr)
+{
+    UInt32 lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((UInt64)hi << 32) | lo;
+}
+
+static inline void PDACPIWriteMSR(UInt32 msr, UInt64 value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"((UInt32)value), "d"((UInt32)(value >> 32)));
+}
+
+/* Only meaningful with interrupts off; otherwise we may be somewhere else by the time it returns. */
+static UInt32 PDACPICurrentAPICID(void)
+{
+    UInt32 regs[4];
+    
+    PDACPICPUID(0, 0, regs);
+    if (regs[0] >= 0xB) {
+        PDACPICPUID(0xB, 0, regs);
+        return regs[3];
+    }
+    
+    PDACPICPUID(1, 0, regs);
+    return regs[1] >> 24;
+}
+
+enum PDACPICPUVendor { kVendorUnknown, kVendorIntel, kVendorAMD };
+
+static PDACPICPUVendor PDACPIGetCPUVendor(void)
+{
+    UInt32 regs[4];
+    
+    PDACPICPUID(0, 0, regs);
+    switch (regs[1]) {
+        case 0x756e6547:    /* "Genu"ineIntel */
+            return kVendorIntel;
+        case 0x68747541:    /* "Auth"enticAMD */
+        case 0x6f677948:    /* "Hygo"nGenuine */
+            return kVendorAMD;
+        default:
+            return kVendorUnknown;
+    }
+}
+
+bool PDACPIDecodeRegister(const ACPI_OBJECT *object, PDACPIRegister *reg)
+{
+    const AML_RESOURCE_GENERIC_REGISTER *gas;
+    
+    if (!object || object->Type != ACPI_TYPE_BUFFER || object->Buffer.Length < sizeof(AML_RESOURCE_GENERIC_REGISTER)) {
+        return false;
+    }
+    
+    gas = (const AML_RESOURCE_GENERIC_REGISTER *)object->Buffer.Pointer;
+    if (gas->DescriptorType != ACPI_RESOURCE_NAME_GENERIC_REGISTER) {
+        return false;
+    }
+    
+    reg->SpaceID = gas->AddressSpaceId;
+    reg->BitWidth = gas->BitWidth;
+    reg->BitOffset = gas->BitOffset;
+    reg->AccessSize = gas->AccessSize;
+    reg->Address = gas->Address;
+    return true;
+}
+
+/*
+ * How wide the access itself must be to cover the register. For PCC, AccessSize is the
+ * subspace ID, so only BitWidth says how wide it is.
+ */
+static UInt32 PDACPIAccessWidth(const PDACPIRegister *reg)
+{
+    UInt32 bits = reg->BitOffset + reg->BitWidth;
+    
+    if (reg->SpaceID == ACPI_ADR_SPACE_FIXED_HARDWARE) {
+        return 64;
+    }
+    if (reg->SpaceID != ACPI_ADR_SPACE_PLATFORM_COMM && reg->AccessSize >= 1 && reg->AccessSize <= 4) {
+        return 8 << (reg->AccessSize - 1);
+    }
+    return bits <= 8 ? 8 : bits <= 16 ? 16 : bits <= 32 ? 32 : 64;
+}
+
+/* For counters with a single writer: no lock prefix, but never torn for a reader. */
+static inline void PDACPICounterAdd(UInt64 *counter, UInt64 value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline UInt32 PDACPILatencyBucket(UInt64 us)
+{
+    UInt32 bucket = 0;
+    
+    for (; us && bucket < kPDACPIIdleLatencyBuckets - 1; us >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static inline UInt64 PDACPIFieldMask(const PDACPIRegister *reg, UInt32 width)
+{
+    UInt32 bits = reg->BitWidth ? reg->BitWidth : width;
+    return bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
+}
+
+/*
+ * A PCC subspace is shared by every CPU whose _CPC points into it. Set up on first use;
+ * Valid is published last, so a reader that sees it set sees the rest.
+ */
+struct PDACPIPCCSubspace {
+    IOLock *Lock;               /* one command in flight */
+    volatile UInt8 *Memory;     /* starts with ACPI_PCCT_SHARED_MEMORY */
+    UInt64 Length;
+    PDACPIRegister Doorbell;
+    UInt64 PreserveMask;
+    UInt64 WriteMask;
+    UInt32 Latency;             /* us */
+    UInt8 ID;
+    volatile bool Valid;
+    volatile bool Failed;       /* missing or unusable; not worth parsing again */
+};
+
+static PDACPIPCCSubspace gPCCSubspaces[kPDACPIMaxPCCSubspaces];
+static IOLock *gPCCLock;
+
+static PDACPIPCCSubspace *PDACPIGetPCCSubspace(UInt8 id)
+{
+    PDACPIPCCSubspace *subspace;
+    ACPI_TABLE_HEADER *table;
+    
+    if (id >= kPDACPIMaxPCCSubspaces) {
+        return nullptr;
+    }
+    subspace = &gPCCSubspaces[id];
+    if (__atomic_load_n(&subspace->Valid, __ATOMIC_ACQUIRE)) {
+        return subspace;
+    }
+    if (__atomic_load_n(&subspace->Failed, __ATOMIC_RELAXED)) {
+        return nullptr;
+    }
+    
+    if (!gPCCLock) {
+        IOLock *lock = IOLockAlloc();
+        if (!lock) {
+            return nullptr;
+        }
+        if (!OSCompareAndSwapPtr(NULL, lock, (void * volatile *)&gPCCLock)) {
+            IOLockFree(lock);
+        }
+    }
+    
+    IOLockLock(gPCCLock);
+    if (subspace->Valid || subspace->Failed) {
+        IOLockUnlock(gPCCLock);
+        return subspace->Valid ? subspace : nullptr;
+    }
+    if (ACPI_FAILURE(AcpiGetTable((char *)ACPI_SIG_PCCT, 1, &table))) {
+        __atomic_store_n(&subspace->Failed, true, __ATOMIC_RELAXED);
+        IOLockUnlock(gPCCLock);
+        return nullptr;
+    }
+    
+    /* Subspace IDs are just the subtable's position. */
+    const UInt8 *cursor = (const UInt8 *)table + sizeof(ACPI_TABLE_PCCT);
+    const UInt8 *end = (const UInt8 *)table + table->Length;
+    for (UInt32 index = 0; cursor + sizeof(ACPI_SUBTABLE_HEADER) <= end; index++) {
+        const ACPI_SUBTABLE_HEADER *entry = (const ACPI_SUBTABLE_HEADER *)cursor;
+        if (entry->Length < sizeof(ACPI_SUBTABLE_HEADER) || cursor + entry->Length > end) {
+            break;
+        }
+        if (index != id) {
+            cursor += entry->Length;
+            continue;
+        }
+        
+        /* Types 0-2 share a layout up to MinTurnaroundTime; the extended types don't. */
+        if (entry->Type > ACPI_PCCT_TYPE_HW_REDUCED_SUBSPACE_TYPE2 || entry->Length < sizeof(ACPI_PCCT_SUBSPACE)) {
+            IOLog("ACPICPU: PCC subspace %u has unsupported type %u\n", id, entry->Type);
+            break;
+        }
+        
+        const ACPI_PCCT_SUBSPACE *pcc = (const ACPI_PCCT_SUBSPACE *)entry;
+        subspace->Length = pcc->Length;
+        subspace->Memory = (volatile UInt8 *)AcpiOsMapMemory(pcc->BaseAddress, pcc->Length);
+        subspace->Lock = IOLockAlloc();
+        if (!subspace->Memory || !subspace->Lock || pcc->Length < sizeof(ACPI_PCCT_SHARED_MEMORY)) {
+            break;
+        }
+        
+        subspace->Doorbell.SpaceID = pcc->DoorbellRegister.SpaceId;
+        subspace->Doorbell.BitWidth = pcc->DoorbellRegister.BitWidth;
+        subspace->Doorbell.BitOffset = pcc->DoorbellRegister.BitOffset;
+        subspace->Doorbell.AccessSize = pcc->DoorbellRegister.AccessWidth;
+        subspace->Doorbell.Address = pcc->DoorbellRegister.Address;
+        subspace->PreserveMask = pcc->PreserveMask;
+        subspace->WriteMask = pcc->WriteMask;
+        subspace->Latency = pcc->Latency;
+        subspace->ID = id;
+        
+        /*
+         * The shared memory is ours through the mapping above, and ringing the doorbell has
+         * side effects; neither should end up behind a page the register cache keeps mapped.
+         */
+        AcpiOsExtExcludeFromPageCache(pcc->BaseAddress, pcc->Length);
+        if (pcc->DoorbellRegister.SpaceId == ACPI_ADR_SPACE_SYSTEM_MEMORY && pcc->DoorbellRegister.Address) {
+            AcpiOsExtExcludeFromPageCache(pcc->DoorbellRegister.Address, 8);
+        }
+        __atomic_store_n(&subspace->Valid, true, __ATOMIC_RELEASE);
+        break;
+    }
+    
+    if (!subspace->Valid) {
+        if (subspace->Memory) {
+            AcpiOsUnmapMemory((void *)subspace->Memory, subspace->Length);
+            subspace->Memory = nullptr;
+        }
+        if (subspace->Lock) {
+            IOLockFree(subspace->Lock);
+            subspace->Lock = nullptr;
+        }
+        subspace->Length = 0;
+        __atomic_store_n(&subspace->Failed, true, __ATOMIC_RELAXED);
+    }
+    
+    AcpiPutTable(table);
+    IOLockUnlock(gPCCLock);
+    return subspace->Valid ? subspace : nullptr;
+}
+
+#pragma mark - Start/stop
+
 bool PDACPICPU::start(IOService *provider)
 {
     IOLog("PDACPICPU::start\n");
@@ -98,16 +383,1350 @@ bool PDACPICPU::start(IOService *provider)
     OSNumber *lapic = OSDynamicCast(OSNumber, provider->getProperty("processor-lapic"));
     OSNumber *id = OSDynamicCast(OSNumber, provider->getProperty("processor-id"));
     
+    /* A processor the MADT marks disabled has no LAPIC, and nothing for us to drive. */
+    if (!lapic) {
+        return false;
+    }
+    
+    this->m_device = OSDynamicCast(IOACPIPlatformDevice, provider);
+    if (!this->m_device) {
+        return false;
+    }
+    this->m_handle = (ACPI_HANDLE)this->m_device->getDeviceHandle();
+    this->m_lapic = lapic->unsigned32BitValue();
+    this->m_cpuNumber = -1;
+    this->m_registerOps.Read = &PDACPICPU::readRegister;
+    this->m_registerOps.Write = &PDACPICPU::writeRegister;
+    this->m_registerOps.Context = this;
+    
+    this->m_idleStateLock = IOLockAlloc();
+    if (!this->m_idleStateLock) {
+        return false;
+    }
+    
+    UInt32 regs[4];
+    PDACPICPUID(1, 0, regs);
+    this->m_mwait = (regs[2] & (1 << 3)) != 0;
+    
     /* ZORMEISTER: this is a nightmare. */
     ml_processor_register(NULL, lapic->unsigned32BitValue(), &machProcessor, false, false);
     
     /* ^ so when the hell do i 'boot' the CPU? when do i 'start' the CPU? */
     /* do i call ml_processor_register again? what */
+    
+    /* The platform expert already ran _OSC/_PDC for us; see declareCapabilities. */
+    if (this->initPerformanceStates()) {
+        IOLog("ACPICPU: processor %u has %u P-states, limit P%u\n", id ? id->unsigned32BitValue() : 0,
+              this->m_pStateCount, this->m_pStateLimit);
+    }
+    
+    /* After our P-states are known (a domain may write them) and before the idle table maps onto _CSD. */
+    this->joinDomains(provider);
+    this->initIdleStates();
+    
+    if (this->initCPPC()) {
+        IOLog("ACPICPU: processor %u has CPPC, performance %u-%u (nominal %u)\n", id ? id->unsigned32BitValue() : 0,
+              this->m_cppcLowest, this->m_cppcHighest, this->m_cppcNominal);
+    }
+    
+    if (ACPI_SUCCESS(AcpiInstallNotifyHandler(this->m_handle, ACPI_DEVICE_NOTIFY, &PDACPICPU::notifyHandler, this))) {
+        this->m_notifyInstalled = true;
+    }
 
     registerService();
     return true;
 }
 
+void PDACPICPU::stop(IOService *provider)
+{
+    if (this->m_notifyInstalled) {
+        AcpiRemoveNotifyHandler(this->m_handle, ACPI_DEVICE_NOTIFY, &PDACPICPU::notifyHandler);
+        this->m_notifyInstalled = false;
+    }
+    
+    this->leaveDomains();
+    OSSafeReleaseNULL(this->pStateArray);
+    OSSafeReleaseNULL(this->cStateArray);
+    if (this->m_idleStateLock) {
+        IOLockFree(this->m_idleStateLock);
+        this->m_idleStateLock = nullptr;
+    }
+    super::stop(provider);
+}
+
+/*
+ * Tell firmware what we can do with a processor object: _OSC if it has one, _PDC otherwise.
+ * Firmware commonly loads the _PSS/_CST/_PSD SSDTs from here, so the platform expert
+ * calls this for every processor nub before it looks for dependency domains.
+ */
+void PDACPICPU::declareCapabilities(ACPI_HANDLE handle)
+{
+    static const UInt8 uuid[16] = {
+        0x16, 0xa6, 0x77, 0x40, 0x0c, 0x29, 0xbe, 0x47, 0x9e, 0xbd, 0xd8, 0x70, 0x58, 0x71, 0x39, 0x53
+    };
+    UInt32 capabilities = kPDACPICapPerfFFH | kPDACPICapPerfHWCoord | kPDACPICapPerfSWCoord | kPDACPICapIdleSWCoord |
+                          kPDACPICapC1Halt | kPDACPICapSMPC1 | kPDACPICapSMPC2C3;
+    UInt32 regs[4];
+    
+    PDACPICPUID(1, 0, regs);
+    if (regs[2] & (1 << 3)) {
+        capabilities |= kPDACPICapC1FFH | kPDACPICapC2C3FFH;
+    }
+    
+    UInt32 osc[2] = { 0, capabilities };
+    UInt32 pdc[3] = { 1, 1, capabilities };
+    ACPI_OBJECT args[4];
+    ACPI_OBJECT_LIST list = { 4, args };
+    ACPI_BUFFER result = { ACPI_ALLOCATE_BUFFER, NULL };
+    
+    args[0].Type = ACPI_TYPE_BUFFER;
+    args[0].Buffer.Length = sizeof(uuid);
+    args[0].Buffer.Pointer = (UInt8 *)uuid;
+    args[1].Type = ACPI_TYPE_INTEGER;
+    args[1].Integer.Value = 1;
+    args[2].Type = ACPI_TYPE_INTEGER;
+    args[2].Integer.Value = 2;
+    args[3].Type = ACPI_TYPE_BUFFER;
+    args[3].Buffer.Length = sizeof(osc);
+    args[3].Buffer.Pointer = (UInt8 *)osc;
+    
+    if (ACPI_SUCCESS(AcpiEvaluateObject(handle, (char *)"_OSC", &list, &result))) {
+        ACPI_FREE(result.Pointer);
+        return;
+    }
+    
+    args[0].Buffer.Length = sizeof(pdc);
+    args[0].Buffer.Pointer = (UInt8 *)pdc;
+    list.Count = 1;
+    AcpiEvaluateObject(handle, (char *)"_PDC", &list, NULL);
+}
+
+/* HW_ALL domains are left to the hardware; we only join the ones software has to coordinate. */
+void PDACPICPU::joinDomains(IOService *provider)
+{
+    PDACPICPUDomain *domain = OSDynamicCast(PDACPICPUDomain, provider->getProperty(kPDACPIPerformanceDomainKey));
+    OSArray *idle = OSDynamicCast(OSArray, provider->getProperty(kPDACPIIdleDomainsKey));
+    SInt32 member;
+    
+    if (domain && this->m_pStateCount && domain->getCoordination() != kPDACPICoordinationHWAll) {
+        member = domain->addMember(this);
+        if (member >= 0) {
+            domain->retain();
+            this->m_perfDomain = domain;
+            this->m_perfMember = member;
+        }
+    }
+    
+    for (UInt32 i = 0; idle && i < idle->getCount() && this->m_idleDomainCount < kPDACPIMaxCStates; i++) {
+        domain = OSDynamicCast(PDACPICPUDomain, idle->getObject(i));
+        if (!domain || domain->getCoordination() == kPDACPICoordinationHWAll) {
+            continue;
+        }
+        
+        member = domain->addMember(this);
+        if (member >= 0) {
+            domain->retain();
+            this->m_idleDomains[this->m_idleDomainCount] = domain;
+            this->m_idleMembers[this->m_idleDomainCount++] = member;
+        }
+    }
+}
+
+void PDACPICPU::leaveDomains()
+{
+    if (this->m_perfDomain) {
+        this->m_perfDomain->removeMember(this->m_perfMember);
+        OSSafeReleaseNULL(this->m_perfDomain);
+    }
+    
+    for (UInt32 i = 0; i < this->m_idleDomainCount; i++) {
+        this->m_idleDomains[i]->removeMember(this->m_idleMembers[i]);
+        OSSafeReleaseNULL(this->m_idleDomains[i]);
+    }
+    this->m_idleDomainCount = 0;
+}
+
+#pragma mark - Register access
+
+IOReturn PDACPICPU::readRegister(void *context, const PDACPIRegister *reg, UInt64 *value)
+{
+    PDACPICPU *cpu = (PDACPICPU *)context;
+    UInt32 width = PDACPIAccessWidth(reg);
+    UInt64 raw = 0;
+    IOReturn ret;
+    
+    ret = cpu->accessRegister(false, reg, &raw);
+    if (ret == kIOReturnSuccess) {
+        *value = (raw >> reg->BitOffset) & PDACPIFieldMask(reg, width);
+    }
+    return ret;
+}
+
+IOReturn PDACPICPU::writeRegister(void *context, const PDACPIRegister *reg, UInt64 value)
+{
+    PDACPICPU *cpu = (PDACPICPU *)context;
+    UInt32 width = PDACPIAccessWidth(reg);
+    UInt64 mask = PDACPIFieldMask(reg, width) << reg->BitOffset;
+    UInt64 raw = value;
+    IOReturn ret;
+    
+    /* Registers that fill their access are the common case and get a single write. */
+    if (reg->BitOffset || (reg->BitWidth && reg->BitWidth < width)) {
+        ret = cpu->accessRegister(false, reg, &raw);
+        if (ret != kIOReturnSuccess) {
+            return ret;
+        }
+        raw = (raw & ~mask) | ((value << reg->BitOffset) & mask);
+    }
+    
+    return cpu->accessRegister(true, reg, &raw);
+}
+
+IOReturn PDACPICPU::accessRegister(bool write, const PDACPIRegister *reg, UInt64 *raw)
+{
+    UInt32 width = PDACPIAccessWidth(reg);
+    ACPI_STATUS status;
+    UInt32 port;
+    
+    switch (reg->SpaceID) {
+        case ACPI_ADR_SPACE_SYSTEM_IO:
+            if (write) {
+                status = AcpiOsWritePort(reg->Address, (UInt32)*raw, width);
+            } else {
+                status = AcpiOsReadPort(reg->Address, &port, width);
+                *raw = port;
+            }
+            return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnIOError;
+        case ACPI_ADR_SPACE_SYSTEM_MEMORY:
+            if (write) {
+                status = AcpiOsWriteMemory(reg->Address, *raw, width);
+            } else {
+                status = AcpiOsReadMemory(reg->Address, raw, width);
+            }
+            return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnIOError;
+        case ACPI_ADR_SPACE_FIXED_HARDWARE:
+            return this->accessMSR(write, (UInt32)reg->Address, raw);
+        case ACPI_ADR_SPACE_PLATFORM_COMM: {
+            /*
+             * Just the shared memory; the caller holds the subspace lock and rings the
+             * doorbell. For PCC registers the GAS access size carries the subspace ID.
+             */
+            PDACPIPCCSubspace *subspace = PDACPIGetPCCSubspace(reg->AccessSize);
+            UInt64 offset = sizeof(ACPI_PCCT_SHARED_MEMORY) + reg->Address;
+            if (!subspace) {
+                return kIOReturnNotFound;
+            }
+            if (offset + width / 8 > subspace->Length) {
+                return kIOReturnBadArgument;
+            }
+            
+            volatile void *field = subspace->Memory + offset;
+            switch (width) {
+                case 8:
+                    write ? (void)(*(volatile UInt8 *)field = (UInt8)*raw) : (void)(*raw = *(volatile UInt8 *)field);
+                    break;
+                case 16:
+                    write ? (void)(*(volatile UInt16 *)field = (UInt16)*raw) : (void)(*raw = *(volatile UInt16 *)field);
+                    break;
+                case 32:
+                    write ? (void)(*(volatile UInt32 *)field = (UInt32)*raw) : (void)(*raw = *(volatile UInt32 *)field);
+                    break;
+                default:
+                    write ? (void)(*(volatile UInt64 *)field = *raw) : (void)(*raw = *(volatile UInt64 *)field);
+                    break;
+            }
+            return kIOReturnSuccess;
+        }
+        default:
+            return kIOReturnUnsupported;
+    }
+}
+
+struct PDACPIMSRAccess {
+    UInt32 MSR;
+    bool Write;
+    UInt64 Value;
+};
+
+static void PDACPIMSRCall(void *arg)
+{
+    PDACPIMSRAccess *access = (PDACPIMSRAccess *)arg;
+    
+    if (access->Write) {
+        PDACPIWriteMSR(access->MSR, access->Value);
+    } else {
+        access->Value = PDACPIReadMSR(access->MSR);
+    }
+}
+
+/* MSRs belong to the CPU they're on; anyone else has to ask it. */
+IOReturn PDACPICPU::accessMSR(bool write, UInt32 msr, UInt64 *value)
+{
+    PDACPIMSRAccess access = { msr, write, *value };
+    boolean_t enabled = ml_set_interrupts_enabled(FALSE);
+    
+    if (PDACPICurrentAPICID() == this->m_lapic) {
+        PDACPIMSRCall(&access);
+        ml_set_interrupts_enabled(enabled);
+    } else {
+        ml_set_interrupts_enabled(enabled);
+        
+        if (this->m_cpuNumber < 0) {
+            for (UInt32 cpu = 0; cpu < ml_get_max_cpus(); cpu++) {
+                if (ml_get_apicid(cpu) == this->m_lapic) {
+                    this->m_cpuNumber = cpu;
+                    break;
+                }
+            }
+            if (this->m_cpuNumber < 0) {
+                return kIOReturnNotReady;
+            }
+        }
+        
+        if (!mp_cpus_call(1ULL << this->m_cpuNumber, SYNC, &PDACPIMSRCall, &access)) {
+            return kIOReturnOffline;
+        }
+    }
+    
+    *value = access.Value;
+    return kIOReturnSuccess;
+}
+
+/*
+ * Reads in one go: every PCC subspace involved gets a single read command, and the
+ * values come out of shared memory afterwards under the same lock.
+ */
+IOReturn PDACPICPU::readRegisters(const PDACPIRegister *const *regs, UInt32 count, UInt64 *values)
+{
+    UInt32 done = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (count > kPDACPIMaxBatchRegisters) {
+        return kIOReturnBadArgument;
+    }
+    
+    for (UInt32 i = 0; i < count; i++) {
+        PDACPIPCCSubspace *subspace;
+        
+        if (done & (1U << i)) {
+            continue;
+        }
+        
+        if (regs[i]->SpaceID != ACPI_ADR_SPACE_PLATFORM_COMM) {
+            IOReturn result = this->m_registerOps.Read(this->m_registerOps.Context, regs[i], &values[i]);
+            if (result != kIOReturnSuccess) {
+                ret = result;
+            }
+            continue;
+        }
+        
+        subspace = PDACPIGetPCCSubspace(regs[i]->AccessSize);
+        if (!subspace) {
+            ret = kIOReturnNotFound;
+            continue;
+        }
+        
+        IOLockLock(subspace->Lock);
+        IOReturn result = this->pccCommand(subspace, kPCCCommandRead);
+        for (UInt32 j = i; j < count; j++) {
+            if (regs[j]->SpaceID != ACPI_ADR_SPACE_PLATFORM_COMM || regs[j]->AccessSize != regs[i]->AccessSize) {
+                continue;
+            }
+            if (result == kIOReturnSuccess) {
+                result = this->m_registerOps.Read(this->m_registerOps.Context, regs[j], &values[j]);
+            }
+            done |= 1U << j;
+        }
+        IOLockUnlock(subspace->Lock);
+        
+        if (result != kIOReturnSuccess) {
+            ret = result;
+        }
+    }
+    
+    return ret;
+}
+
+/*
+ * Writes in one go. Fields that share a register are merged into one access (one
+ * read-modify-write at most), and each PCC subspace gets a single write command
+ * once all of its fields are in shared memory.
+ */
+IOReturn PDACPICPU::writeRegisters(const PDACPIRegisterWrite *writes, UInt32 count)
+{
+    UInt32 done = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (count > kPDACPIMaxBatchRegisters) {
+        return kIOReturnBadArgument;
+    }
+    
+    for (UInt32 i = 0; i < count; i++) {
+        const PDACPIRegister *reg = writes[i].Reg;
+        IOReturn result = kIOReturnSuccess;
+        
+        if (done & (1U << i)) {
+            continue;
+        }
+        
+        if (reg->SpaceID == ACPI_ADR_SPACE_PLATFORM_COMM) {
+            PDACPIPCCSubspace *subspace = PDACPIGetPCCSubspace(reg->AccessSize);
+            if (!subspace) {
+                ret = kIOReturnNotFound;
+                continue;
+            }
+            
+            IOLockLock(subspace->Lock);
+            for (UInt32 j = i; j < count; j++) {
+                if (writes[j].Reg->SpaceID != ACPI_ADR_SPACE_PLATFORM_COMM || writes[j].Reg->AccessSize != reg->AccessSize) {
+                    continue;
+                }
+                if (result == kIOReturnSuccess) {
+                    result = this->m_registerOps.Write(this->m_registerOps.Context, writes[j].Reg, writes[j].Value);
+                }
+                done |= 1U << j;
+            }
+            if (result == kIOReturnSuccess) {
+                result = this->pccCommand(subspace, kPCCCommandWrite);
+            }
+            IOLockUnlock(subspace->Lock);
+        } else {
+            UInt32 width = PDACPIAccessWidth(reg);
+            UInt64 full = width >= 64 ? ~0ULL : ((1ULL << width) - 1);
+            UInt64 mask = 0, value = 0;
+            
+            for (UInt32 j = i; j < count; j++) {
+                const PDACPIRegister *other = writes[j].Reg;
+                if (other->SpaceID != reg->SpaceID || other->Address != reg->Address || PDACPIAccessWidth(other) != width) {
+                    continue;
+                }
+                UInt64 field = PDACPIFieldMask(other, width) << other->BitOffset;
+                mask |= field;
+                value = (value & ~field) | ((writes[j].Value << other->BitOffset) & field);
+                done |= 1U << j;
+            }
+            
+            PDACPIRegister whole = { reg->SpaceID, (UInt8)width, 0, reg->AccessSize, reg->Address };
+            if ((mask & full) != full) {
+                UInt64 old;
+                result = this->m_registerOps.Read(this->m_registerOps.Context, &whole, &old);
+                value = (old & ~mask) | value;
+            }
+            if (result == kIOReturnSuccess) {
+                result = this->m_registerOps.Write(this->m_registerOps.Context, &whole, value);
+            }
+        }
+        
+        if (result != kIOReturnSuccess) {
+            ret = result;
+        }
+    }
+    
+    return ret;
+}
+
+/* With the subspace lock held: post a command, ring the doorbell and wait for completion. */
+IOReturn PDACPICPU::pccCommand(PDACPIPCCSubspace *subspace, UInt16 command)
+{
+    volatile ACPI_PCCT_SHARED_MEMORY *header = (volatile ACPI_PCCT_SHARED_MEMORY *)subspace->Memory;
+    UInt32 timeout = subspace->Latency * kPDACPIPCCTimeoutFactor;
+    UInt64 doorbell;
+    IOReturn ret;
+    
+    if (timeout < kPDACPIPCCMinTimeoutUs) {
+        timeout = kPDACPIPCCMinTimeoutUs;
+    }
+    
+    header->Signature = kPCCSignature | subspace->ID;
+    header->Command = command;
+    header->Status = 0;
+    
+    ret = this->m_registerOps.Read(this->m_registerOps.Context, &subspace->Doorbell, &doorbell);
+    if (ret == kIOReturnSuccess) {
+        ret = this->m_registerOps.Write(this->m_registerOps.Context, &subspace->Doorbell,
+                                        (doorbell & subspace->PreserveMask) | subspace->WriteMask);
+    }
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+    __atomic_add_fetch(&this->m_cppcStats.PCCCommands, 1, __ATOMIC_RELAXED);
+    
+    for (UInt32 waited = 0; !(header->Status & kPCCStatusComplete); waited++) {
+        if (waited >= timeout) {
+            __atomic_add_fetch(&this->m_cppcStats.PCCTimeouts, 1, __ATOMIC_RELAXED);
+            return kIOReturnTimeout;
+        }
+        IODelay(1);
+    }
+    
+    return (header->Status & kPCCStatusError) ? kIOReturnIOError : kIOReturnSuccess;
+}
+
+void PDACPICPU::setRegisterOps(const PDACPIRegisterOps *ops)
+{
+    this->m_registerOps = *ops;
+}
+
+#pragma mark - Performance states
+
+/* _PCT and _PSS into m_pStates, so switching never needs the interpreter. */
+bool PDACPICPU::initPerformanceStates()
+{
+    ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    ACPI_OBJECT *package;
+    bool valid;
+    
+    if (ACPI_FAILURE(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_PCT", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+        return false;
+    }
+    package = (ACPI_OBJECT *)buffer.Pointer;
+    valid = package->Package.Count >= 2 &&
+            PDACPIDecodeRegister(&package->Package.Elements[0], &this->m_perfControl) &&
+            PDACPIDecodeRegister(&package->Package.Elements[1], &this->m_perfStatus);
+    ACPI_FREE(buffer.Pointer);
+    if (!valid) {
+        IOLog("ACPICPU: malformed _PCT\n");
+        return false;
+    }
+    
+    buffer.Length = ACPI_ALLOCATE_BUFFER;
+    buffer.Pointer = NULL;
+    if (ACPI_FAILURE(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_PSS", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+        return false;
+    }
+    package = (ACPI_OBJECT *)buffer.Pointer;
+    
+    this->m_pStateCount = 0;
+    for (UInt32 i = 0; i < package->Package.Count && this->m_pStateCount < kPDACPIMaxPStates; i++) {
+        ACPI_OBJECT *entry = &package->Package.Elements[i];
+        PDACPIPState *state = &this->m_pStates[this->m_pStateCount];
+        
+        if (entry->Type != ACPI_TYPE_PACKAGE || entry->Package.Count < 6) {
+            continue;
+        }
+        
+        valid = true;
+        for (UInt32 j = 0; j < 6; j++) {
+            valid &= entry->Package.Elements[j].Type == ACPI_TYPE_INTEGER;
+        }
+        if (!valid || !entry->Package.Elements[0].Integer.Value) {
+            continue;
+        }
+        
+        state->Frequency = (UInt32)entry->Package.Elements[0].Integer.Value;
+        state->Power = (UInt32)entry->Package.Elements[1].Integer.Value;
+        state->Latency = (UInt32)entry->Package.Elements[2].Integer.Value;
+        state->BusMasterLatency = (UInt32)entry->Package.Elements[3].Integer.Value;
+        state->Control = entry->Package.Elements[4].Integer.Value;
+        state->Status = entry->Package.Elements[5].Integer.Value;
+        this->m_pStateCount++;
+    }
+    ACPI_FREE(buffer.Pointer);
+    
+    if (!this->m_pStateCount) {
+        return false;
+    }
+    
+    /*
+     * FFixedHW means the architectural MSRs. Fold whatever else lives in the control MSR
+     * into each state's value now, so a switch stays one full-width write.
+     */
+    UInt64 statusMask = ~0ULL;
+    if (this->m_perfControl.SpaceID == ACPI_ADR_SPACE_FIXED_HARDWARE) {
+        UInt32 control, status;
+        UInt64 mask, preserved = 0;
+        
+        switch (PDACPIGetCPUVendor()) {
+            case kVendorIntel:
+                control = kIntelPerfControlMSR;
+                status = kIntelPerfStatusMSR;
+                mask = kIntelPerfMask;
+                statusMask = kIntelPerfRatioMask;
+                break;
+            case kVendorAMD:
+                control = kAMDPerfControlMSR;
+                status = kAMDPerfStatusMSR;
+                mask = kAMDPerfMask;
+                break;
+            default:
+                IOLog("ACPICPU: FFixedHW _PCT on an unknown processor\n");
+                this->m_pStateCount = 0;
+                return false;
+        }
+        
+        this->m_perfControl = { ACPI_ADR_SPACE_FIXED_HARDWARE, 64, 0, 4, control };
+        this->m_perfStatus = { ACPI_ADR_SPACE_FIXED_HARDWARE, (UInt8)(mask == kIntelPerfMask ? 16 : 3), 0, 4, status };
+        
+        if (mask != kIntelPerfMask || this->m_registerOps.Read(this->m_registerOps.Context, &this->m_perfControl, &preserved) != kIOReturnSuccess) {
+            preserved = 0;
+        }
+        PDACPIFoldPStateControl(this->m_pStates, this->m_pStateCount, preserved, mask);
+    }
+    
+    /*
+     * Whatever firmware left us in, if we can tell; otherwise the first switch always writes,
+     * and updatePerformanceLimit below makes that switch. Intel's status carries more than
+     * the ratio _PSS lists, so only the ratio is compared there.
+     */
+    UInt64 current;
+    this->currentPState = this->m_pStateCount;
+    if (this->m_registerOps.Read(this->m_registerOps.Context, &this->m_perfStatus, &current) == kIOReturnSuccess) {
+        this->currentPState = PDACPIFindPState(this->m_pStates, this->m_pStateCount, current, statusMask);
+    }
+    this->m_pStateSince = mach_absolute_time();
+    
+    this->pStateArray = OSArray::withCapacity(this->m_pStateCount);
+    for (UInt32 i = 0; this->pStateArray && i < this->m_pStateCount; i++) {
+        OSDictionary *dict = OSDictionary::withCapacity(6);
+        if (!dict) {
+            break;
+        }
+        
+        const struct { const char *key; UInt64 value; } fields[] = {
+            { "Frequency",              this->m_pStates[i].Frequency },
+            { "Power",                  this->m_pStates[i].Power },
+            { "Latency",                this->m_pStates[i].Latency },
+            { "Bus Master Latency",     this->m_pStates[i].BusMasterLatency },
+            { "Control",                this->m_pStates[i].Control },
+            { "Status",                 this->m_pStates[i].Status },
+        };
+        
+        for (UInt32 j = 0; j < sizeof(fields) / sizeof(fields[0]); j++) {
+            OSNumber *num = OSNumber::withNumber(fields[j].value, 64);
+            if (num) {
+                dict->setObject(fields[j].key, num);
+                num->release();
+            }
+        }
+        this->pStateArray->setObject(dict);
+        dict->release();
+    }
+    if (this->pStateArray) {
+        this->IOService::setProperty("Performance States", this->pStateArray);
+    }
+    
+    this->updatePerformanceLimit();
+    return true;
+}
+
+/* _PPC names the fastest state we're allowed; anything faster gets raised to it. */
+void PDACPICPU::updatePerformanceLimit()
+{
+    ACPI_OBJECT object;
+    ACPI_BUFFER buffer = { sizeof(object), &object };
+    UInt32 limit = 0;
+    
+    if (!this->m_pStateCount) {
+        return;
+    }
+    
+    if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_PPC", NULL, &buffer, ACPI_TYPE_INTEGER))) {
+        limit = PDACPIPStateLimit(object.Integer.Value, this->m_pStateCount);
+    }
+    
+    __atomic_store_n(&this->m_pStateLimit, limit, __ATOMIC_RELEASE);
+    
+    if (PDACPIPStateOverLimit(this->currentPState, limit, this->m_pStateCount)) {
+        this->switchToPState(limit);
+    }
+}
+
+#pragma mark - CPPC
+
+/* Values for whichever entries are asked for, constants included, in one batch. */
+IOReturn PDACPICPU::readCPPC(const UInt32 *entries, UInt32 count, UInt64 *values)
+{
+    const PDACPIRegister *regs[kCPPCEntries];
+    UInt64 raw[kCPPCEntries];
+    UInt32 map[kCPPCEntries];
+    UInt32 reads = 0;
+    IOReturn ret;
+    
+    for (UInt32 i = 0; i < count; i++) {
+        const PDACPICPPCEntry *entry = &this->m_cppc[entries[i]];
+        values[i] = entry->Value;
+        if (entry->Present && !entry->Constant) {
+            regs[reads] = &entry->Reg;
+            map[reads++] = i;
+        }
+    }
+    
+    ret = this->readRegisters(regs, reads, raw);
+    for (UInt32 i = 0; ret == kIOReturnSuccess && i < reads; i++) {
+        values[map[i]] = raw[i];
+    }
+    return ret;
+}
+
+bool PDACPICPU::initCPPC()
+{
+    ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    ACPI_OBJECT *package;
+    UInt32 entries;
+    
+    if (ACPI_FAILURE(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_CPC", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+        return false;
+    }
+    package = (ACPI_OBJECT *)buffer.Pointer;
+    
+    /* NumEntries and Revision, then revision 2 has 19 entries and revision 3 has 21. */
+    entries = package->Package.Count > 2 ? package->Package.Count - 2 : 0;
+    if (entries > kCPPCEntries) {
+        entries = kCPPCEntries;
+    }
+    
+    for (UInt32 i = 0; i < entries; i++) {
+        ACPI_OBJECT *element = &package->Package.Elements[i + 2];
+        PDACPICPPCEntry *entry = &this->m_cppc[i];
+        
+        if (element->Type == ACPI_TYPE_INTEGER) {
+            entry->Present = true;
+            entry->Constant = true;
+            entry->Value = element->Integer.Value;
+        } else if (PDACPIDecodeRegister(element, &entry->Reg)) {
+            entry->Present = entry->Reg.SpaceID != ACPI_ADR_SPACE_SYSTEM_MEMORY || entry->Reg.Address != 0;
+        }
+    }
+    ACPI_FREE(buffer.Pointer);
+    
+    if (!this->m_cppc[kCPPCHighest].Present || !this->m_cppc[kCPPCLowest].Present ||
+        !this->m_cppc[kCPPCDesired].Present || !this->m_cppc[kCPPCReferenceCounter].Present ||
+        !this->m_cppc[kCPPCDeliveredCounter].Present) {
+        IOLog("ACPICPU: _CPC is missing required entries\n");
+        return false;
+    }
+    
+    static const UInt32 capabilities[] = { kCPPCHighest, kCPPCNominal, kCPPCLowestNonlinear, kCPPCLowest, kCPPCReference };
+    UInt64 values[5];
+    if (this->readCPPC(capabilities, 5, values) != kIOReturnSuccess || !values[0]) {
+        IOLog("ACPICPU: couldn't read the CPPC capabilities\n");
+        return false;
+    }
+    
+    this->m_cppcHighest = (UInt32)values[0];
+    this->m_cppcNominal = this->m_cppc[kCPPCNominal].Present ? (UInt32)values[1] : this->m_cppcHighest;
+    this->m_cppcLowestNonlinear = this->m_cppc[kCPPCLowestNonlinear].Present ? (UInt32)values[2] : (UInt32)values[3];
+    this->m_cppcLowest = (UInt32)values[3];
+    /* Without a reference performance, the reference counter runs at nominal. */
+    this->m_cppcReference = this->m_cppc[kCPPCReference].Present ? (UInt32)values[4] : this->m_cppcNominal;
+    
+    if (this->m_cppc[kCPPCEnable].Present && !this->m_cppc[kCPPCEnable].Constant) {
+        PDACPIRegisterWrite enable = { &this->m_cppc[kCPPCEnable].Reg, 1 };
+        if (this->writeRegisters(&enable, 1) != kIOReturnSuccess) {
+            IOLog("ACPICPU: couldn't enable CPPC\n");
+            return false;
+        }
+    }
+    
+    this->m_cppcValid = true;
+    this->samplePerformance(NULL);
+    return true;
+}
+
+/*
+ * Request a performance level between lowest and highest, in the platform's abstract
+ * units. Desired, minimum and maximum go out together: merged into one access when they
+ * share a register (as HWP's do) and under one doorbell when they live in PCC.
+ * A 0 minimum or maximum leaves that bound where it is.
+ */
+bool PDACPICPU::setPerformance(uint32_t desired, uint32_t minimum, uint32_t maximum)
+{
+    PDACPIRegisterWrite writes[3];
+    UInt32 count = 0;
+    
+    if (!this->m_cppcValid) {
+        return false;
+    }
+    
+    desired = desired < this->m_cppcLowest ? this->m_cppcLowest : desired > this->m_cppcHighest ? this->m_cppcHighest : desired;
+    writes[count++] = { &this->m_cppc[kCPPCDesired].Reg, desired };
+    if (minimum && this->m_cppc[kCPPCMinimum].Present && !this->m_cppc[kCPPCMinimum].Constant) {
+        writes[count++] = { &this->m_cppc[kCPPCMinimum].Reg, minimum < this->m_cppcLowest ? this->m_cppcLowest : minimum };
+    }
+    if (maximum && this->m_cppc[kCPPCMaximum].Present && !this->m_cppc[kCPPCMaximum].Constant) {
+        writes[count++] = { &this->m_cppc[kCPPCMaximum].Reg, maximum > this->m_cppcHighest ? this->m_cppcHighest : maximum };
+    }
+    
+    __atomic_add_fetch(&this->m_cppcStats.Requests, 1, __ATOMIC_RELAXED);
+    if (this->writeRegisters(writes, count) != kIOReturnSuccess) {
+        __atomic_add_fetch(&this->m_cppcStats.Failures, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    
+    this->m_cppcDesired = desired;
+    return true;
+}
+
+/*
+ * Delivered performance since the previous sample: reference performance scaled by how
+ * much faster the delivered counter ran than the reference counter. Both counters are
+ * read in one batch so they describe the same instant.
+ */
+bool PDACPICPU::samplePerformance(uint32_t *delivered)
+{
+    static const UInt32 counters[] = { kCPPCDeliveredCounter, kCPPCReferenceCounter };
+    UInt64 values[2], deliveredDelta, referenceDelta;
+    
+    if (!this->m_cppcValid || this->readCPPC(counters, 2, values) != kIOReturnSuccess) {
+        return false;
+    }
+    
+    /* Counters narrower than 64 bits wrap; the masked difference survives one wrap. */
+    deliveredDelta = (values[0] - this->m_cppcLastDelivered) &
+                     PDACPIFieldMask(&this->m_cppc[kCPPCDeliveredCounter].Reg, PDACPIAccessWidth(&this->m_cppc[kCPPCDeliveredCounter].Reg));
+    referenceDelta = (values[1] - this->m_cppcLastReference) &
+                     PDACPIFieldMask(&this->m_cppc[kCPPCReferenceCounter].Reg, PDACPIAccessWidth(&this->m_cppc[kCPPCReferenceCounter].Reg));
+    this->m_cppcLastDelivered = values[0];
+    this->m_cppcLastReference = values[1];
+    __atomic_add_fetch(&this->m_cppcStats.Samples, 1, __ATOMIC_RELAXED);
+    
+    if (!referenceDelta) {
+        return false;
+    }
+    
+    this->m_cppcDelivered = (UInt32)((this->m_cppcReference * deliveredDelta) / referenceDelta);
+    if (delivered) {
+        *delivered = this->m_cppcDelivered;
+    }
+    return true;
+}
+
+#pragma mark - Idle states
+
+/* C1 always ends up in slot 0, whatever firmware says or doesn't. */
+bool PDACPICPU::parseCST(PDACPICStateTable *table)
+{
+    ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    ACPI_OBJECT *package;
+    
+    if (ACPI_FAILURE(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_CST", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+        return false;
+    }
+    package = (ACPI_OBJECT *)buffer.Pointer;
+    
+    table->States[0] = kPDACPIDefaultC1;
+    table->Count = 1;
+    
+    /* Element 0 is a count of the rest; the package length is what we can trust. */
+    for (UInt32 i = 1; i < package->Package.Count && table->Count < kPDACPIMaxCStates; i++) {
+        ACPI_OBJECT *entry = &package->Package.Elements[i];
+        PDACPICState state = {};
+        PDACPIRegister reg;
+        
+        if (entry->Type != ACPI_TYPE_PACKAGE || entry->Package.Count < 4 ||
+            entry->Package.Elements[1].Type != ACPI_TYPE_INTEGER ||
+            entry->Package.Elements[2].Type != ACPI_TYPE_INTEGER ||
+            entry->Package.Elements[3].Type != ACPI_TYPE_INTEGER ||
+            !PDACPIDecodeRegister(&entry->Package.Elements[0], &reg)) {
+            continue;
+        }
+        
+        state.Type = (UInt8)entry->Package.Elements[1].Integer.Value;
+        state.Index = (UInt8)i;
+        state.Latency = (UInt32)entry->Package.Elements[2].Integer.Value;
+        state.Power = (UInt32)entry->Package.Elements[3].Integer.Value;
+        state.Residency = state.Latency * kPDACPIResidencyFactor;
+        if (state.Type < 1 || state.Type > 3) {
+            continue;
+        }
+        
+        if (reg.SpaceID == ACPI_ADR_SPACE_FIXED_HARDWARE && reg.BitOffset == kIntelCStateNative && this->m_mwait) {
+            state.Method = kPDACPICStateMwait;
+            state.Hint = reg.Address;
+        } else if (state.Type == 1) {
+            state.Method = kPDACPICStateHalt;
+        } else if (reg.SpaceID == ACPI_ADR_SPACE_SYSTEM_IO) {
+            state.Method = kPDACPICStateIO;
+            state.Hint = reg.Address;
+            /* We don't arbitrate bus masters; flushing is the spec's other way to keep C3 coherent. */
+            state.FlushCache = state.Type == 3;
+        } else {
+            continue;
+        }
+        
+        if (state.Type == 1) {
+            table->States[0] = state;
+        } else {
+            table->States[table->Count++] = state;
+        }
+    }
+    
+    ACPI_FREE(buffer.Pointer);
+    return true;
+}
+
+/* Only this processor's own level; states of enclosing processor containers aren't used. */
+bool PDACPICPU::parseLPI(PDACPICStateTable *table)
+{
+    ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    ACPI_OBJECT *package;
+    
+    if (ACPI_FAILURE(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_LPI", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+        return false;
+    }
+    package = (ACPI_OBJECT *)buffer.Pointer;
+    
+    table->States[0] = kPDACPIDefaultC1;
+    table->Count = 1;
+    
+    /* Revision, level ID and count come before the states. */
+    for (UInt32 i = 3; i < package->Package.Count && table->Count < kPDACPIMaxCStates; i++) {
+        ACPI_OBJECT *entry = &package->Package.Elements[i];
+        PDACPICState state = {};
+        PDACPIRegister reg;
+        bool first = i == 3;
+        
+        if (entry->Type != ACPI_TYPE_PACKAGE || entry->Package.Count < 7 ||
+            entry->Package.Elements[0].Type != ACPI_TYPE_INTEGER ||
+            entry->Package.Elements[1].Type != ACPI_TYPE_INTEGER ||
+            entry->Package.Elements[2].Type != ACPI_TYPE_INTEGER ||
+            !(entry->Package.Elements[2].Integer.Value & 1) ||
+            !PDACPIDecodeRegister(&entry->Package.Elements[6], &reg)) {
+            continue;
+        }
+        
+        state.Residency = (UInt32)entry->Package.Elements[0].Integer.Value;
+        state.Latency = (UInt32)entry->Package.Elements[1].Integer.Value;
+        state.Type = first ? 1 : (table->Count < 3 ? table->Count + 1 : 3);
+        
+        if (reg.SpaceID == ACPI_ADR_SPACE_FIXED_HARDWARE && this->m_mwait) {
+            state.Method = kPDACPICStateMwait;
+            state.Hint = reg.Address;
+        } else if (reg.SpaceID == ACPI_ADR_SPACE_SYSTEM_IO && !first) {
+            state.Method = kPDACPICStateIO;
+            state.Hint = reg.Address;
+        } else if (first) {
+            state.Method = kPDACPICStateHalt;
+        } else {
+            continue;
+        }
+        
+        if (first) {
+            table->States[0] = state;
+        } else {
+            table->States[table->Count++] = state;
+        }
+    }
+    
+    ACPI_FREE(buffer.Pointer);
+    return true;
+}
+
+/*
+ * Build into whichever table the idle path isn't using, then switch it over. Notifies can
+ * come back to back, so rebuilds take turns, and each one waits until our idle path is
+ * done with the spare: it may have picked it up just before the previous switch.
+ */
+void PDACPICPU::initIdleStates()
+{
+    IOLockLock(this->m_idleStateLock);
+    
+    PDACPICStateTable *current = __atomic_load_n(&this->m_cStateTable, __ATOMIC_ACQUIRE);
+    PDACPICStateTable *table = current == &this->m_cStateTables[0] ? &this->m_cStateTables[1] : &this->m_cStateTables[0];
+    
+    while (__atomic_load_n(&this->m_cStateTableInUse, __ATOMIC_SEQ_CST) == table) {
+        IOSleep(1);
+    }
+    
+    if (!this->parseLPI(table) && !this->parseCST(table)) {
+        table->States[0] = kPDACPIDefaultC1;
+        table->Count = 1;
+    }
+    
+    /* The governor takes the last state that fits, so order by exit latency. */
+    for (UInt32 i = 2; i < table->Count; i++) {
+        PDACPICState state = table->States[i];
+        UInt32 j = i;
+        while (j > 1 && table->States[j - 1].Latency > state.Latency) {
+            table->States[j] = table->States[j - 1];
+            j--;
+        }
+        table->States[j] = state;
+    }
+    
+    for (UInt32 i = 0; i < table->Count; i++) {
+        table->Domain[i] = -1;
+        for (UInt32 j = 0; table->States[i].Index && j < this->m_idleDomainCount; j++) {
+            if (this->m_idleDomains[j]->getIndex() == table->States[i].Index) {
+                table->Domain[i] = (SInt8)j;
+                break;
+            }
+        }
+    }
+    
+    /* Counters are per slot, so a new table starts them over; the CPU itself resets them when it sees it. */
+    table->Generation = ++this->m_cStateGeneration;
+    __atomic_store_n(&this->m_cStateTable, table, __ATOMIC_SEQ_CST);
+    
+    OSArray *array = OSArray::withCapacity(table->Count);
+    for (UInt32 i = 0; array && i < table->Count; i++) {
+        static const char *methods[] = { "HLT", "MWAIT", "I/O" };
+        const PDACPICState *state = &table->States[i];
+        OSDictionary *dict = OSDictionary::withCapacity(6);
+        if (!dict) {
+            break;
+        }
+        
+        const struct { const char *key; UInt64 value; } fields[] = {
+            { "Type",                   state->Type },
+            { "Latency",                state->Latency },
+            { "Residency",              state->Residency },
+            { "Power",                  state->Power },
+            { "Hint",                   state->Hint },
+        };
+        
+        for (UInt32 j = 0; j < sizeof(fields) / sizeof(fields[0]); j++) {
+            OSNumber *num = OSNumber::withNumber(fields[j].value, 64);
+            if (num) {
+                dict->setObject(fields[j].key, num);
+                num->release();
+            }
+        }
+        
+        OSString *method = OSString::withCString(methods[state->Method]);
+        if (method) {
+            dict->setObject("Method", method);
+            method->release();
+        }
+        array->setObject(dict);
+        dict->release();
+    }
+    
+    if (array) {
+        OSArray *old = this->cStateArray;
+        this->cStateArray = array;
+        this->IOService::setProperty("Idle States", array);
+        OSSafeReleaseNULL(old);
+    }
+    
+    IOLockUnlock(this->m_idleStateLock);
+}
+
+/*
+ * The idle table, for this CPU's own idle path only. Announcing it before trusting it keeps
+ * initIdleStates from rebuilding it under us, and a table we haven't counted for yet gets
+ * fresh counters here, on the only CPU that writes them.
+ */
+const PDACPICStateTable *PDACPICPU::acquireIdleTable()
+{
+    PDACPICStateTable *table;
+    
+    do {
+        table = __atomic_load_n(&this->m_cStateTable, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&this->m_cStateTableInUse, table, __ATOMIC_SEQ_CST);
+    } while (table != __atomic_load_n(&this->m_cStateTable, __ATOMIC_SEQ_CST));
+    
+    if (table->Generation != this->m_cStateCounterGeneration) {
+        bzero((void *)this->m_cStateCounters, sizeof(this->m_cStateCounters));
+        __atomic_store_n(&this->m_cStateCounterGeneration, table->Generation, __ATOMIC_RELEASE);
+    }
+    return table;
+}
+
+void PDACPICPU::releaseIdleTable()
+{
+    __atomic_store_n(&this->m_cStateTableInUse, (PDACPICStateTable *)nullptr, __ATOMIC_RELEASE);
+}
+
+/* On this CPU, with interrupts disabled; they are still disabled when we come back. */
+void PDACPICPU::enterState(const PDACPICState *state)
+{
+    UInt32 value;
+    
+    switch (state->Method) {
+        case kPDACPICStateMwait:
+            /* ECX bit 0: an interrupt ends the MWAIT even though it's masked. */
+            asm volatile("monitor" : : "a"(&this->m_idleMonitor), "c"(0), "d"(0));
+            asm volatile("mwait" : : "a"((UInt32)state->Hint), "c"(1));
+            break;
+        case kPDACPICStateIO:
+            if (state->FlushCache) {
+                asm volatile("wbinvd" : : : "memory");
+            }
+            AcpiOsReadPort(state->Hint, &value, 8);
+            /* Some chipsets only stop the clock once the next PM timer read comes along. */
+            AcpiGetTimer(&value);
+            break;
+        default:
+            asm volatile("sti; hlt; cli");
+            break;
+    }
+}
+
+/* Enter a state and account for it; returns how long we were gone, in ns. */
+UInt64 PDACPICPU::runState(const PDACPICStateTable *table, UInt32 index)
+{
+    PDACPICStateCounters *counters = &this->m_cStateCounters[index];
+    UInt64 start = mach_absolute_time();
+    UInt64 elapsed;
+    
+    this->enterState(&table->States[index]);
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed);
+    PDACPICounterAdd(&counters->Entries, 1);
+    PDACPICounterAdd(&counters->Residency, elapsed);
+    return elapsed;
+}
+
+/*
+ * The idle path. nextEventUs is the time to the next timer if the caller knows it,
+ * kPDACPIIdleUnknown if not; the history fills in the rest.
+ */
+void PDACPICPU::idle(uint32_t maxAllowedLatencyUs, uint32_t nextEventUs)
+{
+    const PDACPICStateTable *table = this->acquireIdleTable();
+    UInt32 index = PDACPISelectCState(table->States, table->Count, maxAllowedLatencyUs, nextEventUs, &this->m_idleHistory);
+    UInt32 last = 0;
+    
+    /* We're idle in every domain we belong to, whatever state we end up in. */
+    for (UInt32 i = 0; i < this->m_idleDomainCount; i++) {
+        if (this->m_idleDomains[i]->enterIdle(this->m_idleMembers[i])) {
+            last |= 1U << i;
+        }
+    }
+    
+    /* A coordinated state is only for the last one in; everyone else steps down past it. */
+    if (table->Domain[index] >= 0) {
+        PDACPICPUDomain *domain = this->m_idleDomains[table->Domain[index]];
+        while (index > 0 && table->Domain[index] >= 0 && !(last & (1U << table->Domain[index]))) {
+            index--;
+        }
+        domain->countIdle(table->Domain[index] >= 0 && this->m_idleDomains[table->Domain[index]] == domain);
+    }
+    
+    UInt64 elapsed = this->runState(table, index) / NSEC_PER_USEC;
+    
+    for (UInt32 i = 0; i < this->m_idleDomainCount; i++) {
+        this->m_idleDomains[i]->exitIdle(this->m_idleMembers[i]);
+    }
+    
+    /* Exit latency is only measurable when we know what should have woken us, and when. */
+    if (nextEventUs != kPDACPIIdleUnknown && elapsed >= nextEventUs) {
+        PDACPICounterAdd(&this->m_cStateCounters[index].ExitLatency[PDACPILatencyBucket(elapsed - nextEventUs)], 1);
+    }
+    this->releaseIdleTable();
+    
+    PDACPIRecordIdle(&this->m_idleHistory, elapsed < kPDACPIIdleUnknown ? (UInt32)elapsed : kPDACPIIdleUnknown - 1);
+}
+
+void PDACPICPU::notifyHandler(ACPI_HANDLE Device, UInt32 Value, void *Context)
+{
+    PDACPICPU *cpu = (PDACPICPU *)Context;
+    ACPI_OBJECT args[3];
+    ACPI_OBJECT_LIST list = { 3, args };
+    
+    switch (Value) {
+        case kPDACPIPerfNotify:
+            cpu->updatePerformanceLimit();
+            __atomic_add_fetch(&cpu->m_pStateStats.LimitChanges, 1, __ATOMIC_RELAXED);
+            break;
+        case kPDACPIIdleNotify:
+            cpu->initIdleStates();
+            break;
+        default:
+            return;
+    }
+    
+    /* Optional; lets firmware know the new limit is in effect. */
+    args[0].Type = ACPI_TYPE_INTEGER;
+    args[0].Integer.Value = Value;
+    args[1].Type = ACPI_TYPE_INTEGER;
+    args[1].Integer.Value = 0;
+    args[2].Type = ACPI_TYPE_BUFFER;
+    args[2].Buffer.Length = 0;
+    args[2].Buffer.Pointer = NULL;
+    AcpiEvaluateObject(Device, (char *)"_OST", &list, NULL);
+}
+
+#pragma mark - Statistics
+
+OSDictionary *PDACPICPU::copyStatistics() const
+{
+    PDACPIPStateStatistics stats = this->m_pStateStats;
+    UInt32 current = this->currentPState;
+    UInt64 since = this->m_pStateSince;
+    
+    if (!this->m_pStateCount) {
+        return nullptr;
+    }
+    
+    OSDictionary *dict = OSDictionary::withCapacity(9);
+    OSArray *residency = OSArray::withCapacity(this->m_pStateCount);
+    if (!dict || !residency) {
+        OSSafeReleaseNULL(dict);
+        OSSafeReleaseNULL(residency);
+        return nullptr;
+    }
+    
+    /* ns per state, counting the one we're in right now */
+    for (UInt32 i = 0; i < this->m_pStateCount; i++) {
+        UInt64 time = __atomic_load_n(&this->m_pStateResidency[i], __ATOMIC_RELAXED);
+        if (i == current) {
+            time += mach_absolute_time() - since;
+        }
+        absolutetime_to_nanoseconds(time, &time);
+        
+        OSNumber *num = OSNumber::withNumber(time, 64);
+        if (num) {
+            residency->setObject(num);
+            num->release();
+        }
+    }
+    dict->setObject("Time In State", residency);
+    residency->release();
+    
+    const struct { const char *key; UInt64 value; } counters[] = {
+        { "Current State",      this->currentPState },
+        { "Limit",              this->m_pStateLimit },
+        { "Transitions",        stats.Transitions },
+        { "Failures",           stats.Failures },
+        { "Clamped",            stats.Clamped },
+        { "Limit Changes",      stats.LimitChanges },
+        { "Total Latency",      stats.TotalLatency },
+        { "Max Latency",        stats.MaxLatency },
+    };
+    
+    for (UInt32 i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        OSNumber *num = OSNumber::withNumber(counters[i].value, 64);
+        if (num) {
+            dict->setObject(counters[i].key, num);
+            num->release();
+        }
+    }
+    
+    return dict;
+}
+
+/* One dictionary per slot of the current idle state table. */
+OSArray *PDACPICPU::copyIdleStatistics() const
+{
+    const PDACPICStateTable *table = __atomic_load_n(&this->m_cStateTable, __ATOMIC_ACQUIRE);
+    
+    if (!table) {
+        return nullptr;
+    }
+    
+    /* Until the CPU has idled on a new table, what's in the counters belongs to the old one. */
+    bool fresh = __atomic_load_n(&this->m_cStateCounterGeneration, __ATOMIC_ACQUIRE) != table->Generation;
+    
+    OSArray *array = OSArray::withCapacity(table->Count);
+    for (UInt32 i = 0; array && i < table->Count; i++) {
+        PDACPICStateCounters counters = this->m_cStateCounters[i];
+        if (fresh) {
+            bzero(&counters, sizeof(counters));
+        }
+        OSDictionary *dict = OSDictionary::withCapacity(3);
+        OSDictionary *histogram = OSDictionary::withCapacity(kPDACPIIdleLatencyBuckets);
+        if (!dict || !histogram) {
+            OSSafeReleaseNULL(dict);
+            OSSafeReleaseNULL(histogram);
+            break;
+        }
+        
+        OSNumber *num = OSNumber::withNumber(counters.Entries, 64);
+        if (num) {
+            dict->setObject("Entries", num);
+            num->release();
+        }
+        num = OSNumber::withNumber(counters.Residency, 64);
+        if (num) {
+            dict->setObject("Residency", num);
+            num->release();
+        }
+        
+        for (UInt32 j = 0; j < kPDACPIIdleLatencyBuckets; j++) {
+            if (!counters.ExitLatency[j]) {
+                continue;
+            }
+            
+            char key[16];
+            if (j == kPDACPIIdleLatencyBuckets - 1) {
+                snprintf(key, sizeof(key), ">=%uus", 1U << (j - 1));
+            } else {
+                snprintf(key, sizeof(key), "<%uus", 1U << j);
+            }
+            
+            num = OSNumber::withNumber(counters.ExitLatency[j], 64);
+            if (num) {
+                histogram->setObject(key, num);
+                num->release();
+            }
+        }
+        dict->setObject("Exit Latency", histogram);
+        histogram->release();
+        
+        array->setObject(dict);
+        dict->release();
+    }
+    
+    return array;
+}
+
+OSDictionary *PDACPICPU::copyCPPCStatistics() const
+{
+    PDACPICPPCStatistics stats = this->m_cppcStats;
+    
+    if (!this->m_cppcValid) {
+        return nullptr;
+    }
+    
+    OSDictionary *dict = OSDictionary::withCapacity(13);
+    if (!dict) {
+        return nullptr;
+    }
+    
+    const struct { const char *key; UInt64 value; } counters[] = {
+        { "Highest",                this->m_cppcHighest },
+        { "Nominal",                this->m_cppcNominal },
+        { "Lowest Nonlinear",       this->m_cppcLowestNonlinear },
+        { "Lowest",                 this->m_cppcLowest },
+        { "Reference",              this->m_cppcReference },
+        { "Desired",                this->m_cppcDesired },
+        { "Delivered",              this->m_cppcDelivered },
+        { "Requests",               stats.Requests },
+        { "Failures",               stats.Failures },
+        { "Samples",                stats.Samples },
+        { "PCC Commands",           stats.PCCCommands },
+        { "PCC Timeouts",           stats.PCCTimeouts },
+    };
+    
+    for (UInt32 i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        OSNumber *num = OSNumber::withNumber(counters[i].value, 64);
+        if (num) {
+            dict->setObject(counters[i].key, num);
+            num->release();
+        }
+    }
+    
+    return dict;
+}
+
+bool PDACPICPU::serializeProperties(OSSerialize *s) const
+{
+    OSDictionary *stats = this->copyStatistics();
+    if (stats) {
+        const_cast<PDACPICPU *>(this)->IOService::setProperty("Performance Statistics", stats);
+        stats->release();
+    }
+    
+    OSArray *idle = this->copyIdleStatistics();
+    if (idle) {
+        const_cast<PDACPICPU *>(this)->IOService::setProperty("Idle Statistics", idle);
+        idle->release();
+    }
+    
+    OSDictionary *cppc = this->copyCPPCStatistics();
+    if (cppc) {
+        const_cast<PDACPICPU *>(this)->IOService::setProperty("CPPC Statistics", cppc);
+        cppc->release();
+    }
+    
+    /* IOCPU publishes the CPU state from here; super is IOService. */
+    return IOCPU::serializeProperties(s);
+}
+
+#pragma mark - IOCPU
+
 void PDACPICPU::initCPU(bool boot)
 {
     /* mmm... */
@@ -121,8 +1740,21 @@ void PDACPICPU::haltCPU()
     
     if (this->getCPUNumber() > 0) {
         processor_exit(this->machProcessor);
-    } else {
-        /* TODO: here, we should call into ACPICA to initiate the S<X> transaition */
+        return;
+    }
+    
+    /* The boot processor goes last and takes the system into whatever prepareSleepState set up. */
+    PDACPIPlatformExpert *platform = OSDynamicCast(PDACPIPlatformExpert, getPlatform());
+    UInt8 state = platform ? platform->m_preparedSleepState : ACPI_STATE_S0;
+    if (state == ACPI_STATE_S0) {
+        IOLog("ACPICPU: no sleep state prepared, not entering one\n");
+        return;
+    }
+    
+    /* S5 doesn't come back; S1 returns here on wake; S2-S4 resume through the waking vector. */
+    platform->enterSleepState(state);
+    if (state == ACPI_STATE_S1) {
+        platform->wakeFromSleepState(state);
     }
 }
 
@@ -146,30 +1778,88 @@ void PDACPICPU::enterC1()
     asm volatile("hlt");
 }
 
-void PDACPICPU::enterCState(uint32_t cstateType)
+/* Callers can be on any CPU, so they mustn't announce the table as the idle path's. */
+void PDACPICPU::enterCState(uint32_t index)
 {
-    switch (cstateType)
-    {
-        case 1:
-            enterC1();
-            break;
-        default:
-            break;
-    }
+    const PDACPICStateTable *table = __atomic_load_n(&this->m_cStateTable, __ATOMIC_ACQUIRE);
+    
+    this->runState(table, index < table->Count ? index : 0);
 }
 
 bool PDACPICPU::switchToPState(uint32_t index)
 {
+    UInt32 limit = __atomic_load_n(&this->m_pStateLimit, __ATOMIC_ACQUIRE);
+    
+    if (index >= this->m_pStateCount)
+        return false;
+    
+    if (PDACPIClampPState(index, limit) != index) {
+        __atomic_add_fetch(&this->m_pStateStats.Clamped, 1, __ATOMIC_RELAXED);
+        index = limit;
+    }
+    
+    /* The domain decides whether this changes anything, and who writes it. */
+    if (this->m_perfDomain)
+        return this->m_perfDomain->requestPerformance(this->m_perfMember, index);
+    
     if (index == currentPState)
         return true;
 
-    IOLog("PDACPICPU: Switching to P-State %u\n", index);
-    currentPState = index;
+    if (this->writePState(index) != kIOReturnSuccess)
+        return false;
+    
+    this->notePState(index);
     return true;
 }
 
+/* The one register write, timed. */
+IOReturn PDACPICPU::writePState(UInt32 index)
+{
+    UInt64 start, elapsed, max;
+    IOReturn ret;
+    
+    if (index >= this->m_pStateCount) {
+        return kIOReturnBadArgument;
+    }
+    
+    start = mach_absolute_time();
+    ret = this->m_registerOps.Write(this->m_registerOps.Context, &this->m_perfControl, this->m_pStates[index].Control);
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed);
+    
+    if (ret != kIOReturnSuccess) {
+        __atomic_add_fetch(&this->m_pStateStats.Failures, 1, __ATOMIC_RELAXED);
+        return ret;
+    }
+    
+    __atomic_add_fetch(&this->m_pStateStats.TotalLatency, elapsed, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&this->m_pStateStats.MaxLatency, __ATOMIC_RELAXED);
+    while (elapsed > max && !__atomic_compare_exchange_n(&this->m_pStateStats.MaxLatency, &max, elapsed, true,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return kIOReturnSuccess;
+}
+
+/* We're in a new state, by our own write or a domain sibling's. */
+void PDACPICPU::notePState(UInt32 index)
+{
+    if (index == currentPState) {
+        return;
+    }
+    
+    /* Close out the time spent in the state we're leaving. */
+    UInt64 now = mach_absolute_time();
+    UInt64 since = __atomic_exchange_n(&this->m_pStateSince, now, __ATOMIC_RELAXED);
+    if (currentPState < this->m_pStateCount) {
+        __atomic_add_fetch(&this->m_pStateResidency[currentPState], now - since, __ATOMIC_RELAXED);
+    }
+    
+    currentPState = index;
+    __atomic_add_fetch(&this->m_pStateStats.Transitions, 1, __ATOMIC_RELAXED);
+}
+
 uint32_t PDACPICPU::getBestCStateForLatency(uint32_t maxAllowedLatencyUs)
 {
-    // Simulated: always return C1
-    return 1;
+    const PDACPICStateTable *table = __atomic_load_n(&this->m_cStateTable, __ATOMIC_ACQUIRE);
+    
+    return PDACPISelectCState(table->States, table->Count, maxAllowedLatencyUs, kPDACPIIdleUnknown, &this->m_idleHistory);
 }
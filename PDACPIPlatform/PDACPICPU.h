@@ -37,8 +37,17 @@
 #define _PDACPI_CPU_H
 
 #include <IOKit/IOService.h>
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <libkern/c++/OSArray.h>
-#include "acpi.h"
+
+extern "C" {
+#include "acpica/acpi.h"
+#include "acpica/amlresrc.h"
+}
+
+#include "PDACPIIdleGovernor.h"
+#include "PDACPIPerformanceStates.h"
+#include "PDACPICPUDomain.h"
 
 #if __has_include(<IOKit/IOCPU.h>)
 #include <IOKit/IOCPU.h>
@@ -48,17 +57,198 @@ typedef void (*ipi_handler_t)(void);
 #include "ExternalHeaders/IOKit/IOCPU.h"
 #endif
 
+struct PDACPIPCCSubspace;
+
+/* A Generic Register descriptor from _PCT and friends, decoded. */
+struct PDACPIRegister {
+    UInt8 SpaceID;              /* ACPI_ADR_SPACE_*; FFixedHW registers are MSRs */
+    UInt8 BitWidth;
+    UInt8 BitOffset;
+    UInt8 AccessSize;
+    UInt64 Address;
+};
+
+bool PDACPIDecodeRegister(const ACPI_OBJECT *object, PDACPIRegister *reg);
+
+/*
+ * Everything PDACPICPU does to performance and idle hardware goes through these, so the
+ * table parsing and switching logic can run against a recorder instead of the machine.
+ * The defaults run MSR accesses on the CPU that owns them.
+ */
+struct PDACPIRegisterOps {
+    IOReturn (*Read)(void *context, const PDACPIRegister *reg, UInt64 *value);
+    IOReturn (*Write)(void *context, const PDACPIRegister *reg, UInt64 value);
+    void *Context;
+};
+
+/* Updated with atomics from whoever is switching; a snapshot may be slightly torn. */
+struct PDACPIPStateStatistics {
+    UInt64 Transitions;
+    UInt64 Failures;
+    UInt64 Clamped;             /* requests raised to the _PPC limit */
+    UInt64 LimitChanges;        /* _PPC notifications */
+    UInt64 TotalLatency;        /* ns */
+    UInt64 MaxLatency;          /* ns */
+};
+
+/* One write in a batch; fields of the same register are merged into a single access. */
+struct PDACPIRegisterWrite {
+    const PDACPIRegister *Reg;
+    UInt64 Value;
+};
+
+/* _CPC package entries, in package order after NumEntries and Revision. */
+enum {
+    kCPPCHighest,
+    kCPPCNominal,
+    kCPPCLowestNonlinear,
+    kCPPCLowest,
+    kCPPCGuaranteed,
+    kCPPCDesired,
+    kCPPCMinimum,
+    kCPPCMaximum,
+    kCPPCTolerance,
+    kCPPCTimeWindow,
+    kCPPCWraparound,
+    kCPPCReferenceCounter,
+    kCPPCDeliveredCounter,
+    kCPPCLimited,
+    kCPPCEnable,
+    kCPPCAutonomous,
+    kCPPCActivityWindow,
+    kCPPCEnergyPerformance,
+    kCPPCReference,
+    kCPPCLowestFrequency,
+    kCPPCNominalFrequency,
+    kCPPCEntries
+};
+
+/* A _CPC entry is either a constant or a register; the null register means absent. */
+struct PDACPICPPCEntry {
+    bool Present;
+    bool Constant;
+    UInt64 Value;
+    PDACPIRegister Reg;
+};
+
+struct PDACPICPPCStatistics {
+    UInt64 Requests;
+    UInt64 Failures;
+    UInt64 Samples;
+    UInt64 PCCCommands;
+    UInt64 PCCTimeouts;
+};
+
+#define kPDACPIMaxPStates       32
+#define kPDACPIMaxCStates       8
+#define kPDACPIIdleLatencyBuckets   12
+
+/*
+ * Per idle state slot. Only the owning CPU's idle path writes these, so they're updated
+ * without a lock or a locked instruction; readers on other CPUs see each counter whole.
+ */
+struct PDACPICStateCounters {
+    UInt64 Entries;
+    UInt64 Residency;           /* ns */
+    UInt64 ExitLatency[kPDACPIIdleLatencyBuckets];  /* woke past the timer deadline by, log2 us */
+};
+
+/* Swapped whole when _CST changes, so the idle path never sees a half-parsed table. */
+struct PDACPICStateTable {
+    UInt32 Generation;          /* bumped by every rebuild; see acquireIdleTable */
+    UInt32 Count;               /* at least 1: state 0 is always a usable C1 */
+    PDACPICState States[kPDACPIMaxCStates];
+    SInt8 Domain[kPDACPIMaxCStates];    /* into m_idleDomains, -1 if uncoordinated */
+};
+
 class PDACPICPU : public IOCPU
 {
     OSDeclareDefaultStructors(PDACPICPU)
+    friend class PDACPICPUDomain;
 
 private:
     uint32_t currentPState;
     OSArray* pStateArray;
     OSArray* cStateArray;
+    
+    IOACPIPlatformDevice *m_device;
+    ACPI_HANDLE m_handle;
+    UInt32 m_lapic;
+    SInt32 m_cpuNumber;                 /* XNU's number for us, -1 until we find it */
+    bool m_notifyInstalled;
+    PDACPIRegisterOps m_registerOps;
+    
+    PDACPIRegister m_perfControl;       /* _PCT */
+    PDACPIRegister m_perfStatus;
+    PDACPIPState m_pStates[kPDACPIMaxPStates];
+    UInt32 m_pStateCount;
+    volatile UInt32 m_pStateLimit;      /* _PPC: the fastest state we may use */
+    PDACPIPStateStatistics m_pStateStats;
+    UInt64 m_pStateResidency[kPDACPIMaxPStates];   /* absolute time, closed intervals only */
+    volatile UInt64 m_pStateSince;      /* when we entered currentPState */
+    
+    PDACPICStateTable m_cStateTables[2];
+    PDACPICStateTable *volatile m_cStateTable;
+    PDACPICStateTable *volatile m_cStateTableInUse;    /* announced by our idle path while it runs one */
+    IOLock *m_idleStateLock;            /* one initIdleStates at a time */
+    UInt32 m_cStateGeneration;          /* last one handed out, under m_idleStateLock */
+    volatile UInt32 m_cStateCounterGeneration;          /* the table m_cStateCounters count for */
+    PDACPIIdleHistory m_idleHistory;   /* only this CPU's idle path touches it */
+    volatile UInt64 m_idleMonitor;      /* MONITOR target for MWAIT states */
+    bool m_mwait;
+    PDACPICStateCounters m_cStateCounters[kPDACPIMaxCStates] __attribute__((aligned(64)));
+    
+    PDACPICPUDomain *m_perfDomain;      /* _PSD, if software coordinates it */
+    SInt32 m_perfMember;
+    PDACPICPUDomain *m_idleDomains[kPDACPIMaxCStates];     /* _CSD, likewise */
+    SInt32 m_idleMembers[kPDACPIMaxCStates];
+    UInt32 m_idleDomainCount;
+    
+    PDACPICPPCEntry m_cppc[kCPPCEntries];
+    bool m_cppcValid;
+    UInt32 m_cppcHighest;               /* abstract performance units */
+    UInt32 m_cppcNominal;
+    UInt32 m_cppcLowestNonlinear;
+    UInt32 m_cppcLowest;
+    UInt32 m_cppcReference;             /* what the reference counter counts at */
+    UInt32 m_cppcDesired;
+    UInt64 m_cppcLastDelivered;         /* feedback counters at the previous sample */
+    UInt64 m_cppcLastReference;
+    UInt32 m_cppcDelivered;             /* delivered performance over the last sample */
+    PDACPICPPCStatistics m_cppcStats;
+    
+    static void notifyHandler(ACPI_HANDLE Device, UInt32 Value, void *Context);
+    static IOReturn readRegister(void *context, const PDACPIRegister *reg, UInt64 *value);
+    static IOReturn writeRegister(void *context, const PDACPIRegister *reg, UInt64 value);
+    
+    bool initPerformanceStates(void);
+    void joinDomains(IOService *provider);
+    void leaveDomains(void);
+    IOReturn writePState(UInt32 index);
+    void notePState(UInt32 index);
+    void updatePerformanceLimit(void);
+    void initIdleStates(void);
+    const PDACPICStateTable *acquireIdleTable(void);
+    void releaseIdleTable(void);
+    bool parseCST(PDACPICStateTable *table);
+    bool parseLPI(PDACPICStateTable *table);
+    void enterState(const PDACPICState *state);
+    UInt64 runState(const PDACPICStateTable *table, UInt32 index);
+    bool initCPPC(void);
+    IOReturn readRegisters(const PDACPIRegister *const *regs, UInt32 count, UInt64 *values);
+    IOReturn writeRegisters(const PDACPIRegisterWrite *writes, UInt32 count);
+    IOReturn readCPPC(const UInt32 *entries, UInt32 count, UInt64 *values);
+    IOReturn pccCommand(PDACPIPCCSubspace *subspace, UInt16 command);
+    IOReturn accessRegister(bool write, const PDACPIRegister *reg, UInt64 *raw);
+    IOReturn accessMSR(bool write, UInt32 msr, UInt64 *value);
+    OSDictionary *copyStatistics(void) const;
+    OSArray *copyIdleStatistics(void) const;
+    OSDictionary *copyCPPCStatistics(void) const;
 
 public:
     virtual bool start(IOService* provider) override;
+    virtual void stop(IOService* provider) override;
+    virtual bool serializeProperties(OSSerialize* s) const override;
     
     virtual kern_return_t startCPU(vm_offset_t start_paddr, vm_offset_t arg_paddr) override;
     virtual void initCPU(bool boot) override;
@@ -67,11 +257,18 @@ public:
     virtual const OSSymbol *getCPUName(void) override;
     
     void enterC1();
-    void enterCState(uint32_t cstateType);
+    void enterCState(uint32_t index);
+    void idle(uint32_t maxAllowedLatencyUs, uint32_t nextEventUs);
+    bool setPerformance(uint32_t desired, uint32_t minimum, uint32_t maximum);
+    bool samplePerformance(uint32_t *delivered);
     bool switchToPState(uint32_t index);
     uint32_t getBestCStateForLatency(uint32_t maxAllowedLatencyUs);
     OSArray* getPStateArray() const { return pStateArray; }
     OSArray* getCStateArray() const { return cStateArray; }
+    
+    void setRegisterOps(const PDACPIRegisterOps *ops);
+    
+    static void declareCapabilities(ACPI_HANDLE handle);
 };
 
 #endif
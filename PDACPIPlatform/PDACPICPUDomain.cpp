@@ -0,0 +1,311 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#include "PDACPICPUDomain.h"
+#include "PDACPICPU.h"
+#include <libkern/c++/OSDictionary.h>
+#include <libkern/c++/OSNumber.h>
+#include <libkern/c++/OSString.h>
+#include <libkern/c++/OSSerialize.h>
+
+#define super OSObject
+OSDefineMetaClassAndStructors(PDACPICPUDomain, OSObject);
+
+PDACPICPUDomain *PDACPICPUDomain::withDomain(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index)
+{
+    PDACPICPUDomain *me = new PDACPICPUDomain;
+    
+    if (me && !me->init(kind, domain, coordination, processors, index)) {
+        me->release();
+        return nullptr;
+    }
+    return me;
+}
+
+bool PDACPICPUDomain::init(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index)
+{
+    if (!super::init()) {
+        return false;
+    }
+    
+    this->m_kind = kind;
+    this->m_domain = domain;
+    this->m_coordination = coordination;
+    this->m_processors = processors;
+    this->m_index = index;
+    this->m_current = kPDACPINoRequest;
+    for (UInt32 i = 0; i < kPDACPIMaxDomainMembers; i++) {
+        this->m_requests[i] = kPDACPINoRequest;
+    }
+    
+    if (kind == kPDACPIDomainPerformance) {
+        this->m_lock = IOLockAlloc();
+        return this->m_lock != nullptr;
+    }
+    
+    this->m_idleLock = IOSimpleLockAlloc();
+    return this->m_idleLock != nullptr;
+}
+
+void PDACPICPUDomain::free()
+{
+    if (this->m_lock) {
+        IOLockFree(this->m_lock);
+        this->m_lock = nullptr;
+    }
+    if (this->m_idleLock) {
+        IOSimpleLockFree(this->m_idleLock);
+        this->m_idleLock = nullptr;
+    }
+    
+    super::free();
+}
+
+bool PDACPICPUDomain::matches(UInt32 kind, UInt32 domain, UInt32 index) const
+{
+    return this->m_kind == kind && this->m_domain == domain && (kind != kPDACPIDomainIdle || this->m_index == index);
+}
+
+#pragma mark - Membership
+
+/* Members aren't retained; a PDACPICPU leaves before it goes away. */
+SInt32 PDACPICPUDomain::addMember(PDACPICPU *cpu)
+{
+    SInt32 member = -1;
+    
+    if (this->m_lock) {
+        IOLockLock(this->m_lock);
+    } else {
+        IOSimpleLockLock(this->m_idleLock);
+    }
+    
+    if (this->m_memberCount < kPDACPIMaxDomainMembers) {
+        member = this->m_memberCount++;
+        this->m_members[member] = cpu;
+    }
+    
+    if (this->m_lock) {
+        IOLockUnlock(this->m_lock);
+    } else {
+        IOSimpleLockUnlock(this->m_idleLock);
+    }
+    return member;
+}
+
+void PDACPICPUDomain::removeMember(UInt32 member)
+{
+    if (this->m_lock) {
+        IOLockLock(this->m_lock);
+        this->m_members[member] = nullptr;
+        this->m_requests[member] = kPDACPINoRequest;
+        IOLockUnlock(this->m_lock);
+    } else {
+        /* A processor that's gone is as idle as it gets. */
+        IOSimpleLockLock(this->m_idleLock);
+        this->m_members[member] = nullptr;
+        this->m_idleMask |= 1ULL << member;
+        IOSimpleLockUnlock(this->m_idleLock);
+    }
+}
+
+#pragma mark - Performance
+
+/*
+ * Record a member's request and issue whatever change it makes to the domain. The lock
+ * is held across the write so two changes can't land out of order. HW_ALL domains never
+ * get here: their members write their own requests.
+ */
+bool PDACPICPUDomain::requestPerformance(UInt32 member, UInt32 state)
+{
+    UInt32 effective = kPDACPINoRequest;
+    UInt32 active = 0;
+    bool ok = true;
+    
+    IOLockLock(this->m_lock);
+    
+    this->m_requests[member] = state;
+    this->m_requestCount++;
+    
+    /*
+     * The fastest state anyone wants; lower is faster. The domain moves as one, so it
+     * can't go faster than the tightest _PPC among its members either.
+     */
+    UInt32 limit = 0;
+    for (UInt32 i = 0; i < this->m_memberCount; i++) {
+        if (!this->m_members[i]) {
+            continue;
+        }
+        active++;
+        if (this->m_requests[i] < effective) {
+            effective = this->m_requests[i];
+        }
+        UInt32 memberLimit = __atomic_load_n(&this->m_members[i]->m_pStateLimit, __ATOMIC_ACQUIRE);
+        if (memberLimit > limit) {
+            limit = memberLimit;
+        }
+    }
+    if (effective < limit) {
+        effective = limit;
+    }
+    
+    if (effective == this->m_current) {
+        this->m_saved++;
+        IOLockUnlock(this->m_lock);
+        return true;
+    }
+    
+    if (this->m_coordination == kPDACPICoordinationSWAny) {
+        /* Any one member's write moves the whole domain. */
+        ok = this->m_members[member]->writePState(effective) == kIOReturnSuccess;
+        for (UInt32 i = 0; ok && i < this->m_memberCount; i++) {
+            if (this->m_members[i]) {
+                this->m_members[i]->notePState(effective);
+            }
+        }
+        if (ok) {
+            this->m_saved += active - 1;
+        }
+    } else {
+        for (UInt32 i = 0; i < this->m_memberCount; i++) {
+            if (!this->m_members[i]) {
+                continue;
+            }
+            if (this->m_members[i]->writePState(effective) == kIOReturnSuccess) {
+                this->m_members[i]->notePState(effective);
+            } else {
+                ok = false;
+            }
+        }
+    }
+    
+    if (ok) {
+        this->m_current = effective;
+        this->m_transitions++;
+    }
+    
+    IOLockUnlock(this->m_lock);
+    return ok;
+}
+
+#pragma mark - Idle
+
+/*
+ * On the idle path. Returns true if every member is now idle, i.e. we're the last one in.
+ * "Every" is what firmware declared: members that haven't joined yet have no bit set, so
+ * nobody gets the coordinated state until the whole domain is here.
+ */
+bool PDACPICPUDomain::enterIdle(UInt32 member)
+{
+    UInt32 processors = this->m_processors < kPDACPIMaxDomainMembers ? this->m_processors : kPDACPIMaxDomainMembers;
+    UInt64 all;
+    bool last;
+    
+    IOSimpleLockLock(this->m_idleLock);
+    this->m_idleMask |= 1ULL << member;
+    all = processors >= 64 ? ~0ULL : ((1ULL << processors) - 1);
+    last = (this->m_idleMask & all) == all;
+    IOSimpleLockUnlock(this->m_idleLock);
+    
+    return last;
+}
+
+void PDACPICPUDomain::exitIdle(UInt32 member)
+{
+    IOSimpleLockLock(this->m_idleLock);
+    this->m_idleMask &= ~(1ULL << member);
+    IOSimpleLockUnlock(this->m_idleLock);
+}
+
+/* Whether a member that wanted the coordinated state got it, or was demoted. */
+void PDACPICPUDomain::countIdle(bool coordinated)
+{
+    __atomic_add_fetch(coordinated ? &this->m_coordinatedEntries : &this->m_demotions, 1, __ATOMIC_RELAXED);
+}
+
+#pragma mark - Statistics
+
+bool PDACPICPUDomain::serialize(OSSerialize *s) const
+{
+    static const char *coordination[] = { "SW_ALL", "SW_ANY", "HW_ALL" };
+    OSDictionary *dict = OSDictionary::withCapacity(9);
+    bool ok;
+    
+    if (!dict) {
+        return false;
+    }
+    
+    OSString *kind = OSString::withCString(this->m_kind == kPDACPIDomainPerformance ? "Performance" : "Idle");
+    if (kind) {
+        dict->setObject("Kind", kind);
+        kind->release();
+    }
+    if (this->m_coordination >= kPDACPICoordinationSWAll && this->m_coordination <= kPDACPICoordinationHWAll) {
+        OSString *type = OSString::withCString(coordination[this->m_coordination - kPDACPICoordinationSWAll]);
+        if (type) {
+            dict->setObject("Coordination", type);
+            type->release();
+        }
+    }
+    
+    const struct { const char *key; UInt64 value; } perf[] = {
+        { "Domain",                 this->m_domain },
+        { "Processors",             this->m_processors },
+        { "Members",                this->m_memberCount },
+        { "Requests",               this->m_requestCount },
+        { "Transitions",            this->m_transitions },
+        { "Transitions Saved",      this->m_saved },
+    }, idle[] = {
+        { "Domain",                 this->m_domain },
+        { "Processors",             this->m_processors },
+        { "Members",                this->m_memberCount },
+        { "C-State Index",          this->m_index },
+        { "Coordinated Entries",    this->m_coordinatedEntries },
+        { "Demotions",              this->m_demotions },
+    };
+    const bool isPerf = this->m_kind == kPDACPIDomainPerformance;
+    
+    for (UInt32 i = 0; i < sizeof(perf) / sizeof(perf[0]); i++) {
+        const char *key = isPerf ? perf[i].key : idle[i].key;
+        OSNumber *num = OSNumber::withNumber(isPerf ? perf[i].value : idle[i].value, 64);
+        if (num) {
+            dict->setObject(key, num);
+            num->release();
+        }
+    }
+    
+    ok = dict->serialize(s);
+    dict->release();
+    return ok;
+}
@@ -0,0 +1,119 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_CPU_DOMAIN_H
+#define _PDACPI_CPU_DOMAIN_H
+
+#include <libkern/c++/OSObject.h>
+#include <IOKit/IOLib.h>
+
+class PDACPICPU;
+
+/* _PSD/_CSD CoordType */
+#define kPDACPICoordinationSWAll    0xFC
+#define kPDACPICoordinationSWAny    0xFD
+#define kPDACPICoordinationHWAll    0xFE
+
+enum {
+    kPDACPIDomainPerformance,   /* _PSD */
+    kPDACPIDomainIdle,          /* _CSD, one per coordinated _CST entry */
+};
+
+#define kPDACPIMaxDomainMembers     64
+#define kPDACPINoRequest            0xFFFFFFFF
+
+/* Where the platform expert leaves a processor nub's domains. */
+#define kPDACPIPerformanceDomainKey "performance-domain"
+#define kPDACPIIdleDomainsKey       "idle-domains"
+
+/*
+ * A set of processors whose P-state or C-state firmware says must be coordinated.
+ * The platform expert builds these when it creates the processor nubs and hangs them
+ * off the nubs; each PDACPICPU joins its domains at start.
+ *
+ * Performance domains take every member's request and issue only a change in the
+ * effective (fastest requested) state: once, on one member, for SW_ANY; on every
+ * member for SW_ALL, as the spec requires. HW_ALL leaves coordination to hardware,
+ * so requests go straight through.
+ *
+ * Idle domains let a coordinated C-state be entered only by the last member to go
+ * idle; the others are demoted to a state the domain doesn't cover.
+ */
+class PDACPICPUDomain : public OSObject
+{
+    OSDeclareDefaultStructors(PDACPICPUDomain)
+    
+public:
+    static PDACPICPUDomain *withDomain(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index);
+    virtual void free(void) override;
+    virtual bool serialize(OSSerialize *s) const override;
+    
+    bool matches(UInt32 kind, UInt32 domain, UInt32 index) const;
+    UInt32 getCoordination(void) const { return m_coordination; }
+    UInt32 getIndex(void) const { return m_index; }
+    
+    SInt32 addMember(PDACPICPU *cpu);
+    void removeMember(UInt32 member);
+    
+    bool requestPerformance(UInt32 member, UInt32 state);
+    bool enterIdle(UInt32 member);
+    void exitIdle(UInt32 member);
+    void countIdle(bool coordinated);
+    
+private:
+    bool init(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index);
+    
+    UInt32 m_kind;
+    UInt32 m_domain;
+    UInt32 m_coordination;
+    UInt32 m_processors;                /* what firmware declared */
+    UInt32 m_index;                     /* _CSD: the _CST entry, 1-based */
+    IOLock *m_lock;                     /* performance: held across the write */
+    IOSimpleLock *m_idleLock;           /* idle: taken with interrupts off */
+    
+    PDACPICPU *m_members[kPDACPIMaxDomainMembers];
+    UInt32 m_memberCount;
+    UInt32 m_requests[kPDACPIMaxDomainMembers];
+    UInt32 m_current;
+    UInt64 m_idleMask;
+    
+    UInt64 m_requestCount;
+    UInt64 m_transitions;
+    UInt64 m_saved;                     /* requests absorbed plus per-member writes avoided */
+    UInt64 m_coordinatedEntries;
+    UInt64 m_demotions;
+};
+
+#endif /* _PDACPI_CPU_DOMAIN_H */
@@ -0,0 +1,135 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#include "PDACPIECProtocol.h"
+
+bool PDACPIECWaitStatus(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 mask, UInt8 value)
+{
+    UInt64 deadline = ports->Now(ports->Context) + kECTimeoutMS * 1000000ULL;
+    
+    for (UInt32 polls = 0;; polls++) {
+        if ((ports->Read(ports->Context, ports->CommandPort) & mask) == value) {
+            return true;
+        }
+        
+        if (ports->Now(ports->Context) > deadline) {
+            stats->Timeouts++;
+            return false;
+        }
+        
+        ports->Pause(ports->Context, polls);
+    }
+}
+
+bool PDACPIECSendCommand(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 command)
+{
+    if (!PDACPIECWaitStatus(ports, stats, kECStatusIBF, 0)) {
+        return false;
+    }
+    ports->Write(ports->Context, ports->CommandPort, command);
+    return true;
+}
+
+bool PDACPIECWriteData(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 data)
+{
+    if (!PDACPIECWaitStatus(ports, stats, kECStatusIBF, 0)) {
+        return false;
+    }
+    ports->Write(ports->Context, ports->DataPort, data);
+    return true;
+}
+
+bool PDACPIECReadData(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 *data)
+{
+    if (!PDACPIECWaitStatus(ports, stats, kECStatusOBF, kECStatusOBF)) {
+        return false;
+    }
+    *data = ports->Read(ports->Context, ports->DataPort);
+    return true;
+}
+
+/* In burst mode the EC stays dedicated to us, so the bytes that follow don't each wait on its firmware loop. */
+bool PDACPIECEnableBurst(const PDACPIECPorts *ports, PDACPIECStatistics *stats)
+{
+    UInt8 ack = 0;
+    
+    if (!PDACPIECSendCommand(ports, stats, kECCommandBurstEnable) || !PDACPIECReadData(ports, stats, &ack) ||
+        ack != kECBurstAcknowledge) {
+        stats->BurstsRefused++;
+        return false;
+    }
+    
+    stats->Bursts++;
+    return true;
+}
+
+void PDACPIECDisableBurst(const PDACPIECPorts *ports, PDACPIECStatistics *stats)
+{
+    if (PDACPIECSendCommand(ports, stats, kECCommandBurstDisable)) {
+        PDACPIECWaitStatus(ports, stats, kECStatusIBF, 0);
+    }
+}
+
+/*
+ * Read or write count consecutive bytes starting at address: a single burst when there's
+ * more than one byte and the EC agrees to it. Returns how many bytes made it.
+ */
+UInt32 PDACPIECTransfer(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 command, UInt8 address,
+                        UInt8 *data, UInt32 count)
+{
+    bool burst = count > 1 && PDACPIECEnableBurst(ports, stats);
+    UInt32 done;
+    
+    for (done = 0; done < count; done++) {
+        if (!PDACPIECSendCommand(ports, stats, command) || !PDACPIECWriteData(ports, stats, (UInt8)(address + done))) {
+            break;
+        }
+        if (!(command == kECCommandRead ? PDACPIECReadData(ports, stats, &data[done])
+                                        : PDACPIECWriteData(ports, stats, data[done]))) {
+            break;
+        }
+    }
+    
+    if (burst) {
+        PDACPIECDisableBurst(ports, stats);
+    }
+    
+    return done;
+}
+
+bool PDACPIECQuery(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 *event)
+{
+    return PDACPIECSendCommand(ports, stats, kECCommandQuery) && PDACPIECReadData(ports, stats, event);
+}
@@ -0,0 +1,104 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_EC_PROTOCOL_H
+#define _PDACPI_EC_PROTOCOL_H
+
+#include <libkern/OSTypes.h>
+
+/*
+ * The EC_SC/EC_DATA handshake, ACPI 6.5 section 12.2-12.3, kept free of IOKit and ACPICA
+ * so it can be run against a simulated EC. PDACPIEmbeddedController supplies the ports,
+ * the clock and the pause between polls, and does the locking.
+ */
+
+/* EC_SC status bits */
+#define kECStatusOBF            0x01
+#define kECStatusIBF            0x02
+#define kECStatusCMD            0x08
+#define kECStatusBurst          0x10
+#define kECStatusSCIEvent       0x20
+
+/* EC_SC commands */
+#define kECCommandRead          0x80
+#define kECCommandWrite         0x81
+#define kECCommandBurstEnable   0x82
+#define kECCommandBurstDisable  0x83
+#define kECCommandQuery         0x84
+
+#define kECBurstAcknowledge     0x90
+
+#define kECTimeoutMS            500
+
+#define kPDACPIECLatencyBuckets 16
+
+/* Guarded by the controller's lock; every transaction is recorded on its way out. */
+struct PDACPIECStatistics {
+    UInt64 Transactions;
+    UInt64 Bytes;
+    UInt64 Bursts;
+    UInt64 BurstsRefused;       /* the EC didn't acknowledge burst enable */
+    UInt64 Timeouts;
+    UInt64 Events;              /* GPEs with SCI_EVT set */
+    UInt64 Queries;             /* _Qxx methods run */
+    UInt64 TotalLatency;        /* ns */
+    UInt64 MaxLatency;          /* ns */
+    UInt64 Histogram[kPDACPIECLatencyBuckets];  /* transaction latency, log2 us */
+};
+
+struct PDACPIECPorts {
+    UInt8 (*Read)(void *context, UInt16 port);
+    void (*Write)(void *context, UInt16 port, UInt8 value);
+    UInt64 (*Now)(void *context);                   /* ns */
+    void (*Pause)(void *context, UInt32 polls);     /* between status polls; polls so far */
+    void *Context;
+    UInt16 DataPort;
+    UInt16 CommandPort;
+};
+
+/* Each returns false, with Timeouts counted, if the EC didn't get there within kECTimeoutMS. */
+bool PDACPIECWaitStatus(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 mask, UInt8 value);
+bool PDACPIECSendCommand(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 command);
+bool PDACPIECWriteData(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 data);
+bool PDACPIECReadData(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 *data);
+
+bool PDACPIECEnableBurst(const PDACPIECPorts *ports, PDACPIECStatistics *stats);
+void PDACPIECDisableBurst(const PDACPIECPorts *ports, PDACPIECStatistics *stats);
+
+UInt32 PDACPIECTransfer(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 command, UInt8 address,
+                        UInt8 *data, UInt32 count);
+bool PDACPIECQuery(const PDACPIECPorts *ports, PDACPIECStatistics *stats, UInt8 *event);
+
+#endif /* _PDACPI_EC_PROTOCOL_H */
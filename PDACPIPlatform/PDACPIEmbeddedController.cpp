@@ -0,0 +1,464 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#include "PDACPIEmbeddedController.h"
+#include <IOKit/IOLib.h>
+#include <IOKit/acpi/IOACPIPlatformExpert.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
+
+#define kECSpinCount            100     /* 1us polls before we start sleeping between them */
+#define kECMaxQueries           64      /* per SCI; anything more is a stuck SCI_EVT */
+
+#define super IOService
+OSDefineMetaClassAndStructors(PDACPIEmbeddedController, IOService);
+
+#pragma mark - Start/stop
+
+bool PDACPIEmbeddedController::start(IOService *provider)
+{
+    if (!super::start(provider)) {
+        return false;
+    }
+    
+    this->m_device = OSDynamicCast(IOACPIPlatformDevice, provider);
+    if (!this->m_device) {
+        return false;
+    }
+    this->m_handle = (ACPI_HANDLE)this->m_device->getDeviceHandle();
+    
+    if (!this->parseResources()) {
+        IOLog("ACPIEC: no data/command ports in _CRS\n");
+        return false;
+    }
+    
+    this->m_lock = IOLockAlloc();
+    if (!this->m_lock) {
+        return false;
+    }
+    
+    ACPI_OBJECT object;
+    ACPI_BUFFER buffer = { sizeof(object), &object };
+    if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_GLK", NULL, &buffer, ACPI_TYPE_INTEGER))) {
+        this->m_useGlobalLock = object.Integer.Value != 0;
+    }
+    
+    /*
+     * Register before enabling events: registering runs _REG, after which AML may touch
+     * the EC at any time, including from the _Qxx methods our GPE handler queues.
+     */
+    IOACPIPlatformExpert *platform = OSDynamicCast(IOACPIPlatformExpert, getPlatform());
+    if (!platform || platform->registerAddressSpaceHandler(this->m_device, kIOACPIAddressSpaceIDEmbeddedController,
+                                                           &PDACPIEmbeddedController::spaceHandler, this, 0) != kIOReturnSuccess) {
+        IOLog("ACPIEC: failed to register the EmbeddedControl address space\n");
+        IOLockFree(this->m_lock);
+        this->m_lock = nullptr;
+        return false;
+    }
+    this->m_registered = true;
+    
+    buffer.Length = sizeof(object);
+    if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(this->m_handle, (char *)"_GPE", NULL, &buffer, ACPI_TYPE_INTEGER))) {
+        this->m_gpe = (UInt32)object.Integer.Value;
+        if (ACPI_SUCCESS(AcpiInstallGpeHandler(NULL, this->m_gpe, ACPI_GPE_EDGE_TRIGGERED, &PDACPIEmbeddedController::gpeHandler, this))) {
+            this->m_gpeInstalled = true;
+            AcpiEnableGpe(NULL, this->m_gpe);
+        }
+    }
+    
+    IOLog("ACPIEC: data 0x%x command 0x%x GPE %u%s\n", this->m_ports.DataPort, this->m_ports.CommandPort, this->m_gpe,
+          this->m_gpeInstalled ? "" : " (not installed)");
+    
+    registerService();
+    return true;
+}
+
+void PDACPIEmbeddedController::stop(IOService *provider)
+{
+    if (this->m_gpeInstalled) {
+        AcpiDisableGpe(NULL, this->m_gpe);
+        AcpiRemoveGpeHandler(NULL, this->m_gpe, &PDACPIEmbeddedController::gpeHandler);
+        this->m_gpeInstalled = false;
+    }
+    
+    /* Wait for a query that's already been queued; it may still want the EC. */
+    AcpiOsWaitEventsComplete();
+    
+    if (this->m_registered) {
+        IOACPIPlatformExpert *platform = OSDynamicCast(IOACPIPlatformExpert, getPlatform());
+        if (platform) {
+            platform->unregisterAddressSpaceHandler(this->m_device, kIOACPIAddressSpaceIDEmbeddedController,
+                                                    &PDACPIEmbeddedController::spaceHandler, 0);
+        }
+        this->m_registered = false;
+    }
+    
+    if (this->m_lock) {
+        IOLockFree(this->m_lock);
+        this->m_lock = nullptr;
+    }
+    
+    super::stop(provider);
+}
+
+/*
+ * The data port is the first I/O resource and EC_SC the second. Enumeration left _CRS on
+ * the nub, so there's no need to run it again; all we want from it are IO descriptors.
+ */
+bool PDACPIEmbeddedController::parseResources()
+{
+    OSData *crs = OSDynamicCast(OSData, this->m_device->getProperty("_CRS"));
+    UInt16 ports[2];
+    UInt32 found = 0;
+    
+    if (!crs) {
+        return false;
+    }
+    
+    const UInt8 *cursor = (const UInt8 *)crs->getBytesNoCopy();
+    const UInt8 *end = cursor + crs->getLength();
+    
+    while (cursor < end && found < 2) {
+        UInt8 tag = cursor[0];
+        UInt32 length;
+        
+        if (tag & ACPI_RESOURCE_NAME_LARGE) {
+            if (cursor + 3 > end) {
+                break;
+            }
+            length = 3 + (cursor[1] | (cursor[2] << 8));
+        } else {
+            length = 1 + (tag & ACPI_RESOURCE_NAME_SMALL_LENGTH_MASK);
+            tag &= ACPI_RESOURCE_NAME_SMALL_MASK;
+            
+            if (tag == ACPI_RESOURCE_NAME_END_TAG) {
+                break;
+            }
+            
+            if (cursor + length <= end) {
+                if (tag == ACPI_RESOURCE_NAME_IO && length >= sizeof(AML_RESOURCE_IO)) {
+                    ports[found++] = ((const AML_RESOURCE_IO *)cursor)->Minimum;
+                } else if (tag == ACPI_RESOURCE_NAME_FIXED_IO && length >= sizeof(AML_RESOURCE_FIXED_IO)) {
+                    ports[found++] = ((const AML_RESOURCE_FIXED_IO *)cursor)->Address;
+                }
+            }
+        }
+        
+        cursor += length;
+    }
+    
+    if (found < 2) {
+        return false;
+    }
+    
+    this->m_ports = { &readPort, &writePort, &now, &pause, this, ports[0], ports[1] };
+    return true;
+}
+
+#pragma mark - Protocol
+
+/* The handshake itself is in PDACPIECProtocol; these are the ports and clock it runs on. */
+UInt8 PDACPIEmbeddedController::readPort(void *context, UInt16 port)
+{
+    UInt32 value;
+    AcpiOsReadPort(port, &value, 8);
+    return (UInt8)value;
+}
+
+void PDACPIEmbeddedController::writePort(void *context, UInt16 port, UInt8 value)
+{
+    AcpiOsWritePort(port, value, 8);
+}
+
+UInt64 PDACPIEmbeddedController::now(void *context)
+{
+    UInt64 ns;
+    absolutetime_to_nanoseconds(mach_absolute_time(), &ns);
+    return ns;
+}
+
+/* Most ECs answer within microseconds; don't spin on the ones that take milliseconds. */
+void PDACPIEmbeddedController::pause(void *context, UInt32 polls)
+{
+    if (polls < kECSpinCount) {
+        IODelay(1);
+    } else {
+        IOSleep(1);
+    }
+}
+
+/* Caller holds m_lock. */
+void PDACPIEmbeddedController::recordTransaction(UInt64 start, IOReturn result, UInt32 bytes)
+{
+    UInt64 latency;
+    UInt32 bucket = 0;
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &latency);
+    
+    for (UInt64 us = latency / 1000; us && bucket < kPDACPIECLatencyBuckets - 1; us >>= 1) {
+        bucket++;
+    }
+    
+    this->m_stats.Transactions++;
+    this->m_stats.Bytes += bytes;
+    this->m_stats.TotalLatency += latency;
+    this->m_stats.Histogram[bucket]++;
+    if (latency > this->m_stats.MaxLatency) {
+        this->m_stats.MaxLatency = latency;
+    }
+}
+
+/* Read or write count consecutive bytes starting at address, as one transaction. */
+IOReturn PDACPIEmbeddedController::transaction(UInt8 command, UInt8 address, UInt8 *data, UInt32 count)
+{
+    UInt32 globalLock = 0;
+    
+    if (this->m_useGlobalLock && ACPI_FAILURE(AcpiAcquireGlobalLock(kECTimeoutMS, &globalLock))) {
+        return kIOReturnTimeout;
+    }
+    
+    IOLockLock(this->m_lock);
+    UInt64 start = mach_absolute_time();
+    UInt32 done = PDACPIECTransfer(&this->m_ports, &this->m_stats, command, address, data, count);
+    IOReturn ret = done == count ? kIOReturnSuccess : kIOReturnTimeout;
+    
+    this->recordTransaction(start, ret, done);
+    IOLockUnlock(this->m_lock);
+    
+    if (this->m_useGlobalLock) {
+        AcpiReleaseGlobalLock(globalLock);
+    }
+    
+    return ret;
+}
+
+IOReturn PDACPIEmbeddedController::query(UInt8 *event)
+{
+    UInt32 globalLock = 0;
+    
+    if (this->m_useGlobalLock && ACPI_FAILURE(AcpiAcquireGlobalLock(kECTimeoutMS, &globalLock))) {
+        return kIOReturnTimeout;
+    }
+    
+    IOLockLock(this->m_lock);
+    UInt64 start = mach_absolute_time();
+    IOReturn ret = PDACPIECQuery(&this->m_ports, &this->m_stats, event) ? kIOReturnSuccess : kIOReturnTimeout;
+    this->recordTransaction(start, ret, 1);
+    IOLockUnlock(this->m_lock);
+    
+    if (this->m_useGlobalLock) {
+        AcpiReleaseGlobalLock(globalLock);
+    }
+    
+    return ret;
+}
+
+#pragma mark - Handlers
+
+/* EmbeddedControl accesses from AML, 8 to 64 bits at a time. */
+IOReturn PDACPIEmbeddedController::spaceHandler(UInt32 operation, IOACPIAddress address, UInt64 *value,
+                                                UInt32 bitWidth, UInt32 bitOffset, void *context)
+{
+    PDACPIEmbeddedController *ec = (PDACPIEmbeddedController *)context;
+    UInt32 count = bitWidth / 8;
+    UInt8 bytes[8];
+    IOReturn ret;
+    
+    if (!ec || !value || (bitWidth & 7) || count == 0 || count > sizeof(bytes) || address.addr64 + count > 0x100) {
+        return kIOReturnBadArgument;
+    }
+    
+    if (operation == kIOACPIAddressSpaceOpRead) {
+        ret = ec->transaction(kECCommandRead, (UInt8)address.addr64, bytes, count);
+        if (ret == kIOReturnSuccess) {
+            *value = 0;
+            for (UInt32 i = 0; i < count; i++) {
+                *value |= (UInt64)bytes[i] << (i * 8);
+            }
+        }
+    } else {
+        for (UInt32 i = 0; i < count; i++) {
+            bytes[i] = (UInt8)(*value >> (i * 8));
+        }
+        ret = ec->transaction(kECCommandWrite, (UInt8)address.addr64, bytes, count);
+    }
+    
+    return ret;
+}
+
+/* SCI_EVT: queue a query unless one is already queued or running; it drains every pending event. */
+UInt32 PDACPIEmbeddedController::gpeHandler(ACPI_HANDLE GpeDevice, UInt32 GpeNumber, void *Context)
+{
+    PDACPIEmbeddedController *ec = (PDACPIEmbeddedController *)Context;
+    UInt32 status;
+    
+    AcpiOsReadPort(ec->m_ports.CommandPort, &status, 8);
+    if ((status & kECStatusSCIEvent) && OSCompareAndSwap(0, 1, &ec->m_queryPending)) {
+        OSIncrementAtomic64((volatile SInt64 *)&ec->m_stats.Events);
+        if (ACPI_FAILURE(AcpiOsExecute(OSL_EC_POLL_HANDLER, &PDACPIEmbeddedController::queryHandler, ec))) {
+            ec->m_queryPending = 0;
+        }
+    }
+    
+    return ACPI_REENABLE_GPE;
+}
+
+/*
+ * Runs on the EC queue, which has one worker, so _Qxx methods never run concurrently.
+ * AcpiOsExecute never runs it inline, so _Qxx never runs in the GPE's interrupt context.
+ */
+void PDACPIEmbeddedController::queryHandler(void *Context)
+{
+    PDACPIEmbeddedController *ec = (PDACPIEmbeddedController *)Context;
+    UInt32 handled = 0;
+    bool drained = false;
+    
+    for (UInt32 i = 0; i < kECMaxQueries; i++) {
+        UInt8 event = 0;
+        
+        if (ec->query(&event) != kIOReturnSuccess) {
+            break;
+        }
+        if (event == 0) {
+            drained = true;
+            break;
+        }
+        
+        char method[ACPI_NAMESEG_SIZE + 1];
+        snprintf(method, sizeof(method), "_Q%02X", event);
+        AcpiEvaluateObject(ec->m_handle, method, NULL, NULL);
+        handled++;
+        
+        IOLockLock(ec->m_lock);
+        ec->m_stats.Queries++;
+        IOLockUnlock(ec->m_lock);
+    }
+    
+    __atomic_store_n(&ec->m_queryPending, 0, __ATOMIC_SEQ_CST);
+    
+    /*
+     * An event raised after our last query but before the store above found m_queryPending
+     * still set, so its GPE queued nothing. Look once more now that the flag is clear. Only
+     * after a pass that drained real events: a failing EC or a stuck SCI_EVT (the cap, or
+     * a query that answers 0 straight away) would otherwise keep the worker spinning.
+     */
+    if (drained && handled) {
+        UInt32 status;
+        AcpiOsReadPort(ec->m_ports.CommandPort, &status, 8);
+        if ((status & kECStatusSCIEvent) && OSCompareAndSwap(0, 1, &ec->m_queryPending)) {
+            OSIncrementAtomic64((volatile SInt64 *)&ec->m_stats.Events);
+            if (ACPI_FAILURE(AcpiOsExecute(OSL_EC_POLL_HANDLER, &PDACPIEmbeddedController::queryHandler, ec))) {
+                ec->m_queryPending = 0;
+            }
+        }
+    }
+}
+
+#pragma mark - Statistics
+
+OSDictionary *PDACPIEmbeddedController::copyStatistics() const
+{
+    PDACPIECStatistics stats;
+    
+    if (!this->m_lock) {
+        return nullptr;
+    }
+    
+    IOLockLock(this->m_lock);
+    stats = this->m_stats;
+    IOLockUnlock(this->m_lock);
+    
+    OSDictionary *dict = OSDictionary::withCapacity(10);
+    OSDictionary *histogram = OSDictionary::withCapacity(kPDACPIECLatencyBuckets);
+    if (!dict || !histogram) {
+        OSSafeReleaseNULL(dict);
+        OSSafeReleaseNULL(histogram);
+        return nullptr;
+    }
+    
+    const struct { const char *key; UInt64 value; } counters[] = {
+        { "Transactions",       stats.Transactions },
+        { "Bytes",              stats.Bytes },
+        { "Bursts",             stats.Bursts },
+        { "Bursts Refused",     stats.BurstsRefused },
+        { "Timeouts",           stats.Timeouts },
+        { "Events",             stats.Events },
+        { "Queries",            stats.Queries },
+        { "Total Latency",      stats.TotalLatency },
+        { "Max Latency",        stats.MaxLatency },
+    };
+    
+    for (UInt32 i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        OSNumber *num = OSNumber::withNumber(counters[i].value, 64);
+        if (num) {
+            dict->setObject(counters[i].key, num);
+            num->release();
+        }
+    }
+    
+    for (UInt32 i = 0; i < kPDACPIECLatencyBuckets; i++) {
+        if (!stats.Histogram[i]) {
+            continue;
+        }
+        
+        char key[16];
+        if (i == kPDACPIECLatencyBuckets - 1) {
+            snprintf(key, sizeof(key), ">=%uus", 1U << (i - 1));
+        } else {
+            snprintf(key, sizeof(key), "<%uus", 1U << i);
+        }
+        
+        OSNumber *num = OSNumber::withNumber(stats.Histogram[i], 64);
+        if (num) {
+            histogram->setObject(key, num);
+            num->release();
+        }
+    }
+    dict->setObject("Latency", histogram);
+    histogram->release();
+    
+    return dict;
+}
+
+bool PDACPIEmbeddedController::serializeProperties(OSSerialize *s) const
+{
+    OSDictionary *stats = this->copyStatistics();
+    if (stats) {
+        const_cast<PDACPIEmbeddedController *>(this)->setProperty("EC Statistics", stats);
+        stats->release();
+    }
+    
+    return super::serializeProperties(s);
+}
@@ -0,0 +1,91 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_EMBEDDEDCONTROLLER_H
+#define _PDACPI_EMBEDDEDCONTROLLER_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
+
+extern "C" {
+#include "acpica/acpi.h"
+#include "acpica/amlresrc.h"
+}
+
+#include "PDACPIECProtocol.h"
+
+/*
+ * ACPI Embedded Controller (PNP0C09), ACPI 6.5 section 12.
+ *
+ * Serves the EmbeddedControl address space for AML. Multi-byte field accesses arrive
+ * whole (see ACPI_DARWIN_EC_BURST) and are run as one burst-mode transaction. SCI events
+ * are queried and dispatched to _Qxx one at a time from a single queued work item.
+ */
+class PDACPIEmbeddedController : public IOService {
+    OSDeclareDefaultStructors(PDACPIEmbeddedController);
+    
+public:
+    virtual bool start(IOService *provider) override;
+    virtual void stop(IOService *provider) override;
+    virtual bool serializeProperties(OSSerialize *s) const override;
+    
+private:
+    static IOReturn spaceHandler(UInt32 operation, IOACPIAddress address, UInt64 *value, UInt32 bitWidth, UInt32 bitOffset, void *context);
+    static UInt32 gpeHandler(ACPI_HANDLE GpeDevice, UInt32 GpeNumber, void *Context);
+    static void queryHandler(void *Context);
+    
+    bool parseResources(void);
+    IOReturn transaction(UInt8 command, UInt8 address, UInt8 *data, UInt32 count);
+    IOReturn query(UInt8 *event);
+    static UInt8 readPort(void *context, UInt16 port);
+    static void writePort(void *context, UInt16 port, UInt8 value);
+    static UInt64 now(void *context);
+    static void pause(void *context, UInt32 polls);
+    void recordTransaction(UInt64 start, IOReturn result, UInt32 bytes);
+    OSDictionary *copyStatistics(void) const;
+    
+    IOACPIPlatformDevice *m_device;
+    ACPI_HANDLE m_handle;
+    IOLock *m_lock;                     /* one transaction on the wire at a time */
+    PDACPIECPorts m_ports;
+    UInt32 m_gpe;
+    bool m_gpeInstalled;
+    bool m_registered;
+    bool m_useGlobalLock;               /* _GLK */
+    volatile UInt32 m_queryPending;
+    PDACPIECStatistics m_stats;
+};
+
+#endif /* _PDACPI_EMBEDDEDCONTROLLER_H */
@@ -0,0 +1,123 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#include "PDACPIIdleGovernor.h"
+
+/* Below this much variance (us^2) the history is steady enough to trust outright. */
+#define kPDACPIIdleSteadyVariance   400
+#define kPDACPIIdleOutlierPasses    3
+
+void PDACPIRecordIdle(PDACPIIdleHistory *history, UInt32 intervalUs)
+{
+    history->Intervals[history->Next] = intervalUs ? intervalUs : 1;
+    history->Next = (history->Next + 1) % kPDACPIIdleHistory;
+}
+
+/*
+ * The typical recent idle period, or kPDACPIIdleUnknown if the history doesn't show one.
+ * A set of intervals is typical when its standard deviation is small next to its mean;
+ * if it isn't, the longest interval is dropped as an outlier and we try again.
+ */
+UInt32 PDACPIPredictIdle(const PDACPIIdleHistory *history)
+{
+    UInt32 limit = kPDACPIIdleUnknown;
+    
+    for (UInt32 pass = 0; pass < kPDACPIIdleOutlierPasses; pass++) {
+        UInt64 sum = 0, variance = 0, average;
+        UInt32 count = 0, longest = 0;
+        
+        for (UInt32 i = 0; i < kPDACPIIdleHistory; i++) {
+            UInt32 value = history->Intervals[i];
+            if (!value || value > limit) {
+                continue;
+            }
+            sum += value;
+            count++;
+            if (value > longest) {
+                longest = value;
+            }
+        }
+        
+        /* Too few samples left to call anything typical. */
+        if (count < kPDACPIIdleHistory / 2) {
+            return kPDACPIIdleUnknown;
+        }
+        
+        average = sum / count;
+        for (UInt32 i = 0; i < kPDACPIIdleHistory; i++) {
+            UInt32 value = history->Intervals[i];
+            if (!value || value > limit) {
+                continue;
+            }
+            SInt64 delta = (SInt64)value - (SInt64)average;
+            variance += (UInt64)(delta * delta);
+        }
+        variance /= count;
+        
+        /* stddev under 20us, or under a sixth of the mean */
+        if (variance <= kPDACPIIdleSteadyVariance || average * average > 36 * variance) {
+            return (UInt32)average;
+        }
+        
+        limit = longest - 1;
+    }
+    
+    return kPDACPIIdleUnknown;
+}
+
+/*
+ * The deepest state whose exit latency fits the QoS limit and whose break-even residency
+ * fits the idle period we expect: the next known event if sooner, otherwise the history.
+ * State 0 is the fallback and is always allowed.
+ */
+UInt32 PDACPISelectCState(const PDACPICState *states, UInt32 count, UInt32 latencyLimitUs,
+                          UInt32 nextEventUs, const PDACPIIdleHistory *history)
+{
+    UInt32 predicted = PDACPIPredictIdle(history);
+    UInt32 selected = 0;
+    
+    if (nextEventUs < predicted) {
+        predicted = nextEventUs;
+    }
+    
+    for (UInt32 i = 1; i < count; i++) {
+        if (states[i].Latency > latencyLimitUs || states[i].Residency > predicted) {
+            continue;
+        }
+        selected = i;
+    }
+    
+    return selected;
+}
@@ -0,0 +1,80 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_IDLE_GOVERNOR_H
+#define _PDACPI_IDLE_GOVERNOR_H
+
+#include <libkern/OSTypes.h>
+
+/*
+ * Idle state selection, kept free of IOKit and ACPICA so it can be driven from recorded
+ * idle traces outside the kernel. PDACPICPU owns the state table and the history and
+ * does the actual entry.
+ */
+
+enum {
+    kPDACPICStateHalt,          /* sti; hlt */
+    kPDACPICStateMwait,         /* FFixedHW: MWAIT with Hint */
+    kPDACPICStateIO,            /* read the P_LVLx port in Hint */
+};
+
+/* One _CST or _LPI state, shallowest first. */
+struct PDACPICState {
+    UInt8 Type;                 /* ACPI C-state type, 1-3 */
+    UInt8 Method;
+    bool FlushCache;            /* C3 by I/O port without bus-master arbitration */
+    UInt32 Latency;             /* us, worst-case exit */
+    UInt32 Residency;           /* us, shortest stay that saves anything */
+    UInt32 Power;               /* mW, 0 if firmware didn't say */
+    UInt64 Hint;
+    UInt8 Index;                /* position in _CST, which _CSD refers to; 0 if none */
+};
+
+#define kPDACPIIdleHistory      8
+
+/* How long recent idle periods really lasted. Only the owning CPU writes it. */
+struct PDACPIIdleHistory {
+    UInt32 Intervals[kPDACPIIdleHistory];   /* us; 0 is an unused slot */
+    UInt32 Next;
+};
+
+#define kPDACPIIdleUnknown      0xFFFFFFFF
+
+void PDACPIRecordIdle(PDACPIIdleHistory *history, UInt32 intervalUs);
+UInt32 PDACPIPredictIdle(const PDACPIIdleHistory *history);
+UInt32 PDACPISelectCState(const PDACPICState *states, UInt32 count, UInt32 latencyLimitUs,
+                          UInt32 nextEventUs, const PDACPIIdleHistory *history);
+
+#endif /* _PDACPI_IDLE_GOVERNOR_H */
@@ -0,0 +1,77 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#include "PDACPIPerformanceStates.h"
+
+/*
+ * Only the bits under mask belong to the P-state; the rest of the control register is
+ * whatever firmware left there, kept so a switch stays one full-width write.
+ */
+void PDACPIFoldPStateControl(PDACPIPState *states, UInt32 count, UInt64 preserved, UInt64 mask)
+{
+    for (UInt32 i = 0; i < count; i++) {
+        states[i].Control = (preserved & ~mask) | (states[i].Control & mask);
+        states[i].Status &= mask;
+    }
+}
+
+/* The state whose status matches under statusMask, or count if none does. */
+UInt32 PDACPIFindPState(const PDACPIPState *states, UInt32 count, UInt64 status, UInt64 statusMask)
+{
+    for (UInt32 i = 0; i < count; i++) {
+        if ((states[i].Status & statusMask) == (status & statusMask)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/* _PPC past the end of the table means the slowest state, not no state at all. */
+UInt32 PDACPIPStateLimit(UInt64 ppc, UInt32 count)
+{
+    return ppc < count ? (UInt32)ppc : count - 1;
+}
+
+/* Lower indices are faster, so the limit is the fastest state we may ask for. */
+UInt32 PDACPIClampPState(UInt32 index, UInt32 limit)
+{
+    return index < limit ? limit : index;
+}
+
+/* An unknown current state (count) may well be faster than allowed, so it counts too. */
+bool PDACPIPStateOverLimit(UInt32 current, UInt32 limit, UInt32 count)
+{
+    return current < limit || current >= count;
+}
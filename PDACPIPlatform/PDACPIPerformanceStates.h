@@ -0,0 +1,72 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_PERFORMANCE_STATES_H
+#define _PDACPI_PERFORMANCE_STATES_H
+
+#include <libkern/OSTypes.h>
+
+/*
+ * The _PSS bookkeeping that doesn't need the interpreter or the hardware: folding the
+ * control values, recognising the current state from the status register, and the _PPC
+ * limit. PDACPICPU reads and writes the registers; these only decide what to read or write.
+ */
+
+/* The architectural P-state MSRs behind a FFixedHW _PCT. */
+#define kIntelPerfStatusMSR         0x198
+#define kIntelPerfControlMSR        0x199
+#define kIntelPerfMask              0xFFFF
+#define kIntelPerfRatioMask         0xFF00      /* IA32_PERF_STATUS 15:8; older parts report a VID below it */
+#define kAMDPerfControlMSR          0xC0010062
+#define kAMDPerfStatusMSR           0xC0010063
+#define kAMDPerfMask                0x7
+
+/* One _PSS entry. Control is the complete value for the _PCT control register. */
+struct PDACPIPState {
+    UInt32 Frequency;           /* MHz */
+    UInt32 Power;               /* mW */
+    UInt32 Latency;             /* us */
+    UInt32 BusMasterLatency;    /* us */
+    UInt64 Control;
+    UInt64 Status;
+};
+
+void PDACPIFoldPStateControl(PDACPIPState *states, UInt32 count, UInt64 preserved, UInt64 mask);
+UInt32 PDACPIFindPState(const PDACPIPState *states, UInt32 count, UInt64 status, UInt64 statusMask);
+UInt32 PDACPIPStateLimit(UInt64 ppc, UInt32 count);
+UInt32 PDACPIClampPState(UInt32 index, UInt32 limit);
+bool PDACPIPStateOverLimit(UInt32 current, UInt32 limit, UInt32 count);
+
+#endif /* _PDACPI_PERFORMANCE_STATES_H */
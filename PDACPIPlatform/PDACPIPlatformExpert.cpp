@@ -34,7 +34,10 @@
 */
 
 #include "PDACPIPlatformExpert.h"
+#include "PDACPICPU.h"
 #include <IOKit/IOLib.h>
+#include <kern/thread_call.h>
+#include <machine/machine_routines.h>
 
 #if __has_include(<IOKit/pci/IOPCIPrivate.h>)
 #include <IOKit/pci/IOPCIPrivate.h>
@@ -106,17 +109,31 @@ ACPI_TABLE_MADT *gAPICTable;
 /* AcpiOsLayer.cpp */
 extern ACPI_MCFG_ALLOCATION *gPCIDataFromMCFG;
 extern size_t gPCIMCFGEntryCount;
+extern "C" ACPI_STATUS AcpiOsExtRegisterPciEcamTable(const ACPI_TABLE_MCFG *Mcfg);
+extern OSDictionary *AcpiOsExtCopyStatistics(void);
+extern OSData *AcpiOsExtCopyLog(void);
+
+/* osdarwin.c */
+extern "C" void AcpiOsCopyInitStatistics(ACPI_DARWIN_INIT_STATS *Stats);
+
+#define kPDACPIStatisticsKey "ACPI Statistics"
+#define kPDACPITablesKey "ACPI Tables"
+#define kPDACPIBootTimingKey "ACPI Boot Timing"
+#define kPDACPILogKey "ACPI Log"
+#define kPDACPISleepTimingKey "ACPI Sleep Timing"
 
 bool PDACPIPlatformExpert::initializeACPICA()
 {
     /* No need to init OSL seperately. AcpiInitializeSubsystem calls it as one of it's first calls. */
 
+    UInt64 phase = mach_absolute_time();
     ACPI_STATUS status = AcpiInitializeSubsystem();
     if (ACPI_FAILURE(status)) {
         IOLog("PDACPIPlatformExpert::start - [ERROR] AcpiInitializeSubsystem failed with status %s\n", AcpiFormatException(status));
         AcpiTerminate(); // Cleanup
         return false;
     }
+    phase = this->recordBootPhase("AcpiInitializeSubsystem", phase);
 
     // For UEFI, passing NULL for InitialTableArray relies on AcpiOsGetRootPointer
     // to find the XSDT from the EFI System Table.
@@ -128,6 +145,7 @@ bool PDACPIPlatformExpert::initializeACPICA()
         AcpiTerminate(); // Cleanup
         return false;
     }
+    phase = this->recordBootPhase("AcpiInitializeTables", phase);
 
     status = AcpiLoadTables();
     if (ACPI_FAILURE(status)) {
@@ -135,12 +153,24 @@ bool PDACPIPlatformExpert::initializeACPICA()
         AcpiTerminate(); // Cleanup
         return false;
     }
+    phase = this->recordBootPhase("AcpiLoadTables", phase);
     
     /* the system-type field is derived from the FADT, i think. */
     this->m_provider->setProperty("system-type", &AcpiGbl_FADT.PreferredProfile, 1);
     
-    this->catalogACPITables();
+    this->m_tableLock = IOLockAlloc();
+    if (!this->m_tableLock || !this->catalogACPITables()) {
+        IOLog("PDACPIPlatformExpert::start - [ERROR] Failed to catalog the ACPI tables\n");
+        AcpiTerminate(); // Cleanup
+        return false;
+    }
+    
+    /* Tables can still be loaded by AML (Load/LoadTable) or by drivers; rebuild the catalog when they are. */
+    AcpiInstallTableHandler(&PDACPIPlatformExpert::tableEventHandler, this);
+    phase = this->recordBootPhase("catalogACPITables", phase);
+    
     this->fetchPCIData();
+    phase = this->recordBootPhase("fetchPCIData", phase);
 
     /* We can't enable the Events subsystem or IRQ subsystem yet; we need IOCPU subclasses */
     status = AcpiEnableSubsystem(ACPI_NO_EVENT_INIT | ACPI_NO_HANDLER_INIT);
@@ -149,6 +179,7 @@ bool PDACPIPlatformExpert::initializeACPICA()
         AcpiTerminate(); // Cleanup
         return false;
     }
+    phase = this->recordBootPhase("AcpiEnableSubsystem", phase);
 
     status = AcpiInitializeObjects(ACPI_FULL_INITIALIZATION);
     if (ACPI_FAILURE(status)) {
@@ -156,255 +187,2447 @@ bool PDACPIPlatformExpert::initializeACPICA()
         AcpiTerminate(); // Cleanup
         return false;
     }
+    phase = this->recordBootPhase("AcpiInitializeObjects", phase);
     
-    /* First, enumerate the Processor namespace to get the number of available CPUs in ACPI. */
-}
-
-/* this is so IOPCIFamily gets our ACPI tables. */
-OSObject *PDACPIPlatformExpert::copyProperty(const char *property) const
-{
-    if (strncmp(property, "ACPI Tables", strlen(property)) == 0) {
-        return this->m_tableDict->copyCollection();
+    /* _Sx can reference anything, so wait until _INI and _REG have run. */
+    AcpiOsLoadSleepTypes();
+    
+    if (!this->createDeviceNubs()) {
+        IOLog("PDACPIPlatformExpert::start - [ERROR] Failed to enumerate ACPI devices\n");
+        AcpiTerminate(); // Cleanup
+        return false;
     }
+    this->recordBootPhase("createDeviceNubs", phase);
     
-    return super::copyProperty(property);
+    this->publishBootTiming();
+    
+    return true;
 }
 
-bool PDACPIPlatformExpert::fetchPCIData()
+#pragma mark - Boot timing
+
+/* Note a finished initialization phase, returning the time it ended so the next phase can start from it. */
+UInt64 PDACPIPlatformExpert::recordBootPhase(const char *name, UInt64 start)
 {
-    const OSData *table = this->getACPITableData("MCFG", 0);
+    UInt64 end = mach_absolute_time();
+    UInt64 startNs, durationNs;
     
-    if (!table) {
-        IOLog("ACPI: No MCFG table found in the ACPI table collection.\n");
+    if (!this->m_bootPhases) {
+        this->m_bootPhases = OSArray::withCapacity(8);
+        if (!this->m_bootPhases) {
+            return end;
+        }
     }
     
-    ACPI_TABLE_MCFG *mcfg = (ACPI_TABLE_MCFG *)table->getBytesNoCopy();
-
-    gPCIMCFGEntryCount = (mcfg->Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION);
-    gPCIDataFromMCFG = (ACPI_MCFG_ALLOCATION *)(table->getBytesNoCopy() + sizeof(ACPI_TABLE_MCFG));
+    absolutetime_to_nanoseconds(start, &startNs);
+    absolutetime_to_nanoseconds(end - start, &durationNs);
     
-    /* While we're here; kindly tell IOPCIFamily to initialize MMIO mapping services. */
-    IOPCIPlatformInitialize();
+    OSDictionary *entry = OSDictionary::withCapacity(3);
+    OSString *phaseName = OSString::withCString(name);
+    OSNumber *startNum = OSNumber::withNumber(startNs, 64);
+    OSNumber *durationNum = OSNumber::withNumber(durationNs, 64);
+    if (entry && phaseName && startNum && durationNum) {
+        entry->setObject("Name", phaseName);
+        entry->setObject("Start", startNum);
+        entry->setObject("Duration", durationNum);
+        this->m_bootPhases->setObject(entry);
+    }
+    OSSafeReleaseNULL(entry);
+    OSSafeReleaseNULL(phaseName);
+    OSSafeReleaseNULL(startNum);
+    OSSafeReleaseNULL(durationNum);
     
-    return true;
+    return end;
 }
 
-/* This was based off of osbsdtbl.c's shenanigans */
-struct AcpiTableMap {
-    char Signature[4];
-    UInt8 instance;
-    ACPI_TABLE_HEADER *Tbl; /* well we've already mapped the damn thing so, might as well reuse the pointer. */
-};
-
-bool PDACPIPlatformExpert::catalogACPITables()
+static void PDACPISetNumber(OSDictionary *dict, const char *key, UInt64 value)
 {
-    char name[32];
-    ACPI_TABLE_HEADER *Table;
-    UInt32 tables = AcpiGbl_RootTableList.CurrentTableCount;
-    this->m_tableDict = OSDictionary::withCapacity(tables + 1);
-
-    AcpiTableMap *tmp = (AcpiTableMap *)IOMalloc(sizeof(AcpiTableMap) * tables);
+    OSNumber *num = OSNumber::withNumber(value, 64);
+    if (num) {
+        dict->setObject(key, num);
+        num->release();
+    }
+}
 
-    /* ZORMEISTER: God this is such a hack... */
-    for (UInt32 i = 0; i < tables; i++) {
-        AcpiGetTableByIndex(i, &Table);
-        for (UInt32 j = i; 0 > j; j--) { /* ZORMEISTER: walk backwards from our current position. */
-            if (strncmp(tmp[j].Signature, Table->Signature, 4) == 0) {
-                if (tmp[j].instance == 0) {
-                    tmp[j].instance++;
-                }
+static ACPI_STATUS PDACPICountNodes(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue)
+{
+    UInt32 *counts = (UInt32 *)Context;
+    ACPI_NAMESPACE_NODE *node = (ACPI_NAMESPACE_NODE *)Handle;
+    
+    counts[node->OwnerId % (ACPI_NUM_OWNERID_MASKS * 32)]++;
+    return AE_OK;
+}
 
-                tmp[i].instance = tmp[j].instance + 1;
-            }
+/*
+ * The firmware's own boot record from the FPDT, in nanoseconds since reset. Our phase
+ * timestamps are mach absolute time, which starts when the kernel does, so the two
+ * line up at roughly ExitBootServices.
+ */
+static OSDictionary *PDACPICopyFirmwareBootRecord(const OSData *fpdt)
+{
+    const ACPI_TABLE_FPDT *table = (const ACPI_TABLE_FPDT *)fpdt->getBytesNoCopy();
+    const UInt8 *cursor = (const UInt8 *)(table + 1);
+    const UInt8 *end = (const UInt8 *)table + table->Header.Length;
+    UInt64 fbptAddress = 0;
+    
+    while (cursor + sizeof(ACPI_FPDT_HEADER) <= end) {
+        const ACPI_FPDT_HEADER *record = (const ACPI_FPDT_HEADER *)cursor;
+        if (record->Length < sizeof(ACPI_FPDT_HEADER)) {
+            break;
         }
+        
+        if (record->Type == ACPI_FPDT_TYPE_BOOT && cursor + sizeof(ACPI_FPDT_BOOT_POINTER) <= end) {
+            fbptAddress = ((const ACPI_FPDT_BOOT_POINTER *)record)->Address;
+            break;
+        }
+        cursor += record->Length;
     }
-
-    /* ZORMEISTER: now do it again. */
-
-    for (UInt32 k = 0; k < tables; k++) {
-        /* Allocate an OSData using the ACPI table length. */
-        OSData *data = OSData::withBytesNoCopy(tmp[k].Tbl, tmp[k].Tbl->Length);
-        memset(name, 0, 32); /* clear out the stack variable */
-        if (tmp[k].instance > 0) {
-            snprintf(name, 32, "%4.4s-%u", tmp[k].Tbl->Signature, tmp[k].instance);
-        } else {
-            snprintf(name, 32, "%4.4s", tmp[k].Tbl->Signature);
+    
+    if (!fbptAddress) {
+        return nullptr;
+    }
+    
+    /* The FBPT is a bare header ("FBPT", length) followed by performance records. */
+    ACPI_TABLE_S3PT *fbpt = (ACPI_TABLE_S3PT *)AcpiOsMapMemory(fbptAddress, sizeof(ACPI_TABLE_S3PT));
+    if (!fbpt) {
+        return nullptr;
+    }
+    
+    UInt32 length = fbpt->Length;
+    bool valid = memcmp(fbpt->Signature, "FBPT", 4) == 0 && length >= sizeof(ACPI_TABLE_S3PT) && length <= PAGE_SIZE;
+    AcpiOsUnmapMemory(fbpt, sizeof(ACPI_TABLE_S3PT));
+    if (!valid) {
+        return nullptr;
+    }
+    
+    fbpt = (ACPI_TABLE_S3PT *)AcpiOsMapMemory(fbptAddress, length);
+    if (!fbpt) {
+        return nullptr;
+    }
+    
+    OSDictionary *firmware = nullptr;
+    cursor = (const UInt8 *)(fbpt + 1);
+    end = (const UInt8 *)fbpt + length;
+    while (cursor + sizeof(ACPI_FPDT_HEADER) <= end) {
+        const ACPI_FPDT_HEADER *record = (const ACPI_FPDT_HEADER *)cursor;
+        if (record->Length < sizeof(ACPI_FPDT_HEADER)) {
+            break;
         }
-
-        this->m_tableDict->setObject(name, data);
-        OSSafeReleaseNULL(data);
+        
+        if (record->Type == ACPI_FPDT_BOOT_PERFORMANCE && cursor + sizeof(ACPI_FPDT_BOOT) <= end) {
+            const ACPI_FPDT_BOOT *boot = (const ACPI_FPDT_BOOT *)record;
+            firmware = OSDictionary::withCapacity(5);
+            if (firmware) {
+                PDACPISetNumber(firmware, "Reset End", boot->ResetEnd);
+                PDACPISetNumber(firmware, "OS Loader Load Start", boot->LoadStart);
+                PDACPISetNumber(firmware, "OS Loader Start", boot->StartupStart);
+                PDACPISetNumber(firmware, "ExitBootServices Entry", boot->ExitServicesEntry);
+                PDACPISetNumber(firmware, "ExitBootServices Exit", boot->ExitServicesExit);
+            }
+            break;
+        }
+        cursor += record->Length;
     }
     
-    IOFree(tmp, sizeof(AcpiTableMap) * tables);
-
-    return true;
+    AcpiOsUnmapMemory(fbpt, length);
+    return firmware;
 }
 
-const OSData *PDACPIPlatformExpert::getACPITableData(const char *name, UInt32 TableIndex)
+/*
+ * Publish "ACPI Boot Timing": the phases of initializeACPICA, the parse/load time and
+ * namespace footprint of every table ACPICA loaded, _REG and _INI time, and the
+ * firmware's FPDT boot record if it has one. All times are nanoseconds.
+ */
+void PDACPIPlatformExpert::publishBootTiming()
 {
-    char tbl[32];
-
-    if (TableIndex > 0) {
-        snprintf(tbl, 32, "%4.4s-%u", name, TableIndex);
-    } else {
-        snprintf(tbl, 32, "%4.4s", name);
+    OSDictionary *timing = OSDictionary::withCapacity(5);
+    ACPI_DARWIN_INIT_STATS *init = (ACPI_DARWIN_INIT_STATS *)IOMalloc(sizeof(ACPI_DARWIN_INIT_STATS));
+    UInt32 *nodes = (UInt32 *)IOMallocZero(sizeof(UInt32) * ACPI_NUM_OWNERID_MASKS * 32);
+    
+    if (!timing || !init || !nodes) {
+        goto out;
     }
-
-    OSObject *obj = this->m_tableDict->getObject(name);
-    if (obj) {
-        return OSDynamicCast(OSData, obj);
+    
+    if (this->m_bootPhases) {
+        timing->setObject("Phases", this->m_bootPhases);
     }
     
-    return nullptr;
-}
-
-bool PDACPIPlatformExpert::start(IOService *provider)
-{
-    IOLog("PDACPIPlatformExpert::start - Initializing ACPICA\n"); // Modified log
-
-    if (!super::start(provider)) {
-        IOLog("PDACPIPlatformExpert::start - super::start failed\n");
-        return false;
+    /* One walk attributes every namespace node to the table that created it. */
+    AcpiWalkNamespace(ACPI_TYPE_ANY, ACPI_ROOT_OBJECT, ACPI_UINT32_MAX, PDACPICountNodes, NULL, nodes, NULL);
+    
+    AcpiOsCopyInitStatistics(init);
+    
+    {
+        UInt64 totalNodes = 0;
+        for (UInt32 i = 0; i < ACPI_NUM_OWNERID_MASKS * 32; i++) {
+            totalNodes += nodes[i];
+        }
+        PDACPISetNumber(timing, "Namespace Nodes", totalNodes);
+        
+        OSArray *tables = OSArray::withCapacity(init->TableCount);
+        UInt32 timed = init->TableCount < ACPI_DARWIN_MAX_TIMED_TABLES ? init->TableCount : ACPI_DARWIN_MAX_TIMED_TABLES;
+        for (UInt32 i = 0; tables && i < timed; i++) {
+            const ACPI_DARWIN_TABLE_TIMING *t = &init->Tables[i];
+            OSDictionary *table = OSDictionary::withCapacity(7);
+            if (!table) {
+                continue;
+            }
+            
+            char name[16];
+            snprintf(name, sizeof(name), "%4.4s", t->Signature);
+            OSString *signature = OSString::withCString(name);
+            snprintf(name, sizeof(name), "%.8s", t->OemTableId);
+            OSString *oemTableId = OSString::withCString(name);
+            OSString *status = OSString::withCString(AcpiFormatException(t->Status));
+            
+            if (signature) table->setObject("Signature", signature);
+            if (oemTableId) table->setObject("OEM Table ID", oemTableId);
+            if (status) table->setObject("Status", status);
+            OSSafeReleaseNULL(signature);
+            OSSafeReleaseNULL(oemTableId);
+            OSSafeReleaseNULL(status);
+            
+            PDACPISetNumber(table, "Index", t->TableIndex);
+            PDACPISetNumber(table, "Length", t->Length);
+            PDACPISetNumber(table, "Load Time", t->LoadTime);
+            
+            ACPI_OWNER_ID owner;
+            if (ACPI_SUCCESS(AcpiTbGetOwnerId(t->TableIndex, &owner))) {
+                PDACPISetNumber(table, "Namespace Nodes", nodes[owner % (ACPI_NUM_OWNERID_MASKS * 32)]);
+            }
+            
+            tables->setObject(table);
+            table->release();
+        }
+        if (tables) {
+            timing->setObject("Tables", tables);
+            tables->release();
+        }
+        
+        OSDictionary *devices = OSDictionary::withCapacity(5);
+        if (devices) {
+            PDACPISetNumber(devices, "_REG Time", init->RegTime);
+            PDACPISetNumber(devices, "Device Init Time", init->DeviceInitTime);
+            PDACPISetNumber(devices, "Devices", init->Devices);
+            PDACPISetNumber(devices, "_INI Methods", init->IniMethods);
+            PDACPISetNumber(devices, "_STA Methods", init->StaMethods);
+            timing->setObject("Devices", devices);
+            devices->release();
+        }
+        
+        if (this->m_bootEnumeration) {
+            timing->setObject("Enumeration", this->m_bootEnumeration);
+        }
+        
+        const OSData *fpdt = this->getACPITableData(ACPI_SIG_FPDT, 0);
+        OSDictionary *firmware = fpdt ? PDACPICopyFirmwareBootRecord(fpdt) : nullptr;
+        if (firmware) {
+            timing->setObject("Firmware", firmware);
+            firmware->release();
+        }
     }
     
-    this->m_provider = OSDynamicCast(IOPlatformExpertDevice, provider);
+    this->setProperty(kPDACPIBootTimingKey, timing);
     
-    /* Respond to certain boot arguemnts */
-    PE_parse_boot_argn("acpi_layer", &AcpiDbgLayer, 4);
-    PE_parse_boot_argn("acpi_level", &AcpiDbgLevel, 4);
-
-    if (!this->initializeACPICA()) {
-        panic("ACPI: ACPICA layer failed to initialize.\n");
+out:
+    OSSafeReleaseNULL(timing);
+    if (init) {
+        IOFree(init, sizeof(ACPI_DARWIN_INIT_STATS));
+    }
+    if (nodes) {
+        IOFree(nodes, sizeof(UInt32) * ACPI_NUM_OWNERID_MASKS * 32);
     }
+}
 
-    IOLog("PDACPIPlatformExpert::start - [SUCCESS] ACPICA Initialized successfully.\n");
+#pragma mark - Device enumeration
 
-    // The service should be registered after successful initialization.
-    registerService();
-    IOLog("PDACPIPlatformExpert::start - Service registered.\n");
+/*
+ * One AcpiWalkNamespace pass builds an IOACPIPlatformDevice for every Device, Processor
+ * and ThermalZone. Each node's identification (_STA, _HID, _CID, _UID, _ADR, _CRS) is
+ * evaluated right there against the node, with no path lookups, and cached on the nub as
+ * properties: "name" and "compatible" are what IONameMatch looks at, so matching never
+ * has to run AML. A device that is neither present nor functioning takes its whole
+ * subtree with it, so we skip evaluating anything underneath it (ACPI 6.5, 6.3.7).
+ *
+ * Enumeration runs before any driver has registered the EmbeddedControl or SMBus space,
+ * and _STA or _CRS often read the EC. When one of them fails because its region has no
+ * handler yet, the device and its subtree are set aside instead of being counted absent
+ * or published without resources, and enumerated again once a driver registers a space
+ * (see rescanDeferredDevices).
+ *
+ * Processors and devices with power methods are wired up once, right after the boot walk
+ * (createCPUNubs, buildPowerGraph), and a rescan doesn't repeat that. A subtree holding
+ * either is therefore never deferred: it is enumerated straight away, with a device whose
+ * _STA couldn't run taken as present, and one whose _CRS couldn't run published without it.
+ */
+#define kPDACPIMaxNubDepth 32
+#define kPDACPIProcessorHID "ACPI0007"
 
-    return true;
-}
+struct PDACPIEnumeration {
+    PDACPIPlatformExpert *Platform;
+    IOService *Parents[kPDACPIMaxNubDepth];     /* nearest nub above each nesting level */
+    UInt32 Base;                                /* added to NestingLevel, for walks below the root */
+    UInt32 Nodes;
+    UInt32 Absent;
+    UInt32 Deferred;
+    UInt64 EvaluationTime;                      /* absolute time spent in AML */
+};
 
-void PDACPIPlatformExpert::stop(IOService *provider)
+/* A device whose identification needs an address space nobody has registered yet. */
+struct PDACPIDeferredDevice {
+    ACPI_HANDLE Handle;
+    IOService *Parent;                          /* held by m_deviceNubs, or the platform expert */
+};
+
+static bool PDACPIHasMethod(ACPI_HANDLE handle, const char *name)
 {
-    IOLog("PDACPIPlatformExpert::stop\n");
-    super::stop(provider);
+    ACPI_HANDLE child;
+    return ACPI_SUCCESS(AcpiGetHandle(handle, (char *)name, &child));
 }
 
-extern "C" ACPI_TABLE_FADT* getFADT();
-extern "C" void outw(uint16_t port, uint16_t val);
-extern "C" void IOSleep(uint32_t ms);
-
-void PDACPIPlatformExpert::performACPIPowerOff()
+/* What gets a device into the power resource graph. */
+static bool PDACPIHasPowerMethods(ACPI_HANDLE handle)
 {
-    ACPI_TABLE_FADT* fadt = getFADT();
-    if (!fadt || fadt->Pm1aControlBlock == 0)
-        return;
+    return PDACPIHasMethod(handle, "_PRW") || PDACPIHasMethod(handle, "_PS0") || PDACPIHasMethod(handle, "_PS3") ||
+           PDACPIHasMethod(handle, "_PR0") || PDACPIHasMethod(handle, "_PR3") || PDACPIHasMethod(handle, "_PSC");
+}
 
-    ACPI_OBJECT* s5Obj;
-    ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-    if (ACPI_FAILURE(AcpiEvaluateObject(NULL, (char*)"_S5", NULL, &buffer)))
-        return;
+static bool PDACPIIsProcessor(ACPI_NAMESPACE_NODE *node)
+{
+    ACPI_PNP_DEVICE_ID *hid = NULL;
+    bool processor = node->Type == ACPI_TYPE_PROCESSOR;
+    
+    if (!processor && node->Type == ACPI_TYPE_DEVICE && ACPI_SUCCESS(AcpiUtExecute_HID(node, &hid))) {
+        processor = strcmp(hid->String, kPDACPIProcessorHID) == 0;
+        ACPI_FREE(hid);
+    }
+    return processor;
+}
 
-    s5Obj = (ACPI_OBJECT*)buffer.Pointer;
-    if (!s5Obj || s5Obj->Type != ACPI_TYPE_PACKAGE || s5Obj->Package.Count < 2)
-        return;
+static ACPI_STATUS PDACPIFindUndeferrable(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue)
+{
+    ACPI_NAMESPACE_NODE *node = (ACPI_NAMESPACE_NODE *)Handle;
+    
+    if (node->Type != ACPI_TYPE_DEVICE && node->Type != ACPI_TYPE_PROCESSOR) {
+        return AE_OK;
+    }
+    if (PDACPIIsProcessor(node) || PDACPIHasPowerMethods(Handle)) {
+        *(bool *)Context = true;
+        return AE_CTRL_TERMINATE;
+    }
+    return AE_OK;
+}
 
-    ACPI_OBJECT elem1 = s5Obj->Package.Elements[0];
-    uint16_t slp_typ = elem1.Integer.Value & 0x7;
-    uint16_t slp_en = 1 << 13;
-    uint16_t value = (slp_typ << 10) | slp_en;
+/* Whether a device's subtree can wait for a rescan: nothing in it needs the one-time setup. */
+static bool PDACPIMayDefer(ACPI_NAMESPACE_NODE *node)
+{
+    bool found = false;
+    
+    PDACPIFindUndeferrable(node, 0, &found, NULL);
+    if (!found) {
+        AcpiWalkNamespace(ACPI_TYPE_ANY, node, ACPI_UINT32_MAX, PDACPIFindUndeferrable, NULL, &found, NULL);
+    }
+    return !found;
+}
 
-    outw(fadt->Pm1aControlBlock, value);
-    if (fadt->Pm1bControlBlock)
-        outw(fadt->Pm1bControlBlock, value);
+/* Tag a processor's nub for PDACPICPU; createCPUNubs fills in the rest from the MADT. */
+static bool PDACPITagProcessor(IOACPIPlatformDevice *nub, ACPI_NAMESPACE_NODE *node)
+{
+    UInt64 processorId;
+    
+    if (node->Type == ACPI_TYPE_PROCESSOR) {
+        ACPI_OPERAND_OBJECT *object = AcpiNsGetAttachedObject(node);
+        if (!object) {
+            return false;
+        }
+        processorId = object->Processor.ProcId;
+    } else if (ACPI_FAILURE(AcpiUtEvaluateNumericObject(METHOD_NAME__UID, node, &processorId))) {
+        /* ACPI0007 devices are identified by their _UID. */
+        return false;
+    }
+    
+    nub->setProperty("processor-id", processorId, 32);
+    nub->setProperty("device_type", (void *)"processor", sizeof("processor"));
+    return true;
+}
 
-    IOSleep(10000);
-    while (1) asm volatile("hlt");
+/*
+ * Set a device aside until the address space its methods need is registered. Refuses a
+ * subtree that PDACPIMayDefer says can't wait; the caller then enumerates it as it is.
+ * Caller holds m_deviceLock.
+ */
+bool PDACPIPlatformExpert::deferDevice(ACPI_HANDLE handle, IOService *parent)
+{
+    PDACPIDeferredDevice deferred = { handle, parent };
+    OSData *entry;
+    bool ok = false;
+    
+    if (!PDACPIMayDefer((ACPI_NAMESPACE_NODE *)handle)) {
+        return false;
+    }
+    
+    entry = OSData::withBytes(&deferred, sizeof(deferred));
+    if (!entry) {
+        return false;
+    }
+    
+    if (!this->m_deferredDevices) {
+        this->m_deferredDevices = OSArray::withCapacity(4);
+    }
+    if (this->m_deferredDevices) {
+        ok = this->m_deferredDevices->setObject(entry);
+    }
+    entry->release();
+    return ok;
 }
 
-IOReturn PDACPIPlatformExpert::registerAddressSpaceHandler(IOACPIPlatformDevice *,
-                                                           IOACPIAddressSpaceID spaceID,
-                                                           IOACPIAddressSpaceHandler Handler,
-                                                           void *context, IOOptionBits options)
+ACPI_STATUS PDACPIPlatformExpert::deviceNamespaceWalk(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue)
 {
-    /* We don't care about the specific device; we care about the handler itself */
-    switch (spaceID) {
-        case kIOACPIAddressSpaceIDEmbeddedController:
-            this->m_ecSpaceHandler = Handler;
-            this->m_ecSpaceContext = context;
-            IOLog("PDACPIPlatformExpert::%s: Registered handler for the EC address space\n", __PRETTY_FUNCTION__);
-            return kIOReturnSuccess;
-        case kIOACPIAddressSpaceIDSMBus:
-            this->m_smbusSpaceHandler = Handler;
-            this->m_smbusSpaceContext = context;
-            IOLog("PDACPIPlatformExpert::%s: Registered handler for the SMBus address space\n", __PRETTY_FUNCTION__);
-            return kIOReturnSuccess;
-        default:
-            IOLog("PDACPIPlatformExpert::%s: Invalid attempt at registering an address space handler\n", __PRETTY_FUNCTION__);
-            return kIOReturnInvalid;
+    PDACPIEnumeration *walk = (PDACPIEnumeration *)Context;
+    ACPI_NAMESPACE_NODE *node = (ACPI_NAMESPACE_NODE *)Handle;
+    UInt32 level = NestingLevel + walk->Base < kPDACPIMaxNubDepth ? NestingLevel + walk->Base : kPDACPIMaxNubDepth - 1;
+    
+    /* Scopes, methods and the like don't get a nub; their children hang off ours. */
+    walk->Nodes++;
+    walk->Parents[level] = walk->Parents[level - 1];
+    
+    if (node->Type != ACPI_TYPE_DEVICE && node->Type != ACPI_TYPE_PROCESSOR && node->Type != ACPI_TYPE_THERMAL) {
+        return AE_OK;
+    }
+    
+    UInt64 start = mach_absolute_time();
+    UInt32 sta;
+    ACPI_STATUS status = AcpiUtExecute_STA(node, &sta);
+    if (status == AE_NOT_EXIST) {
+        /* A region without a handler; try again when one is registered. */
+        if (walk->Platform->deferDevice(Handle, walk->Parents[level - 1])) {
+            walk->EvaluationTime += mach_absolute_time() - start;
+            walk->Deferred++;
+            return AE_CTRL_DEPTH;
+        }
+        /* Can't wait; treat it like a device without _STA. */
+        sta = ACPI_UINT32_MAX;
+    } else if (ACPI_FAILURE(status)) {
+        sta = 0;
+    }
+    
+    if (!(sta & ACPI_STA_DEVICE_PRESENT)) {
+        walk->Absent++;
+        walk->EvaluationTime += mach_absolute_time() - start;
+        return (sta & ACPI_STA_DEVICE_FUNCTIONING) ? AE_OK : AE_CTRL_DEPTH;
+    }
+    
+    ACPI_PNP_DEVICE_ID *hid = NULL;
+    ACPI_PNP_DEVICE_ID *uid = NULL;
+    ACPI_PNP_DEVICE_ID_LIST *cid = NULL;
+    ACPI_OPERAND_OBJECT *crs = NULL;
+    UInt64 adr;
+    
+    AcpiUtExecute_HID(node, &hid);
+    AcpiUtExecute_CID(node, &cid);
+    AcpiUtExecute_UID(node, &uid);
+    bool hasAdr = ACPI_SUCCESS(AcpiUtEvaluateNumericObject(METHOD_NAME__ADR, node, &adr));
+    status = AcpiUtEvaluateObject(node, METHOD_NAME__CRS, ACPI_BTYPE_BUFFER, &crs);
+    walk->EvaluationTime += mach_absolute_time() - start;
+    
+    char nodeName[ACPI_NAMESEG_SIZE + 1];
+    OSDictionary *props = nullptr;
+    IOACPIPlatformDevice *nub = nullptr;
+    ACPI_STATUS result = AE_OK;
+    
+    if (status == AE_NOT_EXIST && walk->Platform->deferDevice(Handle, walk->Parents[level - 1])) {
+        walk->Deferred++;
+        result = AE_CTRL_DEPTH;
+        goto out;
+    }
+    
+    ACPI_COPY_NAMESEG(nodeName, node->Name.Ascii);
+    nodeName[ACPI_NAMESEG_SIZE] = '\0';
+    
+    props = OSDictionary::withCapacity(6);
+    if (!props) {
+        goto out;
+    }
+    
+    {
+        const char *name = hid ? hid->String : nodeName;
+        OSData *nameData = OSData::withBytes(name, (unsigned)strlen(name) + 1);
+        if (nameData) {
+            props->setObject("name", nameData);
+            nameData->release();
+        }
+    }
+    
+    if (cid && cid->Count) {
+        OSData *compatible = OSData::withCapacity(cid->ListSize);
+        for (UInt32 i = 0; compatible && i < cid->Count; i++) {
+            compatible->appendBytes(cid->Ids[i].String, cid->Ids[i].Length);
+        }
+        if (compatible) {
+            props->setObject("compatible", compatible);
+            compatible->release();
+        }
+    }
+    
+    if (uid) {
+        OSString *uidString = OSString::withCString(uid->String);
+        if (uidString) {
+            props->setObject("_UID", uidString);
+            uidString->release();
+        }
+    }
+    
+    if (hasAdr) {
+        PDACPISetNumber(props, "_ADR", adr);
+    }
+    PDACPISetNumber(props, "_STA", sta);
+    
+    if (crs) {
+        OSData *resources = OSData::withBytes(crs->Buffer.Pointer, crs->Buffer.Length);
+        if (resources) {
+            props->setObject("_CRS", resources);
+            resources->release();
+        }
+    }
+    
+    nub = new IOACPIPlatformDevice;
+    if (!nub || !nub->init(walk->Platform, Handle, props)) {
+        OSSafeReleaseNULL(nub);
+        goto out;
+    }
+    
+    nub->setName(nodeName);
+    if (hasAdr || uid) {
+        char location[24];
+        if (hasAdr) {
+            snprintf(location, sizeof(location), "%llx", adr);
+        } else {
+            snprintf(location, sizeof(location), "%s", uid->String);
+        }
+        nub->setLocation(location);
+    }
+    
+    if ((node->Type == ACPI_TYPE_PROCESSOR || (hid && strcmp(hid->String, kPDACPIProcessorHID) == 0)) &&
+        PDACPITagProcessor(nub, node)) {
+        walk->Platform->m_processorNubs->setObject(nub);
+    }
+    
+    if (nub->attach(walk->Parents[level - 1])) {
+        walk->Platform->m_deviceNubs->setObject(nub);
+        walk->Parents[level] = nub;
+    }
+    nub->release();
+    
+out:
+    OSSafeReleaseNULL(props);
+    if (hid) {
+        ACPI_FREE(hid);
+    }
+    if (uid) {
+        ACPI_FREE(uid);
+    }
+    if (cid) {
+        ACPI_FREE(cid);
+    }
+    if (crs) {
+        AcpiUtRemoveReference(crs);
     }
+    return result;
 }
 
-void PDACPIPlatformExpert::unregisterAddressSpaceHandler(IOACPIPlatformDevice *,
-                                                         IOACPIAddressSpaceID spaceID,
-                                                         IOACPIAddressSpaceHandler,
-                                                         IOOptionBits)
+/*
+ * Enumerate the devices createDeviceNubs set aside, now that a driver has registered an
+ * address space. Anything that still can't be identified stays deferred for the next one.
+ */
+void PDACPIPlatformExpert::rescanDeferredDevices()
 {
-    /* Remove the specified handlers */
-    switch (spaceID) {
-        case kIOACPIAddressSpaceIDEmbeddedController:
-            this->m_ecSpaceHandler = nullptr;
-            this->m_ecSpaceContext = nullptr;
-            IOLog("PDACPIPlatformExpert::%s: Removed handler for the EC address space\n", __PRETTY_FUNCTION__);
-            return;
-        case kIOACPIAddressSpaceIDSMBus:
-            this->m_smbusSpaceHandler = nullptr;
-            this->m_smbusSpaceContext = nullptr;
-            IOLog("PDACPIPlatformExpert::%s: Removed handler for the SMBus address space\n", __PRETTY_FUNCTION__);
-            return;
-        default:
-            IOLog("PDACPIPlatformExpert::%s: Invalid attempt at removing an address space handler\n", __PRETTY_FUNCTION__);
-            break;
+    if (!this->m_deviceLock) {
+        return;
+    }
+    
+    IOLockLock(this->m_deviceLock);
+    OSArray *deferred = this->m_deferredDevices;
+    this->m_deferredDevices = nullptr;
+    if (!deferred) {
+        IOLockUnlock(this->m_deviceLock);
+        return;
+    }
+    
+    PDACPIEnumeration walk = {};
+    UInt32 first = this->m_deviceNubs->getCount();
+    walk.Platform = this;
+    
+    for (UInt32 i = 0; i < deferred->getCount(); i++) {
+        OSData *entry = (OSData *)deferred->getObject(i);
+        const PDACPIDeferredDevice *device = (const PDACPIDeferredDevice *)entry->getBytesNoCopy();
+        
+        /* The device itself sits at level 1 under its old parent, its children below it. */
+        walk.Base = 0;
+        walk.Parents[0] = device->Parent;
+        if (deviceNamespaceWalk(device->Handle, 1, &walk, NULL) != AE_OK) {
+            continue;
+        }
+        
+        walk.Base = 1;
+        AcpiWalkNamespace(ACPI_TYPE_ANY, device->Handle, ACPI_UINT32_MAX, &PDACPIPlatformExpert::deviceNamespaceWalk, NULL, &walk, NULL);
     }
+    deferred->release();
+    
+    for (UInt32 i = first; i < this->m_deviceNubs->getCount(); i++) {
+        IOService *nub = OSDynamicCast(IOService, this->m_deviceNubs->getObject(i));
+        if (nub) {
+            nub->registerService();
+        }
+    }
+    
+    IOLog("ACPI: %u deferred device nubs enumerated, %u still deferred\n",
+          this->m_deviceNubs->getCount() - first, walk.Deferred);
+    IOLockUnlock(this->m_deviceLock);
 }
 
-IOReturn PDACPIPlatformExpert::readAddressSpace(UInt64 *value,
-                                                IOACPIAddressSpaceID spaceID,
-                                                IOACPIAddress address,
-                                                UInt32 bitWidth,
-                                                UInt32 bitOffset,
-                                                IOOptionBits options)
+/* Match the processors we found in the namespace up with their local APICs. */
+void PDACPIPlatformExpert::createCPUNubs()
 {
-    switch (spaceID) {
-        case kIOACPIAddressSpaceIDSystemMemory: {
-            ACPI_STATUS status = AcpiOsReadMemory(address.addr64, value, bitWidth);
-            if (ACPI_FAILURE(status)) {
-                return kIOReturnError;
-            } else {
-                return kIOReturnSuccess;
-            }
+    const OSData *table = this->getACPITableData(ACPI_SIG_MADT, 0);
+    if (!table) {
+        IOLog("ACPI: No MADT found, processors will not be started.\n");
+        return;
+    }
+    
+    gAPICTable = (ACPI_TABLE_MADT *)table->getBytesNoCopy();
+    
+    const UInt8 *cursor = (const UInt8 *)(gAPICTable + 1);
+    const UInt8 *end = (const UInt8 *)gAPICTable + gAPICTable->Header.Length;
+    UInt32 index = 0;
+    
+    for (; cursor + sizeof(ACPI_SUBTABLE_HEADER) <= end; cursor += ((const ACPI_SUBTABLE_HEADER *)cursor)->Length) {
+        const ACPI_SUBTABLE_HEADER *entry = (const ACPI_SUBTABLE_HEADER *)cursor;
+        UInt32 processorId, apicId, flags;
+        
+        if (entry->Length < sizeof(ACPI_SUBTABLE_HEADER) || cursor + entry->Length > end) {
             break;
         }
-        case kIOACPIAddressSpaceIDSystemIO: {
-            ACPI_STATUS status = AcpiOsReadPort((ACPI_IO_ADDRESS)address.addr64, (UInt32 *)value, bitWidth);
-            if (ACPI_FAILURE(status)) {
-                return kIOReturnError;
-            } else {
-                return kIOReturnSuccess;
-            }
-            break;
+        
+        if (entry->Type == ACPI_MADT_TYPE_LOCAL_APIC) {
+            const ACPI_MADT_LOCAL_APIC *lapic = (const ACPI_MADT_LOCAL_APIC *)entry;
+            processorId = lapic->ProcessorId;
+            apicId = lapic->Id;
+            flags = lapic->LapicFlags;
+        } else if (entry->Type == ACPI_MADT_TYPE_LOCAL_X2APIC) {
+            const ACPI_MADT_LOCAL_X2APIC *x2apic = (const ACPI_MADT_LOCAL_X2APIC *)entry;
+            processorId = x2apic->Uid;
+            apicId = x2apic->LocalApicId;
+            flags = x2apic->LapicFlags;
+        } else {
+            continue;
         }
-        case kIOACPIAddressSpaceIDEmbeddedController:
-            if (this->m_ecSpaceHandler && this->m_ecSpaceContext) {
-                return this->m_ecSpaceHandler(kIOACPIAddressSpaceOpRead, address, value, bitWidth, bitOffset, this->m_ecSpaceContext);
+        
+        for (UInt32 i = 0; i < this->m_processorNubs->getCount(); i++) {
+            IOService *nub = OSDynamicCast(IOService, this->m_processorNubs->getObject(i));
+            OSNumber *id = nub ? OSDynamicCast(OSNumber, nub->getProperty("processor-id")) : nullptr;
+            if (!id || id->unsigned32BitValue() != processorId) {
+                continue;
             }
-        case kIOACPIAddressSpaceIDSMBus:
-            if (this->m_smbusSpaceHandler && this->m_smbusSpaceContext) {
-                return this->m_smbusSpaceHandler(kIOACPIAddressSpaceOpRead, address, value, bitWidth, bitOffset, this->m_smbusSpaceContext);
+            
+            nub->setProperty("processor-index", index, 32);
+            if (flags & ACPI_MADT_ENABLED) {
+                nub->setProperty("processor-lapic", apicId, 32);
             }
-        default:
+            index++;
             break;
+        }
+    }
+    
+    this->createCPUDomains();
+}
+
+PDACPICPUDomain *PDACPIPlatformExpert::findCPUDomain(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index)
+{
+    for (UInt32 i = 0; i < this->m_cpuDomains->getCount(); i++) {
+        PDACPICPUDomain *existing = OSDynamicCast(PDACPICPUDomain, this->m_cpuDomains->getObject(i));
+        if (existing && existing->matches(kind, domain, index)) {
+            return existing;
+        }
     }
+    
+    PDACPICPUDomain *created = PDACPICPUDomain::withDomain(kind, domain, coordination, processors, index);
+    if (created) {
+        this->m_cpuDomains->setObject(created);
+        created->release();
+    }
+    return created;
+}
+
+/* Integers [2..count) of a _PSD/_CSD entry: domain, coordination type, processors, and _CSD's index. */
+static bool PDACPIDependencyValues(const ACPI_OBJECT *entry, UInt32 count, UInt64 *values)
+{
+    if (entry->Type != ACPI_TYPE_PACKAGE || entry->Package.Count < count) {
+        return false;
+    }
+    
+    for (UInt32 i = 2; i < count; i++) {
+        if (entry->Package.Elements[i].Type != ACPI_TYPE_INTEGER) {
+            return false;
+        }
+        values[i - 2] = entry->Package.Elements[i].Integer.Value;
+    }
+    
+    /* A domain of no processors would let its idle state in with nobody there. */
+    return values[1] >= kPDACPICoordinationSWAll && values[1] <= kPDACPICoordinationHWAll && values[2] != 0;
+}
+
+/*
+ * Processors that _PSD/_CSD put in the same domain share one PDACPICPUDomain, left on
+ * their nubs for PDACPICPU to join. Capabilities go to firmware first: the dependency
+ * objects often live in SSDTs that _PDC loads.
+ */
+void PDACPIPlatformExpert::createCPUDomains()
+{
+    this->m_cpuDomains = OSArray::withCapacity(4);
+    if (!this->m_cpuDomains) {
+        return;
+    }
+    
+    for (UInt32 i = 0; i < this->m_processorNubs->getCount(); i++) {
+        IOACPIPlatformDevice *nub = OSDynamicCast(IOACPIPlatformDevice, this->m_processorNubs->getObject(i));
+        ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+        ACPI_HANDLE handle;
+        ACPI_OBJECT *package;
+        UInt64 values[4];
+        
+        if (!nub) {
+            continue;
+        }
+        handle = (ACPI_HANDLE)nub->getDeviceHandle();
+        PDACPICPU::declareCapabilities(handle);
+        
+        if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(handle, (char *)"_PSD", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+            package = (ACPI_OBJECT *)buffer.Pointer;
+            if (package->Package.Count && PDACPIDependencyValues(&package->Package.Elements[0], 5, values)) {
+                PDACPICPUDomain *domain = this->findCPUDomain(kPDACPIDomainPerformance, (UInt32)values[0], (UInt32)values[1],
+                                                              (UInt32)values[2], 0);
+                if (domain) {
+                    nub->setProperty(kPDACPIPerformanceDomainKey, domain);
+                }
+            }
+            ACPI_FREE(buffer.Pointer);
+        }
+        
+        buffer.Length = ACPI_ALLOCATE_BUFFER;
+        buffer.Pointer = NULL;
+        if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(handle, (char *)"_CSD", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+            package = (ACPI_OBJECT *)buffer.Pointer;
+            OSArray *domains = OSArray::withCapacity(package->Package.Count);
+            for (UInt32 j = 0; domains && j < package->Package.Count; j++) {
+                if (!PDACPIDependencyValues(&package->Package.Elements[j], 6, values)) {
+                    continue;
+                }
+                PDACPICPUDomain *domain = this->findCPUDomain(kPDACPIDomainIdle, (UInt32)values[0], (UInt32)values[1],
+                                                              (UInt32)values[2], (UInt32)values[3]);
+                if (domain) {
+                    domains->setObject(domain);
+                }
+            }
+            if (domains && domains->getCount()) {
+                nub->setProperty(kPDACPIIdleDomainsKey, domains);
+            }
+            OSSafeReleaseNULL(domains);
+            ACPI_FREE(buffer.Pointer);
+        }
+    }
+}
+
+/* Build and publish the device tree; returns false only if we couldn't allocate anything. */
+bool PDACPIPlatformExpert::createDeviceNubs()
+{
+    PDACPIEnumeration walk = {};
+    UInt64 start = mach_absolute_time();
+    UInt64 elapsed, evaluation;
+    
+    this->m_deviceLock = IOLockAlloc();
+    this->m_deviceNubs = OSArray::withCapacity(256);
+    this->m_processorNubs = OSArray::withCapacity(8);
+    if (!this->m_deviceLock || !this->m_deviceNubs || !this->m_processorNubs) {
+        return false;
+    }
+    
+    /* Drivers start matching as soon as we register, and may register a space mid-loop. */
+    IOLockLock(this->m_deviceLock);
+    walk.Platform = this;
+    walk.Parents[0] = this;
+    AcpiWalkNamespace(ACPI_TYPE_ANY, ACPI_ROOT_OBJECT, ACPI_UINT32_MAX, &PDACPIPlatformExpert::deviceNamespaceWalk, NULL, &walk, NULL);
+    
+    this->createCPUNubs();
+    
+    /* Before anyone can match on a nub and start asking for power state changes. */
+    if (!this->buildPowerGraph()) {
+        IOLog("ACPI: failed to build the power resource graph, device power management is unavailable\n");
+    }
+    
+    /* Parents come before their children in the array, so this registers top-down. */
+    for (UInt32 i = 0; i < this->m_deviceNubs->getCount(); i++) {
+        IOService *nub = OSDynamicCast(IOService, this->m_deviceNubs->getObject(i));
+        if (nub) {
+            nub->registerService();
+        }
+    }
+    
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &elapsed);
+    absolutetime_to_nanoseconds(walk.EvaluationTime, &evaluation);
+    
+    this->m_bootEnumeration = OSDictionary::withCapacity(7);
+    if (this->m_bootEnumeration) {
+        PDACPISetNumber(this->m_bootEnumeration, "Namespace Nodes", walk.Nodes);
+        PDACPISetNumber(this->m_bootEnumeration, "Devices", this->m_deviceNubs->getCount());
+        PDACPISetNumber(this->m_bootEnumeration, "Processors", this->m_processorNubs->getCount());
+        PDACPISetNumber(this->m_bootEnumeration, "Not Present", walk.Absent);
+        PDACPISetNumber(this->m_bootEnumeration, "Deferred", walk.Deferred);
+        PDACPISetNumber(this->m_bootEnumeration, "Evaluation Time", evaluation);
+        PDACPISetNumber(this->m_bootEnumeration, "Total Time", elapsed);
+    }
+    IOLockUnlock(this->m_deviceLock);
+    
+    IOLog("ACPI: %u device nubs (%u processors) from %u namespace nodes in %llu us\n",
+          this->m_deviceNubs->getCount(), this->m_processorNubs->getCount(), walk.Nodes, elapsed / 1000);
+    return true;
+}
+
+#pragma mark - Device power
+
+/*
+ * Device power management.
+ *
+ * The power resource graph is built once, right after enumeration. Every device with
+ * _PSx, _PRx, _PSC or _PRW gets a record with its parent record and its _PR0-_PR3 and
+ * _PRW lists. The lists hold indexes into one table of power resources, sorted by
+ * ResourceOrder. Power resources are reference counted across every device state and
+ * wake enable that depends on them, so _ON and _OFF only run when a resource actually
+ * has to change.
+ *
+ * setDeviceTreePowerState moves every device one tree level at a time: children before
+ * parents going down, parents before children coming up. Devices on the same level don't
+ * depend on each other, so each level runs in parallel on thread calls. The interpreter
+ * is still shared, but a _PSx or _ON that Sleep()s no longer holds up every device behind it.
+ */
+#define kPDACPIDeviceStateUnknown   0xFF
+#define kPDACPINoPowerDevice        0xFFFFFFFF
+#define kPDACPIPowerLists           4           /* _PR0.._PR3 */
+#define kPDACPISlowTransitionNS     (50 * 1000 * 1000ULL)
+
+struct PDACPIPowerResource {
+    ACPI_HANDLE Handle;
+    IOLock *Lock;
+    UInt32 References;
+    UInt32 Order;                               /* ResourceOrder: on ascending, off descending */
+    bool On;
+    UInt64 Switches;                            /* _ON and _OFF actually run */
+};
+
+struct PDACPIPowerList {
+    UInt16 Start;                               /* into PDACPIPowerGraph::Lists */
+    UInt16 Count;
+};
+
+struct PDACPIPowerDevice {
+    ACPI_HANDLE Handle;
+    IOACPIPlatformDevice *Nub;
+    IOLock *Lock;
+    thread_call_t Call;
+    UInt32 Parent;
+    UInt32 Depth;
+    PDACPIPowerList States[kPDACPIPowerLists];
+    PDACPIPowerList Wake;
+    ACPI_HANDLE WakeGpeDevice;
+    UInt32 WakeGpe;
+    bool CanWake;
+    bool WakeEnabled;
+    UInt8 WakeSleepState;                       /* the Sx and Dx _DSW was last armed for */
+    UInt8 WakeDeviceState;
+    UInt8 State;
+    UInt8 Target;                               /* for setDeviceTreePowerState */
+    UInt64 Transitions;
+    UInt64 LastLatency;                         /* ns */
+    UInt64 MaxLatency;                          /* ns */
+};
+
+struct PDACPIPowerGraph {
+    PDACPIPowerDevice *Devices;
+    UInt32 DeviceCount;
+    UInt32 DeviceCapacity;
+    PDACPIPowerResource *Resources;
+    UInt32 ResourceCount;
+    UInt16 *Lists;
+    UInt32 ListCount;
+    UInt32 *Index;                              /* open-addressed by handle, kPDACPINoPowerDevice if empty */
+    UInt32 IndexShift;
+    UInt32 MaxDepth;
+    IOLock *TreeLock;                           /* one setDeviceTreePowerState at a time, and its barrier */
+    UInt32 Pending;
+    UInt8 SleepState;                           /* the Sx wake is armed for; see prepareSleepState */
+};
+
+static void PDACPIFreePowerGraph(PDACPIPowerGraph *graph)
+{
+    if (!graph) {
+        return;
+    }
+    
+    for (UInt32 i = 0; graph->Resources && i < graph->ResourceCount; i++) {
+        if (graph->Resources[i].Lock) {
+            IOLockFree(graph->Resources[i].Lock);
+        }
+    }
+    /* A device that failed half way through setup sits at DeviceCount. */
+    for (UInt32 i = 0; graph->Devices && i <= graph->DeviceCount && i < graph->DeviceCapacity + 1; i++) {
+        PDACPIPowerDevice *device = &graph->Devices[i];
+        if (device->Lock) {
+            IOLockFree(device->Lock);
+        }
+        if (device->Call) {
+            thread_call_free(device->Call);
+        }
+    }
+    
+    if (graph->Resources) {
+        IOFree(graph->Resources, sizeof(PDACPIPowerResource) * graph->ResourceCount);
+    }
+    if (graph->Devices) {
+        IOFree(graph->Devices, sizeof(PDACPIPowerDevice) * (graph->DeviceCapacity + 1));
+    }
+    if (graph->Index) {
+        IOFree(graph->Index, sizeof(UInt32) << graph->IndexShift);
+    }
+    if (graph->Lists) {
+        IOFree(graph->Lists, sizeof(UInt16) * graph->ListCount);
+    }
+    if (graph->TreeLock) {
+        IOLockFree(graph->TreeLock);
+    }
+    IOFree(graph, sizeof(PDACPIPowerGraph));
+}
+
+static UInt32 *PDACPIPowerDeviceSlot(PDACPIPowerGraph *graph, ACPI_HANDLE handle)
+{
+    UInt32 mask = (1U << graph->IndexShift) - 1;
+    UInt32 slot = (UInt32)(((uintptr_t)handle >> 4) * 0x9E3779B1U) >> (32 - graph->IndexShift);
+    
+    for (;; slot = (slot + 1) & mask) {
+        UInt32 *entry = &graph->Index[slot];
+        if (*entry == kPDACPINoPowerDevice || graph->Devices[*entry].Handle == handle) {
+            return entry;
+        }
+    }
+}
+
+static ACPI_STATUS PDACPICollectPowerResources(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue)
+{
+    OSData *resources = (OSData *)Context;
+    PDACPIPowerResource resource = {};
+    ACPI_OPERAND_OBJECT *object = AcpiNsGetAttachedObject((ACPI_NAMESPACE_NODE *)Handle);
+    
+    resource.Handle = Handle;
+    resource.Order = object ? object->PowerResource.ResourceOrder : 0;
+    resources->appendBytes(&resource, sizeof(resource));
+    return AE_OK;
+}
+
+/* Turn a package of power resource references (from element 'first' on) into a list, ordered by ResourceOrder. */
+static PDACPIPowerList PDACPIAppendPowerList(PDACPIPowerGraph *graph, OSData *lists, const ACPI_OBJECT *package, UInt32 first)
+{
+    PDACPIPowerList list = { (UInt16)(lists->getLength() / sizeof(UInt16)), 0 };
+    
+    for (UInt32 i = first; i < package->Package.Count; i++) {
+        const ACPI_OBJECT *element = &package->Package.Elements[i];
+        if (element->Type != ACPI_TYPE_LOCAL_REFERENCE) {
+            continue;
+        }
+        
+        for (UInt16 r = 0; r < graph->ResourceCount; r++) {
+            if (graph->Resources[r].Handle != element->Reference.Handle) {
+                continue;
+            }
+            
+            /* Insertion sort; these lists are a handful of entries at most. */
+            lists->appendBytes(&r, sizeof(r));
+            UInt16 *entries = (UInt16 *)lists->getBytesNoCopy() + list.Start;
+            UInt32 j = list.Count++;
+            for (; j > 0 && graph->Resources[entries[j - 1]].Order > graph->Resources[r].Order; j--) {
+                entries[j] = entries[j - 1];
+            }
+            entries[j] = r;
+            break;
+        }
+    }
+    
+    return list;
+}
+
+/* Find every device that has anything to do with power and wire it up to the resources it uses. */
+bool PDACPIPlatformExpert::buildPowerGraph()
+{
+    static const char *stateLists[kPDACPIPowerLists] = { "_PR0", "_PR1", "_PR2", "_PR3" };
+    PDACPIPowerGraph *graph = (PDACPIPowerGraph *)IOMallocZero(sizeof(PDACPIPowerGraph));
+    OSData *resources = OSData::withCapacity(16 * sizeof(PDACPIPowerResource));
+    OSData *lists = OSData::withCapacity(64 * sizeof(UInt16));
+    
+    if (!graph || !resources || !lists) {
+        goto fail;
+    }
+    
+    graph->SleepState = ACPI_STATE_S3;
+    AcpiWalkNamespace(ACPI_TYPE_POWER, ACPI_ROOT_OBJECT, ACPI_UINT32_MAX, PDACPICollectPowerResources, NULL, resources, NULL);
+    if (resources->getLength()) {
+        graph->Resources = (PDACPIPowerResource *)IOMallocZero(resources->getLength());
+        if (!graph->Resources) {
+            goto fail;
+        }
+        graph->ResourceCount = resources->getLength() / sizeof(PDACPIPowerResource);
+        memcpy(graph->Resources, resources->getBytesNoCopy(), resources->getLength());
+    }
+    
+    for (UInt32 i = 0; i < graph->ResourceCount; i++) {
+        PDACPIPowerResource *resource = &graph->Resources[i];
+        ACPI_OBJECT object;
+        ACPI_BUFFER buffer = { sizeof(object), &object };
+        
+        resource->Lock = IOLockAlloc();
+        if (!resource->Lock) {
+            goto fail;
+        }
+        if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(resource->Handle, (char *)"_STA", NULL, &buffer, ACPI_TYPE_INTEGER))) {
+            resource->On = object.Integer.Value & 1;
+        }
+    }
+    
+    graph->DeviceCapacity = this->m_deviceNubs->getCount();
+    graph->IndexShift = 4;
+    while ((1U << graph->IndexShift) < graph->DeviceCapacity * 2) {
+        graph->IndexShift++;
+    }
+    graph->Devices = (PDACPIPowerDevice *)IOMallocZero(sizeof(PDACPIPowerDevice) * (graph->DeviceCapacity + 1));
+    graph->Index = (UInt32 *)IOMalloc(sizeof(UInt32) << graph->IndexShift);
+    graph->TreeLock = IOLockAlloc();
+    if (!graph->Devices || !graph->Index || !graph->TreeLock) {
+        goto fail;
+    }
+    memset(graph->Index, 0xFF, sizeof(UInt32) << graph->IndexShift);
+    
+    /* m_deviceNubs has parents before children, so a device's parent record already exists. */
+    for (UInt32 n = 0; n < graph->DeviceCapacity; n++) {
+        IOACPIPlatformDevice *nub = OSDynamicCast(IOACPIPlatformDevice, this->m_deviceNubs->getObject(n));
+        ACPI_HANDLE handle = nub ? (ACPI_HANDLE)nub->getDeviceHandle() : NULL;
+        if (!handle) {
+            continue;
+        }
+        
+        bool canWake = PDACPIHasMethod(handle, "_PRW");
+        if (!PDACPIHasPowerMethods(handle)) {
+            continue;
+        }
+        
+        UInt32 index = graph->DeviceCount;
+        PDACPIPowerDevice *device = &graph->Devices[index];
+        device->Handle = handle;
+        device->Nub = nub;
+        device->Parent = kPDACPINoPowerDevice;
+        device->State = kPDACPIDeviceStateUnknown;
+        device->Lock = IOLockAlloc();
+        device->Call = thread_call_allocate(&PDACPIPlatformExpert::powerTransitionCall, this);
+        if (!device->Lock || !device->Call) {
+            goto fail;
+        }
+        
+        for (IOService *parent = nub->getProvider(); parent && parent != this; parent = parent->getProvider()) {
+            IOACPIPlatformDevice *parentNub = OSDynamicCast(IOACPIPlatformDevice, parent);
+            UInt32 *slot = parentNub ? PDACPIPowerDeviceSlot(graph, parentNub->getDeviceHandle()) : NULL;
+            if (slot && *slot != kPDACPINoPowerDevice) {
+                device->Parent = *slot;
+                device->Depth = graph->Devices[*slot].Depth + 1;
+                break;
+            }
+        }
+        if (device->Depth > graph->MaxDepth) {
+            graph->MaxDepth = device->Depth;
+        }
+        
+        for (UInt32 s = 0; s < kPDACPIPowerLists; s++) {
+            ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+            if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(handle, (char *)stateLists[s], NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+                device->States[s] = PDACPIAppendPowerList(graph, lists, (ACPI_OBJECT *)buffer.Pointer, 0);
+                ACPI_FREE(buffer.Pointer);
+            }
+        }
+        
+        /* _PRW: { GPE number or { GPE block device, index }, deepest wakeable Sx, wake resources... } */
+        ACPI_BUFFER buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+        if (canWake && ACPI_SUCCESS(AcpiEvaluateObjectTyped(handle, (char *)"_PRW", NULL, &buffer, ACPI_TYPE_PACKAGE))) {
+            ACPI_OBJECT *prw = (ACPI_OBJECT *)buffer.Pointer;
+            if (prw->Package.Count >= 2) {
+                ACPI_OBJECT *gpe = &prw->Package.Elements[0];
+                if (gpe->Type == ACPI_TYPE_INTEGER) {
+                    device->WakeGpe = (UInt32)gpe->Integer.Value;
+                    device->CanWake = true;
+                } else if (gpe->Type == ACPI_TYPE_PACKAGE && gpe->Package.Count == 2 &&
+                           gpe->Package.Elements[0].Type == ACPI_TYPE_LOCAL_REFERENCE &&
+                           gpe->Package.Elements[1].Type == ACPI_TYPE_INTEGER) {
+                    device->WakeGpeDevice = gpe->Package.Elements[0].Reference.Handle;
+                    device->WakeGpe = (UInt32)gpe->Package.Elements[1].Integer.Value;
+                    device->CanWake = true;
+                }
+                device->Wake = PDACPIAppendPowerList(graph, lists, prw, 2);
+            }
+            ACPI_FREE(buffer.Pointer);
+        }
+        
+        /* Marks the GPE as a wake GPE (and installs implicit notify) once; enables only toggle its wake mask. */
+        if (device->CanWake) {
+            AcpiSetupGpeForWake(handle, device->WakeGpeDevice, device->WakeGpe);
+        }
+        
+        *PDACPIPowerDeviceSlot(graph, handle) = index;
+        graph->DeviceCount++;
+    }
+    
+    if (lists->getLength()) {
+        graph->Lists = (UInt16 *)IOMalloc(lists->getLength());
+        if (!graph->Lists) {
+            goto fail;
+        }
+        graph->ListCount = lists->getLength() / sizeof(UInt16);
+        memcpy(graph->Lists, lists->getBytesNoCopy(), lists->getLength());
+    }
+    
+    /*
+     * Work out where each device starts from. A device whose D0 resources are all on is
+     * taken to be in D0, and holds references on them, so a sibling sharing them going to
+     * D3 won't pull the power out from under it.
+     */
+    this->m_powerGraph = graph;
+    for (UInt32 i = 0; i < graph->DeviceCount; i++) {
+        PDACPIPowerDevice *device = &graph->Devices[i];
+        ACPI_OBJECT object;
+        ACPI_BUFFER buffer = { sizeof(object), &object };
+        
+        if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(device->Handle, (char *)"_PSC", NULL, &buffer, ACPI_TYPE_INTEGER)) &&
+            object.Integer.Value < kPDACPIPowerLists) {
+            device->State = (UInt8)object.Integer.Value;
+        } else if (device->States[0].Count) {
+            bool on = true;
+            for (UInt32 r = 0; r < device->States[0].Count; r++) {
+                on = on && graph->Resources[graph->Lists[device->States[0].Start + r]].On;
+            }
+            device->State = on ? 0 : kPDACPIDeviceStateUnknown;
+        }
+        
+        if (device->State < kPDACPIPowerLists) {
+            const PDACPIPowerList *list = &device->States[device->State];
+            for (UInt32 r = 0; r < list->Count; r++) {
+                graph->Resources[graph->Lists[list->Start + r]].References++;
+            }
+        }
+    }
+    
+    resources->release();
+    lists->release();
+    
+    IOLog("ACPI: %u power-managed devices, %u power resources, %u levels\n",
+          graph->DeviceCount, graph->ResourceCount, graph->MaxDepth + 1);
+    return true;
+    
+fail:
+    OSSafeReleaseNULL(resources);
+    OSSafeReleaseNULL(lists);
+    PDACPIFreePowerGraph(graph);
+    return false;
+}
+
+PDACPIPowerDevice *PDACPIPlatformExpert::findPowerDevice(IOACPIPlatformDevice *device)
+{
+    PDACPIPowerGraph *graph = this->m_powerGraph;
+    
+    if (!graph || !device) {
+        return nullptr;
+    }
+    
+    UInt32 index = *PDACPIPowerDeviceSlot(graph, device->getDeviceHandle());
+    return index == kPDACPINoPowerDevice ? nullptr : &graph->Devices[index];
+}
+
+static void PDACPIReferencePowerList(PDACPIPowerGraph *graph, const PDACPIPowerList *list)
+{
+    for (UInt32 i = 0; i < list->Count; i++) {
+        PDACPIPowerResource *resource = &graph->Resources[graph->Lists[list->Start + i]];
+        
+        IOLockLock(resource->Lock);
+        if (resource->References++ == 0 && !resource->On &&
+            ACPI_SUCCESS(AcpiEvaluateObject(resource->Handle, (char *)"_ON", NULL, NULL))) {
+            resource->On = true;
+            resource->Switches++;
+        }
+        IOLockUnlock(resource->Lock);
+    }
+}
+
+static void PDACPIReleasePowerList(PDACPIPowerGraph *graph, const PDACPIPowerList *list)
+{
+    for (UInt32 i = list->Count; i > 0; i--) {
+        PDACPIPowerResource *resource = &graph->Resources[graph->Lists[list->Start + i - 1]];
+        
+        IOLockLock(resource->Lock);
+        if (resource->References && --resource->References == 0 && resource->On &&
+            ACPI_SUCCESS(AcpiEvaluateObject(resource->Handle, (char *)"_OFF", NULL, NULL))) {
+            resource->On = false;
+            resource->Switches++;
+        }
+        IOLockUnlock(resource->Lock);
+    }
+}
+
+/*
+ * Move one device to D<state>. Coming up, the new state's resources go on before _PSx;
+ * going down, _PSx runs first. Either way the old state's resources are released last,
+ * so the ones both states share never see a reference count of zero.
+ */
+IOReturn PDACPIPlatformExpert::transitionDevice(PDACPIPowerDevice *device, UInt32 state)
+{
+    static const char *stateMethods[kPDACPIPowerLists] = { "_PS0", "_PS1", "_PS2", "_PS3" };
+    PDACPIPowerGraph *graph = this->m_powerGraph;
+    IOReturn ret = kIOReturnSuccess;
+    
+    if (state >= kPDACPIPowerLists) {
+        return kIOReturnBadArgument;
+    }
+    
+    IOLockLock(device->Lock);
+    UInt8 from = device->State;
+    if (from == state) {
+        IOLockUnlock(device->Lock);
+        return kIOReturnSuccess;
+    }
+    
+    UInt64 start = mach_absolute_time();
+    bool up = from == kPDACPIDeviceStateUnknown || state < from;
+    
+    if (up) {
+        PDACPIReferencePowerList(graph, &device->States[state]);
+    }
+    
+    ACPI_STATUS status = AcpiEvaluateObject(device->Handle, (char *)stateMethods[state], NULL, NULL);
+    if (ACPI_FAILURE(status) && status != AE_NOT_FOUND) {
+        if (up) {
+            PDACPIReleasePowerList(graph, &device->States[state]);
+        }
+        ret = kIOReturnError;
+    } else {
+        if (!up) {
+            PDACPIReferencePowerList(graph, &device->States[state]);
+        }
+        if (from < kPDACPIPowerLists) {
+            PDACPIReleasePowerList(graph, &device->States[from]);
+        }
+        device->State = (UInt8)state;
+    }
+    
+    UInt64 latency;
+    absolutetime_to_nanoseconds(mach_absolute_time() - start, &latency);
+    device->Transitions++;
+    device->LastLatency = latency;
+    if (latency > device->MaxLatency) {
+        device->MaxLatency = latency;
+    }
+    
+    OSDictionary *dict = OSDictionary::withCapacity(4);
+    if (dict) {
+        PDACPISetNumber(dict, "Transitions", device->Transitions);
+        PDACPISetNumber(dict, "Last Latency", device->LastLatency);
+        PDACPISetNumber(dict, "Max Latency", device->MaxLatency);
+        PDACPISetNumber(dict, "State", device->State);
+        device->Nub->setProperty("ACPI Power Transitions", dict);
+        dict->release();
+    }
+    IOLockUnlock(device->Lock);
+    
+    if (latency > kPDACPISlowTransitionNS) {
+        ACPI_BUFFER path = { ACPI_ALLOCATE_BUFFER, NULL };
+        if (ACPI_SUCCESS(AcpiGetName(device->Handle, ACPI_FULL_PATHNAME, &path))) {
+            IOLog("ACPI: %s D%u -> D%u took %llu ms\n", (char *)path.Pointer, from, state, latency / 1000000);
+            ACPI_FREE(path.Pointer);
+        }
+    }
+    
+    return ret;
+}
+
+void PDACPIPlatformExpert::powerTransitionCall(void *param0, void *param1)
+{
+    PDACPIPlatformExpert *pe = (PDACPIPlatformExpert *)param0;
+    PDACPIPowerDevice *device = (PDACPIPowerDevice *)param1;
+    PDACPIPowerGraph *graph = pe->m_powerGraph;
+    
+    pe->transitionDevice(device, device->Target);
+    
+    IOLockLock(graph->TreeLock);
+    if (--graph->Pending == 0) {
+        IOLockWakeup(graph->TreeLock, &graph->Pending, false);
+    }
+    IOLockUnlock(graph->TreeLock);
+}
+
+/* Move every power-managed device to D<state>, a tree level at a time and each level in parallel. */
+IOReturn PDACPIPlatformExpert::setDeviceTreePowerState(UInt32 state)
+{
+    PDACPIPowerGraph *graph = this->m_powerGraph;
+    
+    if (!graph) {
+        return kIOReturnNotReady;
+    }
+    if (state >= kPDACPIPowerLists) {
+        return kIOReturnBadArgument;
+    }
+    
+    IOLockLock(graph->TreeLock);
+    for (UInt32 step = 0; step <= graph->MaxDepth; step++) {
+        UInt32 depth = state == 0 ? step : graph->MaxDepth - step;
+        
+        for (UInt32 i = 0; i < graph->DeviceCount; i++) {
+            PDACPIPowerDevice *device = &graph->Devices[i];
+            if (device->Depth != depth) {
+                continue;
+            }
+            
+            /* setDevicePowerState and setDeviceWakeEnable change these under the device's lock. */
+            IOLockLock(device->Lock);
+            UInt8 target = (UInt8)state;
+            if (device->WakeEnabled && device->WakeDeviceState < target) {
+                /* Armed devices stop at the deepest state _DSW was told they can wake from. */
+                target = device->WakeDeviceState;
+            }
+            bool skip = device->State == target;
+            device->Target = target;
+            IOLockUnlock(device->Lock);
+            if (skip) {
+                continue;
+            }
+            
+            graph->Pending++;
+            thread_call_enter1(device->Call, device);
+        }
+        
+        while (graph->Pending) {
+            IOLockSleep(graph->TreeLock, &graph->Pending, THREAD_UNINT);
+        }
+    }
+    IOLockUnlock(graph->TreeLock);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn PDACPIPlatformExpert::setDevicePowerState(IOACPIPlatformDevice *device, UInt32 powerState)
+{
+    PDACPIPowerDevice *record = this->findPowerDevice(device);
+    if (!record) {
+        return kIOReturnUnsupported;
+    }
+    
+    return this->transitionDevice(record, powerState);
+}
+
+IOReturn PDACPIPlatformExpert::getDevicePowerState(IOACPIPlatformDevice *device, UInt32 *powerState)
+{
+    PDACPIPowerDevice *record = this->findPowerDevice(device);
+    ACPI_OBJECT object;
+    ACPI_BUFFER buffer = { sizeof(object), &object };
+    
+    if (!record || !powerState) {
+        return kIOReturnUnsupported;
+    }
+    
+    /* The firmware knows best if it's prepared to say. */
+    if (ACPI_SUCCESS(AcpiEvaluateObjectTyped(record->Handle, (char *)"_PSC", NULL, &buffer, ACPI_TYPE_INTEGER))) {
+        *powerState = (UInt32)object.Integer.Value;
+        return kIOReturnSuccess;
+    }
+    
+    if (record->State == kPDACPIDeviceStateUnknown) {
+        return kIOReturnNotReady;
+    }
+    
+    *powerState = record->State;
+    return kIOReturnSuccess;
+}
+
+/*
+ * _DSW(enable, target Sx, target Dx), or _PSW(enable) on older firmware. The Dx is the deepest
+ * state the device can still wake the system from in Sx (_SxW), and it's where
+ * setDeviceTreePowerState will leave the device. Caller holds the device's lock.
+ */
+static void PDACPIArmWake(PDACPIPowerDevice *device, bool enable, UInt8 sleepState)
+{
+    UInt64 deviceState = ACPI_STATE_D3;
+    
+    if (sleepState <= ACPI_STATE_S4 &&
+        (ACPI_FAILURE(AcpiUtEvaluateNumericObject(AcpiGbl_LowestDstateNames[sleepState], (ACPI_NAMESPACE_NODE *)device->Handle, &deviceState)) ||
+         deviceState > ACPI_STATE_D3)) {
+        deviceState = ACPI_STATE_D3;
+    }
+    
+    ACPI_OBJECT args[3];
+    ACPI_OBJECT_LIST argList = { 3, args };
+    args[0].Type = ACPI_TYPE_INTEGER;
+    args[0].Integer.Value = enable;
+    args[1].Type = ACPI_TYPE_INTEGER;
+    args[1].Integer.Value = sleepState;
+    args[2].Type = ACPI_TYPE_INTEGER;
+    args[2].Integer.Value = deviceState;
+    if (AcpiEvaluateObject(device->Handle, (char *)"_DSW", &argList, NULL) == AE_NOT_FOUND) {
+        argList.Count = 1;
+        AcpiEvaluateObject(device->Handle, (char *)"_PSW", &argList, NULL);
+    }
+    
+    device->WakeSleepState = sleepState;
+    device->WakeDeviceState = (UInt8)deviceState;
+}
+
+IOReturn PDACPIPlatformExpert::setDeviceWakeEnable(IOACPIPlatformDevice *device, bool enable)
+{
+    PDACPIPowerDevice *record = this->findPowerDevice(device);
+    
+    if (!record || !record->CanWake) {
+        return kIOReturnUnsupported;
+    }
+    
+    IOLockLock(record->Lock);
+    if (record->WakeEnabled == enable) {
+        IOLockUnlock(record->Lock);
+        return kIOReturnSuccess;
+    }
+    
+    if (enable) {
+        PDACPIReferencePowerList(this->m_powerGraph, &record->Wake);
+    }
+    
+    PDACPIArmWake(record, enable, __atomic_load_n(&this->m_powerGraph->SleepState, __ATOMIC_RELAXED));
+    
+    if (enable) {
+        AcpiSetGpeWakeMask(record->WakeGpeDevice, record->WakeGpe, ACPI_GPE_ENABLE);
+    } else {
+        AcpiSetGpeWakeMask(record->WakeGpeDevice, record->WakeGpe, ACPI_GPE_DISABLE);
+        PDACPIReleasePowerList(this->m_powerGraph, &record->Wake);
+    }
+    
+    record->WakeEnabled = enable;
+    IOLockUnlock(record->Lock);
+    return kIOReturnSuccess;
+}
+
+OSDictionary *PDACPIPlatformExpert::copyPowerStatistics() const
+{
+    PDACPIPowerGraph *graph = this->m_powerGraph;
+    UInt64 on = 0, switches = 0, transitions = 0;
+    
+    if (!graph) {
+        return nullptr;
+    }
+    
+    OSDictionary *dict = OSDictionary::withCapacity(6);
+    if (!dict) {
+        return nullptr;
+    }
+    
+    for (UInt32 i = 0; i < graph->ResourceCount; i++) {
+        on += graph->Resources[i].On;
+        switches += graph->Resources[i].Switches;
+    }
+    for (UInt32 i = 0; i < graph->DeviceCount; i++) {
+        transitions += graph->Devices[i].Transitions;
+    }
+    
+    PDACPISetNumber(dict, "Devices", graph->DeviceCount);
+    PDACPISetNumber(dict, "Levels", graph->MaxDepth + 1);
+    PDACPISetNumber(dict, "Power Resources", graph->ResourceCount);
+    PDACPISetNumber(dict, "Power Resources On", on);
+    PDACPISetNumber(dict, "Power Resource Switches", switches);
+    PDACPISetNumber(dict, "Device Transitions", transitions);
+    return dict;
+}
+
+/* this is so IOPCIFamily gets our ACPI tables. */
+OSObject *PDACPIPlatformExpert::copyProperty(const char *property) const
+{
+    if (strcmp(property, kPDACPITablesKey) == 0) {
+        /* Rebuilding on demand updates our state, but nothing the caller can see. */
+        return const_cast<PDACPIPlatformExpert *>(this)->copyACPITables();
+    }
+    
+    if (strcmp(property, kPDACPIStatisticsKey) == 0) {
+        return this->copyStatistics();
+    }
+    
+    /* Not published; built when asked for by name, e.g. through IORegistryEntryCreateCFProperty. */
+    if (strcmp(property, kPDACPILogKey) == 0) {
+        return AcpiOsExtCopyLog();
+    }
+    
+    return super::copyProperty(property);
+}
+
+/* Counters from the OS layer and from us; these are built fresh every time they're asked for. */
+OSDictionary *PDACPIPlatformExpert::copyStatistics() const
+{
+    OSDictionary *stats = AcpiOsExtCopyStatistics();
+    if (!stats) {
+        return nullptr;
+    }
+    
+    OSNumber *generation = OSNumber::withNumber(this->m_tableCatalogGeneration, 32);
+    if (generation) {
+        stats->setObject("Table Generation", generation);
+        generation->release();
+    }
+    
+    OSDictionary *sleepStates = this->copySleepStates();
+    if (sleepStates) {
+        stats->setObject("Sleep States", sleepStates);
+        sleepStates->release();
+    }
+    
+    OSDictionary *sleepTiming = this->copySleepTiming();
+    if (sleepTiming) {
+        stats->setObject("Last Sleep", sleepTiming);
+        sleepTiming->release();
+    }
+    
+    OSDictionary *power = this->copyPowerStatistics();
+    if (power) {
+        stats->setObject("Device Power", power);
+        power->release();
+    }
+    
+    OSDictionary *spaces = this->copyAddressSpaceStatistics();
+    if (spaces) {
+        stats->setObject("Address Spaces", spaces);
+        spaces->release();
+    }
+    
+    /* Each domain serializes its own counters. */
+    if (this->m_cpuDomains && this->m_cpuDomains->getCount()) {
+        stats->setObject("CPU Domains", this->m_cpuDomains);
+    }
+    
+    return stats;
+}
+
+bool PDACPIPlatformExpert::serializeProperties(OSSerialize *s) const
+{
+    /* Refresh the counters so that ioreg always sees live values. */
+    OSDictionary *stats = this->copyStatistics();
+    if (stats) {
+        const_cast<PDACPIPlatformExpert *>(this)->setProperty(kPDACPIStatisticsKey, stats);
+        stats->release();
+    }
+    
+    return super::serializeProperties(s);
+}
+
+bool PDACPIPlatformExpert::fetchPCIData()
+{
+    const OSData *table = this->getACPITableData("MCFG", 0);
+    
+    if (!table) {
+        IOLog("ACPI: No MCFG table found in the ACPI table collection.\n");
+        return false;
+    }
+    
+    ACPI_TABLE_MCFG *mcfg = (ACPI_TABLE_MCFG *)table->getBytesNoCopy();
+
+    gPCIMCFGEntryCount = (mcfg->Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION);
+    gPCIDataFromMCFG = (ACPI_MCFG_ALLOCATION *)((UInt8 *)table->getBytesNoCopy() + sizeof(ACPI_TABLE_MCFG));
+    
+    /* Hand every segment to the ECAM routing table, not just the one the booter told us about. */
+    AcpiOsExtRegisterPciEcamTable(mcfg);
+    
+    /* While we're here; kindly tell IOPCIFamily to initialize MMIO mapping services. */
+    IOPCIPlatformInitialize();
+    
+    return true;
+}
+
+/*
+ * ACPI table index.
+ *
+ * Built in one pass over AcpiGbl_RootTableList: an open-addressed hash keyed by the
+ * 4-byte signature, where each slot holds the instances of that signature in table list
+ * order. Tables that were there at boot are zero-copy OSData views of ACPICA's mappings,
+ * which stay put for good. Tables installed later (Load, LoadTable, AcpiInstallTable) can
+ * be unloaded and their memory released, so those are copied, and only while loaded.
+ * getACPITableData is a hash probe plus an array index.
+ *
+ * The "ACPI Tables" dictionary is generated alongside the index ("SSDT", "SSDT-1", ...)
+ * and handed out as a shared snapshot that is never modified once published. ACPICA tells
+ * us when tables come and go and we only bump a generation count; the index and snapshot
+ * are rebuilt the next time someone looks.
+ *
+ * getACPITableData doesn't lock and its callers don't retain the OSData they get back, so
+ * a rebuild hands the OSData of every table that is still there over to the new index,
+ * and an old index is freed only once no lookup is running. The data of a table that was
+ * unloaded goes away with it.
+ */
+struct PDACPITableIndexEntry {
+    UInt32 Signature;   /* 0 marks an empty slot; no table has an all-zero signature */
+    OSArray *Instances;
+};
+
+struct PDACPITableIndex {
+    PDACPITableIndex *Retired;  /* older indexes a lookup may still be probing */
+    UInt32 Shift;
+    PDACPITableIndexEntry Entries[];
+};
+
+#define PDACPITableIndexBytes(shift) (sizeof(PDACPITableIndex) + (sizeof(PDACPITableIndexEntry) << (shift)))
+
+static void PDACPITableIndexFree(PDACPITableIndex *index)
+{
+    while (index) {
+        PDACPITableIndex *retired = index->Retired;
+        
+        for (UInt32 i = 0; i < (1U << index->Shift); i++) {
+            OSSafeReleaseNULL(index->Entries[i].Instances);
+        }
+        IOFree(index, PDACPITableIndexBytes(index->Shift));
+        index = retired;
+    }
+}
+
+static inline UInt32 PDACPITableSignature(const char *name)
+{
+    UInt32 sig;
+    memcpy(&sig, name, sizeof(sig));
+    return sig;
+}
+
+static PDACPITableIndexEntry *PDACPITableIndexFind(PDACPITableIndex *index, UInt32 signature)
+{
+    UInt32 mask = (1U << index->Shift) - 1;
+    UInt32 slot = (signature * 0x9E3779B1U) >> (32 - index->Shift);
+    
+    for (;; slot = (slot + 1) & mask) {
+        PDACPITableIndexEntry *entry = &index->Entries[slot];
+        if (entry->Signature == signature || entry->Signature == 0) {
+            return entry;
+        }
+    }
+}
+
+/* The OSData an older index already has for this table, if any. */
+static OSData *PDACPITableIndexReuse(PDACPITableIndex *index, const ACPI_TABLE_HEADER *table, bool copied)
+{
+    if (!index) {
+        return nullptr;
+    }
+    
+    PDACPITableIndexEntry *entry = PDACPITableIndexFind(index, PDACPITableSignature(table->Signature));
+    for (UInt32 i = 0; entry->Instances && i < entry->Instances->getCount(); i++) {
+        OSData *data = (OSData *)entry->Instances->getObject(i);
+        if (data->getLength() != table->Length) {
+            continue;
+        }
+        
+        if (copied ? !memcmp(data->getBytesNoCopy(), table, table->Length) : data->getBytesNoCopy() == table) {
+            return data;
+        }
+    }
+    
+    return nullptr;
+}
+
+/* Table load/unload notifications; may come with ACPICA's table mutex held, so just note it. */
+ACPI_STATUS PDACPIPlatformExpert::tableEventHandler(UInt32 Event, void *Table, void *Context)
+{
+    PDACPIPlatformExpert *pe = (PDACPIPlatformExpert *)Context;
+    
+    OSIncrementAtomic(&pe->m_tableGeneration);
+    return AE_OK;
+}
+
+/* Rebuild the index and snapshot if the table list changed since they were built. */
+void PDACPIPlatformExpert::refreshACPITables()
+{
+    SInt32 generation = __atomic_load_n(&this->m_tableGeneration, __ATOMIC_ACQUIRE);
+    
+    if (generation == this->m_tableCatalogGeneration || !this->m_tableLock) {
+        return;
+    }
+    
+    IOLockLock(this->m_tableLock);
+    generation = this->m_tableGeneration;
+    if (generation != this->m_tableCatalogGeneration && this->catalogACPITables()) {
+        this->m_tableCatalogGeneration = generation;
+    }
+    IOLockUnlock(this->m_tableLock);
+}
+
+/* The current "ACPI Tables" snapshot, retained. Treat it as read-only; it's shared. */
+OSDictionary *PDACPIPlatformExpert::copyACPITables()
+{
+    this->refreshACPITables();
+    
+    if (!this->m_tableLock) {
+        return nullptr;
+    }
+    
+    IOLockLock(this->m_tableLock);
+    OSDictionary *dict = this->m_tableDict;
+    if (dict) {
+        dict->retain();
+    }
+    IOLockUnlock(this->m_tableLock);
+    
+    return dict;
+}
+
+/* Caller holds m_tableLock, or is start() before anybody else can see us. */
+bool PDACPIPlatformExpert::catalogACPITables()
+{
+    UInt32 tables = AcpiGbl_RootTableList.CurrentTableCount;
+    
+    /* At most half full, so a probe never runs far and always finds an empty slot. */
+    UInt32 shift = 4;
+    while ((1U << shift) < tables * 2) {
+        shift++;
+    }
+    
+    PDACPITableIndex *index = (PDACPITableIndex *)IOMallocZero(PDACPITableIndexBytes(shift));
+    OSDictionary *dict = OSDictionary::withCapacity(tables + 1);
+    if (!index || !dict) {
+        if (index) {
+            IOFree(index, PDACPITableIndexBytes(shift));
+        }
+        OSSafeReleaseNULL(dict);
+        return false;
+    }
+    index->Shift = shift;
+    
+    /* Everything in the list the first time round came from the firmware. */
+    PDACPITableIndex *current = this->m_tableIndex;
+    if (!current) {
+        this->m_tableStaticCount = tables;
+    }
+    
+    for (UInt32 i = 0; i < tables; i++) {
+        bool copied = i >= this->m_tableStaticCount;
+        if (copied && !(AcpiGbl_RootTableList.Tables[i].Flags & ACPI_TABLE_IS_LOADED)) {
+            continue;
+        }
+        
+        ACPI_TABLE_HEADER *table;
+        if (ACPI_FAILURE(AcpiGetTableByIndex(i, &table)) || !table) {
+            continue;
+        }
+        
+        UInt32 signature = PDACPITableSignature(table->Signature);
+        PDACPITableIndexEntry *entry = signature ? PDACPITableIndexFind(index, signature) : nullptr;
+        if (entry && !entry->Instances) {
+            entry->Instances = OSArray::withCapacity(1);
+            if (entry->Instances) {
+                entry->Signature = signature;
+            }
+        }
+        if (!entry || !entry->Instances) {
+            AcpiPutTable(table);
+            continue;
+        }
+        
+        /*
+         * A boot table keeps the mapping from its first AcpiGetTableByIndex for as long
+         * as it is installed; a copy or a reused view doesn't need this reference.
+         */
+        OSData *data = PDACPITableIndexReuse(current, table, copied);
+        bool reused = data != nullptr;
+        if (reused) {
+            data->retain();
+        } else if (copied) {
+            data = OSData::withBytes(table, table->Length);
+        } else {
+            data = OSData::withBytesNoCopy(table, table->Length);
+        }
+        if (copied || reused) {
+            AcpiPutTable(table);
+        }
+        if (!data) {
+            continue;
+        }
+        
+        UInt32 instance = entry->Instances->getCount();
+        entry->Instances->setObject(data);
+        
+        char name[16];
+        if (instance > 0) {
+            snprintf(name, sizeof(name), "%4.4s-%u", (const char *)&signature, instance);
+        } else {
+            snprintf(name, sizeof(name), "%4.4s", (const char *)&signature);
+        }
+        dict->setObject(name, data);
+        data->release();
+    }
+    
+    /*
+     * Swap in the new index. A lookup that started before the swap may still be probing
+     * an old one; the old ones go once nobody is (see getACPITableData).
+     */
+    OSDictionary *oldDict = this->m_tableDict;
+    index->Retired = current;
+    __atomic_store_n(&this->m_tableIndex, index, __ATOMIC_SEQ_CST);
+    this->m_tableDict = dict;
+    
+    if (__atomic_load_n(&this->m_tableReaders, __ATOMIC_SEQ_CST) == 0) {
+        PDACPITableIndexFree(index->Retired);
+        index->Retired = nullptr;
+    }
+    
+    OSSafeReleaseNULL(oldDict);
+    return true;
+}
+
+const OSData *PDACPIPlatformExpert::getACPITableData(const char *name, UInt32 TableIndex)
+{
+    if (!name || strnlen(name, 4) < 4) {
+        return nullptr;
+    }
+    
+    this->refreshACPITables();
+    
+    /* Counted in before the index is loaded, so a rebuild that can't see us has already swapped it. */
+    __atomic_fetch_add(&this->m_tableReaders, 1, __ATOMIC_SEQ_CST);
+    
+    const OSData *data = nullptr;
+    PDACPITableIndex *index = __atomic_load_n(&this->m_tableIndex, __ATOMIC_SEQ_CST);
+    if (index) {
+        PDACPITableIndexEntry *entry = PDACPITableIndexFind(index, PDACPITableSignature(name));
+        if (entry->Instances) {
+            data = OSDynamicCast(OSData, entry->Instances->getObject(TableIndex));
+        }
+    }
+    
+    __atomic_fetch_sub(&this->m_tableReaders, 1, __ATOMIC_RELEASE);
+    return data;
+}
+
+bool PDACPIPlatformExpert::start(IOService *provider)
+{
+    IOLog("PDACPIPlatformExpert::start - Initializing ACPICA\n"); // Modified log
+
+    if (!super::start(provider)) {
+        IOLog("PDACPIPlatformExpert::start - super::start failed\n");
+        return false;
+    }
+    
+    this->m_provider = OSDynamicCast(IOPlatformExpertDevice, provider);
+    this->installAddressSpaces();
+    
+    /* Respond to certain boot arguemnts */
+    PE_parse_boot_argn("acpi_layer", &AcpiDbgLayer, 4);
+    PE_parse_boot_argn("acpi_level", &AcpiDbgLevel, 4);
+
+    if (!this->initializeACPICA()) {
+        panic("ACPI: ACPICA layer failed to initialize.\n");
+    }
+
+    IOLog("PDACPIPlatformExpert::start - [SUCCESS] ACPICA Initialized successfully.\n");
+
+    // The service should be registered after successful initialization.
+    registerService();
+    IOLog("PDACPIPlatformExpert::start - Service registered.\n");
+
+    return true;
+}
+
+void PDACPIPlatformExpert::stop(IOService *provider)
+{
+    IOLog("PDACPIPlatformExpert::stop\n");
+    super::stop(provider);
+}
+
+#pragma mark - System sleep
+
+/*
+ * S-state transitions go through hwxfsleep.c. The SLP_TYP values were read once at boot
+ * (AcpiOsLoadSleepTypes), so nothing here evaluates _Sx. A transition is split the way
+ * ACPICA splits it, so whoever owns the CPU context and the waking vector can sit in between:
+ *
+ *   prepareSleepState    devices to D3, _PTS, _SST       interrupts on
+ *   enterSleepState      wake GPEs, SLP_TYP, SLP_EN      interrupts off; S1 returns on wake
+ *   wakeFromSleepState   SLP_TYP S0, _WAK, devices to D0
+ *
+ * Every phase is timestamped by osdarwin.c. The record survives the sleep, and
+ * wakeFromSleepState publishes it as "ACPI Sleep Timing".
+ */
+static const char *gPDACPISleepPhaseNames[ACPI_DARWIN_SLEEP_PHASES] = {
+    "Devices Off", "_PTS", "Wake GPEs", "Sleep Registers", "Wake Prep", "_WAK", "Devices On",
+};
+
+bool PDACPIPlatformExpert::isSleepStateSupported(UInt8 state)
+{
+    UInt8 typeA, typeB;
+    return ACPI_SUCCESS(AcpiOsGetSleepTypeData(state, &typeA, &typeB));
+}
+
+IOReturn PDACPIPlatformExpert::prepareSleepState(UInt8 state)
+{
+    if (state == ACPI_STATE_S0 || !this->isSleepStateSupported(state)) {
+        return kIOReturnUnsupported;
+    }
+    
+    AcpiOsResetSleepTiming(state);
+    
+    /* Wake was armed for whatever we last slept into; tell armed devices where we're really going. */
+    PDACPIPowerGraph *graph = this->m_powerGraph;
+    if (graph) {
+        __atomic_store_n(&graph->SleepState, state, __ATOMIC_RELAXED);
+        for (UInt32 i = 0; i < graph->DeviceCount; i++) {
+            PDACPIPowerDevice *device = &graph->Devices[i];
+            IOLockLock(device->Lock);
+            if (device->WakeEnabled && device->WakeSleepState != state) {
+                PDACPIArmWake(device, true, state);
+            }
+            IOLockUnlock(device->Lock);
+        }
+    }
+    
+    /* Nothing comes back from S5, so don't spend time putting devices to sleep for it. */
+    if (state < ACPI_STATE_S5) {
+        UInt64 start = AcpiOsGetTimer();
+        this->setDeviceTreePowerState(ACPI_STATE_D3);
+        AcpiOsRecordSleepPhase(ACPI_DARWIN_SLEEP_DEVICES_OFF, start, AcpiOsGetTimer() - start);
+    }
+    
+    ACPI_STATUS status = AcpiEnterSleepStatePrep(state);
+    if (ACPI_FAILURE(status)) {
+        IOLog("ACPI: S%u preparation failed: %s\n", state, AcpiFormatException(status));
+        if (state < ACPI_STATE_S5) {
+            this->setDeviceTreePowerState(ACPI_STATE_D0);
+        }
+        return kIOReturnError;
+    }
+    
+    this->m_preparedSleepState = state;
+    return kIOReturnSuccess;
+}
+
+IOReturn PDACPIPlatformExpert::enterSleepState(UInt8 state)
+{
+    boolean_t enabled = ml_set_interrupts_enabled(FALSE);
+    ACPI_STATUS status = AcpiEnterSleepState(state);
+    ml_set_interrupts_enabled(enabled);
+    
+    if (ACPI_FAILURE(status)) {
+        IOLog("ACPI: S%u entry failed: %s\n", state, AcpiFormatException(status));
+        return kIOReturnError;
+    }
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn PDACPIPlatformExpert::wakeFromSleepState(UInt8 state)
+{
+    this->m_preparedSleepState = ACPI_STATE_S0;
+    
+    boolean_t enabled = ml_set_interrupts_enabled(FALSE);
+    AcpiLeaveSleepStatePrep(state);
+    ml_set_interrupts_enabled(enabled);
+    
+    ACPI_STATUS status = AcpiLeaveSleepState(state);
+    
+    UInt64 start = AcpiOsGetTimer();
+    this->setDeviceTreePowerState(ACPI_STATE_D0);
+    AcpiOsRecordSleepPhase(ACPI_DARWIN_SLEEP_DEVICES_ON, start, AcpiOsGetTimer() - start);
+    
+    OSDictionary *timing = this->copySleepTiming();
+    if (timing) {
+        this->setProperty(kPDACPISleepTimingKey, timing);
+        timing->release();
+    }
+    
+    return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnError;
+}
+
+OSDictionary *PDACPIPlatformExpert::copySleepTiming(void) const
+{
+    ACPI_DARWIN_SLEEP_TIMING timing;
+    
+    AcpiOsCopySleepTiming(&timing);
+    if (!timing.Completed) {
+        return nullptr;
+    }
+    
+    OSDictionary *dict = OSDictionary::withCapacity(ACPI_DARWIN_SLEEP_PHASES + 1);
+    if (!dict) {
+        return nullptr;
+    }
+    
+    PDACPISetNumber(dict, "Sleep State", timing.SleepState);
+    for (UInt32 i = 0; i < ACPI_DARWIN_SLEEP_PHASES; i++) {
+        if (!(timing.Completed & (1U << i))) {
+            continue;
+        }
+        
+        OSDictionary *phase = OSDictionary::withCapacity(2);
+        if (phase) {
+            PDACPISetNumber(phase, "Start", timing.Start[i]);
+            PDACPISetNumber(phase, "Elapsed", timing.Elapsed[i]);
+            dict->setObject(gPDACPISleepPhaseNames[i], phase);
+            phase->release();
+        }
+    }
+    
+    return dict;
+}
+
+OSDictionary *PDACPIPlatformExpert::copySleepStates(void) const
+{
+    OSDictionary *dict = OSDictionary::withCapacity(ACPI_S_STATE_COUNT);
+    if (!dict) {
+        return nullptr;
+    }
+    
+    for (UInt8 state = ACPI_STATE_S0; state < ACPI_S_STATE_COUNT; state++) {
+        char key[4] = { 'S', (char)('0' + state), 0 };
+        UInt8 typeA, typeB;
+        
+        if (ACPI_SUCCESS(AcpiOsGetSleepTypeData(state, &typeA, &typeB))) {
+            PDACPISetNumber(dict, key, (typeB << 8) | typeA);
+        }
+    }
+    
+    return dict;
+}
+
+void PDACPIPlatformExpert::performACPIPowerOff()
+{
+    if (this->prepareSleepState(ACPI_STATE_S5) != kIOReturnSuccess) {
+        return;
+    }
+    
+    /* hwsleep.c already retries S4/S5 once after ten seconds; if we're still here, give up quietly. */
+    this->enterSleepState(ACPI_STATE_S5);
+    while (1) asm volatile("hlt");
+}
+
+int PDACPIPlatformExpert::haltRestart(unsigned int type)
+{
+    /* Only returns if _PTS failed or S5 isn't described, in which case the default halt is all we have. */
+    if (type == kPEHaltCPU) {
+        this->performACPIPowerOff();
+    }
+    
+    return super::haltRestart(type);
+}
+
+#pragma mark - Address spaces
+
+/*
+ * readAddressSpace/writeAddressSpace dispatch through m_addressSpaces, indexed by space ID.
+ * SystemMemory, SystemIO and PCI configuration space are ours and are installed at start;
+ * EC and SMBus belong to their drivers, which register handlers for them.
+ *
+ * A registered handler and its context are published together as one binding. Every call
+ * counts itself in Users before looking at the binding and out after the handler returns,
+ * so once unregister has taken the binding away and seen Users drop to zero, no call can
+ * still be inside the driver's handler and the driver is free to go.
+ */
+static IOReturn PDACPISystemMemoryHandler(UInt32 operation, IOACPIAddress address, UInt64 *value, UInt32 bitWidth, UInt32 bitOffset, void *context)
+{
+    ACPI_STATUS status;
+    
+    if (operation == kIOACPIAddressSpaceOpRead) {
+        status = AcpiOsReadMemory(address.addr64, value, bitWidth);
+    } else {
+        status = AcpiOsWriteMemory(address.addr64, *value, bitWidth);
+    }
+    
+    return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnError;
+}
+
+static IOReturn PDACPISystemIOHandler(UInt32 operation, IOACPIAddress address, UInt64 *value, UInt32 bitWidth, UInt32 bitOffset, void *context)
+{
+    ACPI_STATUS status;
+    
+    if (bitWidth > 32) {
+        return kIOReturnBadArgument;
+    }
+    
+    if (operation == kIOACPIAddressSpaceOpRead) {
+        UInt32 port;
+        status = AcpiOsReadPort((ACPI_IO_ADDRESS)address.addr64, &port, bitWidth);
+        *value = port;
+    } else {
+        status = AcpiOsWritePort((ACPI_IO_ADDRESS)address.addr64, (UInt32)*value, bitWidth);
+    }
+    
+    return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnError;
+}
+
+/* Goes through the ECAM routing table, so any segment in the MCFG works. */
+static IOReturn PDACPIPCIConfigurationHandler(UInt32 operation, IOACPIAddress address, UInt64 *value, UInt32 bitWidth, UInt32 bitOffset, void *context)
+{
+    ACPI_PCI_ID pciId;
+    ACPI_STATUS status;
+    
+    pciId.Segment = address.pci.segment;
+    pciId.Bus = address.pci.bus;
+    pciId.Device = address.pci.device;
+    pciId.Function = address.pci.function;
+    
+    if (operation == kIOACPIAddressSpaceOpRead) {
+        status = AcpiOsReadPciConfiguration(&pciId, address.pci.offset, value, bitWidth);
+    } else {
+        status = AcpiOsWritePciConfiguration(&pciId, address.pci.offset, *value, bitWidth);
+    }
+    
+    return ACPI_SUCCESS(status) ? kIOReturnSuccess : kIOReturnError;
+}
+
+static const PDACPIAddressSpaceBinding *PDACPIAcquireAddressSpace(PDACPIAddressSpace *space)
+{
+    /* Counted in before the load, so unregister either sees us or we see its NULL. */
+    __atomic_add_fetch(&space->Users, 1, __ATOMIC_SEQ_CST);
+    const PDACPIAddressSpaceBinding *binding = __atomic_load_n(&space->Binding, __ATOMIC_SEQ_CST);
+    if (!binding) {
+        __atomic_sub_fetch(&space->Users, 1, __ATOMIC_RELEASE);
+    }
+    return binding;
+}
+
+static inline void PDACPIReleaseAddressSpace(PDACPIAddressSpace *space)
+{
+    __atomic_sub_fetch(&space->Users, 1, __ATOMIC_RELEASE);
+}
+
+static inline void PDACPICountAccess(PDACPIAddressSpace *space, IOReturn result, UInt32 bytes, bool block)
+{
+    OSIncrementAtomic64((volatile SInt64 *)&space->Transactions);
+    if (result != kIOReturnSuccess) {
+        OSIncrementAtomic64((volatile SInt64 *)&space->Errors);
+        return;
+    }
+    
+    if (block) {
+        OSIncrementAtomic64((volatile SInt64 *)&space->BlockTransactions);
+    }
+    OSAddAtomic64(bytes, (volatile SInt64 *)&space->Bytes);
+}
+
+static ACPI_STATUS PDACPIStatusFromIOReturn(IOReturn ret)
+{
+    switch (ret) {
+        case kIOReturnSuccess:
+            return AE_OK;
+        case kIOReturnTimeout:
+            return AE_TIME;
+        case kIOReturnBadArgument:
+            return AE_BAD_PARAMETER;
+        default:
+            return AE_ERROR;
+    }
+}
+
+/*
+ * AML's way into a space that a driver registered for. The IOACPI space IDs are the ACPI
+ * ones, so ACPICA's Address is already what the driver's handler expects.
+ */
+static ACPI_STATUS PDACPIRegionHandler(UInt32 Function, ACPI_PHYSICAL_ADDRESS Address, UInt32 BitWidth, UInt64 *Value, void *HandlerContext, void *RegionContext)
+{
+    PDACPIAddressSpace *space = (PDACPIAddressSpace *)HandlerContext;
+    const PDACPIAddressSpaceBinding *binding = PDACPIAcquireAddressSpace(space);
+    IOACPIAddress address;
+    
+    if (!binding) {
+        return AE_NOT_EXIST;
+    }
+    
+    address.addr64 = Address;
+    UInt32 operation = (Function & ACPI_IO_MASK) == ACPI_READ ? kIOACPIAddressSpaceOpRead : kIOACPIAddressSpaceOpWrite;
+    
+    IOReturn ret = binding->Handler(operation, address, Value, BitWidth, 0, binding->Context);
+    PDACPIReleaseAddressSpace(space);
+    PDACPICountAccess(space, ret, BitWidth / 8, BitWidth > 8);
+    return PDACPIStatusFromIOReturn(ret);
+}
+
+/* Payload of an SMBus transaction, given the protocol and the buffer after a read or before a write. */
+static UInt32 PDACPISMBusPayload(UInt32 protocol, const PDACPISMBusTransfer *transfer)
+{
+    switch (protocol) {
+        case AML_FIELD_ATTRIB_QUICK:
+            return 0;
+        case AML_FIELD_ATTRIB_SEND_RECEIVE:
+        case AML_FIELD_ATTRIB_BYTE:
+            return 1;
+        case AML_FIELD_ATTRIB_WORD:
+        case AML_FIELD_ATTRIB_PROCESS_CALL:
+            return 2;
+        default:
+            return transfer->Length < sizeof(transfer->Data) ? transfer->Length : sizeof(transfer->Data);
+    }
+}
+
+/*
+ * SMBus from AML: ACPICA hands over the whole transaction in its bidirectional buffer
+ * (status, length, 32 data bytes) and we pass that same buffer on, so block protocols
+ * stay a single transaction all the way to the host controller driver. The buffer is
+ * also the AML result, so it's ACPICA's to allocate; AcpiOsAllocate serves it from its
+ * 64-byte size class, so no transaction pays for a fresh IOMalloc either.
+ */
+static ACPI_STATUS PDACPISMBusRegionHandler(UInt32 Function, ACPI_PHYSICAL_ADDRESS Address, UInt32 BitWidth, UInt64 *Value, void *HandlerContext, void *RegionContext)
+{
+    PDACPIAddressSpace *space = (PDACPIAddressSpace *)HandlerContext;
+    const PDACPIAddressSpaceBinding *binding = PDACPIAcquireAddressSpace(space);
+    PDACPISMBusTransfer *transfer = (PDACPISMBusTransfer *)Value;
+    UInt32 protocol = (Function >> 16) & 0xFF;
+    IOACPIAddress address;
+    UInt32 bytes = 0;
+    
+    if (!binding) {
+        return AE_NOT_EXIST;
+    }
+    
+    address.addr64 = (Address & 0xFFFF) | ((UInt64)protocol << kPDACPISMBusProtocolShift);
+    
+    IOReturn ret;
+    if ((Function & ACPI_IO_MASK) == ACPI_READ) {
+        ret = binding->Handler(kIOACPIAddressSpaceOpRead, address, Value, sizeof(PDACPISMBusTransfer) * 8, 0, binding->Context);
+        bytes = PDACPISMBusPayload(protocol, transfer);
+    } else {
+        bytes = PDACPISMBusPayload(protocol, transfer);
+        ret = binding->Handler(kIOACPIAddressSpaceOpWrite, address, Value, sizeof(PDACPISMBusTransfer) * 8, 0, binding->Context);
+    }
+    PDACPIReleaseAddressSpace(space);
+    
+    PDACPICountAccess(space, ret, bytes, bytes > 2);
+    return PDACPIStatusFromIOReturn(ret);
+}
+
+static const struct {
+    const char *Name;
+    IOACPIAddressSpaceHandler Handler;  /* built in; NULL if a driver registers one */
+    ACPI_ADR_SPACE_HANDLER Region;      /* installed into ACPICA while a driver is registered */
+} gPDACPIAddressSpaces[kPDACPIAddressSpaceCount] = {
+    { "SystemMemory",       &PDACPISystemMemoryHandler,     NULL },                      /* kIOACPIAddressSpaceIDSystemMemory */
+    { "SystemIO",           &PDACPISystemIOHandler,         NULL },                      /* kIOACPIAddressSpaceIDSystemIO */
+    { "PCI_Config",         &PDACPIPCIConfigurationHandler, NULL },                      /* kIOACPIAddressSpaceIDPCIConfiguration */
+    { "EmbeddedControl",    NULL,                           &PDACPIRegionHandler },      /* kIOACPIAddressSpaceIDEmbeddedController */
+    { "SMBus",              NULL,                           &PDACPISMBusRegionHandler }, /* kIOACPIAddressSpaceIDSMBus */
+};
+
+void PDACPIPlatformExpert::installAddressSpaces()
+{
+    bzero(this->m_addressSpaces, sizeof(this->m_addressSpaces));
+    for (UInt32 i = 0; i < kPDACPIAddressSpaceCount; i++) {
+        PDACPIAddressSpace *space = &this->m_addressSpaces[i];
+        if (gPDACPIAddressSpaces[i].Handler) {
+            space->Builtin.Handler = gPDACPIAddressSpaces[i].Handler;
+            space->Binding = &space->Builtin;
+        }
+    }
+}
+
+IOReturn PDACPIPlatformExpert::registerAddressSpaceHandler(IOACPIPlatformDevice *,
+                                                           IOACPIAddressSpaceID spaceID,
+                                                           IOACPIAddressSpaceHandler Handler,
+                                                           void *context, IOOptionBits options)
+{
+    /* We don't care about the specific device; we care about the handler itself */
+    if (spaceID >= kPDACPIAddressSpaceCount || gPDACPIAddressSpaces[spaceID].Handler || !Handler) {
+        IOLog("PDACPIPlatformExpert::%s: Invalid attempt at registering an address space handler\n", __PRETTY_FUNCTION__);
+        return kIOReturnInvalid;
+    }
+    
+    PDACPIAddressSpaceBinding *binding = (PDACPIAddressSpaceBinding *)IOMalloc(sizeof(PDACPIAddressSpaceBinding));
+    if (!binding) {
+        return kIOReturnNoMemory;
+    }
+    binding->Handler = Handler;
+    binding->Context = context;
+    
+    /* One driver per space; replacing a live binding would need the same drain as unregister. */
+    PDACPIAddressSpace *space = &this->m_addressSpaces[spaceID];
+    PDACPIAddressSpaceBinding *expected = nullptr;
+    if (!__atomic_compare_exchange_n(&space->Binding, &expected, binding, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        IOLog("PDACPIPlatformExpert::%s: The %s address space already has a handler\n", __PRETTY_FUNCTION__, gPDACPIAddressSpaces[spaceID].Name);
+        IOFree(binding, sizeof(PDACPIAddressSpaceBinding));
+        return kIOReturnExclusiveAccess;
+    }
+    
+    /* This also runs _REG, telling AML the space is usable. */
+    if (gPDACPIAddressSpaces[spaceID].Region) {
+        ACPI_STATUS status = AcpiInstallAddressSpaceHandler(ACPI_ROOT_OBJECT, spaceID, gPDACPIAddressSpaces[spaceID].Region, NULL, space);
+        if (ACPI_FAILURE(status) && status != AE_ALREADY_EXISTS) {
+            IOLog("PDACPIPlatformExpert::%s: AcpiInstallAddressSpaceHandler failed with status %s\n", __PRETTY_FUNCTION__, AcpiFormatException(status));
+            this->retireAddressSpaceBinding(space);
+            return kIOReturnError;
+        }
+    }
+    
+    IOLog("PDACPIPlatformExpert::%s: Registered handler for the %s address space\n", __PRETTY_FUNCTION__, gPDACPIAddressSpaces[spaceID].Name);
+    
+    /* _REG has run, so devices whose _STA/_CRS needed this space can be identified now. */
+    this->rescanDeferredDevices();
+    return kIOReturnSuccess;
+}
+
+/* Take a driver's binding away and free it once nobody can be calling through it. Never call from a handler. */
+void PDACPIPlatformExpert::retireAddressSpaceBinding(PDACPIAddressSpace *space)
+{
+    PDACPIAddressSpaceBinding *binding = __atomic_exchange_n(&space->Binding, (PDACPIAddressSpaceBinding *)nullptr, __ATOMIC_SEQ_CST);
+    
+    while (__atomic_load_n(&space->Users, __ATOMIC_ACQUIRE) != 0) {
+        IOSleep(1);
+    }
+    
+    if (binding && binding != &space->Builtin) {
+        IOFree(binding, sizeof(PDACPIAddressSpaceBinding));
+    }
+}
+
+void PDACPIPlatformExpert::unregisterAddressSpaceHandler(IOACPIPlatformDevice *,
+                                                         IOACPIAddressSpaceID spaceID,
+                                                         IOACPIAddressSpaceHandler,
+                                                         IOOptionBits)
+{
+    /* Remove the specified handlers */
+    if (spaceID >= kPDACPIAddressSpaceCount || gPDACPIAddressSpaces[spaceID].Handler) {
+        IOLog("PDACPIPlatformExpert::%s: Invalid attempt at removing an address space handler\n", __PRETTY_FUNCTION__);
+        return;
+    }
+    
+    if (gPDACPIAddressSpaces[spaceID].Region) {
+        AcpiRemoveAddressSpaceHandler(ACPI_ROOT_OBJECT, spaceID, gPDACPIAddressSpaces[spaceID].Region);
+    }
+    
+    /* The driver may be torn down as soon as we return, so wait out calls already inside it. */
+    this->retireAddressSpaceBinding(&this->m_addressSpaces[spaceID]);
+    
+    IOLog("PDACPIPlatformExpert::%s: Removed handler for the %s address space\n", __PRETTY_FUNCTION__, gPDACPIAddressSpaces[spaceID].Name);
+}
+
+OSDictionary *PDACPIPlatformExpert::copyAddressSpaceStatistics() const
+{
+    OSDictionary *spaces = OSDictionary::withCapacity(kPDACPIAddressSpaceCount);
+    if (!spaces) {
+        return nullptr;
+    }
+    
+    for (UInt32 i = 0; i < kPDACPIAddressSpaceCount; i++) {
+        const PDACPIAddressSpace *space = &this->m_addressSpaces[i];
+        OSDictionary *dict = OSDictionary::withCapacity(5);
+        if (!dict) {
+            continue;
+        }
+        
+        PDACPISetNumber(dict, "Transactions", space->Transactions);
+        PDACPISetNumber(dict, "Block Transactions", space->BlockTransactions);
+        PDACPISetNumber(dict, "Bytes", space->Bytes);
+        PDACPISetNumber(dict, "Errors", space->Errors);
+        dict->setObject("Handler Registered", space->Binding ? kOSBooleanTrue : kOSBooleanFalse);
+        
+        spaces->setObject(gPDACPIAddressSpaces[i].Name, dict);
+        dict->release();
+    }
+    
+    return spaces;
+}
+
+IOReturn PDACPIPlatformExpert::readAddressSpace(UInt64 *value,
+                                                IOACPIAddressSpaceID spaceID,
+                                                IOACPIAddress address,
+                                                UInt32 bitWidth,
+                                                UInt32 bitOffset,
+                                                IOOptionBits options)
+{
+    if (spaceID >= kPDACPIAddressSpaceCount) {
+        return kIOReturnUnsupported;
+    }
+    
+    PDACPIAddressSpace *space = &this->m_addressSpaces[spaceID];
+    const PDACPIAddressSpaceBinding *binding = PDACPIAcquireAddressSpace(space);
+    if (!binding) {
+        return kIOReturnUnsupported;
+    }
+    
+    IOReturn ret = binding->Handler(kIOACPIAddressSpaceOpRead, address, value, bitWidth, bitOffset, binding->Context);
+    PDACPIReleaseAddressSpace(space);
+    PDACPICountAccess(space, ret, bitWidth / 8, false);
+    return ret;
+}
+
+IOReturn PDACPIPlatformExpert::writeAddressSpace(UInt64 value,
+                                                 IOACPIAddressSpaceID spaceID,
+                                                 IOACPIAddress address,
+                                                 UInt32 bitWidth,
+                                                 UInt32 bitOffset,
+                                                 IOOptionBits options)
+{
+    if (spaceID >= kPDACPIAddressSpaceCount) {
+        return kIOReturnUnsupported;
+    }
+    
+    PDACPIAddressSpace *space = &this->m_addressSpaces[spaceID];
+    const PDACPIAddressSpaceBinding *binding = PDACPIAcquireAddressSpace(space);
+    if (!binding) {
+        return kIOReturnUnsupported;
+    }
+    
+    IOReturn ret = binding->Handler(kIOACPIAddressSpaceOpWrite, address, &value, bitWidth, bitOffset, binding->Context);
+    PDACPIReleaseAddressSpace(space);
+    PDACPICountAccess(space, ret, bitWidth / 8, false);
+    return ret;
+}
+
+/*
+ * Batched access for drivers that poll a lot of registers: the handler is looked up once
+ * and every access is performed, each getting its own Status. Returns the first failure,
+ * or kIOReturnSuccess if there wasn't one.
+ */
+IOReturn PDACPIPlatformExpert::accessAddressSpace(UInt32 operation,
+                                                  IOACPIAddressSpaceID spaceID,
+                                                  PDACPIAddressSpaceAccess *accesses,
+                                                  UInt32 count,
+                                                  IOOptionBits options)
+{
+    IOReturn result = kIOReturnSuccess;
+    
+    if (!accesses || (operation != kIOACPIAddressSpaceOpRead && operation != kIOACPIAddressSpaceOpWrite)) {
+        return kIOReturnBadArgument;
+    }
+    
+    if (spaceID >= kPDACPIAddressSpaceCount) {
+        return kIOReturnUnsupported;
+    }
+    
+    PDACPIAddressSpace *space = &this->m_addressSpaces[spaceID];
+    const PDACPIAddressSpaceBinding *binding = PDACPIAcquireAddressSpace(space);
+    if (!binding) {
+        return kIOReturnUnsupported;
+    }
+    
+    for (UInt32 i = 0; i < count; i++) {
+        PDACPIAddressSpaceAccess *access = &accesses[i];
+        access->Status = binding->Handler(operation, access->Address, &access->Value, access->BitWidth, access->BitOffset, binding->Context);
+        PDACPICountAccess(space, access->Status, access->BitWidth / 8, false);
+        if (access->Status != kIOReturnSuccess && result == kIOReturnSuccess) {
+            result = access->Status;
+        }
+    }
+    PDACPIReleaseAddressSpace(space);
+    
+    return result;
+}
+
+IOReturn PDACPIPlatformExpert::readAddressSpace(IOACPIAddressSpaceID spaceID, PDACPIAddressSpaceAccess *accesses, UInt32 count, IOOptionBits options)
+{
+    return this->accessAddressSpace(kIOACPIAddressSpaceOpRead, spaceID, accesses, count, options);
+}
+
+IOReturn PDACPIPlatformExpert::writeAddressSpace(IOACPIAddressSpaceID spaceID, PDACPIAddressSpaceAccess *accesses, UInt32 count, IOOptionBits options)
+{
+    return this->accessAddressSpace(kIOACPIAddressSpaceOpWrite, spaceID, accesses, count, options);
 }
@@ -44,8 +44,61 @@ extern "C" {
 #include "acpica/acstruct.h"
 #include "acpica/aclocal.h"
 #include "acpica/acglobal.h"
+#include "acpica/actables.h"
+#include "acpica/acobject.h"
+#include "acpica/acutils.h"
+#include "acpica/acnamesp.h"
+#include "acpica/amlcode.h"
 }
 
+struct PDACPITableIndex;
+struct PDACPIPowerGraph;
+class PDACPICPUDomain;
+struct PDACPIPowerDevice;
+
+#define kPDACPIAddressSpaceCount (kIOACPIAddressSpaceIDSMBus + 1)
+
+/* Never modified once published, so a handler is always called with its own context. */
+struct PDACPIAddressSpaceBinding {
+    IOACPIAddressSpaceHandler Handler;
+    void *Context;
+};
+
+struct PDACPIAddressSpace {
+    PDACPIAddressSpaceBinding *Binding; /* NULL while nobody is registered */
+    PDACPIAddressSpaceBinding Builtin;  /* what Binding points at for our own spaces */
+    volatile SInt32 Users;              /* calls that may still be using Binding */
+    volatile UInt64 Transactions;       /* handler calls */
+    volatile UInt64 BlockTransactions;  /* of those, ones that moved more than a single value */
+    volatile UInt64 Bytes;              /* payload moved, not counting protocol overhead */
+    volatile UInt64 Errors;
+};
+
+/*
+ * SMBus transactions from AML reach the registered SMBus handler whole, one call per
+ * transaction: address.addr64 is (slave address << 8) | command, with the protocol (the
+ * field's AccessAs attribute, AML_FIELD_ATTRIB_*) at kPDACPISMBusProtocolShift, and value
+ * points at a PDACPISMBusTransfer rather than at a UInt64. Block protocols carry up to 32
+ * bytes in Data, so the handler can issue a real SMBus block transaction. The handler
+ * sets Status (0 is success) and, for reads, Length and Data.
+ */
+#define kPDACPISMBusProtocolShift 16
+
+struct PDACPISMBusTransfer {
+    UInt8 Status;
+    UInt8 Length;
+    UInt8 Data[32];
+};
+
+/* One access in a batched readAddressSpace/writeAddressSpace. */
+struct PDACPIAddressSpaceAccess {
+    IOACPIAddress Address;
+    UInt64 Value;       /* in for writes, out for reads */
+    UInt32 BitWidth;
+    UInt32 BitOffset;
+    IOReturn Status;    /* out */
+};
+
 class PDACPIPlatformExpert : public IOACPIPlatformExpert {
     OSDeclareDefaultStructors(PDACPIPlatformExpert);
     
@@ -57,6 +110,7 @@ public:
     virtual void stop(IOService *provider) override;
     
     virtual OSObject *copyProperty(const char *property) const override;
+    virtual bool serializeProperties(OSSerialize *s) const override;
     
     /* IOACPIPlatformExpert overrides */
     virtual const OSData *getACPITableData(const char *name, UInt32 TableIndex) override;
@@ -90,6 +144,25 @@ public:
                                     UInt32 bitOffset,
                                     IOOptionBits options) override;
 
+    /* Every power-managed device to D<state>; parents and children in order, siblings in parallel. */
+    IOReturn setDeviceTreePowerState(UInt32 state);
+    
+    /*
+     * System sleep, in the order they're called. S1 returns from enterSleepState on wake;
+     * S2-S4 resume through the waking vector, and the resume path calls wakeFromSleepState.
+     */
+    IOReturn prepareSleepState(UInt8 state);
+    IOReturn enterSleepState(UInt8 state);
+    IOReturn wakeFromSleepState(UInt8 state);
+    bool isSleepStateSupported(UInt8 state);
+    
+    /* kPEHaltCPU powers off through S5; everything else is IOPlatformExpert's. */
+    virtual int haltRestart(unsigned int type) override;
+    
+    /* Batched variants: one handler lookup for a whole vector of accesses in the same space. */
+    IOReturn readAddressSpace(IOACPIAddressSpaceID spaceID, PDACPIAddressSpaceAccess *accesses, UInt32 count, IOOptionBits options = 0);
+    IOReturn writeAddressSpace(IOACPIAddressSpaceID spaceID, PDACPIAddressSpaceAccess *accesses, UInt32 count, IOOptionBits options = 0);
+
     // Device power management
 
     virtual IOReturn setDevicePowerState(IOACPIPlatformDevice *device,
@@ -106,21 +179,54 @@ private:
     bool initializeACPICA(void);
     void performACPIPowerOff(void);
     bool catalogACPITables(void);
+    void refreshACPITables(void);
+    OSDictionary *copyACPITables(void);
     bool fetchPCIData(void);
+    bool createDeviceNubs(void);
+    bool deferDevice(ACPI_HANDLE handle, IOService *parent);
+    void rescanDeferredDevices(void);
     void createCPUNubs(void); /* walk MADT and enumerate the CPU devices/objects available. */
+    void createCPUDomains(void);
+    PDACPICPUDomain *findCPUDomain(UInt32 kind, UInt32 domain, UInt32 coordination, UInt32 processors, UInt32 index);
     void systemStateChange(void);
+    OSDictionary *copyStatistics(void) const;
+    OSDictionary *copyAddressSpaceStatistics(void) const;
+    OSDictionary *copyPowerStatistics(void) const;
+    OSDictionary *copySleepStates(void) const;
+    OSDictionary *copySleepTiming(void) const;
+    bool buildPowerGraph(void);
+    PDACPIPowerDevice *findPowerDevice(IOACPIPlatformDevice *device);
+    IOReturn transitionDevice(PDACPIPowerDevice *device, UInt32 state);
+    UInt64 recordBootPhase(const char *name, UInt64 start);
+    void installAddressSpaces(void);
+    void retireAddressSpaceBinding(PDACPIAddressSpace *space);
+    IOReturn accessAddressSpace(UInt32 operation, IOACPIAddressSpaceID spaceID, PDACPIAddressSpaceAccess *accesses, UInt32 count, IOOptionBits options);
+    void publishBootTiming(void);
 
-    static ACPI_STATUS processorNamespaceWalk(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue);
+    static ACPI_STATUS tableEventHandler(UInt32 Event, void *Table, void *Context);
+    static void powerTransitionCall(void *param0, void *param1);
     static ACPI_STATUS deviceNamespaceWalk(ACPI_HANDLE Handle, UInt32 NestingLevel, void *Context, void **ReturnValue);
 
 private:
-    OSDictionary *m_tableDict;
+    OSDictionary *m_tableDict;          /* "ACPI Tables" snapshot, replaced and never modified */
+    PDACPITableIndex *m_tableIndex;     /* see catalogACPITables */
+    IOLock *m_tableLock;
+    volatile SInt32 m_tableGeneration;  /* bumped by tableEventHandler */
+    SInt32 m_tableCatalogGeneration;
+    UInt32 m_tableStaticCount;          /* tables present at boot; later ones are copied */
+    volatile SInt32 m_tableReaders;     /* getACPITableData calls probing an index */
+    OSArray *m_bootPhases;              /* see recordBootPhase */
+    UInt8 m_preparedSleepState;         /* prepareSleepState succeeded for it; PDACPICPU::haltCPU enters it */
+    OSDictionary *m_bootEnumeration;    /* see createDeviceNubs */
+    IOLock *m_deviceLock;               /* m_deviceNubs and m_deferredDevices after boot */
+    OSArray *m_deviceNubs;              /* every nub, parents before children */
+    OSArray *m_deferredDevices;         /* see rescanDeferredDevices */
+    OSArray *m_processorNubs;
+    OSArray *m_cpuDomains;              /* see createCPUDomains */
+    PDACPIPowerGraph *m_powerGraph;     /* see buildPowerGraph */
     
     /* PIO == ACPIPE, MMIO == ACPIPE, PCI CFG == ACPIPE, we have handlers for all of these. */
-    IOACPIAddressSpaceHandler m_ecSpaceHandler;
-    void *m_ecSpaceContext;
-    IOACPIAddressSpaceHandler m_smbusSpaceHandler;
-    void *m_smbusSpaceContext;
+    PDACPIAddressSpace m_addressSpaces[kPDACPIAddressSpaceCount];
     IORTC *m_localRTC;
     IOPlatformExpertDevice *m_provider;
 };
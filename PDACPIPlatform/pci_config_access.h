@@ -37,6 +37,15 @@
 #define _PCI_CONFIG_ACCESS_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <IOKit/IOLib.h>
+
+// AcpiOsLayer.cpp: ECAM routing table, indexed by (segment, bus)
+extern "C" void *AcpiOsExtGetPciConfigAddress(uint16_t Segment, uint8_t Bus, uint8_t Device, uint8_t Function, uint32_t Register);
+
+// AcpiOsLayer.cpp: serializes CF8/CFC address/data pairs, interrupts off while held
+extern "C" IOInterruptState AcpiOsExtLockPciConfigPorts(void);
+extern "C" void AcpiOsExtUnlockPciConfigPorts(IOInterruptState State);
 
 #if defined(__x86_64__) || defined(__i386__)
 
@@ -44,18 +53,42 @@
 #define PCI_CONFIG_ADDRESS 0xCF8
 #define PCI_CONFIG_DATA    0xCFC
 
-static inline void outl(uint16_t port, uint32_t val)
+static inline void PDPortOut32(uint16_t port, uint32_t val)
 {
     asm volatile("outl %0, %1" : : "a"(val), "Nd"(port));
 }
 
-static inline uint32_t inl(uint16_t port)
+static inline uint32_t PDPortIn32(uint16_t port)
 {
     uint32_t ret;
     asm volatile("inl %1, %0" : "=a"(ret) : "Nd"(port));
     return ret;
 }
 
+static inline void PDPortOut16(uint16_t port, uint16_t val)
+{
+    asm volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t PDPortIn16(uint16_t port)
+{
+    uint16_t ret;
+    asm volatile("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void PDPortOut8(uint16_t port, uint8_t val)
+{
+    asm volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t PDPortIn8(uint16_t port)
+{
+    uint8_t ret;
+    asm volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
 // Construct address for PCI config space access
 static inline uint32_t pciConfigAddress(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset)
 {
@@ -68,11 +101,78 @@ static inline uint32_t pciConfigAddress(uint8_t bus, uint8_t device, uint8_t fun
     );
 }
 
-// Read a 32-bit PCI config value
+// Read config space, preferring the ECAM window for (segment, bus).
+// CF8/CFC only reaches the first 256 bytes of segment 0, so anything else fails without ECAM.
+static inline bool pciConfigRead(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t width, uint64_t *value)
+{
+    void *ecam = AcpiOsExtGetPciConfigAddress(segment, bus, device, function, offset);
+    if (ecam) {
+        switch (width) {
+            case 8:  *value = *(volatile uint8_t *)ecam;  return true;
+            case 16: *value = *(volatile uint16_t *)ecam; return true;
+            case 32: *value = *(volatile uint32_t *)ecam; return true;
+            default: return false;
+        }
+    }
+
+    if (segment != 0 || offset > 0xFF) {
+        return false;
+    }
+
+    if (width != 8 && width != 16 && width != 32) {
+        return false;
+    }
+
+    // The address latch is shared, so nothing may get between our address and data cycles.
+    IOInterruptState is = AcpiOsExtLockPciConfigPorts();
+    PDPortOut32(PCI_CONFIG_ADDRESS, pciConfigAddress(bus, device, function, (uint8_t)offset));
+    switch (width) {
+        case 8:  *value = PDPortIn8(PCI_CONFIG_DATA + (offset & 3));  break;
+        case 16: *value = PDPortIn16(PCI_CONFIG_DATA + (offset & 2)); break;
+        default: *value = PDPortIn32(PCI_CONFIG_DATA);                break;
+    }
+    AcpiOsExtUnlockPciConfigPorts(is);
+    return true;
+}
+
+// Write config space; same routing rules as pciConfigRead.
+static inline bool pciConfigWrite(uint16_t segment, uint8_t bus, uint8_t device, uint8_t function, uint16_t offset, uint32_t width, uint64_t value)
+{
+    void *ecam = AcpiOsExtGetPciConfigAddress(segment, bus, device, function, offset);
+    if (ecam) {
+        switch (width) {
+            case 8:  *(volatile uint8_t *)ecam = (uint8_t)value;   return true;
+            case 16: *(volatile uint16_t *)ecam = (uint16_t)value; return true;
+            case 32: *(volatile uint32_t *)ecam = (uint32_t)value; return true;
+            default: return false;
+        }
+    }
+
+    if (segment != 0 || offset > 0xFF) {
+        return false;
+    }
+
+    if (width != 8 && width != 16 && width != 32) {
+        return false;
+    }
+
+    IOInterruptState is = AcpiOsExtLockPciConfigPorts();
+    PDPortOut32(PCI_CONFIG_ADDRESS, pciConfigAddress(bus, device, function, (uint8_t)offset));
+    switch (width) {
+        case 8:  PDPortOut8(PCI_CONFIG_DATA + (offset & 3), (uint8_t)value);   break;
+        case 16: PDPortOut16(PCI_CONFIG_DATA + (offset & 2), (uint16_t)value); break;
+        default: PDPortOut32(PCI_CONFIG_DATA, (uint32_t)value);                break;
+    }
+    AcpiOsExtUnlockPciConfigPorts(is);
+    return true;
+}
+
+// Read a 32-bit PCI config value from segment 0
 static inline uint32_t pciConfigRead32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset)
 {
-    outl(PCI_CONFIG_ADDRESS, pciConfigAddress(bus, device, function, offset));
-    return inl(PCI_CONFIG_DATA);
+    uint64_t value = 0xFFFFFFFF;
+    pciConfigRead(0, bus, device, function, offset, 32, &value);
+    return (uint32_t)value;
 }
 
 #endif // defined(__x86_64__) || defined(__i386__)
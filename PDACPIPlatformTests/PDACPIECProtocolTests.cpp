@@ -0,0 +1,333 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+/*
+ * The EC handshake against a simulated controller: IBF/OBF timing, burst enable and
+ * disable, a refused burst, SCI queries, and an EC that stops answering.
+ */
+
+#include <string.h>
+
+#include "PDACPIECProtocol.h"
+#include "PDACPITest.h"
+
+#define kDataPort       0x62
+#define kCommandPort    0x66
+
+#define kNever          0xFFFFFFFF
+
+/*
+ * An EC whose firmware takes Latency status polls to pick up each byte we write, the way
+ * a real one sits on IBF until its main loop comes round. It counts it as a violation if
+ * the host writes over a full input buffer or reads an empty output buffer.
+ */
+struct SimEC {
+    UInt8 Memory[256];
+    UInt8 Status;
+    UInt8 Output;
+    UInt8 Input;
+    bool InputIsCommand;
+    UInt32 Latency;
+    UInt32 Busy;
+    
+    enum { kIdle, kReadAddress, kWriteAddress, kWriteValue } Phase;
+    UInt8 Address;
+    
+    bool AcceptBurst;
+    UInt32 HangAfter;           /* inputs processed before the firmware stops */
+    UInt32 Processed;
+    UInt8 Events[4];
+    UInt32 EventCount;
+    
+    UInt64 Clock;               /* ns */
+    UInt32 Violations;
+    UInt32 BurstBytes;          /* data bytes moved with the burst bit set */
+    UInt32 BurstDisables;
+};
+
+static void simInit(SimEC *ec, UInt32 latency)
+{
+    memset(ec, 0, sizeof(*ec));
+    for (UInt32 i = 0; i < sizeof(ec->Memory); i++) {
+        ec->Memory[i] = (UInt8)(i ^ 0xA5);
+    }
+    ec->Latency = latency;
+    ec->AcceptBurst = true;
+    ec->HangAfter = kNever;
+}
+
+static void simOutput(SimEC *ec, UInt8 value)
+{
+    ec->Output = value;
+    ec->Status |= kECStatusOBF;
+}
+
+static void simProcess(SimEC *ec)
+{
+    UInt8 value = ec->Input;
+    
+    ec->Status &= ~(kECStatusIBF | kECStatusCMD);
+    ec->Processed++;
+    
+    if (ec->InputIsCommand) {
+        switch (value) {
+            case kECCommandRead:
+                ec->Phase = SimEC::kReadAddress;
+                break;
+            case kECCommandWrite:
+                ec->Phase = SimEC::kWriteAddress;
+                break;
+            case kECCommandBurstEnable:
+                if (ec->AcceptBurst) {
+                    ec->Status |= kECStatusBurst;
+                    simOutput(ec, kECBurstAcknowledge);
+                } else {
+                    simOutput(ec, 0);
+                }
+                break;
+            case kECCommandBurstDisable:
+                ec->Status &= ~kECStatusBurst;
+                ec->BurstDisables++;
+                break;
+            case kECCommandQuery:
+                simOutput(ec, ec->EventCount ? ec->Events[--ec->EventCount] : 0);
+                if (!ec->EventCount) {
+                    ec->Status &= ~kECStatusSCIEvent;
+                }
+                break;
+        }
+        return;
+    }
+    
+    switch (ec->Phase) {
+        case SimEC::kReadAddress:
+            if (ec->Status & kECStatusBurst) {
+                ec->BurstBytes++;
+            }
+            simOutput(ec, ec->Memory[value]);
+            ec->Phase = SimEC::kIdle;
+            break;
+        case SimEC::kWriteAddress:
+            ec->Address = value;
+            ec->Phase = SimEC::kWriteValue;
+            break;
+        case SimEC::kWriteValue:
+            if (ec->Status & kECStatusBurst) {
+                ec->BurstBytes++;
+            }
+            ec->Memory[ec->Address] = value;
+            ec->Phase = SimEC::kIdle;
+            break;
+        default:
+            ec->Violations++;
+            break;
+    }
+}
+
+static UInt8 simRead(void *context, UInt16 port)
+{
+    SimEC *ec = (SimEC *)context;
+    
+    if (port == kCommandPort) {
+        if ((ec->Status & kECStatusIBF) && ec->Processed < ec->HangAfter && (!ec->Busy || !--ec->Busy)) {
+            simProcess(ec);
+        }
+        return ec->Status;
+    }
+    
+    if (!(ec->Status & kECStatusOBF)) {
+        ec->Violations++;
+    }
+    ec->Status &= ~kECStatusOBF;
+    return ec->Output;
+}
+
+static void simWrite(void *context, UInt16 port, UInt8 value)
+{
+    SimEC *ec = (SimEC *)context;
+    
+    if (ec->Status & kECStatusIBF) {
+        ec->Violations++;
+    }
+    ec->Input = value;
+    ec->InputIsCommand = port == kCommandPort;
+    ec->Status |= kECStatusIBF | (ec->InputIsCommand ? kECStatusCMD : 0);
+    ec->Busy = ec->Latency;
+}
+
+static UInt64 simNow(void *context)
+{
+    return ((SimEC *)context)->Clock;
+}
+
+/* Like the kext: 1us polls at first, then 1ms. */
+static void simPause(void *context, UInt32 polls)
+{
+    ((SimEC *)context)->Clock += polls < 100 ? 1000 : 1000000;
+}
+
+static PDACPIECPorts simPorts(SimEC *ec)
+{
+    PDACPIECPorts ports = { &simRead, &simWrite, &simNow, &simPause, ec, kDataPort, kCommandPort };
+    return ports;
+}
+
+static void testSingleByte(void)
+{
+    SimEC ec;
+    PDACPIECStatistics stats = {};
+    UInt8 data = 0;
+    
+    simInit(&ec, 3);
+    PDACPIECPorts ports = simPorts(&ec);
+    
+    /* One byte isn't worth a burst. */
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandRead, 0x40, &data, 1), 1);
+    PDACPI_CHECK_EQ(data, 0x40 ^ 0xA5);
+    PDACPI_CHECK_EQ(stats.Bursts, 0);
+    PDACPI_CHECK_EQ(ec.BurstBytes, 0);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+}
+
+static void testBurst(void)
+{
+    static const UInt8 values[] = { 0x11, 0x22, 0x33, 0x44 };
+    SimEC ec;
+    PDACPIECStatistics stats = {};
+    UInt8 data[4];
+    
+    simInit(&ec, 5);
+    PDACPIECPorts ports = simPorts(&ec);
+    
+    memcpy(data, values, sizeof(data));
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandWrite, 0xF0, data, 4), 4);
+    PDACPI_CHECK(memcmp(&ec.Memory[0xF0], values, sizeof(values)) == 0);
+    
+    memset(data, 0, sizeof(data));
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandRead, 0xF0, data, 4), 4);
+    PDACPI_CHECK(memcmp(data, values, sizeof(values)) == 0);
+    
+    /* Every byte went inside a burst, and each burst was closed again. */
+    PDACPI_CHECK_EQ(stats.Bursts, 2);
+    PDACPI_CHECK_EQ(ec.BurstBytes, 8);
+    PDACPI_CHECK_EQ(ec.BurstDisables, 2);
+    PDACPI_CHECK_EQ(ec.Status & (kECStatusBurst | kECStatusIBF | kECStatusOBF), 0);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+    PDACPI_CHECK_EQ(stats.Timeouts, 0);
+}
+
+static void testBurstRefused(void)
+{
+    SimEC ec;
+    PDACPIECStatistics stats = {};
+    UInt8 data[2];
+    
+    simInit(&ec, 2);
+    ec.AcceptBurst = false;
+    PDACPIECPorts ports = simPorts(&ec);
+    
+    /* A wrong acknowledgement means byte at a time, and nothing to disable afterwards. */
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandRead, 0x10, data, 2), 2);
+    PDACPI_CHECK_EQ(data[0], 0x10 ^ 0xA5);
+    PDACPI_CHECK_EQ(data[1], 0x11 ^ 0xA5);
+    PDACPI_CHECK_EQ(stats.Bursts, 0);
+    PDACPI_CHECK_EQ(stats.BurstsRefused, 1);
+    PDACPI_CHECK_EQ(ec.BurstDisables, 0);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+}
+
+static void testQuery(void)
+{
+    SimEC ec;
+    PDACPIECStatistics stats = {};
+    UInt8 event = 0xFF;
+    
+    simInit(&ec, 1);
+    ec.Events[0] = 0x52;
+    ec.Events[1] = 0x1C;
+    ec.EventCount = 2;
+    ec.Status |= kECStatusSCIEvent;
+    PDACPIECPorts ports = simPorts(&ec);
+    
+    PDACPI_CHECK(PDACPIECQuery(&ports, &stats, &event));
+    PDACPI_CHECK_EQ(event, 0x1C);
+    PDACPI_CHECK(PDACPIECQuery(&ports, &stats, &event));
+    PDACPI_CHECK_EQ(event, 0x52);
+    PDACPI_CHECK_EQ(ec.Status & kECStatusSCIEvent, 0);
+    PDACPI_CHECK(PDACPIECQuery(&ports, &stats, &event));
+    PDACPI_CHECK_EQ(event, 0);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+}
+
+static void testTimeout(void)
+{
+    SimEC ec;
+    PDACPIECStatistics stats = {};
+    UInt8 data[4];
+    
+    /* The firmware stops after the burst enable and the first byte's command and address. */
+    simInit(&ec, 2);
+    ec.HangAfter = 3;
+    PDACPIECPorts ports = simPorts(&ec);
+    
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandRead, 0x20, data, 4), 1);
+    PDACPI_CHECK_EQ(data[0], 0x20 ^ 0xA5);
+    
+    /* The second byte's address and the burst disable each waited out kECTimeoutMS, and no longer. */
+    PDACPI_CHECK_EQ(stats.Timeouts, 2);
+    PDACPI_CHECK(ec.Clock >= 2 * kECTimeoutMS * 1000000ULL);
+    PDACPI_CHECK(ec.Clock <= 2 * (kECTimeoutMS + 2) * 1000000ULL);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+    
+    /* An EC that never answers at all fails the burst enable too. */
+    simInit(&ec, 2);
+    ec.HangAfter = 0;
+    memset(&stats, 0, sizeof(stats));
+    PDACPI_CHECK_EQ(PDACPIECTransfer(&ports, &stats, kECCommandRead, 0x20, data, 2), 0);
+    PDACPI_CHECK_EQ(stats.BurstsRefused, 1);
+    PDACPI_CHECK(stats.Timeouts >= 1);
+    PDACPI_CHECK_EQ(ec.Violations, 0);
+}
+
+int main(void)
+{
+    testSingleByte();
+    testBurst();
+    testBurstRefused();
+    testQuery();
+    testTimeout();
+    
+    return PDACPI_TEST_RESULT();
+}
@@ -0,0 +1,181 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+/*
+ * PDACPISelectCState against idle traces: steady timer ticks, cold history, outliers,
+ * bimodal and scattered periods, and a replayed burst of short idles.
+ */
+
+#include "PDACPIIdleGovernor.h"
+#include "PDACPITest.h"
+
+#define kNoLimit    kPDACPIIdleUnknown
+
+/* C1/C3/C6 as a typical client _CST reports them, residency at twice the latency. */
+static const PDACPICState kStates[] = {
+    { 1, kPDACPICStateHalt,  false, 1,   2,   1000, 0,    1 },
+    { 2, kPDACPICStateMwait, false, 80,  160, 500,  0x10, 2 },
+    { 3, kPDACPICStateMwait, false, 200, 400, 100,  0x20, 3 },
+};
+static const UInt32 kStateCount = sizeof(kStates) / sizeof(kStates[0]);
+
+static void record(PDACPIIdleHistory *history, const UInt32 *trace, UInt32 count)
+{
+    for (UInt32 i = 0; i < count; i++) {
+        PDACPIRecordIdle(history, trace[i]);
+    }
+}
+
+static void testSteadyTick(void)
+{
+    static const UInt32 trace[] = { 990, 1000, 1010, 995, 1005, 1000, 998, 1002 };
+    PDACPIIdleHistory history = {};
+    
+    record(&history, trace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), 1000);
+    
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history), 2);
+    /* QoS rules out the deeper states by exit latency... */
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, 150, kNoLimit, &history), 1);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, 50, kNoLimit, &history), 0);
+    /* ...and a known event sooner than the history predicts wins over it. */
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, 300, &history), 1);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, 100, &history), 0);
+}
+
+static void testColdHistory(void)
+{
+    static const UInt32 trace[] = { 20, 20, 20 };
+    PDACPIIdleHistory history = {};
+    
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), kPDACPIIdleUnknown);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history), 2);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, 100, &history), 0);
+    
+    /* Fewer than half the slots say nothing yet. */
+    record(&history, trace, 3);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), kPDACPIIdleUnknown);
+    
+    /* A zero-length idle still counts as a sample. */
+    PDACPIRecordIdle(&history, 0);
+    PDACPI_CHECK_EQ(history.Intervals[3], 1);
+}
+
+static void testOutlier(void)
+{
+    static const UInt32 trace[] = { 100, 100, 100, 50000, 100, 100, 100, 100 };
+    PDACPIIdleHistory history = {};
+    
+    record(&history, trace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), 100);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history), 0);
+}
+
+static void testBimodal(void)
+{
+    static const UInt32 trace[] = { 50, 3000, 50, 3000, 50, 3000, 50, 3000 };
+    PDACPIIdleHistory history = {};
+    
+    /* The long mode is dropped as outliers, so we err on the shallow side. */
+    record(&history, trace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), 50);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history), 0);
+}
+
+static void testScattered(void)
+{
+    static const UInt32 trace[] = { 10, 200, 400, 800, 1600, 3200, 6400, 12800 };
+    PDACPIIdleHistory history = {};
+    
+    record(&history, trace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), kPDACPIIdleUnknown);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history), 2);
+    PDACPI_CHECK_EQ(PDACPISelectCState(kStates, kStateCount, 100, kNoLimit, &history), 1);
+}
+
+static void testWrap(void)
+{
+    static const UInt32 longTrace[] = { 2000, 2000, 2000, 2000, 2000, 2000, 2000, 2000 };
+    static const UInt32 shortTrace[] = { 100, 100, 100, 100, 100, 100, 100, 100 };
+    PDACPIIdleHistory history = {};
+    
+    record(&history, longTrace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), 2000);
+    record(&history, shortTrace, 8);
+    PDACPI_CHECK_EQ(PDACPIPredictIdle(&history), 100);
+    PDACPI_CHECK_EQ(history.Next, 0);
+}
+
+/*
+ * Replay: a 1ms tick interrupted by a burst of 120us idles, selecting before each
+ * period and recording it afterwards, the way PDACPICPU::idle does. The governor
+ * should go shallow once half the history is short and deep again once it isn't.
+ */
+static void testReplay(void)
+{
+    static const UInt32 trace[] = {
+        1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000,
+        120,  120,  120,  120,  120,  120,  120,  120,
+        1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000,
+    };
+    static const UInt32 expected[] = {
+        2, 2, 2, 2, 2, 2, 2, 2,
+        2, 2, 2, 2, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 2, 2, 2,
+    };
+    PDACPIIdleHistory history = {};
+    
+    for (UInt32 i = 0; i < sizeof(trace) / sizeof(trace[0]); i++) {
+        UInt32 selected = PDACPISelectCState(kStates, kStateCount, kNoLimit, kNoLimit, &history);
+        if (selected != expected[i]) {
+            fprintf(stderr, "replay step %u: selected C-state %u, expected %u\n", i, selected, expected[i]);
+            gPDACPITestFailures++;
+        }
+        PDACPIRecordIdle(&history, trace[i]);
+    }
+}
+
+int main(void)
+{
+    testSteadyTick();
+    testColdHistory();
+    testOutlier();
+    testBimodal();
+    testScattered();
+    testWrap();
+    testReplay();
+    
+    return PDACPI_TEST_RESULT();
+}
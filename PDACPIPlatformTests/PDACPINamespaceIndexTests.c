@@ -0,0 +1,291 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+/*
+ * The namespace index under a real table load: ACPICA on osunixxf.c, with SSDTs written
+ * out as files and read back through acfileio.c. Two tables fill one scope well past
+ * ACPI_NS_WIDE_SCOPE; every name must resolve through the interpreter to its own value and
+ * through the index to the node a linear walk finds, before and after one table unloads.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "acpi.h"
+#include "accommon.h"
+#include "acnamesp.h"
+#include "actables.h"
+#include "amlcode.h"
+#include "acapps.h"
+#include "PDACPITest.h"
+
+#define kNamesPerTable  300
+#define kTableSize      (sizeof(ACPI_TABLE_HEADER) + 16 + kNamesPerTable * 8)
+
+/* acpinames-style configuration: no firmware tables beyond the ones we load. */
+ACPI_PHYSICAL_ADDRESS AcpiOsGetRootPointer(void)
+{
+    return (0);
+}
+
+static UINT32 encodePkgLength(UINT8 *out, UINT32 body)
+{
+    UINT32 bytes = body + 1 <= 0x3F ? 1 : body + 2 <= 0xFFF ? 2 : 3;
+    UINT32 length = body + bytes;
+    
+    if (bytes == 1) {
+        out[0] = (UINT8)length;
+        return (1);
+    }
+    out[0] = (UINT8)(((bytes - 1) << 6) | (length & 0xF));
+    for (UINT32 i = 1; i < bytes; i++) {
+        out[i] = (UINT8)(length >> (4 + 8 * (i - 1)));
+    }
+    return (bytes);
+}
+
+/*
+ * An SSDT holding Device (\WIDE) or Scope (\WIDE) with kNamesPerTable integers named
+ * <prefix>000 onwards, each set to base plus its index.
+ */
+static UINT32 buildTable(UINT8 *table, const char *tableId, BOOLEAN device, char prefix, UINT32 base)
+{
+    ACPI_TABLE_HEADER *header = (ACPI_TABLE_HEADER *)table;
+    UINT8 body[kNamesPerTable * 8 + 5];
+    UINT32 bodyLength = 0, length;
+    UINT8 *p;
+    
+    memcpy(body, "\\WIDE", 5);
+    bodyLength = 5;
+    for (UINT32 i = 0; i < kNamesPerTable; i++) {
+        char name[5];
+        snprintf(name, sizeof(name), "%c%03X", prefix, i);
+        body[bodyLength++] = AML_NAME_OP;
+        memcpy(&body[bodyLength], name, 4);
+        bodyLength += 4;
+        body[bodyLength++] = AML_WORD_OP;
+        body[bodyLength++] = (UINT8)(base + i);
+        body[bodyLength++] = (UINT8)((base + i) >> 8);
+    }
+    
+    memset(table, 0, kTableSize);
+    p = table + sizeof(ACPI_TABLE_HEADER);
+    if (device) {
+        *p++ = AML_EXTENDED_PREFIX;
+        *p++ = AML_DEVICE_OP & 0xFF;
+    } else {
+        *p++ = AML_SCOPE_OP;
+    }
+    p += encodePkgLength(p, bodyLength);
+    memcpy(p, body, bodyLength);
+    length = (UINT32)(p + bodyLength - table);
+    
+    ACPI_COPY_NAMESEG(header->Signature, ACPI_SIG_SSDT);
+    header->Length = length;
+    header->Revision = 2;
+    memcpy(header->OemId, "PUREDW", ACPI_OEM_ID_SIZE);
+    memcpy(header->OemTableId, tableId, ACPI_OEM_TABLE_ID_SIZE);
+    header->OemRevision = 1;
+    ACPI_COPY_NAMESEG(header->AslCompilerId, "PDAC");
+    header->AslCompilerRevision = 1;
+    header->Checksum = (UINT8)(0 - AcpiUtChecksum(table, length));
+    
+    return (length);
+}
+
+static BOOLEAN writeTable(const char *path, const UINT8 *table, UINT32 length)
+{
+    FILE *file = fopen(path, "wb");
+    BOOLEAN written;
+    
+    if (!file) {
+        return (FALSE);
+    }
+    written = fwrite(table, 1, length, file) == length;
+    return (fclose(file) == 0 && written);
+}
+
+static ACPI_TABLE_HEADER *readTable(const char *path, ACPI_NEW_TABLE_DESC **list)
+{
+    if (ACPI_FAILURE(AcGetAllTablesFromFile((char *)path, ACPI_GET_ONLY_AML_TABLES, list)) || !*list) {
+        return (NULL);
+    }
+    return ((*list)->Table);
+}
+
+static ACPI_NAMESPACE_NODE *linearSearch(ACPI_NAMESPACE_NODE *parent, UINT32 name)
+{
+    ACPI_NAMESPACE_NODE *node;
+    
+    for (node = parent->Child; node && node->Name.Integer != name; node = node->Peer) {
+    }
+    return (node);
+}
+
+/* Each name in the table as the interpreter sees it, and as the index does. */
+static void checkNames(ACPI_NAMESPACE_NODE *scope, char prefix, UINT32 base, BOOLEAN present)
+{
+    for (UINT32 i = 0; i < kNamesPerTable; i++) {
+        char path[16];
+        ACPI_OBJECT object;
+        ACPI_BUFFER buffer = { sizeof(object), &object };
+        ACPI_NAME name;
+        ACPI_STATUS status;
+        
+        snprintf(path, sizeof(path), "\\WIDE.%c%03X", prefix, i);
+        ACPI_COPY_NAMESEG(&name, path + 6);
+        
+        status = AcpiEvaluateObjectTyped(NULL, path, NULL, &buffer, ACPI_TYPE_INTEGER);
+        if (present) {
+            PDACPI_CHECK(ACPI_SUCCESS(status));
+            PDACPI_CHECK_EQ(ACPI_SUCCESS(status) ? object.Integer.Value : ~0ULL, base + i);
+        } else {
+            PDACPI_CHECK_EQ(status, AE_NOT_FOUND);
+        }
+        
+        PDACPI_CHECK(AcpiNsIndexSearch(scope, name) == linearSearch(scope, name));
+    }
+}
+
+static void checkTail(ACPI_NAMESPACE_NODE *scope)
+{
+    ACPI_NAMESPACE_NODE *last = scope->Child;
+    
+    while (last && last->Peer) {
+        last = last->Peer;
+    }
+    PDACPI_CHECK(AcpiNsIndexLastChild(scope) == last);
+}
+
+/*
+ * Four tables fill \WIDE in turn: A declares it, B, C and D add to it. C is the one unloaded,
+ * so its names come out of the middle of the child list; index 1 would be refused, since
+ * AcpiUnloadTable takes it for the DSDT.
+ */
+static struct {
+    const char *TableId;
+    char Prefix;
+    UINT32 Base;
+    UINT8 Table[kTableSize];
+    char Path[512];
+    ACPI_NEW_TABLE_DESC *List;
+    UINT32 Index;
+} gTables[] = {
+    { "WIDEA   ", 'A', 0 },
+    { "WIDEB   ", 'B', 1000 },
+    { "WIDEC   ", 'C', 2000 },
+    { "WIDED   ", 'D', 3000 },
+};
+#define kTables         (sizeof(gTables) / sizeof(gTables[0]))
+#define kUnloaded       2
+
+int main(int argc, char **argv)
+{
+    ACPI_DARWIN_NS_INDEX_STATS stats;
+    ACPI_NAMESPACE_NODE *scope;
+    ACPI_HANDLE handle;
+    const char *slash = strrchr(argv[0], '/');
+    int dirLength = slash ? (int)(slash - argv[0]) : 1;
+    const char *dir = slash ? argv[0] : ".";
+    UINT32 i;
+    
+    (void)argc;
+    AcpiDbgLevel = 0;
+    
+    /* The tables go next to the test binary, in the build directory. */
+    for (i = 0; i < kTables; i++) {
+        UINT32 length = buildTable(gTables[i].Table, gTables[i].TableId, i == 0, gTables[i].Prefix, gTables[i].Base);
+        
+        snprintf(gTables[i].Path, sizeof(gTables[i].Path), "%.*s/wide%c.aml", dirLength, dir, gTables[i].Prefix);
+        if (!writeTable(gTables[i].Path, gTables[i].Table, length)) {
+            fprintf(stderr, "can't write %s\n", gTables[i].Path);
+            return (1);
+        }
+    }
+    
+    if (ACPI_FAILURE(AcpiInitializeSubsystem()) || ACPI_FAILURE(AcpiAllocateRootTable(kTables))) {
+        fprintf(stderr, "can't initialize ACPICA\n");
+        return (1);
+    }
+    
+    for (i = 0; i < kTables; i++) {
+        ACPI_TABLE_HEADER *table = readTable(gTables[i].Path, &gTables[i].List);
+        PDACPI_CHECK(table && ACPI_SUCCESS(AcpiLoadTable(table, &gTables[i].Index)));
+    }
+    
+    if (ACPI_FAILURE(AcpiGetHandle(NULL, "\\WIDE", &handle))) {
+        fprintf(stderr, "\\WIDE wasn't loaded\n");
+        return (1);
+    }
+    scope = AcpiNsValidateHandle(handle);
+    
+    /* The first table's load indexed the scope, and everything after was appended through it. */
+    PDACPI_CHECK(scope->Flags & ANOBJ_DARWIN_INDEXED);
+    AcpiNsIndexGetStatistics(&stats);
+    PDACPI_CHECK_EQ(stats.Scopes, 1);
+    PDACPI_CHECK(stats.Appends >= (kTables - 1) * kNamesPerTable);
+    PDACPI_CHECK_EQ(stats.Failures, 0);
+    
+    for (i = 0; i < kTables; i++) {
+        checkNames(scope, gTables[i].Prefix, gTables[i].Base, TRUE);
+    }
+    checkTail(scope);
+    
+    /* Unloading C takes its names out of the middle of the index... */
+    PDACPI_CHECK_EQ(gTables[kUnloaded].Index, kUnloaded);
+    PDACPI_CHECK(ACPI_SUCCESS(AcpiUnloadTable(gTables[kUnloaded].Index)));
+    for (i = 0; i < kTables; i++) {
+        checkNames(scope, gTables[i].Prefix, gTables[i].Base, i != kUnloaded);
+    }
+    checkTail(scope);
+    
+    /* ...and loading it again appends it after D. */
+    PDACPI_CHECK(ACPI_SUCCESS(AcpiLoadTable(gTables[kUnloaded].List->Table, &gTables[kUnloaded].Index)));
+    for (i = 0; i < kTables; i++) {
+        checkNames(scope, gTables[i].Prefix, gTables[i].Base, TRUE);
+    }
+    checkTail(scope);
+    
+    AcpiNsIndexGetStatistics(&stats);
+    PDACPI_CHECK(stats.Lookups > 0);
+    PDACPI_CHECK_EQ(stats.Failures, 0);
+    
+    AcpiTerminate();
+    for (i = 0; i < kTables; i++) {
+        AcDeleteTableList(gTables[i].List);
+    }
+    
+    return (PDACPI_TEST_RESULT());
+}
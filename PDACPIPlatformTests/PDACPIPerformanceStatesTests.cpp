@@ -0,0 +1,190 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+/*
+ * The _PSS bookkeeping against a synthetic table and a mock MSR file: folding the control
+ * values, recognising the current state by ratio, and settling an unknown state under _PPC.
+ */
+
+#include "PDACPIPerformanceStates.h"
+#include "PDACPITest.h"
+
+/* Four states as a typical Intel _PSS lists them, control and status both the bare ratio. */
+static const PDACPIPState kIntelTable[] = {
+    { 4200, 65000, 10, 10, 0x2A00, 0x2A00 },
+    { 3600, 48000, 10, 10, 0x2400, 0x2400 },
+    { 3000, 35000, 10, 10, 0x1E00, 0x1E00 },
+    { 2400, 25000, 10, 10, 0x1800, 0x1800 },
+};
+static const UInt32 kStateCount = sizeof(kIntelTable) / sizeof(kIntelTable[0]);
+
+/* The two P-state MSRs, standing in for PDACPICPU's register ops. */
+struct MockMSRs {
+    UInt64 Control;
+    UInt64 Status;
+    UInt32 Writes;
+};
+
+static UInt64 readMSR(MockMSRs *msrs, UInt32 msr)
+{
+    return msr == kIntelPerfControlMSR ? msrs->Control : msrs->Status;
+}
+
+static void writeMSR(MockMSRs *msrs, UInt32 msr, UInt64 value)
+{
+    PDACPI_CHECK_EQ(msr, kIntelPerfControlMSR);
+    msrs->Control = value;
+    msrs->Writes++;
+}
+
+/* What initPerformanceStates does with FFixedHW on Intel, minus the interpreter. */
+static UInt32 loadIntel(MockMSRs *msrs, PDACPIPState *states)
+{
+    for (UInt32 i = 0; i < kStateCount; i++) {
+        states[i] = kIntelTable[i];
+    }
+    PDACPIFoldPStateControl(states, kStateCount, readMSR(msrs, kIntelPerfControlMSR), kIntelPerfMask);
+    return PDACPIFindPState(states, kStateCount, readMSR(msrs, kIntelPerfStatusMSR), kIntelPerfRatioMask);
+}
+
+/* What switchToPState does without a domain: requests faster than the limit are raised to it. */
+static void switchTo(MockMSRs *msrs, const PDACPIPState *states, UInt32 *current, UInt32 index, UInt32 limit)
+{
+    index = PDACPIClampPState(index, limit);
+    if (index != *current) {
+        writeMSR(msrs, kIntelPerfControlMSR, states[index].Control);
+        *current = index;
+    }
+}
+
+/* What updatePerformanceLimit does with a new _PPC value. */
+static UInt32 applyLimit(MockMSRs *msrs, const PDACPIPState *states, UInt32 *current, UInt64 ppc)
+{
+    UInt32 limit = PDACPIPStateLimit(ppc, kStateCount);
+    
+    if (PDACPIPStateOverLimit(*current, limit, kStateCount)) {
+        switchTo(msrs, states, current, limit, limit);
+    }
+    return limit;
+}
+
+static void testRatioLookup(void)
+{
+    /* Ratio 0x1E with a VID in the low byte, and the turbo disengage bit set above the mask. */
+    MockMSRs msrs = { 0x100002A00ULL, 0x1E3C, 0 };
+    PDACPIPState states[kStateCount];
+    
+    PDACPI_CHECK_EQ(loadIntel(&msrs, states), 2);
+    
+    /* Comparing the whole status would miss it because of the VID. */
+    PDACPI_CHECK_EQ(PDACPIFindPState(states, kStateCount, 0x1E3C, kIntelPerfMask), kStateCount);
+    
+    /* Bits outside the P-state field carry over into every control value. */
+    PDACPI_CHECK_EQ(states[0].Control, 0x100002A00ULL);
+    PDACPI_CHECK_EQ(states[3].Control, 0x100001800ULL);
+    
+    /* A ratio the table doesn't list is an unknown state. */
+    PDACPI_CHECK_EQ(PDACPIFindPState(states, kStateCount, 0x2000, kIntelPerfRatioMask), kStateCount);
+}
+
+static void testLimitClamp(void)
+{
+    PDACPI_CHECK_EQ(PDACPIPStateLimit(0, kStateCount), 0);
+    PDACPI_CHECK_EQ(PDACPIPStateLimit(2, kStateCount), 2);
+    PDACPI_CHECK_EQ(PDACPIPStateLimit(9, kStateCount), kStateCount - 1);
+    
+    PDACPI_CHECK_EQ(PDACPIClampPState(0, 2), 2);
+    PDACPI_CHECK_EQ(PDACPIClampPState(2, 2), 2);
+    PDACPI_CHECK_EQ(PDACPIClampPState(3, 2), 3);
+    
+    PDACPI_CHECK(PDACPIPStateOverLimit(0, 2, kStateCount));
+    PDACPI_CHECK(!PDACPIPStateOverLimit(2, 2, kStateCount));
+    PDACPI_CHECK(!PDACPIPStateOverLimit(3, 2, kStateCount));
+    PDACPI_CHECK(PDACPIPStateOverLimit(kStateCount, 2, kStateCount));
+    PDACPI_CHECK(PDACPIPStateOverLimit(kStateCount, 0, kStateCount));
+}
+
+static void testUnknownUnderLimit(void)
+{
+    /* Firmware left a ratio _PSS doesn't know, so we can't tell if it's within _PPC. */
+    MockMSRs msrs = { 0x2C00, 0x2C3C, 0 };
+    PDACPIPState states[kStateCount];
+    UInt32 current = loadIntel(&msrs, states);
+    
+    PDACPI_CHECK_EQ(current, kStateCount);
+    
+    applyLimit(&msrs, states, &current, 1);
+    PDACPI_CHECK_EQ(current, 1);
+    PDACPI_CHECK_EQ(msrs.Writes, 1);
+    PDACPI_CHECK_EQ(msrs.Control, 0x2400);
+    
+    /* Relaxing the limit leaves a known state alone... */
+    applyLimit(&msrs, states, &current, 0);
+    PDACPI_CHECK_EQ(msrs.Writes, 1);
+    
+    /* ...tightening it past the current state moves down to it... */
+    UInt32 limit = applyLimit(&msrs, states, &current, 3);
+    PDACPI_CHECK_EQ(current, 3);
+    PDACPI_CHECK_EQ(msrs.Writes, 2);
+    PDACPI_CHECK_EQ(msrs.Control, 0x1800);
+    
+    /* ...and a request for full speed under it goes nowhere. */
+    switchTo(&msrs, states, &current, 0, limit);
+    PDACPI_CHECK_EQ(current, 3);
+    PDACPI_CHECK_EQ(msrs.Writes, 2);
+}
+
+static void testKnownUnderLimit(void)
+{
+    /* Already at the slowest state: _PPC 2 is no reason to write anything. */
+    MockMSRs msrs = { 0x1800, 0x1828, 0 };
+    PDACPIPState states[kStateCount];
+    UInt32 current = loadIntel(&msrs, states);
+    
+    PDACPI_CHECK_EQ(current, 3);
+    applyLimit(&msrs, states, &current, 2);
+    PDACPI_CHECK_EQ(current, 3);
+    PDACPI_CHECK_EQ(msrs.Writes, 0);
+}
+
+int main(void)
+{
+    testRatioLookup();
+    testLimitClamp();
+    testUnknownUnderLimit();
+    testKnownUnderLimit();
+    
+    return PDACPI_TEST_RESULT();
+}
@@ -0,0 +1,69 @@
+/*
+*
+* Copyright (c) 2007-Present The PureDarwin Project.
+* All rights reserved.
+*
+* @PUREDARWIN_LICENSE_HEADER_START@
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+* IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+* THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+* PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+* CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+* EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+* PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+* PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+* LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+* NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* @PUREDARWIN_LICENSE_HEADER_END@
+*
+* PDACPIPlatform Open Source Version of Apples AppleACPIPlatform
+* Created by github.com/csekel (InSaneDarwin)
+*
+*/
+
+#ifndef _PDACPI_TEST_H
+#define _PDACPI_TEST_H
+
+#include <stdio.h>
+
+/*
+ * Just enough of a harness for the userspace tests: a failed check is reported and
+ * counted, and PDACPI_TEST_RESULT() turns the count into the exit status.
+ */
+
+static unsigned gPDACPITestFailures;
+
+#define PDACPI_CHECK(cond)                                                              \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);   \
+            gPDACPITestFailures++;                                                      \
+        }                                                                               \
+    } while (0)
+
+#define PDACPI_CHECK_EQ(a, b)                                                           \
+    do {                                                                                \
+        unsigned long long _a = (unsigned long long)(a), _b = (unsigned long long)(b);  \
+        if (_a != _b) {                                                                 \
+            fprintf(stderr, "%s:%d: %s == %s failed: %llu != %llu\n",                  \
+                    __FILE__, __LINE__, #a, #b, _a, _b);                                \
+            gPDACPITestFailures++;                                                      \
+        }                                                                               \
+    } while (0)
+
+#define PDACPI_TEST_RESULT()                                                            \
+    (gPDACPITestFailures ? (fprintf(stderr, "%u check(s) failed\n", gPDACPITestFailures), 1) : 0)
+
+#endif /* _PDACPI_TEST_H */